@@ -8,6 +8,15 @@ static const gint DEFAULT_WINDOW_WIDTH = 500;
 static const gint DEFAULT_WINDOW_HEIGHT = 500;
 static const gchar *DEFAULT_DIFF_COMMAND_LINE = "/usr/bin/diff";
 static const gboolean DEFAULT_KEEP_TEMP_FILES = FALSE;
+static const gint DEFAULT_SCAN_JOBS = 8;
+static const gint DEFAULT_CHECK_JOBS = 16;
+static const gint DEFAULT_CHECK_JOBS_PER_DEVICE = 4;
+static const gchar *DEFAULT_SCAN_BACKEND = "gio";
+static const gboolean DEFAULT_WATCH = FALSE;
+static const gboolean DEFAULT_SCAN_SNAPSHOT = FALSE;
+static const gboolean DEFAULT_DIGEST_CACHE = FALSE;
+static const gboolean DEFAULT_LAZY_SCAN = FALSE;
+static const gboolean DEFAULT_USE_GITIGNORE = FALSE;
 
 static void config_data_free(DiffTreeConfig *config);
 
@@ -20,15 +29,39 @@ DiffTreeConfig *config_data_new(void)
     config->window_height = DEFAULT_WINDOW_HEIGHT;
     config->diff_command_line = g_strdup(DEFAULT_DIFF_COMMAND_LINE);
     config->keep_temp_files = DEFAULT_KEEP_TEMP_FILES;
+    config->scan_jobs = DEFAULT_SCAN_JOBS;
+    config->check_jobs = DEFAULT_CHECK_JOBS;
+    config->check_jobs_per_device = DEFAULT_CHECK_JOBS_PER_DEVICE;
+    config->scan_backend = g_strdup(DEFAULT_SCAN_BACKEND);
+    config->watch = DEFAULT_WATCH;
+    config->scan_snapshot = DEFAULT_SCAN_SNAPSHOT;
+    config->digest_cache = DEFAULT_DIGEST_CACHE;
+    config->lazy_scan = DEFAULT_LAZY_SCAN;
+    config->exclude = g_new0(char *, 1);
+    config->use_gitignore = DEFAULT_USE_GITIGNORE;
 
     return diff_tree_config_ref(config);
 }
 
+DiffTreeConfig *config_data_copy(const DiffTreeConfig *config)
+{
+    DiffTreeConfig *copy = g_malloc(sizeof(DiffTreeConfig));
+    *copy = *config;
+    util_ref_counted_struct_init(&copy->refcount);
+    copy->diff_command_line = g_strdup(config->diff_command_line);
+    copy->scan_backend = g_strdup(config->scan_backend);
+    copy->exclude = g_strdupv(config->exclude);
+
+    return copy;
+}
+
 void config_data_free(DiffTreeConfig *config)
 {
     if (config != NULL)
     {
         g_free(config->diff_command_line);
+        g_free(config->scan_backend);
+        g_strfreev(config->exclude);
         g_free(config);
     }
 }
@@ -75,6 +108,119 @@ static void set_default_values(GKeyFile *keyfile)
         g_key_file_set_boolean(keyfile, "main", "keep_temp_files", DEFAULT_KEEP_TEMP_FILES);
         g_key_file_set_comment(keyfile, "main", "keep_temp_files", comment, NULL);
     }
+
+    g_key_file_get_integer(keyfile, "main", "scan_jobs", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " The maximum number of directories to read at the same time while\n"
+            " scanning. Higher values help on network filesystems and fast SSDs.";
+        g_clear_error(&error);
+        g_key_file_set_integer(keyfile, "main", "scan_jobs", DEFAULT_SCAN_JOBS);
+        g_key_file_set_comment(keyfile, "main", "scan_jobs", comment, NULL);
+    }
+
+    g_key_file_get_integer(keyfile, "main", "check_jobs", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " The maximum number of files to compare at the same time.";
+        g_clear_error(&error);
+        g_key_file_set_integer(keyfile, "main", "check_jobs", DEFAULT_CHECK_JOBS);
+        g_key_file_set_comment(keyfile, "main", "check_jobs", comment, NULL);
+    }
+
+    g_key_file_get_integer(keyfile, "main", "check_jobs_per_device", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " The maximum number of files to compare at the same time that read from\n"
+            " the same device. Each zip file counts as its own device.";
+        g_clear_error(&error);
+        g_key_file_set_integer(keyfile, "main", "check_jobs_per_device", DEFAULT_CHECK_JOBS_PER_DEVICE);
+        g_key_file_set_comment(keyfile, "main", "check_jobs_per_device", comment, NULL);
+    }
+
+    str = g_key_file_get_string(keyfile, "main", "scan_backend", &error);
+    if (str == NULL || error != NULL)
+    {
+        const gchar *comment = 
+            " How to read local directories. This can be \"gio\", \"native\" to use\n"
+            " getdents64 and statx on worker threads, or \"io_uring\" to batch the\n"
+            " statx calls through io_uring.";
+        g_clear_error(&error);
+        g_key_file_set_string(keyfile, "main", "scan_backend", DEFAULT_SCAN_BACKEND);
+        g_key_file_set_comment(keyfile, "main", "scan_backend", comment, NULL);
+    }
+    g_free(str);
+
+    g_key_file_get_boolean(keyfile, "main", "watch", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " If this is true, then keep watching local directories for changes\n"
+            " after scanning them, and update the tree as files change.";
+        g_clear_error(&error);
+        g_key_file_set_boolean(keyfile, "main", "watch", DEFAULT_WATCH);
+        g_key_file_set_comment(keyfile, "main", "watch", comment, NULL);
+    }
+
+    g_key_file_get_boolean(keyfile, "main", "scan_snapshot", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " If this is true, then save a snapshot of each local directory after\n"
+            " scanning it, and only reread the directories that changed the next\n"
+            " time. Note that a file that's modified in place won't show up as\n"
+            " changed until something is added or removed in the same directory.";
+        g_clear_error(&error);
+        g_key_file_set_boolean(keyfile, "main", "scan_snapshot", DEFAULT_SCAN_SNAPSHOT);
+        g_key_file_set_comment(keyfile, "main", "scan_snapshot", comment, NULL);
+    }
+
+    g_key_file_get_boolean(keyfile, "main", "digest_cache", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " If this is true, then save a digest of each local file's contents\n"
+            " after comparing it, keyed by its device, inode, size, and timestamps,\n"
+            " and use that instead of reading the file again next time.";
+        g_clear_error(&error);
+        g_key_file_set_boolean(keyfile, "main", "digest_cache", DEFAULT_DIGEST_CACHE);
+        g_key_file_set_comment(keyfile, "main", "digest_cache", comment, NULL);
+    }
+
+    g_key_file_get_boolean(keyfile, "main", "lazy_scan", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " If this is true, then scan local directories one at a time in the\n"
+            " background, and read the directories that you open or select first.";
+        g_clear_error(&error);
+        g_key_file_set_boolean(keyfile, "main", "lazy_scan", DEFAULT_LAZY_SCAN);
+        g_key_file_set_comment(keyfile, "main", "lazy_scan", comment, NULL);
+    }
+
+    if (!g_key_file_has_key(keyfile, "main", "exclude", NULL))
+    {
+        const gchar *comment = 
+            " A list of .gitignore-style patterns for files and directories to leave\n"
+            " out when scanning local directories, separated by semicolons. For\n"
+            " example: .git/;*.o;build/";
+        g_key_file_set_string(keyfile, "main", "exclude", "");
+        g_key_file_set_comment(keyfile, "main", "exclude", comment, NULL);
+    }
+
+    g_key_file_get_boolean(keyfile, "main", "use_gitignore", &error);
+    if (error != NULL)
+    {
+        const gchar *comment = 
+            " If this is true, then also leave out the files that the .gitignore file\n"
+            " in each local directory matches.";
+        g_clear_error(&error);
+        g_key_file_set_boolean(keyfile, "main", "use_gitignore", DEFAULT_USE_GITIGNORE);
+        g_key_file_set_comment(keyfile, "main", "use_gitignore", comment, NULL);
+    }
 }
 
 static void update_from_keyfile(DiffTreeConfig *config, GKeyFile *keyfile)
@@ -82,6 +228,7 @@ static void update_from_keyfile(DiffTreeConfig *config, GKeyFile *keyfile)
     GError *err = NULL;
     gint ival;
     gchar *str;
+    gchar **strv;
     gboolean bval;
 
     ival = g_key_file_get_integer(keyfile, "main", "window_width", NULL);
@@ -112,6 +259,88 @@ static void update_from_keyfile(DiffTreeConfig *config, GKeyFile *keyfile)
     {
         config->keep_temp_files = bval;
     }
+
+    ival = g_key_file_get_integer(keyfile, "main", "scan_jobs", NULL);
+    if (ival > 0)
+    {
+        config->scan_jobs = ival;
+    }
+
+    ival = g_key_file_get_integer(keyfile, "main", "check_jobs", NULL);
+    if (ival > 0)
+    {
+        config->check_jobs = ival;
+    }
+
+    ival = g_key_file_get_integer(keyfile, "main", "check_jobs_per_device", NULL);
+    if (ival > 0)
+    {
+        config->check_jobs_per_device = ival;
+    }
+
+    str = g_key_file_get_string(keyfile, "main", "scan_backend", NULL);
+    if (str != NULL)
+    {
+        g_free(config->scan_backend);
+        config->scan_backend = str;
+    }
+
+    bval = g_key_file_get_boolean(keyfile, "main", "watch", &err);
+    if (err != NULL)
+    {
+        g_clear_error(&err);
+    }
+    else
+    {
+        config->watch = bval;
+    }
+
+    bval = g_key_file_get_boolean(keyfile, "main", "scan_snapshot", &err);
+    if (err != NULL)
+    {
+        g_clear_error(&err);
+    }
+    else
+    {
+        config->scan_snapshot = bval;
+    }
+
+    bval = g_key_file_get_boolean(keyfile, "main", "digest_cache", &err);
+    if (err != NULL)
+    {
+        g_clear_error(&err);
+    }
+    else
+    {
+        config->digest_cache = bval;
+    }
+
+    bval = g_key_file_get_boolean(keyfile, "main", "lazy_scan", &err);
+    if (err != NULL)
+    {
+        g_clear_error(&err);
+    }
+    else
+    {
+        config->lazy_scan = bval;
+    }
+
+    strv = g_key_file_get_string_list(keyfile, "main", "exclude", NULL, NULL);
+    if (strv != NULL)
+    {
+        g_strfreev(config->exclude);
+        config->exclude = strv;
+    }
+
+    bval = g_key_file_get_boolean(keyfile, "main", "use_gitignore", &err);
+    if (err != NULL)
+    {
+        g_clear_error(&err);
+    }
+    else
+    {
+        config->use_gitignore = bval;
+    }
 }
 
 /**
@@ -127,6 +356,17 @@ static gboolean store_to_keyfile(DiffTreeConfig *config, GKeyFile *keyfile)
     changed = changed || (g_key_file_get_integer(keyfile, "main", "window_width", NULL) != config->window_width);
     changed = changed || (g_key_file_get_integer(keyfile, "main", "window_height", NULL) != config->window_height);
     changed = changed || (g_key_file_get_boolean(keyfile, "main", "keep_temp_files", NULL) != config->keep_temp_files);
+    changed = changed || (g_key_file_get_integer(keyfile, "main", "scan_jobs", NULL) != config->scan_jobs);
+    changed = changed || (g_key_file_get_integer(keyfile, "main", "check_jobs", NULL) != config->check_jobs);
+    changed = changed || (g_key_file_get_integer(keyfile, "main", "check_jobs_per_device", NULL) != config->check_jobs_per_device);
+    changed = changed || (g_key_file_get_boolean(keyfile, "main", "watch", NULL) != config->watch);
+    changed = changed || (g_key_file_get_boolean(keyfile, "main", "scan_snapshot", NULL) != config->scan_snapshot);
+    changed = changed || (g_key_file_get_boolean(keyfile, "main", "digest_cache", NULL) != config->digest_cache);
+    changed = changed || (g_key_file_get_boolean(keyfile, "main", "lazy_scan", NULL) != config->lazy_scan);
+    changed = changed || (g_key_file_get_boolean(keyfile, "main", "use_gitignore", NULL) != config->use_gitignore);
+
+    // The exclude list is only ever set in the config file itself, so there's
+    // nothing to store for it.
 
     str = g_key_file_get_string(keyfile, "main", "diff_command_line", NULL);
     if (g_strcmp0(str, config->diff_command_line) != 0)
@@ -143,11 +383,28 @@ static gboolean store_to_keyfile(DiffTreeConfig *config, GKeyFile *keyfile)
     }
     g_free(str);
 
+    str = g_key_file_get_string(keyfile, "main", "scan_backend", NULL);
+    if (g_strcmp0(str, config->scan_backend) != 0)
+    {
+        changed = TRUE;
+        g_key_file_set_string(keyfile, "main", "scan_backend",
+                config->scan_backend != NULL ? config->scan_backend : DEFAULT_SCAN_BACKEND);
+    }
+    g_free(str);
+
     if (changed)
     {
         g_key_file_set_integer(keyfile, "main", "window_width", config->window_width);
         g_key_file_set_integer(keyfile, "main", "window_height", config->window_height);
         g_key_file_set_boolean(keyfile, "main", "keep_temp_files", config->keep_temp_files);
+        g_key_file_set_integer(keyfile, "main", "scan_jobs", config->scan_jobs);
+        g_key_file_set_integer(keyfile, "main", "check_jobs", config->check_jobs);
+        g_key_file_set_integer(keyfile, "main", "check_jobs_per_device", config->check_jobs_per_device);
+        g_key_file_set_boolean(keyfile, "main", "watch", config->watch);
+        g_key_file_set_boolean(keyfile, "main", "scan_snapshot", config->scan_snapshot);
+        g_key_file_set_boolean(keyfile, "main", "digest_cache", config->digest_cache);
+        g_key_file_set_boolean(keyfile, "main", "lazy_scan", config->lazy_scan);
+        g_key_file_set_boolean(keyfile, "main", "use_gitignore", config->use_gitignore);
     }
     else
     {
@@ -23,6 +23,58 @@ typedef struct
     gint window_height;
     char *diff_command_line;
     gboolean keep_temp_files;
+
+    /**
+     * The maximum number of directories to enumerate at once while scanning.
+     */
+    gint scan_jobs;
+
+    /**
+     * The maximum number of files to compare at once, and the maximum number
+     * of those that can read from the same device.
+     */
+    gint check_jobs;
+    gint check_jobs_per_device;
+
+    /**
+     * How to read local directories, either "gio" or "native".
+     */
+    char *scan_backend;
+
+    /**
+     * If true, then watch local directories for changes after scanning them.
+     */
+    gboolean watch;
+
+    /**
+     * If true, then cache a snapshot of each local directory after scanning
+     * it, and use it to speed up the next scan.
+     */
+    gboolean scan_snapshot;
+
+    /**
+     * If true, then save the digest of each local file that's compared, and
+     * use it instead of reading the file again if it hasn't changed.
+     */
+    gboolean digest_cache;
+
+    /**
+     * If true, then scan local directories in the background, and read the
+     * directories that the user opens first.
+     */
+    gboolean lazy_scan;
+
+    /**
+     * .gitignore-style patterns for files and directories to leave out when
+     * scanning local directories, as a NULL-terminated array.
+     */
+    char **exclude;
+
+    /**
+     * If true, then also leave out the files that each directory's
+     * .gitignore file matches.
+     */
+    gboolean use_gitignore;
 } DiffTreeConfig;
 
 UTIL_DECLARE_BOXED_REFCOUNT_FUNCS(DiffTreeConfig, diff_tree_config)
@@ -32,6 +84,11 @@ UTIL_DECLARE_BOXED_REFCOUNT_FUNCS(DiffTreeConfig, diff_tree_config)
  */
 DiffTreeConfig *config_data_new(void);
 
+/**
+ * Allocates a new DiffTreeConfig struct with the same values as \p config.
+ */
+DiffTreeConfig *config_data_copy(const DiffTreeConfig *config);
+
 /**
  * Searches for a default config file to use.
  *
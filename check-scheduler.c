@@ -0,0 +1,537 @@
+#include "check-scheduler.h"
+
+#include <string.h>
+
+#include "source-helpers.h"
+
+/**
+ * How far into each queue to look for a check whose devices aren't busy.
+ * This keeps one busy device from blocking everything behind it, without
+ * scanning the whole queue each time.
+ */
+#define MAX_LOOKAHEAD 64
+
+/**
+ * The minimum time between progress callbacks, in milliseconds.
+ */
+#define PROGRESS_INTERVAL_MS 100
+
+/**
+ * Used in place of a device number for a source that doesn't have one, like
+ * a zip file. Each of those sources counts as its own device.
+ */
+#define NO_DEVICE_BASE (G_GUINT64_CONSTANT(1) << 32)
+
+typedef struct
+{
+    guint64 device;
+    gint running;
+} DeviceSlot;
+
+/**
+ * A check that's waiting in one of the queues.
+ */
+typedef struct
+{
+    DtFileKey *key;
+    DtCheckPriority priority;
+
+    /// The link in DtCheckScheduler::queues.
+    GList *link;
+
+    /// The device of the file in each source.
+    guint64 devices[];
+} CheckItem;
+
+/**
+ * A check that's running.
+ */
+typedef struct
+{
+    /**
+     * The scheduler, or NULL if it was freed while this check was still
+     * running.
+     */
+    DtCheckScheduler *scheduler;
+    DtCheckPriority priority;
+    guint64 devices[];
+} RunningCheck;
+
+struct _DtCheckScheduler
+{
+    DtDiffTreeModel *model;
+    gint num_sources;
+    gint max_per_device;
+    gint max_running;
+
+    DtCheckSchedulerProgressFunc progress_func;
+    DtCheckSchedulerErrorFunc error_func;
+    gpointer userdata;
+
+    GQueue queues[DT_CHECK_PRIORITY_COUNT];
+
+    /// Maps a DtFileKey to its CheckItem, for every queued check.
+    GHashTable *queued_keys;
+
+    /// The number of checks that we've started from the user queue in a row.
+    gint user_streak;
+
+    /// The RunningCheck for every check that's running.
+    GList *running;
+    gint num_running;
+
+    /// A DeviceSlot for each device that we've seen.
+    GArray *devices;
+
+    /// Cancelled and replaced by dt_check_scheduler_cancel_all.
+    GCancellable *cancellable;
+
+    guint64 completed;
+    guint64 failed;
+    gdouble completed_per_second;
+    gint64 rate_window_start;
+    guint rate_window_count;
+
+    guint progress_timeout_id;
+};
+
+static void start_checks(DtCheckScheduler *self);
+
+DtCheckScheduler *dt_check_scheduler_new(DtDiffTreeModel *model,
+        gint max_per_device, gint max_running,
+        DtCheckSchedulerProgressFunc progress_func,
+        DtCheckSchedulerErrorFunc error_func, gpointer userdata)
+{
+    DtCheckScheduler *self = g_malloc0(sizeof(DtCheckScheduler));
+    gint i;
+
+    self->model = g_object_ref(model);
+    self->num_sources = dt_diff_tree_model_get_num_sources(model);
+    self->max_per_device = MAX(max_per_device, 1);
+    self->max_running = MAX(max_running, 1);
+    self->progress_func = progress_func;
+    self->error_func = error_func;
+    self->userdata = userdata;
+
+    for (i=0; i<DT_CHECK_PRIORITY_COUNT; i++)
+    {
+        g_queue_init(&self->queues[i]);
+    }
+    self->queued_keys = g_hash_table_new(dt_file_key_hash, dt_file_key_equal);
+    self->devices = g_array_new(FALSE, FALSE, sizeof(DeviceSlot));
+    self->cancellable = g_cancellable_new();
+    self->rate_window_start = g_get_monotonic_time();
+
+    return self;
+}
+
+static void check_item_free(CheckItem *item)
+{
+    dt_file_key_unref(item->key);
+    g_free(item);
+}
+
+static void clear_queue(DtCheckScheduler *self, DtCheckPriority priority)
+{
+    CheckItem *item;
+
+    while ((item = g_queue_pop_head(&self->queues[priority])) != NULL)
+    {
+        g_hash_table_remove(self->queued_keys, item->key);
+        check_item_free(item);
+    }
+}
+
+void dt_check_scheduler_free(DtCheckScheduler *self)
+{
+    if (self != NULL)
+    {
+        GList *node;
+        gint i;
+
+        for (i=0; i<DT_CHECK_PRIORITY_COUNT; i++)
+        {
+            clear_queue(self, i);
+        }
+
+        // The running checks still finish, but they won't touch the
+        // scheduler.
+        g_cancellable_cancel(self->cancellable);
+        for (node = self->running; node != NULL; node = node->next)
+        {
+            RunningCheck *check = node->data;
+            check->scheduler = NULL;
+        }
+        g_list_free(self->running);
+
+        if (self->progress_timeout_id != 0)
+        {
+            g_source_remove(self->progress_timeout_id);
+        }
+        g_hash_table_unref(self->queued_keys);
+        g_array_unref(self->devices);
+        g_object_unref(self->cancellable);
+        g_object_unref(self->model);
+        g_free(self);
+    }
+}
+
+void dt_check_scheduler_get_stats(DtCheckScheduler *self, DtCheckSchedulerStats *stats)
+{
+    gint i;
+
+    for (i=0; i<DT_CHECK_PRIORITY_COUNT; i++)
+    {
+        stats->queued[i] = g_queue_get_length(&self->queues[i]);
+    }
+    stats->running = self->num_running;
+    stats->completed = self->completed;
+    stats->failed = self->failed;
+    stats->completed_per_second = self->completed_per_second;
+}
+
+static gboolean is_idle(DtCheckScheduler *self)
+{
+    return (self->num_running == 0 && g_hash_table_size(self->queued_keys) == 0);
+}
+
+static void send_progress(DtCheckScheduler *self)
+{
+    if (self->progress_func != NULL)
+    {
+        DtCheckSchedulerStats stats;
+
+        dt_check_scheduler_get_stats(self, &stats);
+        self->progress_func(self, &stats, self->userdata);
+    }
+}
+
+static gboolean on_progress_timeout(gpointer userdata)
+{
+    DtCheckScheduler *self = userdata;
+
+    self->progress_timeout_id = 0;
+    send_progress(self);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Sends a progress update, either now if we just went idle, or after
+ * PROGRESS_INTERVAL_MS otherwise.
+ */
+static void schedule_progress(DtCheckScheduler *self)
+{
+    if (is_idle(self))
+    {
+        if (self->progress_timeout_id != 0)
+        {
+            g_source_remove(self->progress_timeout_id);
+            self->progress_timeout_id = 0;
+        }
+        send_progress(self);
+    }
+    else if (self->progress_timeout_id == 0)
+    {
+        self->progress_timeout_id = g_timeout_add(PROGRESS_INTERVAL_MS, on_progress_timeout, self);
+    }
+}
+
+static DeviceSlot *get_device_slot(DtCheckScheduler *self, guint64 device)
+{
+    DeviceSlot slot = { device, 0 };
+    guint i;
+
+    // There's only ever a handful of devices, so a linear search is fine.
+    for (i=0; i<self->devices->len; i++)
+    {
+        if (g_array_index(self->devices, DeviceSlot, i).device == device)
+        {
+            return &g_array_index(self->devices, DeviceSlot, i);
+        }
+    }
+    g_array_append_val(self->devices, slot);
+    return &g_array_index(self->devices, DeviceSlot, self->devices->len - 1);
+}
+
+/**
+ * Returns TRUE if an earlier source in \p devices is on the same device as
+ * source \p index.
+ *
+ * A check counts once against each device, even if it reads more than one
+ * file from it.
+ */
+static gboolean is_duplicate_device(const guint64 *devices, gint index)
+{
+    gint i;
+
+    for (i=0; i<index; i++)
+    {
+        if (devices[i] == devices[index])
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean devices_available(DtCheckScheduler *self, const guint64 *devices)
+{
+    gint i;
+
+    for (i=0; i<self->num_sources; i++)
+    {
+        if (!is_duplicate_device(devices, i)
+                && get_device_slot(self, devices[i])->running >= self->max_per_device)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void update_devices(DtCheckScheduler *self, const guint64 *devices, gint delta)
+{
+    gint i;
+
+    for (i=0; i<self->num_sources; i++)
+    {
+        if (!is_duplicate_device(devices, i))
+        {
+            get_device_slot(self, devices[i])->running += delta;
+        }
+    }
+}
+
+/**
+ * Finds the next check that can start right now, and takes it out of its
+ * queue.
+ */
+static CheckItem *take_next_item(DtCheckScheduler *self)
+{
+    DtCheckPriority order[DT_CHECK_PRIORITY_COUNT];
+    gint i;
+
+    if (self->user_streak >= DT_CHECK_SCHEDULER_USER_BURST)
+    {
+        // Give the background queue a turn.
+        order[0] = DT_CHECK_PRIORITY_BACKGROUND;
+        order[1] = DT_CHECK_PRIORITY_USER;
+    }
+    else
+    {
+        order[0] = DT_CHECK_PRIORITY_USER;
+        order[1] = DT_CHECK_PRIORITY_BACKGROUND;
+    }
+
+    for (i=0; i<DT_CHECK_PRIORITY_COUNT; i++)
+    {
+        GQueue *queue = &self->queues[order[i]];
+        GList *node;
+        gint count = 0;
+
+        for (node = queue->head; node != NULL && count < MAX_LOOKAHEAD; node = node->next, count++)
+        {
+            CheckItem *item = node->data;
+            if (devices_available(self, item->devices))
+            {
+                g_queue_delete_link(queue, node);
+                g_hash_table_remove(self->queued_keys, item->key);
+
+                if (order[i] == DT_CHECK_PRIORITY_USER)
+                {
+                    self->user_streak++;
+                }
+                else
+                {
+                    self->user_streak = 0;
+                }
+                return item;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void on_check_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    RunningCheck *check = userdata;
+    DtCheckScheduler *self = check->scheduler;
+    GError *error = NULL;
+    gboolean success;
+    gint64 now;
+
+    success = dt_diff_tree_model_check_difference_finish(DT_DIFF_TREE_MODEL(sourceobj), res, &error);
+    if (self == NULL)
+    {
+        g_clear_error(&error);
+        g_free(check);
+        return;
+    }
+
+    self->running = g_list_remove(self->running, check);
+    self->num_running--;
+    update_devices(self, check->devices, -1);
+
+    if (!success)
+    {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+            self->failed++;
+            if (self->error_func != NULL)
+            {
+                self->error_func(self, check->priority, error, self->userdata);
+            }
+        }
+        g_clear_error(&error);
+    }
+    g_free(check);
+
+    self->completed++;
+    self->rate_window_count++;
+    now = g_get_monotonic_time();
+    if (now - self->rate_window_start >= G_USEC_PER_SEC)
+    {
+        self->completed_per_second = (gdouble) self->rate_window_count * G_USEC_PER_SEC
+            / (now - self->rate_window_start);
+        self->rate_window_start = now;
+        self->rate_window_count = 0;
+    }
+
+    start_checks(self);
+    schedule_progress(self);
+}
+
+/**
+ * Starts as many queued checks as the limits allow.
+ */
+static void start_checks(DtCheckScheduler *self)
+{
+    while (self->num_running < self->max_running)
+    {
+        CheckItem *item = take_next_item(self);
+        RunningCheck *check;
+        GtkTreeIter iter;
+        DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
+
+        if (item == NULL)
+        {
+            break;
+        }
+
+        // The row might have been removed or checked since it was queued.
+        if (!dt_file_key_get_iter(GTK_TREE_MODEL(self->model), &iter, item->key))
+        {
+            check_item_free(item);
+            continue;
+        }
+        gtk_tree_model_get(GTK_TREE_MODEL(self->model), &iter,
+                DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
+        if (diff != DT_DIFF_TYPE_UNKNOWN)
+        {
+            check_item_free(item);
+            continue;
+        }
+
+        check = g_malloc(sizeof(RunningCheck) + self->num_sources * sizeof(guint64));
+        check->scheduler = self;
+        check->priority = item->priority;
+        memcpy(check->devices, item->devices, self->num_sources * sizeof(guint64));
+        check_item_free(item);
+
+        self->running = g_list_prepend(self->running, check);
+        self->num_running++;
+        update_devices(self, check->devices, 1);
+
+        dt_diff_tree_model_check_difference_async(self->model, &iter,
+                check->priority == DT_CHECK_PRIORITY_USER ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
+                self->cancellable, on_check_ready, check);
+    }
+}
+
+void dt_check_scheduler_add(DtCheckScheduler *self, GtkTreeIter *iter,
+        DtCheckPriority priority)
+{
+    GFileType type = G_FILE_TYPE_UNKNOWN;
+    DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
+    DtFileKey *key;
+    CheckItem *item;
+    gint i;
+
+    gtk_tree_model_get(GTK_TREE_MODEL(self->model), iter,
+            DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &type,
+            DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
+    if (type != G_FILE_TYPE_REGULAR || diff != DT_DIFF_TYPE_UNKNOWN)
+    {
+        return;
+    }
+
+    key = dt_file_key_from_model(GTK_TREE_MODEL(self->model), iter);
+    item = g_hash_table_lookup(self->queued_keys, key);
+    if (item != NULL)
+    {
+        if (priority == DT_CHECK_PRIORITY_USER && item->priority != DT_CHECK_PRIORITY_USER)
+        {
+            // The user asked for a file that was already waiting in the
+            // background, so move it up.
+            g_queue_delete_link(&self->queues[item->priority], item->link);
+            item->priority = priority;
+            g_queue_push_tail(&self->queues[priority], item);
+            item->link = self->queues[priority].tail;
+        }
+        dt_file_key_unref(key);
+        return;
+    }
+
+    item = g_malloc(sizeof(CheckItem) + self->num_sources * sizeof(guint64));
+    item->key = key;
+    item->priority = priority;
+    for (i=0; i<self->num_sources; i++)
+    {
+        DtTreeSourceNode *node = dt_diff_tree_model_get_source_node(self->model, i, iter);
+        const DtFileMetadata *meta = NULL;
+
+        if (node != NULL)
+        {
+            meta = dt_tree_source_get_metadata(dt_diff_tree_model_get_source(self->model, i), node);
+        }
+        if (meta != NULL && (meta->flags & DT_FILE_METADATA_HAS_INODE))
+        {
+            item->devices[i] = meta->device;
+        }
+        else
+        {
+            item->devices[i] = NO_DEVICE_BASE + i;
+        }
+    }
+
+    g_queue_push_tail(&self->queues[priority], item);
+    item->link = self->queues[priority].tail;
+    g_hash_table_insert(self->queued_keys, item->key, item);
+
+    start_checks(self);
+    schedule_progress(self);
+}
+
+void dt_check_scheduler_cancel_queued(DtCheckScheduler *self, DtCheckPriority priority)
+{
+    clear_queue(self, priority);
+    schedule_progress(self);
+}
+
+void dt_check_scheduler_cancel_all(DtCheckScheduler *self)
+{
+    gint i;
+
+    for (i=0; i<DT_CHECK_PRIORITY_COUNT; i++)
+    {
+        clear_queue(self, i);
+    }
+
+    // Cancel the running checks, and use a new GCancellable for anything
+    // that gets queued after this.
+    g_cancellable_cancel(self->cancellable);
+    g_object_unref(self->cancellable);
+    self->cancellable = g_cancellable_new();
+
+    schedule_progress(self);
+}
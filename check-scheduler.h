@@ -0,0 +1,118 @@
+#ifndef CHECK_SCHEDULER_H
+#define CHECK_SCHEDULER_H
+
+/**
+ * \file
+ *
+ * Runs content checks on a DtDiffTreeModel, several at a time.
+ *
+ * Each check reads the same file from every source, so the scheduler keeps
+ * track of how many checks are reading from each device, and only starts a
+ * check if none of its devices are already at the limit. That way, a slow
+ * device (or a zip file) doesn't take every slot, and a fast device can still
+ * have plenty of reads in flight.
+ *
+ * There are two queues. Checks that the user asked for go in the user queue,
+ * and everything else (like files that changed while watching) goes in the
+ * background queue. The user queue goes first, but the background queue
+ * still gets one slot out of every DT_CHECK_SCHEDULER_USER_BURST + 1, so it
+ * can't be starved completely.
+ */
+
+#include <gtk/gtk.h>
+
+#include "diff-tree-model.h"
+
+G_BEGIN_DECLS
+
+/**
+ * How many checks from the user queue to start in a row before taking one
+ * from the background queue.
+ */
+#define DT_CHECK_SCHEDULER_USER_BURST 4
+
+typedef enum
+{
+    DT_CHECK_PRIORITY_USER,
+    DT_CHECK_PRIORITY_BACKGROUND,
+
+    DT_CHECK_PRIORITY_COUNT
+} DtCheckPriority;
+
+typedef struct
+{
+    /// The number of checks waiting in each queue.
+    guint queued[DT_CHECK_PRIORITY_COUNT];
+
+    guint running;
+
+    /// The number of checks that have finished, including failed ones.
+    guint64 completed;
+    guint64 failed;
+
+    /// How many checks finished per second, over the last second or so.
+    gdouble completed_per_second;
+} DtCheckSchedulerStats;
+
+typedef struct _DtCheckScheduler DtCheckScheduler;
+
+/**
+ * Called when the queue depth or the completion count changes.
+ *
+ * These are rate-limited, except that there's always one call right after
+ * the scheduler goes idle.
+ */
+typedef void (* DtCheckSchedulerProgressFunc) (DtCheckScheduler *scheduler,
+        const DtCheckSchedulerStats *stats, gpointer userdata);
+
+/**
+ * Called when a check fails.
+ */
+typedef void (* DtCheckSchedulerErrorFunc) (DtCheckScheduler *scheduler,
+        DtCheckPriority priority, const GError *error, gpointer userdata);
+
+/**
+ * Creates a new DtCheckScheduler.
+ *
+ * \param max_per_device The maximum number of checks to read from each
+ *      device at the same time.
+ * \param max_running The maximum number of checks to run at the same time,
+ *      across every device.
+ */
+DtCheckScheduler *dt_check_scheduler_new(DtDiffTreeModel *model,
+        gint max_per_device, gint max_running,
+        DtCheckSchedulerProgressFunc progress_func,
+        DtCheckSchedulerErrorFunc error_func, gpointer userdata);
+
+/**
+ * Cancels everything and frees the scheduler.
+ *
+ * The callbacks won't be called after this.
+ */
+void dt_check_scheduler_free(DtCheckScheduler *scheduler);
+
+/**
+ * Queues a check for a row.
+ *
+ * This does nothing unless the row is a regular file that hasn't been
+ * checked yet. If the row is already queued, then this only moves it to the
+ * user queue if \p priority is DT_CHECK_PRIORITY_USER.
+ */
+void dt_check_scheduler_add(DtCheckScheduler *scheduler, GtkTreeIter *iter,
+        DtCheckPriority priority);
+
+/**
+ * Throws out every check in one queue that hasn't started yet.
+ */
+void dt_check_scheduler_cancel_queued(DtCheckScheduler *scheduler, DtCheckPriority priority);
+
+/**
+ * Throws out every queued check, and cancels every running check.
+ */
+void dt_check_scheduler_cancel_all(DtCheckScheduler *scheduler);
+
+void dt_check_scheduler_get_stats(DtCheckScheduler *scheduler, DtCheckSchedulerStats *stats);
+
+G_END_DECLS
+
+#endif // CHECK_SCHEDULER_H
@@ -0,0 +1,1016 @@
+#include "diff-compare.h"
+
+#include <string.h>
+
+#include "fs-extents.h"
+#include "fs-compare.h"
+#include "file-digest.h"
+#include "digest-cache.h"
+
+G_STATIC_ASSERT(DT_FILE_DIGEST_SIZE == DT_FILE_METADATA_DIGEST_SIZE);
+
+/**
+ * With at least this many files, we compare digests instead of comparing the
+ * contents directly.
+ */
+#define DIGEST_MIN_SOURCES 3
+
+/**
+ * Returns TRUE if every file is the same inode on the same device, which
+ * means that they're all hardlinks to the same file.
+ *
+ * Only DtTreeSourceFS fills in the device and inode, so this is always FALSE
+ * for anything else.
+ */
+static gboolean check_same_inode(gint num_sources, const DtFileMetadata **metas)
+{
+    gint i;
+
+    for (i=0; i<num_sources; i++)
+    {
+        if (!(metas[i]->flags & DT_FILE_METADATA_HAS_INODE))
+        {
+            return FALSE;
+        }
+        if (metas[0]->device != metas[i]->device || metas[0]->inode != metas[i]->inode)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Compares a digest from every file.
+ *
+ * \param digests The digest of each file, or NULL if we don't know it yet.
+ * \return DT_DIFF_TYPE_DIFFERENT if any two digests don't match,
+ *      DT_DIFF_TYPE_IDENTICAL if they all match, or DT_DIFF_TYPE_UNKNOWN if
+ *      the ones we know match but some are missing.
+ */
+static DtDiffType compare_digests(gint num_sources, const guint8 **digests)
+{
+    const guint8 *first = NULL;
+    gboolean all = TRUE;
+    gint i;
+
+    for (i=0; i<num_sources; i++)
+    {
+        if (digests[i] == NULL)
+        {
+            all = FALSE;
+        }
+        else if (first == NULL)
+        {
+            first = digests[i];
+        }
+        else if (memcmp(first, digests[i], DT_FILE_DIGEST_SIZE) != 0)
+        {
+            return DT_DIFF_TYPE_DIFFERENT;
+        }
+    }
+    return (all ? DT_DIFF_TYPE_IDENTICAL : DT_DIFF_TYPE_UNKNOWN);
+}
+
+DtDiffType dt_diff_check_basic(gint num_sources, DtTreeSource **sources,
+        DtTreeSourceNode **nodes)
+{
+    const DtFileMetadata **metas = g_alloca(num_sources * sizeof(DtFileMetadata *));
+    gint i;
+
+    // Check if the file exists in every source.
+    for (i=0; i<num_sources; i++)
+    {
+        if (nodes[i] == NULL)
+        {
+            // The file is missing from at least one source.
+            return DT_DIFF_TYPE_DIFFERENT;
+        }
+
+        metas[i] = dt_tree_source_get_metadata(sources[i], nodes[i]);
+        g_assert(metas[0]->type == metas[i]->type);
+    }
+
+    if (metas[0]->type == G_FILE_TYPE_DIRECTORY)
+    {
+        // We don't bother comparing directories.
+        return DT_DIFF_TYPE_IDENTICAL;
+    }
+    else if (metas[0]->type == G_FILE_TYPE_REGULAR)
+    {
+        const guint8 **digests = g_alloca(num_sources * sizeof(guint8 *));
+        guint32 firstCRC = 0;
+        gboolean anyCRC = FALSE;
+        gboolean allCRC = TRUE;
+        DtDiffType result;
+
+        for (i=0; i<num_sources; i++)
+        {
+            if (metas[0]->size != metas[i]->size)
+            {
+                return DT_DIFF_TYPE_DIFFERENT;
+            }
+
+            if (metas[i]->flags & DT_FILE_METADATA_HAS_CRC)
+            {
+                if (!anyCRC)
+                {
+                    anyCRC = TRUE;
+                    firstCRC = metas[i]->crc;
+                }
+                else if (firstCRC != metas[i]->crc)
+                {
+                    return DT_DIFF_TYPE_DIFFERENT;
+                }
+            }
+            else
+            {
+                allCRC = FALSE;
+            }
+
+            digests[i] = (metas[i]->flags & DT_FILE_METADATA_HAS_DIGEST) ? metas[i]->digest : NULL;
+        }
+
+        if (allCRC)
+        {
+            // Every file had a CRC, and they all matched.
+            return DT_DIFF_TYPE_IDENTICAL;
+        }
+
+        if (check_same_inode(num_sources, metas))
+        {
+            return DT_DIFF_TYPE_IDENTICAL;
+        }
+
+        // An earlier check might have left a digest for some of the files.
+        result = compare_digests(num_sources, digests);
+        if (result != DT_DIFF_TYPE_UNKNOWN)
+        {
+            return result;
+        }
+
+        // We'll have to read the files to determine if they're different or not.
+        return DT_DIFF_TYPE_UNKNOWN;
+    }
+    else if (metas[0]->type == G_FILE_TYPE_SYMBOLIC_LINK)
+    {
+        // For a symlink, check the target
+        const char *first_target = dt_tree_source_get_symlink_target(sources[0], nodes[0]);
+        for (i=1; i<num_sources; i++)
+        {
+            const char *target = dt_tree_source_get_symlink_target(sources[i], nodes[i]);
+            if (g_strcmp0(target, first_target) != 0)
+            {
+                return DT_DIFF_TYPE_DIFFERENT;
+            }
+        }
+        return DT_DIFF_TYPE_IDENTICAL;
+    }
+    else
+    {
+        // Ignore anything other than a regular file for now.
+        return DT_DIFF_TYPE_UNKNOWN;
+    }
+}
+
+/**
+ * The size of the first block that we read from each file. Each block after
+ * that is twice as big, up to MAX_READ_BLOCK_SIZE, so that small files only
+ * need small buffers, but big files are read in big enough chunks to keep
+ * the devices busy.
+ */
+#define MIN_READ_BLOCK_SIZE (64 * 1024)
+#define MAX_READ_BLOCK_SIZE (2 * 1024 * 1024)
+
+/**
+ * The number of blocks that can be in flight for each file: one that's being
+ * compared or waiting for the other files, and one that's being read.
+ */
+#define NUM_BLOCK_BUFFERS 2
+
+typedef struct
+{
+    GInputStream *stream;
+
+    /// The next block to read from this stream.
+    guint64 next_block;
+    gboolean reading;
+
+    gchar *buffers[NUM_BLOCK_BUFFERS];
+    gsize buffer_sizes[NUM_BLOCK_BUFFERS];
+
+    /// The number of bytes that we read into each buffer.
+    gsize filled[NUM_BLOCK_BUFFERS];
+} CheckContentsSource;
+
+typedef struct
+{
+    gint num_sources;
+    DtTreeSource **sources;
+    DtTreeSourceNode **nodes;
+    CheckContentsSource *streams;
+
+    /// The local path of each file, or NULL if it isn't a local file.
+    char **local_paths;
+
+    /**
+     * Cancelled if the caller's GCancellable is cancelled, or once we have a
+     * result, to stop any reads that are still running.
+     */
+    GCancellable *cancellable;
+    GCancellable *caller_cancellable;
+    gulong cancel_handler_id;
+
+    /// Set once the task has a result.
+    gboolean finished;
+
+    /// The offset of the first byte that's different, or -1 if we don't know.
+    gint64 diff_offset;
+
+    gint pending_opens;
+
+    /// The next block to compare. Every block before this one matched.
+    guint64 next_compare;
+
+    /// The file offset where the next block starts.
+    guint64 compare_offset;
+
+    /// The number of streams that have read each block that's in flight.
+    gint num_filled[NUM_BLOCK_BUFFERS];
+
+    /**
+     * The digest of each file, for a digest check. Each one is NULL until we
+     * know it, and then it points into digest_data.
+     */
+    const guint8 **digests;
+    guint8 *digest_data;
+} CheckContentsState;
+
+static void cleanup_check_contents_state(gpointer ptr)
+{
+    CheckContentsState *state = ptr;
+    gint i, j;
+
+    if (state->caller_cancellable != NULL)
+    {
+        g_cancellable_disconnect(state->caller_cancellable, state->cancel_handler_id);
+        g_object_unref(state->caller_cancellable);
+    }
+    for (i=0; i<state->num_sources; i++)
+    {
+        g_clear_object(&state->streams[i].stream);
+        for (j=0; j<NUM_BLOCK_BUFFERS; j++)
+        {
+            g_free(state->streams[i].buffers[j]);
+        }
+        g_object_unref(state->sources[i]);
+        g_free(state->local_paths[i]);
+    }
+    g_object_unref(state->cancellable);
+    g_free(state->local_paths);
+    g_free(state->digests);
+    g_free(state->digest_data);
+    g_free(state->streams);
+    g_free(state->nodes);
+    g_free(state->sources);
+    g_free(state);
+}
+
+static void on_caller_cancelled(GCancellable *cancellable, gpointer userdata)
+{
+    g_cancellable_cancel(G_CANCELLABLE(userdata));
+}
+
+/**
+ * Returns a result, and stops anything that's still running.
+ *
+ * The reads and opens that are still running each hold a reference to the
+ * task, so the buffers stay around until they finish.
+ */
+static void check_contents_return(GTask *task, DtDiffType result, GError *error)
+{
+    CheckContentsState *state = g_task_get_task_data(task);
+
+    if (state->finished)
+    {
+        g_clear_error(&error);
+        return;
+    }
+    state->finished = TRUE;
+    g_cancellable_cancel(state->cancellable);
+
+    if (error != NULL)
+    {
+        g_task_return_error(task, error);
+    }
+    else
+    {
+        g_task_return_int(task, result);
+    }
+}
+
+static gsize get_block_size(guint64 block)
+{
+    if (block >= 6)
+    {
+        return MAX_READ_BLOCK_SIZE;
+    }
+    return MIN(MIN_READ_BLOCK_SIZE << block, MAX_READ_BLOCK_SIZE);
+}
+
+static void on_check_contents_read_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata);
+
+/**
+ * Starts reading the next block from a stream, if it isn't already reading
+ * and the buffer for that block is free.
+ */
+static void check_contents_start_read(GTask *task, gint source_index)
+{
+    CheckContentsState *state = g_task_get_task_data(task);
+    CheckContentsSource *src = &state->streams[source_index];
+    guint64 block = src->next_block;
+    gint slot = block % NUM_BLOCK_BUFFERS;
+    gsize size = get_block_size(block);
+
+    if (src->reading || block >= state->next_compare + NUM_BLOCK_BUFFERS)
+    {
+        // Either we're already reading, or the buffer for the next block
+        // still has a block that hasn't been compared yet.
+        return;
+    }
+
+    if (src->buffer_sizes[slot] < size)
+    {
+        g_free(src->buffers[slot]);
+        src->buffers[slot] = g_malloc(size);
+        src->buffer_sizes[slot] = size;
+    }
+
+    src->reading = TRUE;
+    g_input_stream_read_all_async(src->stream, src->buffers[slot], size,
+            g_task_get_priority(task), state->cancellable,
+            on_check_contents_read_ready, g_object_ref(task));
+}
+
+/**
+ * Compares every block that every stream has finished reading.
+ *
+ * \return TRUE if there's more to read, or FALSE if this returned a result.
+ */
+static gboolean check_contents_compare_blocks(GTask *task)
+{
+    CheckContentsState *state = g_task_get_task_data(task);
+
+    while (state->num_filled[state->next_compare % NUM_BLOCK_BUFFERS] == state->num_sources)
+    {
+        gint slot = state->next_compare % NUM_BLOCK_BUFFERS;
+        gsize num = state->streams[0].filled[slot];
+        gsize same = num;
+        gboolean sizes_match = TRUE;
+        gint i;
+
+        // Find the first byte that isn't the same in every file. If one file
+        // ended early, then that's the end of the file.
+        for (i=1; i<state->num_sources; i++)
+        {
+            gsize filled = state->streams[i].filled[slot];
+
+            same = dt_fs_compare_find_difference(state->streams[0].buffers[slot],
+                    state->streams[i].buffers[slot], MIN(same, filled));
+            sizes_match = sizes_match && (filled == num);
+        }
+        if (same < num || !sizes_match)
+        {
+            state->diff_offset = state->compare_offset + same;
+            check_contents_return(task, DT_DIFF_TYPE_DIFFERENT, NULL);
+            return FALSE;
+        }
+
+        if (num < get_block_size(state->next_compare))
+        {
+            // We read to the end of every file with no differences.
+            check_contents_return(task, DT_DIFF_TYPE_IDENTICAL, NULL);
+            return FALSE;
+        }
+
+        state->num_filled[slot] = 0;
+        state->next_compare++;
+        state->compare_offset += num;
+    }
+    return TRUE;
+}
+
+static void on_check_contents_read_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GTask *task = G_TASK(userdata);
+    CheckContentsState *state = g_task_get_task_data(task);
+    GError *error = NULL;
+    gsize num = 0;
+    gint source_index;
+    gint i;
+
+    for (source_index=0; state->streams[source_index].stream != G_INPUT_STREAM(sourceobj); source_index++)
+    {
+    }
+
+    if (!g_input_stream_read_all_finish(G_INPUT_STREAM(sourceobj), res, &num, &error))
+    {
+        check_contents_return(task, DT_DIFF_TYPE_UNKNOWN, error);
+        g_object_unref(task);
+        return;
+    }
+
+    if (!state->finished)
+    {
+        CheckContentsSource *src = &state->streams[source_index];
+        gint slot = src->next_block % NUM_BLOCK_BUFFERS;
+
+        src->reading = FALSE;
+        src->filled[slot] = num;
+        src->next_block++;
+        state->num_filled[slot]++;
+
+        if (check_contents_compare_blocks(task))
+        {
+            // Comparing a block frees up its buffers, so start reading into
+            // them. This also starts the next read on this stream.
+            for (i=0; i<state->num_sources; i++)
+            {
+                check_contents_start_read(task, i);
+            }
+        }
+    }
+    g_object_unref(task);
+}
+
+typedef struct
+{
+    GTask *task;
+    gint source_index;
+} CheckContentsOpenData;
+
+static void on_check_contents_open_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    CheckContentsOpenData *data = userdata;
+    GTask *task = data->task;
+    CheckContentsState *state = g_task_get_task_data(task);
+    GError *error = NULL;
+    GInputStream *stream;
+    gint i;
+
+    stream = dt_tree_source_open_file_finish(DT_TREE_SOURCE(sourceobj), res, &error);
+    if (stream == NULL)
+    {
+        check_contents_return(task, DT_DIFF_TYPE_UNKNOWN, error);
+        g_object_unref(task);
+        g_free(data);
+        return;
+    }
+    state->streams[data->source_index].stream = stream;
+    g_free(data);
+
+    state->pending_opens--;
+    if (state->pending_opens == 0 && !state->finished)
+    {
+        // Start reading the first two blocks from every file at once.
+        for (i=0; i<state->num_sources; i++)
+        {
+            check_contents_start_read(task, i);
+        }
+    }
+    g_object_unref(task);
+}
+
+/**
+ * Opens every file at the same time.
+ */
+static void check_contents_start_opens(GTask *task)
+{
+    CheckContentsState *state = g_task_get_task_data(task);
+    gint i;
+
+    // If the caller cancelled the check because a file was removed, then the
+    // nodes might not be valid anymore.
+    if (g_task_return_error_if_cancelled(task))
+    {
+        state->finished = TRUE;
+        return;
+    }
+
+    state->pending_opens = state->num_sources;
+    for (i=0; i<state->num_sources; i++)
+    {
+        CheckContentsOpenData *data = g_malloc(sizeof(CheckContentsOpenData));
+
+        data->task = g_object_ref(task);
+        data->source_index = i;
+        dt_tree_source_open_file_async(state->sources[i], state->nodes[i],
+                g_task_get_priority(task), state->cancellable,
+                on_check_contents_open_ready, data);
+    }
+}
+
+typedef struct
+{
+    char **paths;
+    gint num_paths;
+    gint64 diff_offset;
+} CheckLocalData;
+
+static void check_local_data_free(CheckLocalData *data)
+{
+    g_strfreev(data->paths);
+    g_free(data);
+}
+
+/**
+ * Looks up every file in the digest cache, and compares the digests if they
+ * all have one.
+ *
+ * \param keys Returns the cache key for each file, or NULL if any of them
+ *      couldn't be stat'ed.
+ * \return The result, or DT_DIFF_TYPE_UNKNOWN if some of the files aren't
+ *      in the cache.
+ */
+static DtDiffType check_local_cached(CheckLocalData *data, DtDigestCache *cache,
+        DtDigestCacheKey **ret_keys)
+{
+    DtDigestCacheKey *keys = g_new(DtDigestCacheKey, data->num_paths);
+    const guint8 **digests = g_new0(const guint8 *, data->num_paths);
+    guint8 *digest_data = g_malloc(data->num_paths * DT_FILE_DIGEST_SIZE);
+    DtDiffType result = DT_DIFF_TYPE_UNKNOWN;
+    gint i;
+
+    for (i=0; i<data->num_paths; i++)
+    {
+        if (!dt_digest_cache_key_from_path(&keys[i], data->paths[i]))
+        {
+            g_clear_pointer(&keys, g_free);
+            break;
+        }
+        if (dt_digest_cache_lookup(cache, &keys[i], digest_data + i * DT_FILE_DIGEST_SIZE))
+        {
+            digests[i] = digest_data + i * DT_FILE_DIGEST_SIZE;
+        }
+    }
+    if (keys != NULL)
+    {
+        result = compare_digests(data->num_paths, digests);
+    }
+
+    g_free(digests);
+    g_free(digest_data);
+    *ret_keys = keys;
+    return result;
+}
+
+/**
+ * Compares local files on a worker thread.
+ *
+ * If the digest cache is enabled, then this first checks whether the cache
+ * already has every file. Otherwise, it compares the files directly, and if
+ * that reads both files all the way through and finds them identical, then
+ * it adds their digest to the cache on the way.
+ *
+ * This returns DT_DIFF_TYPE_UNKNOWN if the caller should fall back to
+ * reading the files through the sources.
+ */
+static void check_local_thread(GTask *subtask, gpointer sourceobj,
+        gpointer taskdata, GCancellable *cancellable)
+{
+    CheckLocalData *data = taskdata;
+    DtDigestCache *cache = dt_digest_cache_get_default();
+    DtDigestCacheKey *keys = NULL;
+    DtFileDigest *digest = NULL;
+    gint i;
+
+    if (cache != NULL)
+    {
+        DtDiffType result = check_local_cached(data, cache, &keys);
+        if (result != DT_DIFF_TYPE_UNKNOWN)
+        {
+            g_free(keys);
+            data->diff_offset = -1;
+            g_task_return_int(subtask, result);
+            return;
+        }
+    }
+
+    if (dt_fs_extents_is_supported())
+    {
+        for (i=1; i<data->num_paths; i++)
+        {
+            if (g_cancellable_is_cancelled(cancellable) || !dt_fs_extents_same(data->paths[0], data->paths[i]))
+            {
+                break;
+            }
+        }
+        if (i == data->num_paths)
+        {
+            g_free(keys);
+            data->diff_offset = -1;
+            g_task_return_int(subtask, DT_DIFF_TYPE_IDENTICAL);
+            return;
+        }
+    }
+
+    if (keys != NULL)
+    {
+        digest = dt_file_digest_new();
+    }
+    if (dt_fs_compare_mapped((const char * const *) data->paths, data->num_paths,
+                digest, cancellable, &data->diff_offset))
+    {
+        if (digest != NULL && data->diff_offset < 0)
+        {
+            guint8 digest_data[DT_FILE_DIGEST_SIZE];
+
+            dt_file_digest_finish(digest, digest_data);
+            digest = NULL;
+            for (i=0; i<data->num_paths; i++)
+            {
+                dt_digest_cache_insert_path(cache, data->paths[i], &keys[i], digest_data);
+            }
+        }
+        dt_file_digest_free(digest);
+        g_free(keys);
+        g_task_return_int(subtask, data->diff_offset >= 0 ? DT_DIFF_TYPE_DIFFERENT : DT_DIFF_TYPE_IDENTICAL);
+        return;
+    }
+    dt_file_digest_free(digest);
+    g_free(keys);
+    g_task_return_int(subtask, DT_DIFF_TYPE_UNKNOWN);
+}
+
+static void check_local_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GTask *task = G_TASK(userdata);
+    CheckLocalData *data = g_task_get_task_data(G_TASK(res));
+    gssize result = g_task_propagate_int(G_TASK(res), NULL);
+
+    if (result == DT_DIFF_TYPE_IDENTICAL || result == DT_DIFF_TYPE_DIFFERENT)
+    {
+        CheckContentsState *state = g_task_get_task_data(task);
+
+        state->diff_offset = data->diff_offset;
+        check_contents_return(task, result, NULL);
+    }
+    else
+    {
+        check_contents_start_opens(task);
+    }
+    g_object_unref(task);
+}
+
+/**
+ * Returns the local path of the file in one source, or NULL if it isn't a
+ * local file.
+ */
+static char *get_local_path(CheckContentsState *state, gint source_index)
+{
+    GFileInfo *info = dt_tree_source_create_file_info(state->sources[source_index],
+            state->nodes[source_index]);
+    char *path = NULL;
+
+    if (g_file_info_get_attribute_type(info, DT_FILE_ATTRIBUTE_FS_PATH) == G_FILE_ATTRIBUTE_TYPE_OBJECT)
+    {
+        GObject *fspath = g_file_info_get_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH);
+        path = g_file_get_path(G_FILE(fspath));
+    }
+    g_object_unref(info);
+    return path;
+}
+
+/**
+ * Returns a copy of the local path of the file in every source, or NULL if
+ * any of them isn't a local file.
+ */
+static char **get_local_paths(CheckContentsState *state)
+{
+    gint i;
+
+    for (i=0; i<state->num_sources; i++)
+    {
+        if (state->local_paths[i] == NULL)
+        {
+            return NULL;
+        }
+    }
+    return g_strdupv(state->local_paths);
+}
+
+typedef struct
+{
+    GTask *task;
+    gint source_index;
+
+    /// The local path of the file, or NULL to read it through the source.
+    char *path;
+    GInputStream *stream;
+
+    /// The metadata when we started, to check that the file didn't change.
+    DtFileMetadata metadata;
+    guint8 digest[DT_FILE_DIGEST_SIZE];
+} CheckDigestJob;
+
+static void check_digest_job_free(CheckDigestJob *job)
+{
+    g_free(job->path);
+    g_clear_object(&job->stream);
+    g_object_unref(job->task);
+    g_free(job);
+}
+
+/**
+ * Returns TRUE if we should compare digests instead of comparing the
+ * contents directly.
+ *
+ * Comparing the contents can stop at the first difference, and it finds the
+ * offset of that difference, so that's better for a pair of files, even if
+ * one of them already has a digest. But with three or more, hashing each
+ * file once reads them all independently, and the digests are kept in the
+ * metadata for the next check. If some of the files already have a digest,
+ * then we only need to read the rest.
+ *
+ * For a pair of files, we only use digests if both of them already have
+ * one, so that we don't have to read anything. The digest cache is checked
+ * separately in check_local_thread.
+ */
+static gboolean use_digests(CheckContentsState *state)
+{
+    gint i;
+
+    if (state->num_sources >= DIGEST_MIN_SOURCES)
+    {
+        return TRUE;
+    }
+    for (i=0; i<state->num_sources; i++)
+    {
+        const DtFileMetadata *meta = dt_tree_source_get_metadata(state->sources[i], state->nodes[i]);
+        if (!(meta->flags & DT_FILE_METADATA_HAS_DIGEST))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void check_digest_thread(GTask *subtask, gpointer sourceobj,
+        gpointer taskdata, GCancellable *cancellable)
+{
+    CheckDigestJob *job = taskdata;
+    GError *error = NULL;
+    gboolean success;
+
+    if (job->path != NULL)
+    {
+        success = dt_digest_cache_compute_path(dt_digest_cache_get_default(),
+                job->path, cancellable, job->digest, &error);
+    }
+    else
+    {
+        success = dt_file_digest_compute_stream(job->stream, cancellable, job->digest, &error);
+    }
+
+    if (success)
+    {
+        g_task_return_boolean(subtask, TRUE);
+    }
+    else
+    {
+        g_task_return_error(subtask, error);
+    }
+}
+
+/**
+ * Stores a digest in the node's metadata, unless the file changed while we
+ * were reading it.
+ */
+static void store_digest(CheckContentsState *state, CheckDigestJob *job)
+{
+    DtTreeSource *source = state->sources[job->source_index];
+    DtTreeSourceNode *node = state->nodes[job->source_index];
+    const DtFileMetadata *meta = dt_tree_source_get_metadata(source, node);
+
+    if (meta->size == job->metadata.size
+            && meta->mtime_sec == job->metadata.mtime_sec
+            && meta->mtime_usec == job->metadata.mtime_usec)
+    {
+        dt_tree_source_set_digest(source, node, job->digest);
+    }
+}
+
+static void on_check_digest_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    CheckDigestJob *job = g_task_get_task_data(G_TASK(res));
+    GTask *task = job->task;
+    CheckContentsState *state = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    if (!g_task_propagate_boolean(G_TASK(res), &error))
+    {
+        check_contents_return(task, DT_DIFF_TYPE_UNKNOWN, error);
+        return;
+    }
+
+    // If the caller cancelled the check because a file was removed, then the
+    // nodes might not be valid anymore. Otherwise, keep the digest even if
+    // another file already settled the result.
+    if (state->caller_cancellable == NULL || !g_cancellable_is_cancelled(state->caller_cancellable))
+    {
+        store_digest(state, job);
+    }
+
+    if (!state->finished)
+    {
+        DtDiffType result;
+        guint8 *digest = state->digest_data + job->source_index * DT_FILE_DIGEST_SIZE;
+
+        memcpy(digest, job->digest, DT_FILE_DIGEST_SIZE);
+        state->digests[job->source_index] = digest;
+
+        result = compare_digests(state->num_sources, state->digests);
+        if (result != DT_DIFF_TYPE_UNKNOWN)
+        {
+            check_contents_return(task, result, NULL);
+        }
+    }
+}
+
+static void check_digest_start_thread(CheckDigestJob *job)
+{
+    CheckContentsState *state = g_task_get_task_data(job->task);
+    GTask *subtask = g_task_new(NULL, state->cancellable, on_check_digest_ready, NULL);
+
+    g_task_set_priority(subtask, g_task_get_priority(job->task));
+    g_task_set_task_data(subtask, job, (GDestroyNotify) check_digest_job_free);
+    g_task_run_in_thread(subtask, check_digest_thread);
+    g_object_unref(subtask);
+}
+
+static void on_check_digest_open_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    CheckDigestJob *job = userdata;
+    GError *error = NULL;
+
+    job->stream = dt_tree_source_open_file_finish(DT_TREE_SOURCE(sourceobj), res, &error);
+    if (job->stream == NULL)
+    {
+        check_contents_return(job->task, DT_DIFF_TYPE_UNKNOWN, error);
+        check_digest_job_free(job);
+        return;
+    }
+    check_digest_start_thread(job);
+}
+
+/**
+ * Starts computing the digest of every file that doesn't have one yet.
+ *
+ * Each file is hashed on its own worker thread, so all of them are read at
+ * the same time. A local file is read directly, and anything else is read
+ * through its source's stream.
+ */
+static void check_digests_start(GTask *task)
+{
+    CheckContentsState *state = g_task_get_task_data(task);
+    DtDiffType result;
+    gint i;
+
+    if (g_task_return_error_if_cancelled(task))
+    {
+        state->finished = TRUE;
+        return;
+    }
+
+    state->digests = g_new0(const guint8 *, state->num_sources);
+    state->digest_data = g_malloc(state->num_sources * DT_FILE_DIGEST_SIZE);
+    for (i=0; i<state->num_sources; i++)
+    {
+        const DtFileMetadata *meta = dt_tree_source_get_metadata(state->sources[i], state->nodes[i]);
+        if (meta->flags & DT_FILE_METADATA_HAS_DIGEST)
+        {
+            memcpy(state->digest_data + i * DT_FILE_DIGEST_SIZE, meta->digest, DT_FILE_DIGEST_SIZE);
+            state->digests[i] = state->digest_data + i * DT_FILE_DIGEST_SIZE;
+        }
+    }
+
+    result = compare_digests(state->num_sources, state->digests);
+    if (result != DT_DIFF_TYPE_UNKNOWN)
+    {
+        check_contents_return(task, result, NULL);
+        return;
+    }
+
+    for (i=0; i<state->num_sources; i++)
+    {
+        CheckDigestJob *job;
+
+        if (state->digests[i] != NULL)
+        {
+            continue;
+        }
+
+        job = g_malloc0(sizeof(CheckDigestJob));
+        job->task = g_object_ref(task);
+        job->source_index = i;
+        job->metadata = *dt_tree_source_get_metadata(state->sources[i], state->nodes[i]);
+        job->path = g_strdup(state->local_paths[i]);
+        if (job->path != NULL)
+        {
+            check_digest_start_thread(job);
+        }
+        else
+        {
+            dt_tree_source_open_file_async(state->sources[i], state->nodes[i],
+                    g_task_get_priority(task), state->cancellable,
+                    on_check_digest_open_ready, job);
+        }
+    }
+}
+
+void dt_diff_check_contents_async(gint num_sources, DtTreeSource **sources,
+        DtTreeSourceNode **nodes, gint io_priority, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer userdata)
+{
+    GTask *task = g_task_new(NULL, cancellable, callback, userdata);
+    CheckContentsState *state = g_malloc0(sizeof(CheckContentsState));
+    char **paths = NULL;
+    gboolean digests;
+    gint i;
+
+    g_task_set_priority(task, io_priority);
+
+    state->num_sources = num_sources;
+    state->sources = g_new(DtTreeSource *, num_sources);
+    for (i=0; i<num_sources; i++)
+    {
+        g_assert(nodes[i] != NULL);
+        state->sources[i] = g_object_ref(sources[i]);
+    }
+    state->nodes = g_memdup(nodes, num_sources * sizeof(DtTreeSourceNode *));
+    state->local_paths = g_new0(char *, num_sources + 1);
+    for (i=0; i<num_sources; i++)
+    {
+        state->local_paths[i] = get_local_path(state, i);
+    }
+    state->diff_offset = -1;
+    state->streams = g_new0(CheckContentsSource, num_sources);
+    state->cancellable = g_cancellable_new();
+    if (cancellable != NULL)
+    {
+        state->caller_cancellable = g_object_ref(cancellable);
+        state->cancel_handler_id = g_cancellable_connect(cancellable,
+                G_CALLBACK(on_caller_cancelled), state->cancellable, NULL);
+    }
+    g_task_set_task_data(task, state, cleanup_check_contents_state);
+
+    digests = use_digests(state);
+    if (!digests && (dt_fs_extents_is_supported() || dt_fs_compare_is_supported()
+                || dt_digest_cache_get_default() != NULL))
+    {
+        paths = get_local_paths(state);
+    }
+
+    if (digests)
+    {
+        check_digests_start(task);
+    }
+    else if (paths != NULL)
+    {
+        // Every file is local, so we can skip the GInputStreams entirely.
+        CheckLocalData *data = g_malloc(sizeof(CheckLocalData));
+        GTask *subtask = g_task_new(NULL, cancellable, check_local_ready, g_object_ref(task));
+
+        data->paths = paths;
+        data->num_paths = num_sources;
+        data->diff_offset = -1;
+        g_task_set_priority(subtask, io_priority);
+        g_task_set_task_data(subtask, data, (GDestroyNotify) check_local_data_free);
+        g_task_run_in_thread(subtask, check_local_thread);
+        g_object_unref(subtask);
+    }
+    else
+    {
+        check_contents_start_opens(task);
+    }
+
+    // Anything that's still running holds its own reference.
+    g_object_unref(task);
+}
+
+DtDiffType dt_diff_check_contents_finish(GAsyncResult *res, gint64 *ret_diff_offset,
+        GError **error)
+{
+    CheckContentsState *state = g_task_get_task_data(G_TASK(res));
+    gssize result = g_task_propagate_int(G_TASK(res), error);
+
+    if (ret_diff_offset != NULL)
+    {
+        *ret_diff_offset = (result == DT_DIFF_TYPE_DIFFERENT ? state->diff_offset : -1);
+    }
+    if (result < 0)
+    {
+        return DT_DIFF_TYPE_UNKNOWN;
+    }
+    return result;
+}
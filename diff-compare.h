@@ -0,0 +1,87 @@
+#ifndef DIFF_COMPARE_H
+#define DIFF_COMPARE_H
+
+/**
+ * \file
+ *
+ * Compares the same file from several DtTreeSource objects.
+ *
+ * This doesn't depend on GTK, so that it can be used by both DtDiffTreeModel
+ * and the headless report mode.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "tree-source.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    DT_DIFF_TYPE_UNKNOWN,
+    DT_DIFF_TYPE_IDENTICAL,
+    DT_DIFF_TYPE_DIFFERENT,
+} DtDiffType;
+
+/**
+ * Checks for differences based on the metadata from each source.
+ *
+ * This basically checks everything that we can without actually reading the
+ * files, including any digests that an earlier dt_diff_check_contents_async
+ * call left in the metadata.
+ *
+ * \param nodes The node from each source. Any of these can be NULL.
+ * \return DT_DIFF_TYPE_UNKNOWN if the contents need to be compared.
+ */
+DtDiffType dt_diff_check_basic(gint num_sources, DtTreeSource **sources,
+        DtTreeSourceNode **nodes);
+
+/**
+ * Compares the contents of a regular file in every source.
+ *
+ * With three or more sources, or if every file already has a digest, this
+ * computes a digest of each file that doesn't have one, with every file
+ * read at the same time on its own worker thread, and compares the digests.
+ * Each digest is stored in the node's metadata with
+ * dt_tree_source_set_digest, so it's only computed once. A digest check
+ * doesn't know where the first difference is. If
+ * dt_digest_cache_init_default was called, then each local file's digest is
+ * looked up in the cache before reading the file, and added to it after.
+ *
+ * Otherwise, if every file is a local file, then this first checks whether
+ * the digest cache has all of them, and then whether they're reflink copies
+ * that share all of their extents, in which case it doesn't read them at
+ * all. If neither one settles it, then it maps the files and compares them
+ * in place, on a worker thread. If the files turn out to be identical, then
+ * their digest is added to the cache on the way, without reading them again.
+ *
+ * Otherwise, it reads every file at the same time, and reads the next block
+ * of each file while it's waiting for the others, so the devices stay busy.
+ * The blocks start small and get bigger as the files keep matching.
+ *
+ * The sources are referenced and the node array is copied, but the nodes
+ * themselves have to stay valid until the check finishes or \p cancellable is
+ * cancelled.
+ *
+ * \param nodes The node from each source. These must all be non-NULL.
+ */
+void dt_diff_check_contents_async(gint num_sources, DtTreeSource **sources,
+        DtTreeSourceNode **nodes, gint io_priority, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer userdata);
+
+/**
+ * Finishes a dt_diff_check_contents_async call.
+ *
+ * \param ret_diff_offset If this isn't NULL, then it returns the offset of
+ *      the first byte that's different, or -1 if the files are identical or
+ *      the offset isn't known.
+ * \return DT_DIFF_TYPE_IDENTICAL or DT_DIFF_TYPE_DIFFERENT, or
+ *      DT_DIFF_TYPE_UNKNOWN on error.
+ */
+DtDiffType dt_diff_check_contents_finish(GAsyncResult *res, gint64 *ret_diff_offset,
+        GError **error);
+
+G_END_DECLS
+
+#endif // DIFF_COMPARE_H
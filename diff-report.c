@@ -0,0 +1,824 @@
+#include "diff-report.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "diff-compare.h"
+
+/**
+ * How far the walk can get ahead of the first file that's still being
+ * compared. The results are written in order, so everything after that file
+ * has to wait in memory.
+ */
+#define MAX_PENDING_ITEMS 4096
+
+/**
+ * The minimum time between check-progress lines in the progress log.
+ */
+#define CHECK_PROGRESS_INTERVAL (G_USEC_PER_SEC / 10)
+
+typedef enum
+{
+    ITEM_STATUS_PENDING,
+    ITEM_STATUS_IDENTICAL,
+    ITEM_STATUS_DIFFERENT,
+
+    /// The file is missing from at least one source.
+    ITEM_STATUS_MISSING,
+
+    /// The file exists in every source, but it's not the same type in all of them.
+    ITEM_STATUS_TYPE_MISMATCH,
+
+    /// The file is something other than a regular file, directory, or symlink.
+    ITEM_STATUS_UNKNOWN,
+    ITEM_STATUS_ERROR,
+} ItemStatus;
+
+/**
+ * A single entry in the report.
+ */
+typedef struct
+{
+    /// The path relative to the base of each source.
+    char *path;
+    ItemStatus status;
+    char *error;
+
+    /// The offset of the first byte that's different, or -1 if we don't know.
+    gint64 diff_offset;
+
+    /// The node from each source, or NULL if the file is missing from it.
+    DtTreeSourceNode *nodes[];
+} ReportItem;
+
+/**
+ * A directory that the walk is in the middle of.
+ */
+typedef struct
+{
+    char *path;
+    DtTreeSourceNode * const **children;
+    guint *num_children;
+    guint *pos;
+} WalkFrame;
+
+typedef struct
+{
+    gint num_sources;
+    DtTreeSource **sources;
+    const char * const *paths;
+    DtDiffReportFormat format;
+    gint max_jobs;
+    FILE *out;
+    FILE *progress_log;
+
+    GMainLoop *loop;
+    gint num_scans_running;
+    gboolean found_error;
+    gboolean found_difference;
+
+    /// The directories that the walk is in, with the innermost one at the head.
+    GQueue walk_stack;
+
+    /// The ReportItems that haven't been written yet, in tree order.
+    GQueue items;
+    gint num_running;
+
+    guint64 checks_completed;
+    guint64 checks_failed;
+    gdouble checks_per_second;
+    gint64 rate_window_start;
+    guint rate_window_count;
+    gint64 last_check_progress_time;
+} Report;
+
+typedef struct
+{
+    Report *report;
+    ReportItem *item;
+} CheckData;
+
+static void report_pump(Report *report);
+
+gboolean dt_diff_report_parse_format(const char *name, DtDiffReportFormat *ret_format)
+{
+    if (g_strcmp0(name, "brief") == 0)
+    {
+        *ret_format = DT_DIFF_REPORT_FORMAT_BRIEF;
+        return TRUE;
+    }
+    else if (g_strcmp0(name, "jsonl") == 0)
+    {
+        *ret_format = DT_DIFF_REPORT_FORMAT_JSONL;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static void report_item_free(ReportItem *item)
+{
+    g_free(item->path);
+    g_free(item->error);
+    g_free(item);
+}
+
+static WalkFrame *walk_frame_new(Report *report, const char *path, DtTreeSourceNode **nodes)
+{
+    WalkFrame *frame = g_malloc(sizeof(WalkFrame));
+    gint i;
+
+    frame->path = g_strdup(path);
+    frame->children = g_new(DtTreeSourceNode * const *, report->num_sources);
+    frame->num_children = g_new(guint, report->num_sources);
+    frame->pos = g_new0(guint, report->num_sources);
+    for (i=0; i<report->num_sources; i++)
+    {
+        frame->children[i] = dt_tree_source_get_child_array(report->sources[i],
+                nodes[i], &frame->num_children[i]);
+    }
+    return frame;
+}
+
+static void walk_frame_free(WalkFrame *frame)
+{
+    g_free(frame->path);
+    g_free(frame->children);
+    g_free(frame->num_children);
+    g_free(frame->pos);
+    g_free(frame);
+}
+
+static GFileType get_node_type(Report *report, gint source_index, DtTreeSourceNode *node)
+{
+    return dt_tree_source_get_metadata(report->sources[source_index], node)->type;
+}
+
+/**
+ * Fills in everything about an item that doesn't require reading the files.
+ *
+ * \return TRUE if the item is a directory that exists in every source, so the
+ *      walk should go into it.
+ */
+static gboolean classify_item(Report *report, ReportItem *item)
+{
+    GFileType type = G_FILE_TYPE_UNKNOWN;
+    gint i;
+
+    for (i=0; i<report->num_sources; i++)
+    {
+        if (item->nodes[i] == NULL)
+        {
+            // Like diff -r, we don't go into a directory unless every source
+            // has it.
+            item->status = ITEM_STATUS_MISSING;
+            return FALSE;
+        }
+        if (i == 0)
+        {
+            type = get_node_type(report, i, item->nodes[i]);
+        }
+        else if (get_node_type(report, i, item->nodes[i]) != type)
+        {
+            item->status = ITEM_STATUS_TYPE_MISMATCH;
+            return FALSE;
+        }
+    }
+
+    switch (dt_diff_check_basic(report->num_sources, report->sources, item->nodes))
+    {
+        case DT_DIFF_TYPE_IDENTICAL:
+            item->status = ITEM_STATUS_IDENTICAL;
+            break;
+        case DT_DIFF_TYPE_DIFFERENT:
+            item->status = ITEM_STATUS_DIFFERENT;
+            break;
+        default:
+            // A regular file stays pending until we read it.
+            item->status = (type == G_FILE_TYPE_REGULAR ? ITEM_STATUS_PENDING : ITEM_STATUS_UNKNOWN);
+            break;
+    }
+
+    return (type == G_FILE_TYPE_DIRECTORY);
+}
+
+/**
+ * Returns the next file in the walk, or NULL if there's nothing left.
+ *
+ * This is a merge join across the sources, the same as
+ * DtDiffTreeModel does to build its rows: each step takes the smallest name
+ * that's left in any source in the current directory.
+ */
+static ReportItem *walk_next(Report *report)
+{
+    while (!g_queue_is_empty(&report->walk_stack))
+    {
+        WalkFrame *frame = g_queue_peek_head(&report->walk_stack);
+        ReportItem *item;
+        const char *name = NULL;
+        gint i;
+
+        for (i=0; i<report->num_sources; i++)
+        {
+            if (frame->pos[i] < frame->num_children[i])
+            {
+                const char *childName = dt_tree_source_get_name(report->sources[i],
+                        frame->children[i][frame->pos[i]]);
+                if (name == NULL || strcmp(childName, name) < 0)
+                {
+                    name = childName;
+                }
+            }
+        }
+
+        if (name == NULL)
+        {
+            // We're done with this directory.
+            walk_frame_free(g_queue_pop_head(&report->walk_stack));
+            continue;
+        }
+
+        item = g_malloc0(sizeof(ReportItem) + report->num_sources * sizeof(DtTreeSourceNode *));
+        item->diff_offset = -1;
+        for (i=0; i<report->num_sources; i++)
+        {
+            if (frame->pos[i] < frame->num_children[i])
+            {
+                DtTreeSourceNode *child = frame->children[i][frame->pos[i]];
+                if (strcmp(dt_tree_source_get_name(report->sources[i], child), name) == 0)
+                {
+                    item->nodes[i] = child;
+                    frame->pos[i]++;
+                }
+            }
+        }
+
+        if (frame->path[0] != '\0')
+        {
+            item->path = g_strconcat(frame->path, "/", name, NULL);
+        }
+        else
+        {
+            item->path = g_strdup(name);
+        }
+
+        if (classify_item(report, item))
+        {
+            g_queue_push_head(&report->walk_stack, walk_frame_new(report, item->path, item->nodes));
+            report_item_free(item);
+            continue;
+        }
+        return item;
+    }
+    return NULL;
+}
+
+static char *get_display_path(Report *report, gint source_index, const char *path)
+{
+    return g_build_filename(report->paths[source_index], path, NULL);
+}
+
+static const char *get_type_name(GFileType type)
+{
+    switch (type)
+    {
+        case G_FILE_TYPE_REGULAR:
+            return "regular file";
+        case G_FILE_TYPE_DIRECTORY:
+            return "directory";
+        case G_FILE_TYPE_SYMBOLIC_LINK:
+            return "symbolic link";
+        default:
+            return "special file";
+    }
+}
+
+static const char *get_json_type_name(GFileType type)
+{
+    switch (type)
+    {
+        case G_FILE_TYPE_REGULAR:
+            return "file";
+        case G_FILE_TYPE_DIRECTORY:
+            return "directory";
+        case G_FILE_TYPE_SYMBOLIC_LINK:
+            return "symlink";
+        default:
+            return "special";
+    }
+}
+
+static const char *get_json_status_name(ItemStatus status)
+{
+    switch (status)
+    {
+        case ITEM_STATUS_IDENTICAL:
+            return "identical";
+        case ITEM_STATUS_DIFFERENT:
+            return "different";
+        case ITEM_STATUS_MISSING:
+            return "missing";
+        case ITEM_STATUS_TYPE_MISMATCH:
+            return "type-mismatch";
+        case ITEM_STATUS_ERROR:
+            return "error";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Appends a string to \p buf as a quoted JSON string.
+ *
+ * File names don't have to be valid UTF-8, so any byte that isn't part of a
+ * valid UTF-8 sequence is written as a \\u00XX escape.
+ */
+static void append_json_string(GString *buf, const char *str)
+{
+    const char *ptr = str;
+
+    g_string_append_c(buf, '"');
+    while (*ptr != '\0')
+    {
+        const char *end;
+
+        g_utf8_validate(ptr, -1, &end);
+        for (; ptr < end; ptr++)
+        {
+            guchar c = *ptr;
+            if (c == '"' || c == '\\')
+            {
+                g_string_append_c(buf, '\\');
+                g_string_append_c(buf, c);
+            }
+            else if (c < 0x20)
+            {
+                g_string_append_printf(buf, "\\u%04x", c);
+            }
+            else
+            {
+                g_string_append_c(buf, c);
+            }
+        }
+
+        if (*ptr != '\0')
+        {
+            // This is an invalid byte.
+            g_string_append_printf(buf, "\\u%04x", (guchar) *ptr);
+            ptr++;
+        }
+    }
+    g_string_append_c(buf, '"');
+}
+
+/**
+ * Adds a "digests" member with the content digest from each source, if any
+ * of them has one. Files that are missing or don't have a digest are null.
+ */
+static void append_json_digests(Report *report, ReportItem *item, GString *buf)
+{
+    gboolean any = FALSE;
+    gint i, j;
+
+    for (i=0; i<report->num_sources; i++)
+    {
+        const DtFileMetadata *meta = NULL;
+
+        if (item->nodes[i] != NULL)
+        {
+            meta = dt_tree_source_get_metadata(report->sources[i], item->nodes[i]);
+        }
+        if (!any && (meta == NULL || !(meta->flags & DT_FILE_METADATA_HAS_DIGEST)))
+        {
+            continue;
+        }
+
+        if (!any)
+        {
+            // Fill in the sources before the first one with a digest.
+            g_string_append(buf, ",\"digests\":[");
+            for (j=0; j<i; j++)
+            {
+                g_string_append(buf, "null,");
+            }
+            any = TRUE;
+        }
+        else
+        {
+            g_string_append_c(buf, ',');
+        }
+
+        if (meta != NULL && (meta->flags & DT_FILE_METADATA_HAS_DIGEST))
+        {
+            g_string_append_c(buf, '"');
+            for (j=0; j<DT_FILE_METADATA_DIGEST_SIZE; j++)
+            {
+                g_string_append_printf(buf, "%02x", meta->digest[j]);
+            }
+            g_string_append_c(buf, '"');
+        }
+        else
+        {
+            g_string_append(buf, "null");
+        }
+    }
+    if (any)
+    {
+        g_string_append_c(buf, ']');
+    }
+}
+
+static void write_item_jsonl(Report *report, ReportItem *item)
+{
+    GString *buf = g_string_new("{\"path\":");
+    GFileType type = G_FILE_TYPE_UNKNOWN;
+    gint i;
+
+    for (i=0; i<report->num_sources; i++)
+    {
+        if (item->nodes[i] != NULL)
+        {
+            type = get_node_type(report, i, item->nodes[i]);
+            break;
+        }
+    }
+
+    append_json_string(buf, item->path);
+    g_string_append_printf(buf, ",\"type\":\"%s\",\"status\":\"%s\"",
+            item->status == ITEM_STATUS_TYPE_MISMATCH ? "mixed" : get_json_type_name(type),
+            get_json_status_name(item->status));
+
+    if (item->status == ITEM_STATUS_MISSING)
+    {
+        g_string_append(buf, ",\"present\":[");
+        for (i=0; i<report->num_sources; i++)
+        {
+            g_string_append(buf, i > 0 ? "," : "");
+            g_string_append(buf, item->nodes[i] != NULL ? "true" : "false");
+        }
+        g_string_append_c(buf, ']');
+    }
+    else if (item->status == ITEM_STATUS_DIFFERENT && item->diff_offset >= 0)
+    {
+        g_string_append_printf(buf, ",\"offset\":%" G_GINT64_FORMAT, item->diff_offset);
+    }
+    else if (item->status == ITEM_STATUS_ERROR)
+    {
+        g_string_append(buf, ",\"error\":");
+        append_json_string(buf, item->error);
+    }
+    append_json_digests(report, item, buf);
+    g_string_append(buf, "}\n");
+
+    fwrite(buf->str, 1, buf->len, report->out);
+    g_string_free(buf, TRUE);
+}
+
+/**
+ * Writes a list of paths like "A, B and C".
+ */
+static void write_path_list(Report *report, ReportItem *item)
+{
+    gint i;
+
+    for (i=0; i<report->num_sources; i++)
+    {
+        char *path = get_display_path(report, i, item->path);
+
+        if (i > 0)
+        {
+            fputs(i + 1 < report->num_sources ? ", " : " and ", report->out);
+        }
+        fputs(path, report->out);
+        g_free(path);
+    }
+}
+
+static void write_item_brief(Report *report, ReportItem *item)
+{
+    gint i;
+
+    if (item->status == ITEM_STATUS_DIFFERENT)
+    {
+        // Every source has the same type here, so just check the first one.
+        if (get_node_type(report, 0, item->nodes[0]) == G_FILE_TYPE_SYMBOLIC_LINK)
+        {
+            fputs("Symbolic links ", report->out);
+        }
+        else
+        {
+            fputs("Files ", report->out);
+        }
+        write_path_list(report, item);
+        fputs(" differ\n", report->out);
+    }
+    else if (item->status == ITEM_STATUS_TYPE_MISMATCH)
+    {
+        // This is the same wording as diff for two sources.
+        for (i=0; i<report->num_sources; i++)
+        {
+            char *path = get_display_path(report, i, item->path);
+
+            fprintf(report->out, "%s%s is a %s",
+                    i == 0 ? "File " : " while file ", path,
+                    get_type_name(get_node_type(report, i, item->nodes[i])));
+            g_free(path);
+        }
+        fputc('\n', report->out);
+    }
+    else if (item->status == ITEM_STATUS_MISSING)
+    {
+        const char *slash = strrchr(item->path, '/');
+        char *dir = (slash != NULL ? g_strndup(item->path, slash - item->path) : g_strdup(""));
+        const char *name = (slash != NULL ? slash + 1 : item->path);
+
+        // With two sources, this is just diff's "Only in" line. With more,
+        // we list each source that the file is missing from instead.
+        for (i=0; i<report->num_sources; i++)
+        {
+            if ((report->num_sources == 2) == (item->nodes[i] != NULL))
+            {
+                char *path = get_display_path(report, i, dir);
+                fprintf(report->out, "%s %s: %s\n",
+                        report->num_sources == 2 ? "Only in" : "Not in", path, name);
+                g_free(path);
+            }
+        }
+        g_free(dir);
+    }
+}
+
+/**
+ * Writes every item at the start of the queue that's done.
+ */
+static void flush_items(Report *report)
+{
+    ReportItem *item;
+
+    while ((item = g_queue_peek_head(&report->items)) != NULL
+            && item->status != ITEM_STATUS_PENDING)
+    {
+        g_queue_pop_head(&report->items);
+
+        if (item->status == ITEM_STATUS_ERROR)
+        {
+            g_printerr("Can't compare %s: %s\n", item->path, item->error);
+            report->found_error = TRUE;
+        }
+        else if (item->status != ITEM_STATUS_IDENTICAL && item->status != ITEM_STATUS_UNKNOWN)
+        {
+            report->found_difference = TRUE;
+        }
+
+        if (report->format == DT_DIFF_REPORT_FORMAT_JSONL)
+        {
+            write_item_jsonl(report, item);
+        }
+        else
+        {
+            write_item_brief(report, item);
+        }
+        report_item_free(item);
+    }
+}
+
+void dt_diff_report_write_scan_progress(FILE *fp, gint source_index,
+        const DtTreeSourceScanStats *stats)
+{
+    fprintf(fp, "scan-progress source=%d elapsed=%.3f dirs=%" G_GUINT64_FORMAT
+            " entries=%" G_GUINT64_FORMAT " bytes=%" G_GUINT64_FORMAT
+            " rate=%.0f queue=%u finished=%d\n",
+            source_index, (gdouble) stats->elapsed / G_USEC_PER_SEC,
+            stats->dirs_visited, stats->entries_found, stats->metadata_bytes,
+            stats->entries_per_second, stats->queue_depth, stats->finished ? 1 : 0);
+    fflush(fp);
+}
+
+static void on_scan_progress(DtTreeSource *source, const DtTreeSourceScanStats *stats, gpointer userdata)
+{
+    Report *report = userdata;
+    gint i;
+
+    for (i=0; i<report->num_sources; i++)
+    {
+        if (report->sources[i] == source)
+        {
+            dt_diff_report_write_scan_progress(report->progress_log, i, stats);
+            break;
+        }
+    }
+}
+
+/**
+ * Writes a check-progress line to the progress log, in the same format as
+ * the window's check scheduler uses. Nothing is queued in a report, since
+ * the walk only starts a comparison once there's room for it.
+ *
+ * Unless \p finished is TRUE, this does nothing if the last line was less
+ * than CHECK_PROGRESS_INTERVAL ago.
+ */
+static void write_check_progress(Report *report, gboolean finished)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (report->progress_log == NULL)
+    {
+        return;
+    }
+    if (!finished && now - report->last_check_progress_time < CHECK_PROGRESS_INTERVAL)
+    {
+        return;
+    }
+    report->last_check_progress_time = now;
+
+    fprintf(report->progress_log, "check-progress queued-user=0 queued-background=0 running=%d"
+            " completed=%" G_GUINT64_FORMAT " failed=%" G_GUINT64_FORMAT " rate=%.1f\n",
+            report->num_running, report->checks_completed, report->checks_failed,
+            report->checks_per_second);
+    fflush(report->progress_log);
+}
+
+/**
+ * Counts a finished comparison, and updates the completion rate about once
+ * a second.
+ */
+static void count_check_finished(Report *report, gboolean failed)
+{
+    gint64 now = g_get_monotonic_time();
+
+    report->checks_completed++;
+    if (failed)
+    {
+        report->checks_failed++;
+    }
+
+    report->rate_window_count++;
+    if (now - report->rate_window_start >= G_USEC_PER_SEC)
+    {
+        report->checks_per_second = (gdouble) report->rate_window_count * G_USEC_PER_SEC
+            / (now - report->rate_window_start);
+        report->rate_window_start = now;
+        report->rate_window_count = 0;
+    }
+}
+
+static void on_check_contents_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    CheckData *data = userdata;
+    GError *error = NULL;
+    DtDiffType result = dt_diff_check_contents_finish(res, &data->item->diff_offset, &error);
+
+    if (error != NULL)
+    {
+        data->item->status = ITEM_STATUS_ERROR;
+        data->item->error = g_strdup(error->message);
+        g_clear_error(&error);
+    }
+    else if (result == DT_DIFF_TYPE_IDENTICAL)
+    {
+        data->item->status = ITEM_STATUS_IDENTICAL;
+    }
+    else
+    {
+        data->item->status = ITEM_STATUS_DIFFERENT;
+    }
+
+    data->report->num_running--;
+    count_check_finished(data->report, data->item->status == ITEM_STATUS_ERROR);
+    write_check_progress(data->report, FALSE);
+    report_pump(data->report);
+    g_free(data);
+}
+
+/**
+ * Walks as far as it can, and starts comparing files until there are
+ * max_jobs comparisons running.
+ *
+ * This quits the main loop once everything is written.
+ */
+static void report_pump(Report *report)
+{
+    while (report->num_running < report->max_jobs
+            && g_queue_get_length(&report->items) < MAX_PENDING_ITEMS)
+    {
+        ReportItem *item = walk_next(report);
+        if (item == NULL)
+        {
+            break;
+        }
+
+        g_queue_push_tail(&report->items, item);
+        if (item->status == ITEM_STATUS_PENDING)
+        {
+            CheckData *data = g_malloc(sizeof(CheckData));
+
+            data->report = report;
+            data->item = item;
+            report->num_running++;
+            dt_diff_check_contents_async(report->num_sources, report->sources,
+                    item->nodes, G_PRIORITY_DEFAULT, NULL,
+                    on_check_contents_ready, data);
+        }
+    }
+
+    flush_items(report);
+
+    if (report->num_running == 0 && g_queue_is_empty(&report->items)
+            && g_queue_is_empty(&report->walk_stack))
+    {
+        g_main_loop_quit(report->loop);
+    }
+}
+
+static void on_scan_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    Report *report = userdata;
+    GError *error = NULL;
+
+    if (!dt_tree_source_scan_finish(DT_TREE_SOURCE(sourceobj), res, &error))
+    {
+        g_printerr("Error in reading source files: %s\n", error->message);
+        g_clear_error(&error);
+        report->found_error = TRUE;
+    }
+
+    g_assert(report->num_scans_running > 0);
+    report->num_scans_running--;
+    if (report->num_scans_running > 0)
+    {
+        return;
+    }
+
+    if (report->found_error)
+    {
+        g_main_loop_quit(report->loop);
+        return;
+    }
+
+    {
+        DtTreeSourceNode **roots = g_alloca(report->num_sources * sizeof(DtTreeSourceNode *));
+        gint i;
+
+        for (i=0; i<report->num_sources; i++)
+        {
+            roots[i] = dt_tree_source_get_root(report->sources[i]);
+        }
+        g_queue_push_head(&report->walk_stack, walk_frame_new(report, "", roots));
+    }
+    report_pump(report);
+}
+
+gint dt_diff_report_run(gint num_sources, DtTreeSource **sources,
+        const char * const *paths, DtDiffReportFormat format, gint max_jobs,
+        FILE *out, FILE *progress_log)
+{
+    Report report = { 0 };
+    gint i;
+
+    report.num_sources = num_sources;
+    report.sources = sources;
+    report.paths = paths;
+    report.format = format;
+    report.max_jobs = MAX(max_jobs, 1);
+    report.out = out;
+    report.progress_log = progress_log;
+    report.rate_window_start = g_get_monotonic_time();
+    report.loop = g_main_loop_new(NULL, FALSE);
+    g_queue_init(&report.walk_stack);
+    g_queue_init(&report.items);
+
+    for (i=0; i<num_sources; i++)
+    {
+        report.num_scans_running++;
+        if (progress_log != NULL)
+        {
+            g_signal_connect(sources[i], "scan-progress", G_CALLBACK(on_scan_progress), &report);
+        }
+        dt_tree_source_scan_async(sources[i], G_PRIORITY_DEFAULT, NULL,
+                on_scan_ready, &report);
+    }
+    g_main_loop_run(report.loop);
+    g_main_loop_unref(report.loop);
+
+    if (progress_log != NULL)
+    {
+        for (i=0; i<num_sources; i++)
+        {
+            g_signal_handlers_disconnect_by_func(sources[i], on_scan_progress, &report);
+        }
+        write_check_progress(&report, TRUE);
+    }
+
+    // These are only left over if a scan failed.
+    while (!g_queue_is_empty(&report.walk_stack))
+    {
+        walk_frame_free(g_queue_pop_head(&report.walk_stack));
+    }
+    fflush(out);
+
+    if (report.found_error)
+    {
+        return 2;
+    }
+    return report.found_difference ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#ifndef DIFF_REPORT_H
+#define DIFF_REPORT_H
+
+/**
+ * \file
+ *
+ * Compares a set of sources without a GUI, and writes out the results.
+ *
+ * This scans every source, then walks the trees together and compares the
+ * contents of every file that the metadata can't settle, with many files
+ * being read at once. Results are written in the same order as the tree, as
+ * soon as each one is known, so that the output can be piped into something
+ * else while the comparison is still running.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "tree-source.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    /**
+     * A listing like "diff -rq": one line for each file that's different or
+     * missing.
+     */
+    DT_DIFF_REPORT_FORMAT_BRIEF,
+
+    /**
+     * One JSON object per line for every file, with "path", "type", and
+     * "status" members. A file whose contents are different also has an
+     * "offset" member with the first byte that's different, if it's known.
+     * A file that was hashed to compare it has a "digests" member, with the
+     * content digest from each source.
+     */
+    DT_DIFF_REPORT_FORMAT_JSONL,
+} DtDiffReportFormat;
+
+/**
+ * Looks up a report format by name ("brief" or "jsonl").
+ *
+ * \return TRUE on success, or FALSE if \p name isn't a known format.
+ */
+gboolean dt_diff_report_parse_format(const char *name, DtDiffReportFormat *ret_format);
+
+/**
+ * Writes a scan-progress update to a progress log as a line of key=value
+ * pairs.
+ */
+void dt_diff_report_write_scan_progress(FILE *fp, gint source_index,
+        const DtTreeSourceScanStats *stats);
+
+/**
+ * Scans and compares the sources, and writes the report.
+ *
+ * This runs its own main loop until it's done.
+ *
+ * \param paths The path of each source, used to name the files in the
+ *      report.
+ * \param max_jobs The maximum number of files to compare at the same time.
+ * \param out Where to write the report. Errors go to stderr.
+ * \param progress_log If this isn't NULL, then scan and check progress
+ *      updates are written to it, in the same format as the window uses.
+ * \return An exit code like diff's: 0 if everything is the same, 1 if
+ *      anything is different or missing, or 2 if there was an error.
+ */
+gint dt_diff_report_run(gint num_sources, DtTreeSource **sources,
+        const char * const *paths, DtDiffReportFormat format, gint max_jobs,
+        FILE *out, FILE *progress_log);
+
+G_END_DECLS
+
+#endif // DIFF_REPORT_H
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include <gtk/gtk.h>
 #include <glib.h>
@@ -7,8 +9,20 @@
 #include "diff-tree-model.h"
 #include "diff-tree-view.h"
 #include "source-helpers.h"
+#include "tree-source-fs.h"
+#include "scan-snapshot.h"
+#include "exclude-rules.h"
 #include "app-config.h"
 #include "settings-window.h"
+#include "diff-report.h"
+#include "check-scheduler.h"
+#include "digest-cache.h"
+
+/**
+ * The default for --report-jobs. Comparing files is almost all waiting on
+ * I/O, so this is well above the number of CPUs.
+ */
+#define DEFAULT_REPORT_JOBS 32
 
 typedef struct
 {
@@ -19,6 +33,8 @@ typedef struct
     GtkTreeView *view;
     GtkCheckMenuItem **hide_missing_menus;
     GArray *hide_missing_flags;
+    GtkCheckMenuItem *hide_identical_menu;
+    gboolean hide_identical;
 
     /**
      * True if the DtDiffTreeModel needs to be updated to refilter missing
@@ -26,9 +42,22 @@ typedef struct
      */
     gboolean needs_missing_filter_update;
 
-    GQueue *diff_check_queue;
-    gboolean diff_check_running;
+    DtCheckScheduler *checks;
     gint num_scans_running;
+
+    /**
+     * The latest scan-progress statistics from each source.
+     */
+    DtTreeSourceScanStats *scan_stats;
+    GtkStatusbar *statusbar;
+    guint status_context;
+    guint check_status_context;
+
+    /**
+     * If this isn't NULL, then each scan-progress update is written to it as
+     * a single line.
+     */
+    FILE *progress_log;
 } WindowData;
 
 static const char *get_gerror_message(GError *error)
@@ -61,15 +90,60 @@ void show_error_message(GtkWindow *parent, const gchar *format, ...)
     g_free(text);
 }
 
+/**
+ * Converts the scan_backend config value to a DtTreeSourceFSScanBackend.
+ */
+static DtTreeSourceFSScanBackend get_scan_backend(const char *name)
+{
+    if (g_strcmp0(name, "native") == 0)
+    {
+        return DT_TREE_SOURCE_FS_SCAN_NATIVE;
+    }
+    if (g_strcmp0(name, "io_uring") == 0)
+    {
+        return DT_TREE_SOURCE_FS_SCAN_IO_URING;
+    }
+    if (name != NULL && g_strcmp0(name, "gio") != 0)
+    {
+        g_warning("Unknown scan backend \"%s\", using gio", name);
+    }
+    return DT_TREE_SOURCE_FS_SCAN_GIO;
+}
+
+/**
+ * Adds a list of patterns to a DtExcludeRules, and to a string that
+ * identifies the whole set of rules for the snapshot cache.
+ */
+static void add_exclude_patterns(DtExcludeRules *rules, GString *variant,
+        const char * const *patterns)
+{
+    gint i;
+
+    for (i=0; patterns != NULL && patterns[i] != NULL; i++)
+    {
+        dt_exclude_rules_add_pattern(rules, patterns[i]);
+        g_string_append_c(variant, '\n');
+        g_string_append(variant, patterns[i]);
+    }
+}
+
 static GPtrArray *create_sources(const char * const *paths, int num_sources,
-        gboolean follow_symlinks, GError **error)
+        gboolean follow_symlinks, DiffTreeConfig *config,
+        const char * const *extra_excludes, GError **error)
 {
     GPtrArray *sources;
+    DtExcludeRules *excludes;
+    GString *variant;
     gboolean success = TRUE;
     gint i;
 
     sources = g_ptr_array_new_full(num_sources, g_object_unref);
 
+    excludes = dt_exclude_rules_new();
+    variant = g_string_new(config->use_gitignore ? "gitignore" : "");
+    add_exclude_patterns(excludes, variant, (const char * const *) config->exclude);
+    add_exclude_patterns(excludes, variant, extra_excludes);
+
     for (i=0; i<num_sources; i++)
     {
         DtTreeSource *source = get_tree_source_for_arg(paths[i], follow_symlinks, error);
@@ -79,8 +153,35 @@ static GPtrArray *create_sources(const char * const *paths, int num_sources,
             success = FALSE;
             break;
         }
+        if (DT_IS_TREE_SOURCE_FS(source))
+        {
+            g_object_set(source,
+                    "max-scan-jobs", config->scan_jobs,
+                    "scan-backend", get_scan_backend(config->scan_backend),
+                    "watch", config->watch,
+                    "lazy", config->lazy_scan,
+                    "exclude-rules", excludes,
+                    "use-gitignore", config->use_gitignore,
+                    NULL);
+            if (config->scan_snapshot)
+            {
+                GFile *base = NULL;
+                char *uri;
+                char *snapshot_file;
+
+                g_object_get(source, "base", &base, NULL);
+                uri = g_file_get_uri(base);
+                snapshot_file = dt_scan_snapshot_get_cache_path(uri, follow_symlinks, variant->str);
+                g_object_set(source, "snapshot-file", snapshot_file, NULL);
+                g_free(snapshot_file);
+                g_free(uri);
+                g_object_unref(base);
+            }
+        }
         g_ptr_array_insert(sources, -1, source);
     }
+    dt_exclude_rules_unref(excludes);
+    g_string_free(variant, TRUE);
 
     if (!success)
     {
@@ -190,6 +291,50 @@ done:
     return ret;
 }
 
+static void prioritize_view_row(WindowData *win, GtkTreeIter *viewIter)
+{
+    GtkTreeIter iter;
+
+    gtk_tree_model_filter_convert_iter_to_child_iter(win->missing_filter, &iter, viewIter);
+    dt_diff_tree_model_prioritize_row(win->diff_model, &iter);
+}
+
+/**
+ * When a row is expanded, its subdirectories become visible, so read those
+ * before anything else. That way, they get their own expanders right away.
+ */
+static void on_row_expanded(GtkTreeView *view, GtkTreeIter *viewIter, GtkTreePath *path, gpointer userdata)
+{
+    WindowData *win = userdata;
+    GtkTreeModel *viewModel = GTK_TREE_MODEL(win->missing_filter);
+    GtkTreeIter child;
+    gboolean valid;
+
+    prioritize_view_row(win, viewIter);
+    for (valid = gtk_tree_model_iter_children(viewModel, &child, viewIter);
+            valid; valid = gtk_tree_model_iter_next(viewModel, &child))
+    {
+        prioritize_view_row(win, &child);
+    }
+}
+
+static void on_cursor_changed(GtkTreeView *view, gpointer userdata)
+{
+    WindowData *win = userdata;
+    GtkTreePath *path = NULL;
+    GtkTreeIter viewIter;
+
+    gtk_tree_view_get_cursor(view, &path, NULL);
+    if (path != NULL)
+    {
+        if (gtk_tree_model_get_iter(GTK_TREE_MODEL(win->missing_filter), &viewIter, path))
+        {
+            prioritize_view_row(win, &viewIter);
+        }
+        gtk_tree_path_free(path);
+    }
+}
+
 static void on_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *col, gpointer userdata)
 {
     WindowData *win = userdata;
@@ -236,90 +381,63 @@ static void on_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewCo
     }
 }
 
-static gboolean get_next_diff_check(WindowData *win, GtkTreeIter *iter)
+/**
+ * Writes a check-progress update to the log, in the same format as
+ * dt_diff_report_write_scan_progress.
+ */
+static void write_check_progress_log(FILE *fp, const DtCheckSchedulerStats *stats)
 {
-    while (!g_queue_is_empty(win->diff_check_queue))
-    {
-        DtFileKey *key = g_queue_pop_head(win->diff_check_queue);
-        DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
-
-        if (!dt_file_key_get_iter(GTK_TREE_MODEL(win->diff_model), iter, key))
-        {
-            dt_file_key_unref(key);
-            continue;
-        }
-        dt_file_key_unref(key);
-
-        gtk_tree_model_get(GTK_TREE_MODEL(win->diff_model), iter,
-                DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
-        if (diff != DT_DIFF_TYPE_UNKNOWN)
-        {
-            continue;
-        }
-
-        return TRUE;
-    }
-    return FALSE;
+    fprintf(fp, "check-progress queued-user=%u queued-background=%u running=%u"
+            " completed=%" G_GUINT64_FORMAT " failed=%" G_GUINT64_FORMAT " rate=%.1f\n",
+            stats->queued[DT_CHECK_PRIORITY_USER], stats->queued[DT_CHECK_PRIORITY_BACKGROUND],
+            stats->running, stats->completed, stats->failed, stats->completed_per_second);
+    fflush(fp);
 }
 
-static void on_diff_check_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata);
-
-static void start_next_diff_check(WindowData *win)
-{
-    if (!win->diff_check_running)
-    {
-        GtkTreeIter iter;
-        if (get_next_diff_check(win, &iter))
-        {
-            win->diff_check_running = TRUE;
-            dt_diff_tree_model_check_difference_async(win->diff_model,
-                    &iter, G_PRIORITY_DEFAULT, NULL,
-                    on_diff_check_ready, win);
-        }
-    }
-}
-
-static void on_diff_check_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+static void on_check_progress(DtCheckScheduler *scheduler,
+        const DtCheckSchedulerStats *stats, gpointer userdata)
 {
     WindowData *win = userdata;
-    GError *error = NULL;
-
-    win->diff_check_running = FALSE;
+    guint queued = stats->queued[DT_CHECK_PRIORITY_USER] + stats->queued[DT_CHECK_PRIORITY_BACKGROUND];
 
-    if (!dt_diff_tree_model_check_difference_finish(win->diff_model, res, &error))
+    if (win->progress_log != NULL)
     {
-        show_error_message(win->window, "%s", get_gerror_message(error));
-        g_clear_error(&error);
+        write_check_progress_log(win->progress_log, stats);
     }
 
-    start_next_diff_check(win);
+    gtk_statusbar_remove_all(win->statusbar, win->check_status_context);
+    if (queued > 0 || stats->running > 0)
+    {
+        gchar *text = g_strdup_printf("Comparing files: %u running, %u queued, %"
+                G_GUINT64_FORMAT " done, %.1f files/s",
+                stats->running, queued, stats->completed, stats->completed_per_second);
+        gtk_statusbar_push(win->statusbar, win->check_status_context, text);
+        g_free(text);
+    }
 }
 
-static void add_diff_check(WindowData *win, GtkTreeIter *iter)
+static void on_check_error(DtCheckScheduler *scheduler, DtCheckPriority priority,
+        const GError *error, gpointer userdata)
 {
-    GFileType type = DT_DIFF_TYPE_UNKNOWN;
-    DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
-    DtFileKey *key = NULL;
+    WindowData *win = userdata;
 
-    gtk_tree_model_get(GTK_TREE_MODEL(win->diff_model), iter,
-            DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &type,
-            DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
-    if (type != G_FILE_TYPE_REGULAR || diff != DT_DIFF_TYPE_UNKNOWN)
+    if (priority == DT_CHECK_PRIORITY_USER)
     {
-        return;
+        show_error_message(win->window, "%s", error->message);
     }
-
-    // TODO: Use a GTree to keep track of which rows are in progress?
-    key = dt_file_key_from_model(GTK_TREE_MODEL(win->diff_model), iter);
-    if (g_queue_find_custom(win->diff_check_queue, key, dt_file_key_compare) != NULL)
+    else
     {
-        dt_file_key_unref(key);
-        return;
+        // Nobody asked for this check, so don't pop up a dialog for it.
+        g_warning("Can't compare files: %s", error->message);
     }
+}
 
-    g_queue_push_tail(win->diff_check_queue, key);
+static void on_diff_invalidated(DtDiffTreeModel *model, GtkTreeIter *iter, gpointer userdata)
+{
+    WindowData *win = userdata;
 
-    start_next_diff_check(win);
+    // A file changed while we're watching the sources, so check it again.
+    dt_check_scheduler_add(win->checks, iter, DT_CHECK_PRIORITY_BACKGROUND);
 }
 
 static void on_menu_item_check_files(GtkMenuItem *item, gpointer userdata)
@@ -339,12 +457,18 @@ static void on_menu_item_check_files(GtkMenuItem *item, gpointer userdata)
             //GError *error = NULL;
             gtk_tree_model_filter_convert_iter_to_child_iter(win->missing_filter, &iter, &viewIter);
 
-            add_diff_check(win, &iter);
+            dt_check_scheduler_add(win->checks, &iter, DT_CHECK_PRIORITY_USER);
         }
     }
     g_list_free_full(paths, (GDestroyNotify) gtk_tree_path_free);
 }
 
+static void on_menu_item_cancel_checks(GtkMenuItem *item, gpointer userdata)
+{
+    WindowData *win = userdata;
+    dt_check_scheduler_cancel_all(win->checks);
+}
+
 static void on_menu_item_settings(GtkMenuItem *item, gpointer userdata)
 {
     WindowData *win = userdata;
@@ -379,6 +503,11 @@ static gboolean update_missing_filter(gpointer userdata)
             changed = TRUE;
         }
     }
+    if (win->hide_identical != gtk_check_menu_item_get_active(win->hide_identical_menu))
+    {
+        win->hide_identical = !win->hide_identical;
+        changed = TRUE;
+    }
 
     if (changed)
     {
@@ -498,6 +627,7 @@ static GtkMenuBar *create_menu(WindowData *win, GtkAccelGroup *accel_group)
     gtk_menu_shell_append(GTK_MENU_SHELL(top), item);
     add_menu_item(win, menu, "_Check Files", accel_group,
             GDK_KEY_d, GDK_CONTROL_MASK, on_menu_item_check_files);
+    add_menu_item(win, menu, "Cancel C_hecks", NULL, 0, 0, on_menu_item_cancel_checks);
     add_menu_item(win, menu, "_Settings", NULL, 0, 0, on_menu_item_settings);
 
     for (i=0; i<dt_diff_tree_model_get_num_sources(win->diff_model); i++)
@@ -556,6 +686,13 @@ static GtkMenuBar *create_menu(WindowData *win, GtkAccelGroup *accel_group)
         gtk_menu_shell_append(menu, item);
     }
 
+    gtk_menu_shell_append(menu, gtk_separator_menu_item_new());
+    item = gtk_check_menu_item_new_with_mnemonic("Hide _Identical Files");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), win->hide_identical);
+    g_signal_connect(item, "toggled", G_CALLBACK(on_menu_item_toggle_missing), win);
+    win->hide_identical_menu = GTK_CHECK_MENU_ITEM(item);
+    gtk_menu_shell_append(menu, item);
+
     return top;
 }
 
@@ -574,6 +711,24 @@ static void on_window_destroy(GtkWidget *widget, gpointer userdata)
     gtk_main_quit();
 }
 
+static gboolean filter_row_visible(GtkTreeModel *model, GtkTreeIter *iter, gpointer userdata)
+{
+    WindowData *win = userdata;
+
+    if (win->hide_identical)
+    {
+        // A directory is only identical if everything under it is, so this
+        // hides the whole subtree without looking at it.
+        DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
+        gtk_tree_model_get(model, iter, DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
+        if (diff == DT_DIFF_TYPE_IDENTICAL)
+        {
+            return FALSE;
+        }
+    }
+    return dt_tree_filter_missing_visible(model, iter, win->hide_missing_flags);
+}
+
 static void init_gui(WindowData *win)
 {
     GtkAccelGroup *accel_group;
@@ -587,14 +742,15 @@ static void init_gui(WindowData *win)
 
     win->missing_filter = GTK_TREE_MODEL_FILTER(gtk_tree_model_filter_new(GTK_TREE_MODEL(win->diff_model), NULL));
     gtk_tree_model_filter_set_visible_func(win->missing_filter,
-            dt_tree_filter_missing_visible, g_array_ref(win->hide_missing_flags),
-            (GDestroyNotify) g_array_unref);
+            filter_row_visible, win, NULL);
 
     win->view = create_diff_tree_view_from_model(win->diff_model);
     gtk_tree_view_set_model(win->view, GTK_TREE_MODEL(win->missing_filter));
     gtk_tree_selection_set_mode(gtk_tree_view_get_selection(win->view), GTK_SELECTION_MULTIPLE);
 
     g_signal_connect(win->view, "row-activated", G_CALLBACK(on_row_activated), win);
+    g_signal_connect(win->view, "row-expanded", G_CALLBACK(on_row_expanded), win);
+    g_signal_connect(win->view, "cursor-changed", G_CALLBACK(on_cursor_changed), win);
 
     content = GTK_BOX(gtk_box_new(GTK_ORIENTATION_VERTICAL, 0));
     menu = create_menu(win, accel_group);
@@ -605,6 +761,11 @@ static void init_gui(WindowData *win)
     gtk_container_add(GTK_CONTAINER(swin), GTK_WIDGET(win->view));
     gtk_box_pack_start(content, swin, TRUE, TRUE, 0);
 
+    win->statusbar = GTK_STATUSBAR(gtk_statusbar_new());
+    win->status_context = gtk_statusbar_get_context_id(win->statusbar, "scan");
+    win->check_status_context = gtk_statusbar_get_context_id(win->statusbar, "checks");
+    gtk_box_pack_start(content, GTK_WIDGET(win->statusbar), FALSE, FALSE, 0);
+
     gtk_container_add(GTK_CONTAINER(win->window), GTK_WIDGET(content));
 
     g_signal_connect(win->window, "configure-event", G_CALLBACK(on_window_configure), win->config);
@@ -630,22 +791,89 @@ static void on_source_scan_ready(GObject *sourceobj, GAsyncResult *res, gpointer
     win->num_scans_running--;
     if (win->num_scans_running == 0)
     {
+        // Don't wait for the idle callbacks to add the last few directories.
+        dt_diff_tree_model_flush(win->diff_model);
         gtk_window_set_title(win->window, "DiffTree");
     }
 }
 
-WindowData *create_main_window(DiffTreeConfig *config, GPtrArray *sources)
+/**
+ * Updates the status bar with the combined progress of every source.
+ */
+static void update_scan_status(WindowData *win)
+{
+    gint num_sources = dt_diff_tree_model_get_num_sources(win->diff_model);
+    DtTreeSourceScanStats total = {};
+    gboolean finished = TRUE;
+    gchar *size;
+    gchar *text;
+    gint i;
+
+    for (i=0; i<num_sources; i++)
+    {
+        const DtTreeSourceScanStats *stats = &win->scan_stats[i];
+        total.dirs_visited += stats->dirs_visited;
+        total.entries_found += stats->entries_found;
+        total.metadata_bytes += stats->metadata_bytes;
+        total.queue_depth += stats->queue_depth;
+        total.entries_per_second += stats->entries_per_second;
+        total.elapsed = MAX(total.elapsed, stats->elapsed);
+        finished = finished && stats->finished;
+    }
+
+    size = g_format_size(total.metadata_bytes);
+    if (finished)
+    {
+        text = g_strdup_printf("Scanned %" G_GUINT64_FORMAT " entries in %"
+                G_GUINT64_FORMAT " directories (%s of metadata) in %.1f s",
+                total.entries_found, total.dirs_visited, size,
+                (gdouble) total.elapsed / G_USEC_PER_SEC);
+    }
+    else
+    {
+        text = g_strdup_printf("Scanning: %" G_GUINT64_FORMAT " entries in %"
+                G_GUINT64_FORMAT " directories, %.0f entries/s, %u directories queued, %s of metadata",
+                total.entries_found, total.dirs_visited, total.entries_per_second,
+                total.queue_depth, size);
+    }
+
+    gtk_statusbar_remove_all(win->statusbar, win->status_context);
+    gtk_statusbar_push(win->statusbar, win->status_context, text);
+    g_free(text);
+    g_free(size);
+}
+
+static void on_scan_progress(DtTreeSource *source, const DtTreeSourceScanStats *stats, gpointer userdata)
+{
+    WindowData *win = userdata;
+    gint i;
+
+    for (i=0; i<dt_diff_tree_model_get_num_sources(win->diff_model); i++)
+    {
+        if (dt_diff_tree_model_get_source(win->diff_model, i) == source)
+        {
+            win->scan_stats[i] = *stats;
+            if (win->progress_log != NULL)
+            {
+                dt_diff_report_write_scan_progress(win->progress_log, i, stats);
+            }
+            break;
+        }
+    }
+    update_scan_status(win);
+}
+
+WindowData *create_main_window(DiffTreeConfig *config, GPtrArray *sources, FILE *progress_log)
 {
     WindowData *win = g_malloc0(sizeof(WindowData));
     gint i;
 
     win->config = diff_tree_config_ref(config);
-    win->diff_model = dt_diff_tree_model_new(sources->len, (DtTreeSource **) sources->pdata, 0, NULL);
-    gtk_tree_sortable_set_default_sort_func(GTK_TREE_SORTABLE(win->diff_model),
-            diff_tree_model_row_compare, NULL, NULL);
-    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(win->diff_model),
-            GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
-    win->diff_check_queue = g_queue_new();
+    win->progress_log = progress_log;
+    win->diff_model = dt_diff_tree_model_new(sources->len, (DtTreeSource **) sources->pdata);
+    win->checks = dt_check_scheduler_new(win->diff_model, config->check_jobs_per_device,
+            config->check_jobs, on_check_progress, on_check_error, win);
+    g_signal_connect(win->diff_model, "diff-invalidated", G_CALLBACK(on_diff_invalidated), win);
 
     win->hide_missing_flags = g_array_sized_new(FALSE, TRUE, sizeof(gboolean), sources->len);
     g_array_set_size(win->hide_missing_flags, dt_diff_tree_model_get_num_sources(win->diff_model));
@@ -653,9 +881,11 @@ WindowData *create_main_window(DiffTreeConfig *config, GPtrArray *sources)
     init_gui(win);
 
     // Start reading the sources
+    win->scan_stats = g_new0(DtTreeSourceScanStats, dt_diff_tree_model_get_num_sources(win->diff_model));
     for (i=0; i<dt_diff_tree_model_get_num_sources(win->diff_model); i++)
     {
         DtTreeSource *source = dt_diff_tree_model_get_source(win->diff_model, i);
+        g_signal_connect(source, "scan-progress", G_CALLBACK(on_scan_progress), win);
         win->num_scans_running++;
         dt_tree_source_scan_async(source, G_PRIORITY_DEFAULT, NULL,
                 on_source_scan_ready, win);
@@ -677,11 +907,12 @@ void cleanup_main_window(WindowData *win)
             dt_diff_tree_model_cleanup_temp_files(win->diff_model);
         }
 
-        g_queue_free_full(win->diff_check_queue, (GDestroyNotify) dt_file_key_unref);
+        dt_check_scheduler_free(win->checks);
         g_clear_object(&win->diff_model);
         g_clear_object(&win->missing_filter);
         g_free(win->hide_missing_menus);
         g_array_unref(win->hide_missing_flags);
+        g_free(win->scan_stats);
         diff_tree_config_unref(win->config);
 
         g_free(win);
@@ -693,6 +924,19 @@ int main(int argc, char **argv)
     char *config_file = NULL;
     char *option_diff_command = NULL;
     gboolean option_follow_symlinks = TRUE;
+    gint option_scan_jobs = 0;
+    char *option_scan_backend = NULL;
+    gboolean option_watch = FALSE;
+    gboolean option_snapshot = FALSE;
+    gboolean option_digest_cache = FALSE;
+    gboolean option_lazy = FALSE;
+    char *option_progress_log = NULL;
+    char **option_exclude = NULL;
+    gboolean option_gitignore = FALSE;
+    char *option_report = NULL;
+    gint option_report_jobs = DEFAULT_REPORT_JOBS;
+    DtDiffReportFormat report_format = DT_DIFF_REPORT_FORMAT_BRIEF;
+    FILE *progress_log = NULL;
     char **paths = NULL;
     gint num_sources = 0;
 
@@ -706,22 +950,59 @@ int main(int argc, char **argv)
             "Dereference symlinks and show targets", NULL },
         { "no-follow-symlinks", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &option_follow_symlinks,
             "Dereference symlinks and show targets", NULL },
+        { "scan-jobs", 0, 0, G_OPTION_ARG_INT, &option_scan_jobs,
+            "Number of directories to read at the same time", "N" },
+        { "scan-backend", 0, 0, G_OPTION_ARG_STRING, &option_scan_backend,
+            "How to read local directories: gio, native, or io_uring", "BACKEND" },
+        { "watch", 0, 0, G_OPTION_ARG_NONE, &option_watch,
+            "Watch local directories and update the tree when files change", NULL },
+        { "snapshot", 0, 0, G_OPTION_ARG_NONE, &option_snapshot,
+            "Cache each scanned tree, and only reread directories that changed next time", NULL },
+        { "digest-cache", 0, 0, G_OPTION_ARG_NONE, &option_digest_cache,
+            "Cache the digest of each file that's compared, and only reread files that changed next time", NULL },
+        { "lazy", 0, 0, G_OPTION_ARG_NONE, &option_lazy,
+            "Scan in the background, and read the directories that you open first", NULL },
+        { "progress-log", 0, 0, G_OPTION_ARG_FILENAME, &option_progress_log,
+            "Write scan progress to a file, or to stderr if PATH is -", "PATH" },
+        { "exclude", 0, 0, G_OPTION_ARG_STRING_ARRAY, &option_exclude,
+            "Leave out files and directories that match a .gitignore-style pattern", "PATTERN" },
+        { "gitignore", 0, 0, G_OPTION_ARG_NONE, &option_gitignore,
+            "Leave out the files that each directory's .gitignore file matches", NULL },
+        { "report", 0, 0, G_OPTION_ARG_STRING, &option_report,
+            "Compare everything without opening a window, and print the results as brief or jsonl", "FORMAT" },
+        { "report-jobs", 0, 0, G_OPTION_ARG_INT, &option_report_jobs,
+            "Number of files to compare at the same time with --report", "N" },
         { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths,
             "Paths to view", "PATH1 PATH2 [PATH3...]" },
         { NULL }
     };
     WindowData *win = NULL;
     DiffTreeConfig *config = NULL;
+    DiffTreeConfig *run_config = NULL;
     GPtrArray *sources = NULL;
+    GOptionContext *context;
     GError *error = NULL;
     gint ret = 2;
 
-    if (!gtk_init_with_args(&argc, &argv, NULL, options, NULL, &error))
+    // Parse the options without opening a display, so that --report works
+    // without one.
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, options, NULL);
+    g_option_context_add_group(context, gtk_get_option_group(FALSE));
+    if (!g_option_context_parse(context, &argc, &argv, &error))
     {
+        g_option_context_free(context);
         printf("%s\n", error->message);
         g_clear_error(&error);
         goto done;
     }
+    g_option_context_free(context);
+
+    if (option_report != NULL && !dt_diff_report_parse_format(option_report, &report_format))
+    {
+        printf("Unknown report format: %s\n", option_report);
+        goto done;
+    }
 
     if (paths != NULL)
     {
@@ -736,14 +1017,6 @@ int main(int argc, char **argv)
         goto done;
     }
 
-    sources = create_sources((const char * const *)paths, num_sources, option_follow_symlinks, &error);
-    if (sources == NULL)
-    {
-        show_error_message(NULL, "Error loading sources: %s", get_gerror_message(error));
-        g_clear_error(&error);
-        goto done;
-    }
-
     config = config_data_new();
     if (config_file == NULL)
     {
@@ -758,7 +1031,104 @@ int main(int argc, char **argv)
         g_free(config->diff_command_line);
         config->diff_command_line = option_diff_command;
     }
-    win = create_main_window(config, sources);
+
+    // The rest of the options only apply to this run, so they go into a copy
+    // that never gets written back to the config file.
+    run_config = config_data_copy(config);
+    if (option_scan_jobs > 0)
+    {
+        run_config->scan_jobs = option_scan_jobs;
+    }
+    if (option_watch)
+    {
+        run_config->watch = TRUE;
+    }
+    if (option_snapshot)
+    {
+        run_config->scan_snapshot = TRUE;
+    }
+    if (option_digest_cache)
+    {
+        run_config->digest_cache = TRUE;
+    }
+    if (option_lazy)
+    {
+        run_config->lazy_scan = TRUE;
+    }
+    if (option_gitignore)
+    {
+        run_config->use_gitignore = TRUE;
+    }
+    if (option_scan_backend != NULL)
+    {
+        g_free(run_config->scan_backend);
+        run_config->scan_backend = option_scan_backend;
+        option_scan_backend = NULL;
+    }
+
+    if (option_progress_log != NULL)
+    {
+        if (strcmp(option_progress_log, "-") == 0)
+        {
+            progress_log = stderr;
+        }
+        else
+        {
+            progress_log = fopen(option_progress_log, "w");
+            if (progress_log == NULL)
+            {
+                // There's no display yet, so this can't use show_error_message.
+                g_printerr("Can't open %s: %s\n", option_progress_log, g_strerror(errno));
+                goto done;
+            }
+        }
+    }
+
+    if (run_config->digest_cache && !dt_digest_cache_init_default(&error))
+    {
+        // Everything still works without the cache, just slower.
+        g_warning("Can't open digest cache: %s", get_gerror_message(error));
+        g_clear_error(&error);
+    }
+
+    if (option_report != NULL)
+    {
+        // There's nothing to watch or prioritize without a window. A report
+        // also has to read the trees as they are now, not as a snapshot.
+        run_config->watch = FALSE;
+        run_config->lazy_scan = FALSE;
+        run_config->scan_snapshot = FALSE;
+
+        sources = create_sources((const char * const *)paths, num_sources,
+                option_follow_symlinks, run_config, (const char * const *) option_exclude, &error);
+        if (sources == NULL)
+        {
+            g_printerr("Error loading sources: %s\n", get_gerror_message(error));
+            g_clear_error(&error);
+            goto done;
+        }
+        ret = dt_diff_report_run(sources->len, (DtTreeSource **) sources->pdata,
+                (const char * const *) paths, report_format, option_report_jobs, stdout,
+                progress_log);
+        g_ptr_array_unref(sources);
+        goto done;
+    }
+
+    if (!gtk_init_check(&argc, &argv))
+    {
+        printf("Can't open display\n");
+        goto done;
+    }
+
+    sources = create_sources((const char * const *)paths, num_sources,
+            option_follow_symlinks, run_config, (const char * const *) option_exclude, &error);
+    if (sources == NULL)
+    {
+        show_error_message(NULL, "Error loading sources: %s", get_gerror_message(error));
+        g_clear_error(&error);
+        goto done;
+    }
+    win = create_main_window(config, sources, progress_log);
     g_ptr_array_unref(sources);
 
     gtk_main();
@@ -770,10 +1140,23 @@ int main(int argc, char **argv)
     ret = 0;
 
 done:
+    if (dt_digest_cache_get_default() != NULL)
+    {
+        dt_digest_cache_flush(dt_digest_cache_get_default());
+    }
     g_strfreev(paths);
     g_free(config_file);
+    g_free(option_scan_backend);
     diff_tree_config_unref(config);
+    diff_tree_config_unref(run_config);
     cleanup_main_window(win);
+    if (progress_log != NULL && progress_log != stderr)
+    {
+        fclose(progress_log);
+    }
+    g_free(option_progress_log);
+    g_strfreev(option_exclude);
+    g_free(option_report);
 
     return ret;
 }
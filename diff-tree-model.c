@@ -2,43 +2,168 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
 #include <gio/gio.h>
 
-#include "ref-count-struct.h"
+#include "slab-alloc.h"
 
 static const gint64 DEFAULT_MAX_READ_SIZE = (16 * 1024 * 1024);
-#define READ_BLOCK_SIZE 4096
+#define ROWS_PER_CHUNK 1024
+
+/**
+ * How long to spend adding queued nodes in each idle callback, so that the
+ * view still gets to redraw and handle input while the sources are scanning.
+ */
+#define APPLY_SLICE_USEC 8000
+
+typedef struct _DiffRow DiffRow;
+
+/**
+ * Counts of the rows under a directory. See get_row_contribution for what
+ * each row adds.
+ */
+typedef struct
+{
+    guint32 num_different;
+    guint32 num_identical;
+    guint32 num_unknown;
+    guint32 num_missing;
+
+    /// The total size of the regular files.
+    guint64 size;
+} DiffSubtreeStats;
+
+/**
+ * A single row in the model.
+ *
+ * Each row is allocated from DtDiffTreeModel::rows, with room for one
+ * DtTreeSourceNode pointer for each source at the end. The GtkTreeIter for a
+ * row just points to the DiffRow, so an iterator stays valid until the row is
+ * removed.
+ */
+struct _DiffRow
+{
+    DiffRow *parent;
+
+    /**
+     * The file name. This is borrowed from one of the source nodes, so it
+     * has to be pointed at a different one if that node is removed.
+     */
+    const char *name;
+
+    /**
+     * The child rows, in the order that they're displayed in. See
+     * compare_rows.
+     */
+    DiffRow **children;
+    guint32 num_children;
+    guint32 child_capacity;
+
+    /// The index of this row in parent->children.
+    guint32 index;
+
+    /// A GFileType value.
+    guint16 type;
+
+    /// A DtDiffType value.
+    guint16 diff;
+
+    /**
+     * The files that dt_diff_tree_model_get_fs_file returned for each
+     * source. This is NULL until dt_diff_tree_model_get_fs_file is called.
+     */
+    GFile **files;
+
+    /**
+     * The totals for everything under a directory, from
+     * DtDiffTreeModel::dir_stats. This is NULL for anything but a directory.
+     */
+    DiffSubtreeStats *stats;
+
+    DtTreeSourceNode *nodes[];
+};
 
 struct _DtDiffTreeModel
 {
-    GtkTreeStore parent_instance;
+    GObject parent_instance;
+
+    /// Used to check that a GtkTreeIter came from this model.
+    gint stamp;
 
     gint num_sources;
     DtTreeSource **sources;
     gint64 max_read_size;
 
+    /// The root row. This is the only top-level row in the model.
+    DiffRow *root;
+
+    DtSlab rows;
+    DtSlabArrays child_arrays;
+    DtSlab dir_stats;
+
+    /**
+     * The directories whose totals changed since the last row-changed
+     * signal for them. Changing a file changes every directory above it,
+     * so those signals are sent from an idle callback instead of for every
+     * change.
+     */
+    GHashTable *dirty_dirs;
+    guint dirty_idle_id;
+
     /**
      * A list of temp files that we've created, which we need to clean up.
      */
     GList *temp_files;
+
+    /**
+     * The CheckDiffState structs for every dt_diff_tree_model_check_difference_async
+     * call that's still running.
+     */
+    GList *running_checks;
+
+    /**
+     * An index of every row, keyed on the parent row, the name, and the file
+     * type, so that find_child_row doesn't have to look at every sibling.
+     * This is a set of DiffRow pointers.
+     */
+    GHashTable *row_index;
+
+    /**
+     * Maps each directory DtTreeSourceNode from any source to its row. The
+     * source signals always give us the parent directory, so this lets us
+     * find the row without walking down from the root.
+     */
+    GHashTable *dir_node_rows;
+
+    /**
+     * The nodes-added signals that haven't been applied to the model yet.
+     * This contains PendingAdd structs. See queue_added_nodes.
+     */
+    GQueue pending_adds;
+
+    /// How many nodes from the head of pending_adds were already applied.
+    guint pending_pos;
+
+    guint pending_idle_id;
 };
 
+/**
+ * A nodes-added signal that's waiting in DtDiffTreeModel::pending_adds.
+ */
 typedef struct
 {
-    UtilRefCountedBase base;
-    DtDiffTreeModel *owner;
-    GFile **files;
-} DtInternalTreeData; 
-
-G_DEFINE_TYPE(DtDiffTreeModel, dt_diff_tree_model, GTK_TYPE_TREE_STORE);
+    gint source_index;
+    DtTreeSourceNode *parent;
+    guint num_nodes;
+    DtTreeSourceNode *nodes[];
+} PendingAdd;
 
-static void dt_internal_tree_data_free(DtInternalTreeData *data);
+static void dt_diff_tree_model_tree_model_init(GtkTreeModelIface *iface);
 
-#define DT_TYPE_INTERNAL_TREE_DATA dt_internal_tree_data_get_type()
-UTIL_DECLARE_BOXED_REFCOUNT_FUNCS(DtInternalTreeData, dt_internal_tree_data);
-UTIL_DEFINE_BOXED_REFCOUNT_TYPE(DtInternalTreeData, dt_internal_tree_data, dt_internal_tree_data_free);
+G_DEFINE_TYPE_WITH_CODE(DtDiffTreeModel, dt_diff_tree_model, G_TYPE_OBJECT,
+        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, dt_diff_tree_model_tree_model_init));
 
 enum
 {
@@ -46,44 +171,48 @@ enum
     N_PROPERTIES
 };
 
-static DtInternalTreeData *dt_internal_tree_data_lookup(DtDiffTreeModel *self, GtkTreeIter *iter, gboolean add)
+enum
 {
-    DtInternalTreeData *data = NULL;
-    gtk_tree_model_get(GTK_TREE_MODEL(self), iter,
-            DT_DIFF_TREE_MODEL_COL_INTERNAL, &data, -1);
-    if (data == NULL && add)
-    {
-        data = g_malloc0(sizeof(DtInternalTreeData) + self->num_sources * sizeof(GFile *));
-        util_ref_counted_struct_init(&data->base);
-        data->owner = self;
-        data->files = (GFile **) (data + 1);
-
-        gtk_tree_store_set(GTK_TREE_STORE(self), iter,
-                DT_DIFF_TREE_MODEL_COL_INTERNAL, data, -1);
-        g_assert(data->base.refcount == 2);
-    }
-    dt_internal_tree_data_unref(data);
+    SIGNAL_DIFF_INVALIDATED,
+    NUM_SIGNALS
+};
+static guint diff_tree_model_signals[NUM_SIGNALS] = {};
 
-    return data;
-}
+static GParamSpec *obj_properties[N_PROPERTIES] = {};
 
-static void dt_internal_tree_data_free(DtInternalTreeData *data)
+static void free_row_files(DtDiffTreeModel *self, DiffRow *row)
 {
-    if (data != NULL)
+    if (row->files != NULL)
     {
         gint i;
-        for (i=0; i<data->owner->num_sources; i++)
+        for (i=0; i<self->num_sources; i++)
         {
-            if (data->files[i] != NULL)
-            {
-                g_object_unref(data->files[i]);
-            }
+            g_clear_object(&row->files[i]);
         }
-        g_free(data);
+        g_free(row->files);
+        row->files = NULL;
     }
 }
 
-static GParamSpec *obj_properties[N_PROPERTIES] = {};
+/**
+ * Releases everything that a row and its children hold, other than the slab
+ * memory itself.
+ */
+static void free_row_data(DtDiffTreeModel *self, DiffRow *row)
+{
+    guint32 i;
+
+    for (i=0; i<row->num_children; i++)
+    {
+        free_row_data(self, row->children[i]);
+    }
+    if (row->child_capacity > (1U << DT_SLAB_ARRAYS_MAX_SHIFT))
+    {
+        // This one didn't come from a slab.
+        dt_slab_arrays_free(&self->child_arrays, (gpointer *) row->children, row->child_capacity);
+    }
+    free_row_files(self, row);
+}
 
 static void dt_diff_tree_model_dispose(GObject *gobj)
 {
@@ -108,14 +237,60 @@ static void dt_diff_tree_model_finalize(GObject *gobj)
         g_object_unref(self->sources[i]);
     }
     g_free(self->sources);
+    g_hash_table_destroy(self->row_index);
+    g_hash_table_destroy(self->dir_node_rows);
+
+    if (self->pending_idle_id != 0)
+    {
+        g_source_remove(self->pending_idle_id);
+    }
+    if (self->dirty_idle_id != 0)
+    {
+        g_source_remove(self->dirty_idle_id);
+    }
+    g_hash_table_destroy(self->dirty_dirs);
+    while (!g_queue_is_empty(&self->pending_adds))
+    {
+        g_free(g_queue_pop_head(&self->pending_adds));
+    }
+
+    if (self->root != NULL)
+    {
+        free_row_data(self, self->root);
+    }
+    dt_slab_arrays_clear(&self->child_arrays);
+    dt_slab_clear(&self->rows);
+    dt_slab_clear(&self->dir_stats);
+
     G_OBJECT_CLASS(dt_diff_tree_model_parent_class)->finalize(gobj);
 }
 
+static guint row_index_hash(gconstpointer key)
+{
+    const DiffRow *row = key;
+    return (g_str_hash(row->name) ^ (((guint) (gsize) row->parent >> 4) * 0x9E3779B1U))
+        + row->type;
+}
+
+static gboolean row_index_equal(gconstpointer a, gconstpointer b)
+{
+    const DiffRow *r1 = a;
+    const DiffRow *r2 = b;
+    return (r1->parent == r2->parent && r1->type == r2->type && strcmp(r1->name, r2->name) == 0);
+}
+
 static void dt_diff_tree_model_init(DtDiffTreeModel *self)
 {
+    self->stamp = g_random_int();
     self->num_sources = 0;
     self->sources = NULL;
     self->max_read_size = DEFAULT_MAX_READ_SIZE;
+    self->row_index = g_hash_table_new(row_index_hash, row_index_equal);
+    self->dir_node_rows = g_hash_table_new(NULL, NULL);
+    g_queue_init(&self->pending_adds);
+    dt_slab_arrays_init(&self->child_arrays);
+    dt_slab_init(&self->dir_stats, sizeof(DiffSubtreeStats), ROWS_PER_CHUNK);
+    self->dirty_dirs = g_hash_table_new(NULL, NULL);
 }
 
 static void dt_diff_tree_model_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
@@ -160,407 +335,1129 @@ static void dt_diff_tree_model_class_init(DtDiffTreeModelClass *klass)
             G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
     g_object_class_install_properties(object_class, N_PROPERTIES, obj_properties);
 
+    diff_tree_model_signals[SIGNAL_DIFF_INVALIDATED] = g_signal_new("diff-invalidated",
+            DT_TYPE_DIFF_TREE_MODEL,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL, NULL,
+            G_TYPE_NONE,
+            1, GTK_TYPE_TREE_ITER);
+
     object_class->dispose = dt_diff_tree_model_dispose;
     object_class->finalize = dt_diff_tree_model_finalize;
 }
 
-static gboolean find_child_iter(DtDiffTreeModel *self, GtkTreeIter *iter,
-        GtkTreeIter *parent, const gchar *name, GFileType type)
+static inline DiffRow *iter_get_row(DtDiffTreeModel *self, GtkTreeIter *iter)
 {
-    GtkTreeModel *model = GTK_TREE_MODEL(self);
-    GtkTreeIter child;
-    gboolean ok;
-    for (ok = gtk_tree_model_iter_children(model, &child, parent);
-            ok;
-            ok = gtk_tree_model_iter_next(model, &child))
+    g_return_val_if_fail(iter != NULL, NULL);
+    g_return_val_if_fail(iter->stamp == self->stamp, NULL);
+    return iter->user_data;
+}
+
+static inline gboolean iter_set_row(DtDiffTreeModel *self, GtkTreeIter *iter, DiffRow *row)
+{
+    if (row != NULL)
     {
-        gchar *childName = NULL;
-        GFileType childType = G_FILE_TYPE_UNKNOWN;
-        gtk_tree_model_get(GTK_TREE_MODEL(self), &child,
-                DT_DIFF_TREE_MODEL_COL_NAME, &childName,
-                DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &childType, -1);
+        iter->stamp = self->stamp;
+        iter->user_data = row;
+        iter->user_data2 = NULL;
+        iter->user_data3 = NULL;
+        return TRUE;
+    }
+    else
+    {
+        iter->stamp = 0;
+        return FALSE;
+    }
+}
+
+static GtkTreePath *get_row_path(DiffRow *row)
+{
+    GtkTreePath *path;
+    DiffRow *r;
+    gint *indices;
+    gint depth = 0;
+    gint i;
 
-        if (childName == NULL)
+    for (r = row; r != NULL; r = r->parent)
+    {
+        depth++;
+    }
+
+    indices = g_alloca(depth * sizeof(gint));
+    for (r = row, i = depth - 1; r != NULL; r = r->parent, i--)
+    {
+        // The root row has an index of 0, since it's the only top-level row.
+        indices[i] = r->index;
+    }
+
+    path = gtk_tree_path_new_from_indicesv(indices, depth);
+    return path;
+}
+
+static void emit_row_changed(DtDiffTreeModel *self, DiffRow *row)
+{
+    GtkTreePath *path = get_row_path(row);
+    GtkTreeIter iter;
+
+    iter_set_row(self, &iter, row);
+    gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
+    gtk_tree_path_free(path);
+}
+
+static void emit_row_inserted(DtDiffTreeModel *self, DiffRow *row)
+{
+    GtkTreePath *path = get_row_path(row);
+    GtkTreeIter iter;
+
+    iter_set_row(self, &iter, row);
+    gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
+
+    if (row->parent != NULL && row->parent->num_children == 1)
+    {
+        gtk_tree_path_up(path);
+        iter_set_row(self, &iter, row->parent);
+        gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(self), path, &iter);
+    }
+    gtk_tree_path_free(path);
+}
+
+static gint get_sort_group(GFileType type)
+{
+    switch (type)
+    {
+        case G_FILE_TYPE_DIRECTORY: return 0;
+        default: return 1;
+    }
+}
+
+/**
+ * Compares two sibling rows.
+ *
+ * Directories come first, and then everything is sorted by name, ignoring
+ * case. Since the name and type of a row never change, the model can keep
+ * each row's children in this order, so there's no need for a
+ * GtkTreeModelSort wrapper.
+ */
+static gint compare_rows(const DiffRow *a, const DiffRow *b)
+{
+    gint diff = get_sort_group(a->type) - get_sort_group(b->type);
+
+    if (diff == 0)
+    {
+        diff = strcasecmp(a->name, b->name);
+    }
+    if (diff == 0)
+    {
+        diff = strcmp(a->name, b->name);
+    }
+    if (diff == 0)
+    {
+        diff = (gint) a->type - (gint) b->type;
+    }
+    return diff;
+}
+
+static gint compare_row_ptrs(gconstpointer a, gconstpointer b, gpointer userdata)
+{
+    return compare_rows(*((DiffRow * const *) a), *((DiffRow * const *) b));
+}
+
+/**
+ * Creates a new row and appends it to the end of the parent's children.
+ *
+ * This doesn't emit any signals, and it doesn't move the row into sorted
+ * order. The caller has to call sort_new_children for that.
+ */
+static DiffRow *row_new(DtDiffTreeModel *self, DiffRow *parent,
+        const char *name, GFileType type)
+{
+    DiffRow *row = dt_slab_alloc(&self->rows);
+
+    row->parent = parent;
+    row->name = name;
+    row->children = NULL;
+    row->num_children = 0;
+    row->child_capacity = 0;
+    row->index = 0;
+    row->type = type;
+    row->diff = DT_DIFF_TYPE_UNKNOWN;
+    row->files = NULL;
+    row->stats = NULL;
+    memset(row->nodes, 0, self->num_sources * sizeof(DtTreeSourceNode *));
+
+    if (type == G_FILE_TYPE_DIRECTORY)
+    {
+        row->stats = dt_slab_alloc(&self->dir_stats);
+        memset(row->stats, 0, sizeof(DiffSubtreeStats));
+    }
+
+    if (parent != NULL)
+    {
+        parent->children = (DiffRow **) dt_slab_arrays_reserve(&self->child_arrays,
+                (gpointer *) parent->children, &parent->child_capacity,
+                parent->num_children, parent->num_children + 1);
+        row->index = parent->num_children;
+        parent->children[parent->num_children++] = row;
+    }
+
+    if (!g_hash_table_add(self->row_index, row))
+    {
+        g_critical("Duplicate row: \"%s\"", name);
+    }
+    return row;
+}
+
+/**
+ * Moves rows that were added with row_new into sorted order.
+ *
+ * \param first_new The index of the first new row. Everything before that is
+ *      already sorted.
+ * \param emit If TRUE, then emit a rows-reordered signal if anything moved.
+ */
+static void sort_new_children(DtDiffTreeModel *self, DiffRow *parent,
+        guint32 first_new, gboolean emit)
+{
+    DiffRow **old_children;
+    gint *new_order;
+    guint32 num = parent->num_children;
+    guint32 i, j, k;
+    gboolean moved = FALSE;
+
+    if (first_new >= num || num < 2)
+    {
+        return;
+    }
+
+    // Sort the new rows, and then merge them with the old ones.
+    g_qsort_with_data(parent->children + first_new, num - first_new,
+            sizeof(DiffRow *), compare_row_ptrs, NULL);
+
+    old_children = g_new(DiffRow *, num);
+    memcpy(old_children, parent->children, num * sizeof(DiffRow *));
+    new_order = g_new(gint, num);
+
+    i = 0;
+    j = first_new;
+    for (k=0; k<num; k++)
+    {
+        DiffRow *row;
+        if (j >= num || (i < first_new && compare_rows(old_children[i], old_children[j]) < 0))
         {
-            g_critical("Shouldn't happen: name is NULL");
-            continue;
+            row = old_children[i++];
         }
-        if (childType == type && strcmp(name, childName) == 0)
+        else
         {
-            g_free(childName);
-            *iter = child;
-            return TRUE;
+            row = old_children[j++];
         }
-        g_free(childName);
+
+        // Note that the new rows still have the index that they were added
+        // with, which is where the views think they are.
+        new_order[k] = row->index;
+        if (row->index != k)
+        {
+            moved = TRUE;
+        }
+        row->index = k;
+        parent->children[k] = row;
     }
 
-    return FALSE;
+    if (moved && emit)
+    {
+        GtkTreePath *path = get_row_path(parent);
+        GtkTreeIter iter;
+
+        iter_set_row(self, &iter, parent);
+        gtk_tree_model_rows_reordered(GTK_TREE_MODEL(self), path, &iter, new_order);
+        gtk_tree_path_free(path);
+    }
+
+    g_free(new_order);
+    g_free(old_children);
 }
 
-static void add_child_node(DtDiffTreeModel *self, GtkTreeIter *iter,
-        GtkTreeIter *parent, gint source_index, DtTreeSourceNode *node)
+/**
+ * Removes a row, which must not have any children.
+ */
+static void remove_row(DtDiffTreeModel *self, DiffRow *row)
 {
-    GtkTreeIter child;
-    GPtrArray *nodeArray;
-    DtTreeSource *source = self->sources[source_index];
-    GFileInfo *info = dt_tree_source_get_file_info(source, node);
+    DiffRow *parent = row->parent;
+    GtkTreePath *path;
+    guint32 i;
+
+    g_return_if_fail(parent != NULL);
+    g_assert(row->num_children == 0);
+
+    path = get_row_path(row);
+
+    for (i=row->index + 1; i<parent->num_children; i++)
+    {
+        parent->children[i - 1] = parent->children[i];
+        parent->children[i - 1]->index = i - 1;
+    }
+    parent->num_children--;
+    parent->children = (DiffRow **) dt_slab_arrays_trim(&self->child_arrays,
+            (gpointer *) parent->children, &parent->child_capacity, parent->num_children);
+
+    g_hash_table_remove(self->row_index, row);
+    if (row->stats != NULL)
+    {
+        g_hash_table_remove(self->dirty_dirs, row);
+        dt_slab_free(&self->dir_stats, row->stats);
+    }
+    free_row_files(self, row);
+    dt_slab_arrays_free(&self->child_arrays, (gpointer *) row->children, row->child_capacity);
+    dt_slab_free(&self->rows, row);
+
+    gtk_tree_model_row_deleted(GTK_TREE_MODEL(self), path);
+
+    if (parent->num_children == 0)
+    {
+        GtkTreeIter iter;
+
+        gtk_tree_path_up(path);
+        iter_set_row(self, &iter, parent);
+        gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(self), path, &iter);
+    }
+    gtk_tree_path_free(path);
+}
+
+/**
+ * Sets or clears the node for one source in a row.
+ *
+ * This also keeps DtDiffTreeModel::dir_node_rows up to date.
+ */
+static void set_row_node(DtDiffTreeModel *self, DiffRow *row, gint source_index,
+        DtTreeSourceNode *node)
+{
+    if (row->type == G_FILE_TYPE_DIRECTORY)
+    {
+        if (row->nodes[source_index] != NULL)
+        {
+            g_hash_table_remove(self->dir_node_rows, row->nodes[source_index]);
+        }
+        if (node != NULL)
+        {
+            g_hash_table_insert(self->dir_node_rows, node, row);
+        }
+    }
+    row->nodes[source_index] = node;
+}
 
-    nodeArray = g_ptr_array_new();
-    g_ptr_array_set_size(nodeArray, self->num_sources);
-    nodeArray->pdata[source_index] = node;
+static DiffRow *find_child_row(DtDiffTreeModel *self, DiffRow *parent,
+        const gchar *name, GFileType type)
+{
+    DiffRow key;
 
-    gtk_tree_store_insert_with_values(GTK_TREE_STORE(self), &child, parent, 0,
-            DT_DIFF_TREE_MODEL_COL_NAME, g_file_info_get_name(info),
-            DT_DIFF_TREE_MODEL_COL_DIFFERENT, DT_DIFF_TYPE_DIFFERENT,
-            DT_DIFF_TREE_MODEL_COL_FILE_TYPE, g_file_info_get_file_type(info),
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, nodeArray, -1);
-    *iter = child;
-    g_ptr_array_unref(nodeArray);
+    key.parent = parent;
+    key.type = type;
+    key.name = name;
+    return g_hash_table_lookup(self->row_index, &key);
 }
 
 /**
- * Checks for differences based on the GFileInfo objects from each source.
+ * Fills in what a row adds to the totals of each directory above it.
  *
- * This basically checks everything that we can without actually reading the
- * files.
+ * A row that's missing from any source counts as missing, whether it's a
+ * file or a directory. Otherwise, directories don't count, and a file
+ * counts as different, identical, or unknown.
  */
-static DtDiffType check_file_diff_basic(gint num_sources, GFileInfo **infos)
+static void get_row_contribution(DtDiffTreeModel *self, DiffRow *row, DiffSubtreeStats *stats)
 {
+    DtTreeSourceNode *present = NULL;
+    gboolean missing = FALSE;
     gint i;
 
-    // Check if the file exists in every source.
-    for (i=0; i<num_sources; i++)
+    memset(stats, 0, sizeof(DiffSubtreeStats));
+    for (i=0; i<self->num_sources; i++)
+    {
+        if (row->nodes[i] == NULL)
+        {
+            missing = TRUE;
+        }
+        else if (present == NULL)
+        {
+            present = row->nodes[i];
+            if (row->type == G_FILE_TYPE_REGULAR)
+            {
+                stats->size = dt_tree_source_get_metadata(self->sources[i], present)->size;
+            }
+        }
+    }
+
+    if (missing)
+    {
+        stats->num_missing = 1;
+    }
+    else if (row->type != G_FILE_TYPE_DIRECTORY)
+    {
+        switch (row->diff)
+        {
+            case DT_DIFF_TYPE_IDENTICAL: stats->num_identical = 1; break;
+            case DT_DIFF_TYPE_DIFFERENT: stats->num_different = 1; break;
+            default: stats->num_unknown = 1; break;
+        }
+    }
+}
+
+static void add_subtree_stats(DiffSubtreeStats *dest, const DiffSubtreeStats *add)
+{
+    dest->num_different += add->num_different;
+    dest->num_identical += add->num_identical;
+    dest->num_unknown += add->num_unknown;
+    dest->num_missing += add->num_missing;
+    dest->size += add->size;
+}
+
+static void subtract_subtree_stats(DiffSubtreeStats *dest, const DiffSubtreeStats *sub)
+{
+    dest->num_different -= sub->num_different;
+    dest->num_identical -= sub->num_identical;
+    dest->num_unknown -= sub->num_unknown;
+    dest->num_missing -= sub->num_missing;
+    dest->size -= sub->size;
+}
+
+/**
+ * Figures out the diff type of a row from its nodes.
+ *
+ * For a file, this is just dt_diff_check_basic. A directory is different
+ * if anything under it is different or missing, and unknown if anything
+ * under it still needs to be checked.
+ */
+static DtDiffType compute_row_diff(DtDiffTreeModel *self, DiffRow *row)
+{
+    DtDiffType diff = dt_diff_check_basic(self->num_sources, self->sources, row->nodes);
+
+    if (row->stats != NULL && diff == DT_DIFF_TYPE_IDENTICAL)
+    {
+        if (row->stats->num_different > 0 || row->stats->num_missing > 0)
+        {
+            diff = DT_DIFF_TYPE_DIFFERENT;
+        }
+        else if (row->stats->num_unknown > 0)
+        {
+            diff = DT_DIFF_TYPE_UNKNOWN;
+        }
+    }
+    return diff;
+}
+
+static gboolean on_dirty_dirs_idle(gpointer userdata)
+{
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
+    GHashTable *dirty = self->dirty_dirs;
+    GHashTableIter iter;
+    gpointer key;
+
+    // Swap in a new table first, in case a row-changed handler changes
+    // anything else.
+    self->dirty_dirs = g_hash_table_new(NULL, NULL);
+    self->dirty_idle_id = 0;
+
+    g_hash_table_iter_init(&iter, dirty);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+    {
+        emit_row_changed(self, key);
+    }
+    g_hash_table_destroy(dirty);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Updates the totals of every directory above a row after the row changes.
+ *
+ * \param old The row's contribution from before the change, from
+ *      get_row_contribution. This can be NULL for a new row.
+ * \param removed TRUE if the row is about to be removed.
+ */
+static void update_parent_stats(DtDiffTreeModel *self, DiffRow *row,
+        const DiffSubtreeStats *old, gboolean removed)
+{
+    DiffSubtreeStats current;
+    DiffRow *dir;
+
+    if (removed)
+    {
+        memset(&current, 0, sizeof(current));
+    }
+    else
+    {
+        get_row_contribution(self, row, &current);
+    }
+    if (old != NULL && memcmp(old, &current, sizeof(current)) == 0)
+    {
+        return;
+    }
+
+    for (dir = row->parent; dir != NULL; dir = dir->parent)
     {
-        if (infos[i] == NULL)
+        if (old != NULL)
         {
-            // The file is missing from at least one source.
-            return DT_DIFF_TYPE_DIFFERENT;
+            subtract_subtree_stats(dir->stats, old);
         }
+        add_subtree_stats(dir->stats, &current);
+        dir->diff = compute_row_diff(self, dir);
+        g_hash_table_add(self->dirty_dirs, dir);
+    }
 
-        g_assert(g_file_info_get_file_type(infos[0]) == g_file_info_get_file_type(infos[i]));
-        g_assert(strcmp(g_file_info_get_name(infos[0]), g_file_info_get_name(infos[i])) == 0);
+    if (self->dirty_idle_id == 0)
+    {
+        self->dirty_idle_id = g_idle_add(on_dirty_dirs_idle, self);
     }
+}
+
+/**
+ * Updates a row after its nodes change.
+ *
+ * \param old The row's contribution from before the change.
+ */
+static void update_diff_type(DtDiffTreeModel *self, DiffRow *row, const DiffSubtreeStats *old)
+{
+    row->diff = compute_row_diff(self, row);
+
+    // Send out a row-changed event even if the diff type is the same, since
+    // the size and time columns come from the source nodes.
+    emit_row_changed(self, row);
+    update_parent_stats(self, row, old, FALSE);
+}
+
+/**
+ * Adds or updates a row with a new DtTreeSourceNode.
+ *
+ * If this adds a new row, then it's added to the end of the parent's
+ * children, so the caller has to call sort_new_children afterward.
+ *
+ * \return The row for \p node.
+ */
+static DiffRow *add_source_node(DtDiffTreeModel *self, DiffRow *parent,
+        gint source_index, DtTreeSourceNode *node)
+{
+    DtTreeSource *source = self->sources[source_index];
+    const char *name = dt_tree_source_get_name(source, node);
+    GFileType type = dt_tree_source_get_metadata(source, node)->type;
+    DiffRow *child;
 
-    if (g_file_info_get_file_type(infos[0]) == G_FILE_TYPE_DIRECTORY)
+    child = find_child_row(self, parent, name, type);
+    if (child != NULL)
     {
-        // We don't bother comparing directories.
-        return DT_DIFF_TYPE_IDENTICAL;
+        DiffSubtreeStats old;
+
+        get_row_contribution(self, child, &old);
+        set_row_node(self, child, source_index, node);
+        child->name = name;
+        update_diff_type(self, child, &old);
     }
-    else if (g_file_info_get_file_type(infos[0]) == G_FILE_TYPE_REGULAR)
+    else
+    {
+        child = row_new(self, parent, name, type);
+        set_row_node(self, child, source_index, node);
+        child->diff = compute_row_diff(self, child);
+        emit_row_inserted(self, child);
+        update_parent_stats(self, child, NULL, FALSE);
+    }
+    return child;
+}
+
+static void abort_row_checks(DtDiffTreeModel *self, GtkTreeIter *iter);
+
+static void remove_source_node(DtDiffTreeModel *self, DiffRow *parent,
+        gint source_index, DtTreeSourceNode *node)
+{
+    DtTreeSource *source = self->sources[source_index];
+    DiffRow *child;
+
+    child = find_child_row(self, parent, dt_tree_source_get_name(source, node),
+            dt_tree_source_get_metadata(source, node)->type);
+    if (child != NULL)
     {
-        guint32 firstCRC = 0;
-        gboolean anyCRC = FALSE;
-        gboolean allCRC = TRUE;
+        DiffSubtreeStats old;
+        GtkTreeIter iter;
+        gint i;
 
-        for (i=0; i<num_sources; i++)
+        // A running check still has this node, so stop it before the node
+        // goes away.
+        iter_set_row(self, &iter, child);
+        abort_row_checks(self, &iter);
+
+        get_row_contribution(self, child, &old);
+        set_row_node(self, child, source_index, NULL);
+        for (i=0; i<self->num_sources; i++)
         {
-            if (g_file_info_get_size(infos[0]) != g_file_info_get_size(infos[i]))
+            if (child->nodes[i] != NULL)
             {
-                return DT_DIFF_TYPE_DIFFERENT;
+                break;
             }
+        }
 
-            if (g_file_info_has_attribute(infos[i], DT_FILE_ATTRIBUTE_CRC))
+        if (i < self->num_sources)
+        {
+            // Don't leave the name pointing into a node that's going away.
+            child->name = dt_tree_source_get_name(self->sources[i], child->nodes[i]);
+            update_diff_type(self, child, &old);
+        }
+        else
+        {
+            update_parent_stats(self, child, &old, TRUE);
+            remove_row(self, child);
+        }
+    }
+}
+
+/**
+ * Fills in the rows under \p row, after the model is first created.
+ *
+ * Each source's children are already sorted by name, so this does a merge
+ * join across all of the sources: each step takes the smallest name that's
+ * left in any source, and creates the row for it with the node from every
+ * source that has that name. That way, each row is created once with all of
+ * its nodes, and we never have to look anything up in the row index.
+ *
+ * Nothing is connected to the model yet, so this doesn't emit any signals.
+ */
+static void init_tree(DtDiffTreeModel *self, DiffRow *row)
+{
+    DtTreeSourceNode * const **children = g_alloca(self->num_sources * sizeof(DtTreeSourceNode * const *));
+    const char **names = g_alloca(self->num_sources * sizeof(const char *));
+    guint *num = g_alloca(self->num_sources * sizeof(guint));
+    guint *pos = g_alloca(self->num_sources * sizeof(guint));
+    guint32 total = 0;
+    guint32 j;
+    gint i;
+
+    for (i=0; i<self->num_sources; i++)
+    {
+        children[i] = NULL;
+        num[i] = 0;
+        pos[i] = 0;
+        names[i] = NULL;
+        if (row->nodes[i] != NULL)
+        {
+            children[i] = dt_tree_source_get_child_array(self->sources[i], row->nodes[i], &num[i]);
+            if (num[i] > 0)
+            {
+                names[i] = dt_tree_source_get_name(self->sources[i], children[i][0]);
+            }
+        }
+        total += num[i];
+    }
+    if (total == 0)
+    {
+        return;
+    }
+
+    // We'll have at most one row for each child of each source.
+    row->children = (DiffRow **) dt_slab_arrays_reserve(&self->child_arrays,
+            (gpointer *) row->children, &row->child_capacity, row->num_children, total);
+
+    while (TRUE)
+    {
+        const char *name = NULL;
+        guint32 first = row->num_children;
+
+        for (i=0; i<self->num_sources; i++)
+        {
+            if (names[i] != NULL && (name == NULL || strcmp(names[i], name) < 0))
             {
-                if (!anyCRC)
+                name = names[i];
+            }
+        }
+        if (name == NULL)
+        {
+            break;
+        }
+
+        for (i=0; i<self->num_sources; i++)
+        {
+            if (names[i] != NULL && strcmp(names[i], name) == 0)
+            {
+                DtTreeSourceNode *node = children[i][pos[i]];
+                GFileType type = dt_tree_source_get_metadata(self->sources[i], node)->type;
+                DiffRow *child = NULL;
+
+                // If the sources have different types for the same name,
+                // then each type gets its own row.
+                for (j=first; j<row->num_children; j++)
                 {
-                    anyCRC = TRUE;
-                    firstCRC = g_file_info_get_attribute_uint32(infos[i], DT_FILE_ATTRIBUTE_CRC);
+                    if (row->children[j]->type == type)
+                    {
+                        child = row->children[j];
+                        break;
+                    }
                 }
-                else if (firstCRC != g_file_info_get_attribute_uint32(infos[i], DT_FILE_ATTRIBUTE_CRC))
+                if (child == NULL)
                 {
-                    return DT_DIFF_TYPE_DIFFERENT;
+                    child = row_new(self, row, name, type);
                 }
+                set_row_node(self, child, i, node);
+
+                pos[i]++;
+                names[i] = (pos[i] < num[i] ? dt_tree_source_get_name(self->sources[i], children[i][pos[i]]) : NULL);
             }
-            else
+        }
+
+        for (j=first; j<row->num_children; j++)
+        {
+            DiffRow *child = row->children[j];
+            if (child->type != G_FILE_TYPE_DIRECTORY)
             {
-                allCRC = FALSE;
+                child->diff = dt_diff_check_basic(self->num_sources, self->sources, child->nodes);
             }
         }
+    }
+
+    row->children = (DiffRow **) dt_slab_arrays_trim(&self->child_arrays,
+            (gpointer *) row->children, &row->child_capacity, row->num_children);
+
+    // The merge goes in strcmp order, but the rows are displayed in a
+    // different order.
+    sort_new_children(self, row, 0, FALSE);
 
-        if (allCRC)
+    for (j=0; j<row->num_children; j++)
+    {
+        DiffRow *child = row->children[j];
+        DiffSubtreeStats stats;
+
+        if (child->stats != NULL)
         {
-            // Every file had a CRC, and they all matched.
-            return DT_DIFF_TYPE_IDENTICAL;
+            init_tree(self, child);
+            child->diff = compute_row_diff(self, child);
+            add_subtree_stats(row->stats, child->stats);
         }
+        get_row_contribution(self, child, &stats);
+        add_subtree_stats(row->stats, &stats);
+    }
+}
+
+/**
+ * Returns the row for a directory node.
+ */
+static DiffRow *lookup_source_node(DtDiffTreeModel *self, DtTreeSource *source,
+        DtTreeSourceNode *node)
+{
+    DiffRow *row;
+
+    g_assert(node != NULL);
 
-        // We'll have to read the files to determine if they're different or not.
-        return DT_DIFF_TYPE_UNKNOWN;
+    row = g_hash_table_lookup(self->dir_node_rows, node);
+    if (row == NULL)
+    {
+        g_error("Can't find row for directory node");
     }
-    else if (g_file_info_get_file_type(infos[0]) == G_FILE_TYPE_SYMBOLIC_LINK)
+    return row;
+}
+
+static gint lookup_source_index(DtDiffTreeModel *self, DtTreeSource *source)
+{
+    gint i;
+    for (i=0; i<self->num_sources; i++)
     {
-        // For a symlink, check the target
-        const char *first_target = g_file_info_get_symlink_target(infos[0]);
-        for (i=1; i<num_sources; i++)
+        if (source == self->sources[i])
         {
-            const char *target = g_file_info_get_symlink_target(infos[1]);
-            if (g_strcmp0(target, first_target) != 0)
+            return i;
+        }
+    }
+    g_error("Invalid DtTreeSource\n");
+}
+
+/**
+ * Applies queued nodes from pending_adds until the queue is empty or until
+ * \p deadline passes.
+ *
+ * New rows are appended to the end of their parent's children first, and
+ * then each parent is sorted once at the end, so that adding a whole
+ * directory only sends out one rows-reordered signal.
+ *
+ * \param deadline A time from g_get_monotonic_time, or -1 to apply
+ *      everything.
+ * \return TRUE if the queue is empty.
+ */
+static gboolean apply_pending_adds(DtDiffTreeModel *self, gint64 deadline)
+{
+    // Maps each parent DiffRow to the number of children that it had before
+    // we started adding to it.
+    GHashTable *touched = g_hash_table_new(NULL, NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    guint count = 0;
+
+    while (!g_queue_is_empty(&self->pending_adds))
+    {
+        PendingAdd *pending = g_queue_peek_head(&self->pending_adds);
+        DiffRow *parentRow = lookup_source_node(self, self->sources[pending->source_index], pending->parent);
+
+        if (!g_hash_table_contains(touched, parentRow))
+        {
+            g_hash_table_insert(touched, parentRow, GUINT_TO_POINTER(parentRow->num_children));
+        }
+
+        while (self->pending_pos < pending->num_nodes)
+        {
+            add_source_node(self, parentRow, pending->source_index, pending->nodes[self->pending_pos++]);
+
+            // Only check the time every so often, since adding a row is
+            // cheap.
+            if (deadline >= 0 && (++count % 64) == 0 && g_get_monotonic_time() >= deadline)
             {
-                return DT_DIFF_TYPE_DIFFERENT;
+                break;
             }
         }
-        return DT_DIFF_TYPE_IDENTICAL;
+
+        if (self->pending_pos < pending->num_nodes)
+        {
+            break;
+        }
+        g_free(g_queue_pop_head(&self->pending_adds));
+        self->pending_pos = 0;
+    }
+
+    g_hash_table_iter_init(&iter, touched);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        sort_new_children(self, key, GPOINTER_TO_UINT(value), TRUE);
+    }
+    g_hash_table_destroy(touched);
+
+    return g_queue_is_empty(&self->pending_adds);
+}
+
+static gboolean on_apply_pending_idle(gpointer userdata)
+{
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
+
+    if (apply_pending_adds(self, g_get_monotonic_time() + APPLY_SLICE_USEC))
+    {
+        self->pending_idle_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void dt_diff_tree_model_flush(DtDiffTreeModel *self)
+{
+    if (self->pending_idle_id != 0)
+    {
+        g_source_remove(self->pending_idle_id);
+        self->pending_idle_id = 0;
+    }
+    apply_pending_adds(self, -1);
+}
+
+/**
+ * Queues up new nodes from a source, to be added to the model from an idle
+ * callback.
+ *
+ * A scan sends out a lot of nodes-added signals, and adding each batch to
+ * the model right away means that the view has to process every one of them
+ * before it can redraw. Instead, we add as many as we can in each idle
+ * callback, and then let the main loop run.
+ *
+ * The nodes stay valid until the source removes them, and we flush the queue
+ * before handling a nodes-removed or nodes-changed signal, so the pointers in
+ * the queue are always valid.
+ */
+static void on_source_nodes_added(DtTreeSource *source, DtTreeSourceNode *parent,
+        gint num_added, DtTreeSourceNode **nodes, gpointer userdata)
+{
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
+    PendingAdd *pending;
+
+    if (num_added <= 0)
+    {
+        return;
     }
-    else
+
+    pending = g_malloc(sizeof(PendingAdd) + num_added * sizeof(DtTreeSourceNode *));
+    pending->source_index = lookup_source_index(self, source);
+    pending->parent = parent;
+    pending->num_nodes = num_added;
+    memcpy(pending->nodes, nodes, num_added * sizeof(DtTreeSourceNode *));
+    g_queue_push_tail(&self->pending_adds, pending);
+
+    if (self->pending_idle_id == 0)
     {
-        // Ignore anything other than a regular file for now.
-        return DT_DIFF_TYPE_UNKNOWN;
+        self->pending_idle_id = g_idle_add(on_apply_pending_idle, self);
     }
 }
 
-static void update_diff_type(DtDiffTreeModel *self, GtkTreeIter *iter)
+static void on_source_nodes_removed(DtTreeSource *source, DtTreeSourceNode *parent,
+        gint num_removed, DtTreeSourceNode **nodes, gpointer userdata)
 {
-    GPtrArray *nodeArray = NULL;
-    GFileInfo **infos;
-    DtDiffType diff;
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
+    DiffRow *parentRow;
+    gint source_index;
     gint i;
 
-    gtk_tree_model_get(GTK_TREE_MODEL(self), iter,
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
-    infos = g_malloc(self->num_sources * sizeof(GFileInfo *));
-    for (i=0; i<self->num_sources; i++)
+    dt_diff_tree_model_flush(self);
+    parentRow = lookup_source_node(self, source, parent);
+    source_index = lookup_source_index(self, source);
+
+    for (i=0; i<num_removed; i++)
     {
-        if (nodeArray->pdata[i] != NULL)
-        {
-            infos[i] = dt_tree_source_get_file_info(self->sources[i], nodeArray->pdata[i]);
-        }
-        else
-        {
-            infos[i] = NULL;
-        }
+        remove_source_node(self, parentRow, source_index, nodes[i]);
     }
-    diff = check_file_diff_basic(self->num_sources, infos);
-    g_free(infos);
-    g_ptr_array_unref(nodeArray);
-
-    gtk_tree_store_set(GTK_TREE_STORE(self), iter, DT_DIFF_TREE_MODEL_COL_DIFFERENT, diff, -1);
 }
 
 /**
- * Adds or updates a row with a new DtTreeSourceNode.
+ * Throws out anything that we know about a row's contents after one of the
+ * files changes.
  */
-static void add_source_node(DtDiffTreeModel *self, GtkTreeIter *parent,
-        gint source_index, DtTreeSourceNode *node)
+static void invalidate_row(DtDiffTreeModel *self, DiffRow *row, gint source_index)
 {
-    GtkTreeIter child;
-    GFileInfo *info = dt_tree_source_get_file_info(self->sources[source_index], node);
-
-    if (find_child_iter(self, &child, parent, g_file_info_get_name(info),
-                g_file_info_get_file_type(info)))
-    {
-        GPtrArray *nodeArray = NULL;
+    GtkTreeIter iter;
 
-        gtk_tree_model_get(GTK_TREE_MODEL(self), &child,
-                DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
-        nodeArray->pdata[source_index] = node;
-        g_ptr_array_unref(nodeArray);
+    iter_set_row(self, &iter, row);
+    abort_row_checks(self, &iter);
 
-        // Update the diff type and send out a row-changed event
-        update_diff_type(self, &child);
+    if (row->files != NULL)
+    {
+        g_clear_object(&row->files[source_index]);
     }
-    else
+
+    // add_source_node already redid the basic checks, so if we still don't
+    // know whether the files are different, then the contents need to be
+    // checked again.
+    if (row->type == G_FILE_TYPE_REGULAR && row->diff == DT_DIFF_TYPE_UNKNOWN)
     {
-        add_child_node(self, &child, parent, source_index, node);
+        g_signal_emit(self, diff_tree_model_signals[SIGNAL_DIFF_INVALIDATED], 0, &iter);
     }
 }
 
-static void remove_source_node(DtDiffTreeModel *self, GtkTreeIter *parent,
-        gint source_index, DtTreeSourceNode *node)
+static void on_source_nodes_changed(DtTreeSource *source, DtTreeSourceNode *parent,
+        gint num_changed, DtTreeSourceNode **nodes, GFileInfo **old_info, gpointer userdata)
 {
-    GtkTreeIter child;
-    GFileInfo *info = dt_tree_source_get_file_info(self->sources[source_index], node);
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
+    gint source_index = lookup_source_index(self, source);
+    DiffRow *parentRow;
+    guint32 first_new;
+    gint i;
 
-    if (find_child_iter(self, &child, parent, g_file_info_get_name(info),
-                g_file_info_get_file_type(info)))
-    {
-        GPtrArray *nodeArray = NULL;
-        gboolean keep = FALSE;
-        gint i;
+    dt_diff_tree_model_flush(self);
 
-        gtk_tree_model_get(GTK_TREE_MODEL(self), &child,
-                DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
-        nodeArray->pdata[source_index] = NULL;
-        for (i=0; i<self->num_sources; i++)
-        {
-            if (nodeArray->pdata[i] != NULL)
-            {
-                keep = TRUE;
-                break;
-            }
-        }
-        g_ptr_array_unref(nodeArray);
+    if (parent == NULL)
+    {
+        // The root node changed.
+        set_row_node(self, self->root, source_index, nodes[0]);
+        emit_row_changed(self, self->root);
+        return;
+    }
 
-        if (keep)
-        {
-            update_diff_type(self, &child);
-        }
-        else
+    parentRow = lookup_source_node(self, source, parent);
+    first_new = parentRow->num_children;
+    for (i=0; i<num_changed; i++)
+    {
+        DiffRow *child = add_source_node(self, parentRow, source_index, nodes[i]);
+        if (child->index < first_new)
         {
-            g_assert(!gtk_tree_model_iter_has_child(GTK_TREE_MODEL(self), &child));
-            gtk_tree_store_remove(GTK_TREE_STORE(self), &child);
+            invalidate_row(self, child, source_index);
         }
     }
+    sort_new_children(self, parentRow, first_new, TRUE);
 }
 
-static void init_tree(DtDiffTreeModel *self, GtkTreeIter *parent)
+static GtkTreeModelFlags dt_diff_tree_model_get_flags(GtkTreeModel *model)
 {
-    GPtrArray *nodeArray = NULL;
-    GtkTreeIter childIter;
-    gboolean ok;
-    gint i;
-
-    gtk_tree_model_get(GTK_TREE_MODEL(self), parent,
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
+    return GTK_TREE_MODEL_ITERS_PERSIST;
+}
 
-    // TODO: Rewrite this to be more efficient? I can collect a map from (name,
-    // type) to the child nodes, then add each node once. If the model always
-    // starts with just the root node, though, then it won't matter.
-    for (i=0; i<self->num_sources; i++)
-    {
-        if (nodeArray->pdata[i] != NULL)
-        {
-            GList *children = dt_tree_source_get_children(self->sources[i], nodeArray->pdata[i]);
-            GList *ch;
-            for (ch = children; ch != NULL; ch = ch->next)
-            {
-                add_source_node(self, parent, i, ch->data);
-            }
-            g_list_free(children);
-        }
-    }
-    g_ptr_array_unref(nodeArray);
+static gint dt_diff_tree_model_get_n_columns(GtkTreeModel *model)
+{
+    return DT_DIFF_TREE_MODEL_NUM_COLUMNS;
+}
 
-    for (ok = gtk_tree_model_iter_children(GTK_TREE_MODEL(self), &childIter, parent);
-            ok;
-            ok = gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &childIter))
+static GType dt_diff_tree_model_get_column_type(GtkTreeModel *model, gint index)
+{
+    switch (index)
     {
-        init_tree(self, &childIter);
+        case DT_DIFF_TREE_MODEL_COL_NAME: return G_TYPE_STRING;
+        case DT_DIFF_TREE_MODEL_COL_FILE_TYPE: return G_TYPE_INT;
+        case DT_DIFF_TREE_MODEL_COL_DIFFERENT: return G_TYPE_INT;
+        case DT_DIFF_TREE_MODEL_COL_NODE_ARRAY: return G_TYPE_POINTER;
+        case DT_DIFF_TREE_MODEL_COL_NUM_DIFFERENT: return G_TYPE_UINT;
+        case DT_DIFF_TREE_MODEL_COL_NUM_IDENTICAL: return G_TYPE_UINT;
+        case DT_DIFF_TREE_MODEL_COL_NUM_UNKNOWN: return G_TYPE_UINT;
+        case DT_DIFF_TREE_MODEL_COL_NUM_MISSING: return G_TYPE_UINT;
+        case DT_DIFF_TREE_MODEL_COL_TOTAL_SIZE: return G_TYPE_UINT64;
+        default:
+            g_return_val_if_reached(G_TYPE_INVALID);
     }
 }
 
-static void lookup_source_node(DtDiffTreeModel *self, DtTreeSource *source,
-        DtTreeSourceNode *node, GtkTreeIter *iter)
+static gboolean dt_diff_tree_model_get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
 {
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
+    gint depth = 0;
+    gint *indices = gtk_tree_path_get_indices_with_depth(path, &depth);
+    DiffRow *row = self->root;
     gint i;
 
-    g_assert(node != NULL);
-
-    if (iter != NULL)
+    if (depth <= 0 || indices[0] != 0)
+    {
+        return iter_set_row(self, iter, NULL);
+    }
+    for (i=1; i<depth && row != NULL; i++)
     {
-        gint depth = -1;
-        DtTreeSourceNode **path = dt_tree_source_get_node_path(source, node, &depth);
-        if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(self), iter, NULL))
+        if (indices[i] >= 0 && (guint32) indices[i] < row->num_children)
         {
-            g_error("No root node");
+            row = row->children[indices[i]];
         }
-
-        g_assert(depth > 0);
-
-        for (i=1; path[i] != NULL; i++)
+        else
         {
-            GFileInfo *info = dt_tree_source_get_file_info(source, path[i]);
-            if (!find_child_iter(self, iter, iter, g_file_info_get_name(info), g_file_info_get_file_type(info)))
-            {
-                g_error("Can't find child node");
-            }
+            row = NULL;
         }
-        g_free(path);
     }
+    return iter_set_row(self, iter, row);
 }
 
-static gint lookup_source_index(DtDiffTreeModel *self, DtTreeSource *source)
+static GtkTreePath *dt_diff_tree_model_get_path(GtkTreeModel *model, GtkTreeIter *iter)
 {
-    gint i;
-    for (i=0; i<self->num_sources; i++)
-    {
-        if (source == self->sources[i])
-        {
-            return i;
-        }
-    }
-    g_error("Invalid DtTreeSource\n");
+    DiffRow *row = iter_get_row(DT_DIFF_TREE_MODEL(model), iter);
+    g_return_val_if_fail(row != NULL, NULL);
+    return get_row_path(row);
 }
 
-static void on_source_nodes_added(DtTreeSource *source, DtTreeSourceNode *parent,
-        gint num_added, DtTreeSourceNode **nodes, gpointer userdata)
+static void dt_diff_tree_model_get_value(GtkTreeModel *model, GtkTreeIter *iter,
+        gint column, GValue *value)
 {
-    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
-    GtkTreeIter parentIter;
-    gint source_index = -1;
-    gint i;
+    DiffRow *row = iter_get_row(DT_DIFF_TREE_MODEL(model), iter);
 
-    lookup_source_node(self, source, parent, &parentIter);
-    source_index = lookup_source_index(self, source);
+    g_value_init(value, dt_diff_tree_model_get_column_type(model, column));
+    g_return_if_fail(row != NULL);
 
-    for (i=0; i<num_added; i++)
+    switch (column)
     {
-        add_source_node(self, &parentIter, source_index, nodes[i]);
+        case DT_DIFF_TREE_MODEL_COL_NAME:
+            // The name stays valid for as long as the row does, so there's no
+            // need to copy it.
+            g_value_set_static_string(value, row->name);
+            break;
+        case DT_DIFF_TREE_MODEL_COL_FILE_TYPE:
+            g_value_set_int(value, row->type);
+            break;
+        case DT_DIFF_TREE_MODEL_COL_DIFFERENT:
+            g_value_set_int(value, row->diff);
+            break;
+        case DT_DIFF_TREE_MODEL_COL_NODE_ARRAY:
+            g_value_set_pointer(value, row->nodes);
+            break;
+        case DT_DIFF_TREE_MODEL_COL_NUM_DIFFERENT:
+            g_value_set_uint(value, (row->stats != NULL ? row->stats->num_different : 0));
+            break;
+        case DT_DIFF_TREE_MODEL_COL_NUM_IDENTICAL:
+            g_value_set_uint(value, (row->stats != NULL ? row->stats->num_identical : 0));
+            break;
+        case DT_DIFF_TREE_MODEL_COL_NUM_UNKNOWN:
+            g_value_set_uint(value, (row->stats != NULL ? row->stats->num_unknown : 0));
+            break;
+        case DT_DIFF_TREE_MODEL_COL_NUM_MISSING:
+            g_value_set_uint(value, (row->stats != NULL ? row->stats->num_missing : 0));
+            break;
+        case DT_DIFF_TREE_MODEL_COL_TOTAL_SIZE:
+            g_value_set_uint64(value, (row->stats != NULL ? row->stats->size : 0));
+            break;
     }
 }
 
-static void on_source_nodes_removed(DtTreeSource *source, DtTreeSourceNode *parent,
-        gint num_removed, DtTreeSourceNode **nodes, gpointer userdata)
+static gboolean dt_diff_tree_model_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
 {
-    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
-    GtkTreeIter parentIter;
-    gint source_index = -1;
-    gint i;
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
+    DiffRow *row = iter_get_row(self, iter);
 
-    lookup_source_node(self, source, parent, &parentIter);
-    source_index = lookup_source_index(self, source);
+    if (row != NULL && row->parent != NULL && row->index + 1 < row->parent->num_children)
+    {
+        return iter_set_row(self, iter, row->parent->children[row->index + 1]);
+    }
+    return iter_set_row(self, iter, NULL);
+}
 
-    for (i=0; i<num_removed; i++)
+static gboolean dt_diff_tree_model_iter_previous(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
+    DiffRow *row = iter_get_row(self, iter);
+
+    if (row != NULL && row->parent != NULL && row->index > 0)
     {
-        remove_source_node(self, &parentIter, source_index, nodes[i]);
+        return iter_set_row(self, iter, row->parent->children[row->index - 1]);
     }
+    return iter_set_row(self, iter, NULL);
 }
 
-static void on_source_nodes_changed(DtTreeSource *source, DtTreeSourceNode *parent,
-        gint num_changed, DtTreeSourceNode **nodes, GFileInfo **old_info, gpointer userdata)
+static gboolean dt_diff_tree_model_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter,
+        GtkTreeIter *parent, gint n)
 {
-    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(userdata);
-    GtkTreeIter parentIterBuf;
-    GtkTreeIter *parentIter;
-    gint source_index = -1;
-    gint i;
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
 
-    if (parent != NULL)
+    if (parent == NULL)
     {
-        parentIter = &parentIterBuf;
-        lookup_source_node(self, source, parent, parentIter);
+        return iter_set_row(self, iter, (n == 0 ? self->root : NULL));
     }
     else
     {
-        parentIter = NULL;
+        DiffRow *row = iter_get_row(self, parent);
+        if (row != NULL && n >= 0 && (guint32) n < row->num_children)
+        {
+            return iter_set_row(self, iter, row->children[n]);
+        }
+        return iter_set_row(self, iter, NULL);
     }
-    source_index = lookup_source_index(self, source);
+}
 
-    for (i=0; i<num_changed; i++)
-    {
-        add_source_node(self, parentIter, source_index, nodes[i]);
-    }
+static gboolean dt_diff_tree_model_iter_children(GtkTreeModel *model, GtkTreeIter *iter,
+        GtkTreeIter *parent)
+{
+    return dt_diff_tree_model_iter_nth_child(model, iter, parent, 0);
 }
 
-DtDiffTreeModel *dt_diff_tree_model_new(gint num_sources, DtTreeSource **sources,
-        int num_extra_columns, GType *extra_columns)
+static gint dt_diff_tree_model_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
 {
-    GType *column_types = g_malloc0((DT_DIFF_TREE_MODEL_NUM_COLUMNS + num_extra_columns) * sizeof(GType));
-    DtDiffTreeModel *self = g_object_new(DT_TYPE_DIFF_TREE_MODEL, NULL);
-    GtkTreeIter root;
-    GPtrArray *nodeArray;
-    gint i;
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
 
-    column_types[DT_DIFF_TREE_MODEL_COL_NAME] = G_TYPE_STRING;
-    column_types[DT_DIFF_TREE_MODEL_COL_FILE_TYPE] = G_TYPE_INT;
-    column_types[DT_DIFF_TREE_MODEL_COL_DIFFERENT] = G_TYPE_INT;
-    column_types[DT_DIFF_TREE_MODEL_COL_NODE_ARRAY] = G_TYPE_PTR_ARRAY;
-    column_types[DT_DIFF_TREE_MODEL_COL_INTERNAL] = DT_TYPE_INTERNAL_TREE_DATA;
-    for (i=0; i<num_extra_columns; i++)
+    if (iter == NULL)
+    {
+        return (self->root != NULL ? 1 : 0);
+    }
+    else
     {
-        column_types[DT_DIFF_TREE_MODEL_NUM_COLUMNS + i] = extra_columns[i];
+        DiffRow *row = iter_get_row(self, iter);
+        return (row != NULL ? row->num_children : 0);
     }
+}
+
+static gboolean dt_diff_tree_model_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return dt_diff_tree_model_iter_n_children(model, iter) > 0;
+}
+
+static gboolean dt_diff_tree_model_iter_parent(GtkTreeModel *model, GtkTreeIter *iter,
+        GtkTreeIter *child)
+{
+    DtDiffTreeModel *self = DT_DIFF_TREE_MODEL(model);
+    DiffRow *row = iter_get_row(self, child);
 
-    gtk_tree_store_set_column_types(GTK_TREE_STORE(self), DT_DIFF_TREE_MODEL_NUM_COLUMNS + num_extra_columns, column_types);
-    g_free(column_types);
+    return iter_set_row(self, iter, (row != NULL ? row->parent : NULL));
+}
+
+static void dt_diff_tree_model_tree_model_init(GtkTreeModelIface *iface)
+{
+    iface->get_flags = dt_diff_tree_model_get_flags;
+    iface->get_n_columns = dt_diff_tree_model_get_n_columns;
+    iface->get_column_type = dt_diff_tree_model_get_column_type;
+    iface->get_iter = dt_diff_tree_model_get_iter;
+    iface->get_path = dt_diff_tree_model_get_path;
+    iface->get_value = dt_diff_tree_model_get_value;
+    iface->iter_next = dt_diff_tree_model_iter_next;
+    iface->iter_previous = dt_diff_tree_model_iter_previous;
+    iface->iter_children = dt_diff_tree_model_iter_children;
+    iface->iter_has_child = dt_diff_tree_model_iter_has_child;
+    iface->iter_n_children = dt_diff_tree_model_iter_n_children;
+    iface->iter_nth_child = dt_diff_tree_model_iter_nth_child;
+    iface->iter_parent = dt_diff_tree_model_iter_parent;
+}
+
+DtDiffTreeModel *dt_diff_tree_model_new(gint num_sources, DtTreeSource **sources)
+{
+    DtDiffTreeModel *self = g_object_new(DT_TYPE_DIFF_TREE_MODEL, NULL);
+    gint i;
 
     self->num_sources = num_sources;
     self->sources = g_malloc(num_sources * sizeof(DtTreeSource *));
@@ -568,24 +1465,19 @@ DtDiffTreeModel *dt_diff_tree_model_new(gint num_sources, DtTreeSource **sources
     {
         self->sources[i] = g_object_ref(sources[i]);
     }
+    dt_slab_init(&self->rows, sizeof(DiffRow) + num_sources * sizeof(DtTreeSourceNode *),
+            ROWS_PER_CHUNK);
 
     // Add the root node.
-    nodeArray = g_ptr_array_new();
-    g_ptr_array_set_size(nodeArray, num_sources);
+    self->root = row_new(self, NULL, "/", G_FILE_TYPE_DIRECTORY);
     for (i=0; i<num_sources; i++)
     {
-        nodeArray->pdata[i] = dt_tree_source_get_root(sources[i]);
+        set_row_node(self, self->root, i, dt_tree_source_get_root(sources[i]));
     }
-    gtk_tree_store_insert_with_values(GTK_TREE_STORE(self), &root, NULL, 0,
-            DT_DIFF_TREE_MODEL_COL_NAME, "/",
-            DT_DIFF_TREE_MODEL_COL_DIFFERENT, DT_DIFF_TYPE_IDENTICAL,
-            DT_DIFF_TREE_MODEL_COL_FILE_TYPE, G_FILE_TYPE_DIRECTORY,
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, nodeArray,
-            -1);
-    g_ptr_array_unref(nodeArray);
 
     // Initialize the rest of the tree
-    init_tree(self, &root);
+    init_tree(self, self->root);
+    self->root->diff = compute_row_diff(self, self->root);
 
     for (i=0; i<num_sources; i++)
     {
@@ -612,38 +1504,48 @@ DtTreeSource *dt_diff_tree_model_get_source(DtDiffTreeModel *self, gint source_i
 DtTreeSourceNode *dt_diff_tree_model_get_source_node(DtDiffTreeModel *self,
         gint source_index, GtkTreeIter *iter)
 {
-    GPtrArray *nodeArray = NULL;
-    DtTreeSourceNode *node = NULL;
+    DiffRow *row;
 
     g_return_val_if_fail(source_index >= 0, NULL);
     g_return_val_if_fail(source_index < self->num_sources, NULL);
 
-    gtk_tree_model_get(GTK_TREE_MODEL(self), iter,
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
-    g_return_val_if_fail(nodeArray != NULL, NULL);
-    node = nodeArray->pdata[source_index];
-    g_ptr_array_unref(nodeArray);
-    return node;
+    row = iter_get_row(self, iter);
+    g_return_val_if_fail(row != NULL, NULL);
+    return row->nodes[source_index];
 }
 
-typedef struct
+void dt_diff_tree_model_prioritize_row(DtDiffTreeModel *self, GtkTreeIter *iter)
 {
-    GInputStream *stream;
-} CheckDiffSourceState;
+    gint i;
+
+    for (i=0; i<self->num_sources; i++)
+    {
+        DtTreeSourceNode *node = dt_diff_tree_model_get_source_node(self, i, iter);
+        if (node != NULL)
+        {
+            if (dt_tree_source_get_metadata(self->sources[i], node)->type == G_FILE_TYPE_DIRECTORY)
+            {
+                dt_tree_source_prioritize_node(self->sources[i], node);
+            }
+        }
+    }
+}
 
 typedef struct
 {
     DtDiffTreeModel *model;
+    GTask *task;
     GtkTreeRowReference *row;
     gboolean aborted;
 
-    CheckDiffSourceState *sources;
-
-    gchar buffer0[READ_BLOCK_SIZE];
-    gchar buffer1[READ_BLOCK_SIZE];
-    gsize numread;
-
-    gint pending_source;
+    /**
+     * Cancelled if the row changes, or if the caller's GCancellable is
+     * cancelled. This is separate from the caller's GCancellable, since the
+     * caller might use the same one for many checks.
+     */
+    GCancellable *cancellable;
+    GCancellable *caller_cancellable;
+    gulong cancel_handler_id;
 } CheckDiffState;
 
 void cleanup_check_diff_state(gpointer ptr)
@@ -651,180 +1553,52 @@ void cleanup_check_diff_state(gpointer ptr)
     if (ptr != NULL)
     {
         CheckDiffState *state = ptr;
-        gint i;
 
-        if (state->sources != NULL)
+        state->model->running_checks = g_list_remove(state->model->running_checks, state);
+        if (state->caller_cancellable != NULL)
         {
-            for (i=0; i<state->model->num_sources; i++)
-            {
-                g_clear_object(&state->sources[i].stream);
-            }
-            g_free(state->sources);
+            g_cancellable_disconnect(state->caller_cancellable, state->cancel_handler_id);
+            g_object_unref(state->caller_cancellable);
         }
-
+        g_clear_object(&state->cancellable);
         gtk_tree_row_reference_free(state->row);
         g_clear_object(&state->model);
         g_free(state);
     }
 }
 
-static void check_diff_start_next_open(GTask *task, gint source_index);
-static void check_diff_start_next_read(GTask *task, gint source_index);
-
-void on_check_diff_open_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+static void on_check_caller_cancelled(GCancellable *cancellable, gpointer userdata)
 {
-    GTask *task = G_TASK(userdata);
-    CheckDiffState *state = g_task_get_task_data(task);
-    GError *error = NULL;
-    gint source_index = state->pending_source;
-
-    g_assert(state->model->sources[source_index] == DT_TREE_SOURCE(sourceobj));
-
-    state->sources[source_index].stream = dt_tree_source_open_file_finish(DT_TREE_SOURCE(sourceobj), res, &error);
-    if (state->sources[source_index].stream == NULL)
-    {
-        g_task_return_error(task, error);
-        return;
-    }
-
-    if (source_index + 1 < state->model->num_sources)
-    {
-        check_diff_start_next_open(task, source_index + 1);
-    }
-    else
-    {
-        check_diff_start_next_read(task, 0);
-    }
+    g_cancellable_cancel(G_CANCELLABLE(userdata));
 }
 
-void on_check_diff_read_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+static void on_check_contents_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
 {
     GTask *task = G_TASK(userdata);
-    CheckDiffState *state = g_task_get_task_data(task);
-    gint source_index = state->pending_source;
     GError *error = NULL;
-    gsize num = 0;
+    DtDiffType result = dt_diff_check_contents_finish(res, NULL, &error);
 
-    if (!g_input_stream_read_all_finish(G_INPUT_STREAM(sourceobj), res, &num, &error))
+    if (error != NULL)
     {
         g_task_return_error(task, error);
-        return;
-    }
-
-    if (source_index == 0)
-    {
-        state->numread = num;
-    }
-    else
-    {
-        if (state->numread != num)
-        {
-            g_task_return_int(task, DT_DIFF_TYPE_DIFFERENT);
-            return;
-        }
-        if (memcmp(state->buffer0, state->buffer1, num) != 0)
-        {
-            g_task_return_int(task, DT_DIFF_TYPE_DIFFERENT);
-            return;
-        }
-    }
-
-    if (source_index + 1 < state->model->num_sources)
-    {
-        check_diff_start_next_read(task, source_index + 1);
-    }
-    else
-    {
-        // We got to the last source.
-        if (num == 0)
-        {
-            // We read to the end of the file with no differences
-            g_task_return_int(task, DT_DIFF_TYPE_IDENTICAL);
-            return;
-        }
-        else
-        {
-            // Start reading the next block
-            check_diff_start_next_read(task, 0);
-        }
-    }
-}
-
-static void check_diff_start_next_read(GTask *task, gint source_index)
-{
-    CheckDiffState *state = g_task_get_task_data(task);
-    void *buffer;
-
-    if (source_index == 0)
-    {
-        buffer = state->buffer0;
     }
     else
     {
-        buffer = state->buffer1;
-    }
-
-    state->pending_source = source_index;
-    g_input_stream_read_all_async(state->sources[source_index].stream,
-            buffer, READ_BLOCK_SIZE,
-            g_task_get_priority(task), g_task_get_cancellable(task),
-            on_check_diff_read_ready, task);
-}
-
-static void check_diff_start_next_open(GTask *task, gint source_index)
-{
-    CheckDiffState *state = g_task_get_task_data(task);
-    GPtrArray *nodeArray = NULL;
-    GtkTreePath *path;
-    GtkTreeIter iter;
-
-    path = gtk_tree_row_reference_get_path(state->row);
-    if (path == NULL)
-    {
-        // TODO: Pick a better error code for this
-        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
-                "File was removed from source");
-        return;
-    }
-    if (!gtk_tree_model_get_iter(GTK_TREE_MODEL(state->model), &iter, path))
-    {
-        gtk_tree_path_free(path);
-        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
-                "File was removed from source");
-        return;
-    }
-    gtk_tree_path_free(path);
-
-    gtk_tree_model_get(GTK_TREE_MODEL(state->model), &iter,
-            DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodeArray, -1);
-
-    if (nodeArray->pdata[source_index] == NULL)
-    {
-        g_task_return_int(task, DT_DIFF_TYPE_DIFFERENT);
-        g_ptr_array_unref(nodeArray);
-        return;
+        g_task_return_int(task, result);
     }
-
-    state->pending_source = source_index;
-    dt_tree_source_open_file_async(state->model->sources[source_index],
-            nodeArray->pdata[source_index], g_task_get_priority(task),
-            g_task_get_cancellable(task), on_check_diff_open_ready, task);
 }
 
 static gboolean check_diff_can_run(DtDiffTreeModel *self, GtkTreeIter *iter)
 {
-    DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
+    DiffRow *row = iter_get_row(self, iter);
     DtTreeSourceNode *node;
-    GFileInfo *info;
 
-    gtk_tree_model_get(GTK_TREE_MODEL(self), iter,
-            DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
-    if (diff != DT_DIFF_TYPE_UNKNOWN)
+    if (row == NULL || row->type != G_FILE_TYPE_REGULAR || row->diff != DT_DIFF_TYPE_UNKNOWN)
     {
         return FALSE;
     }
 
-    node = dt_diff_tree_model_get_source_node(self, 0, iter);
+    node = row->nodes[0];
     if (node == NULL)
     {
         // This shouldn't happen. If this file is missing from any source, then
@@ -833,8 +1607,7 @@ static gboolean check_diff_can_run(DtDiffTreeModel *self, GtkTreeIter *iter)
         return FALSE;
     }
 
-    info = dt_tree_source_get_file_info(self->sources[0], node);
-    if (g_file_info_get_size(info) > self->max_read_size)
+    if ((gint64) dt_tree_source_get_metadata(self->sources[0], node)->size > self->max_read_size)
     {
         // This file is bigger than we're willing to read
         return FALSE;
@@ -850,7 +1623,6 @@ void dt_diff_tree_model_check_difference_async(DtDiffTreeModel *self,
     GTask *task;
     CheckDiffState *state;
     GtkTreePath *path;
-    gint i;
 
     if (!check_diff_can_run(self, iter))
     {
@@ -860,16 +1632,6 @@ void dt_diff_tree_model_check_difference_async(DtDiffTreeModel *self,
         return;
     }
 
-    if (cancellable == NULL)
-    {
-        // We need a GCancellable internally, so create one if the caller
-        // didn't provide one.
-        cancellable = g_cancellable_new();
-    }
-    else
-    {
-        g_object_ref(cancellable);
-    }
     task = g_task_new(self, cancellable, callback, userdata);
     g_task_set_priority(task, io_priority);
 
@@ -877,22 +1639,57 @@ void dt_diff_tree_model_check_difference_async(DtDiffTreeModel *self,
     path = gtk_tree_model_get_path(GTK_TREE_MODEL(self), iter);
 
     state->model = g_object_ref(self);
+    state->task = task;
     state->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(self), path);
     gtk_tree_path_free(path);
 
-    state->sources = g_malloc(self->num_sources * sizeof(CheckDiffSourceState));
-    for (i=0; i<self->num_sources; i++)
+    // Use our own GCancellable, so that aborting this check doesn't cancel
+    // anything else that shares the caller's.
+    state->cancellable = g_cancellable_new();
+    if (cancellable != NULL)
     {
-        state->sources[i].stream = NULL;
+        state->caller_cancellable = g_object_ref(cancellable);
+        state->cancel_handler_id = g_cancellable_connect(cancellable,
+                G_CALLBACK(on_check_caller_cancelled), state->cancellable, NULL);
     }
+    self->running_checks = g_list_prepend(self->running_checks, state);
     g_task_set_task_data(task, state, cleanup_check_diff_state);
 
-    // TODO: Abort the check if the file changes or is removed while it's
-    // running. For this to work, I have to make sure that the row-changed and
-    // row-deleted callbacks get disconnected when the GTask is destroyed.
+    dt_diff_check_contents_async(self->num_sources, self->sources,
+            iter_get_row(self, iter)->nodes, io_priority, state->cancellable,
+            on_check_contents_ready, task);
+}
+
+/**
+ * Aborts any running checks for a row, because one of the files changed.
+ *
+ * The checks still finish through dt_diff_tree_model_check_difference_finish,
+ * but they don't change the model.
+ */
+static void abort_row_checks(DtDiffTreeModel *self, GtkTreeIter *iter)
+{
+    GtkTreePath *path;
+    GList *node;
+
+    if (self->running_checks == NULL)
+    {
+        return;
+    }
+
+    path = gtk_tree_model_get_path(GTK_TREE_MODEL(self), iter);
+    for (node = self->running_checks; node != NULL; node = node->next)
+    {
+        CheckDiffState *state = node->data;
+        GtkTreePath *rowPath = gtk_tree_row_reference_get_path(state->row);
 
-    check_diff_start_next_open(task, 0);
-    g_object_unref(cancellable);
+        if (!state->aborted && rowPath != NULL && gtk_tree_path_compare(path, rowPath) == 0)
+        {
+            state->aborted = TRUE;
+            g_cancellable_cancel(state->cancellable);
+        }
+        gtk_tree_path_free(rowPath);
+    }
+    gtk_tree_path_free(path);
 }
 
 gboolean dt_diff_tree_model_check_difference_finish(DtDiffTreeModel *self, GAsyncResult *res, GError **error)
@@ -924,13 +1721,15 @@ gboolean dt_diff_tree_model_check_difference_finish(DtDiffTreeModel *self, GAsyn
             {
                 if (gtk_tree_model_get_iter(GTK_TREE_MODEL(self), &iter, path))
                 {
-                    DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
-                    gtk_tree_model_get(GTK_TREE_MODEL(self), &iter,
-                            DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
-                    if (diff == DT_DIFF_TYPE_UNKNOWN)
+                    DiffRow *row = iter_get_row(self, &iter);
+                    if (row->diff == DT_DIFF_TYPE_UNKNOWN)
                     {
-                        gtk_tree_store_set(GTK_TREE_STORE(self), &iter,
-                                DT_DIFF_TREE_MODEL_COL_DIFFERENT, (DtDiffType) result, -1);
+                        DiffSubtreeStats old;
+
+                        get_row_contribution(self, row, &old);
+                        row->diff = result;
+                        emit_row_changed(self, row);
+                        update_parent_stats(self, row, &old, FALSE);
                     }
                 }
                 gtk_tree_path_free(path);
@@ -1018,8 +1817,17 @@ static GFile *create_temp_file(const char *filename, GInputStream *stream, GErro
 
 GFile *dt_diff_tree_model_get_fs_file(DtDiffTreeModel *self, GtkTreeIter *iter, gint index, GError **error)
 {
-    DtInternalTreeData *data = dt_internal_tree_data_lookup(self, iter, TRUE);
-    GFile *fspath = data->files[index];
+    DiffRow *row = iter_get_row(self, iter);
+    GFile *fspath;
+
+    g_return_val_if_fail(row != NULL, NULL);
+    g_return_val_if_fail(index >= 0 && index < self->num_sources, NULL);
+
+    if (row->files == NULL)
+    {
+        row->files = g_new0(GFile *, self->num_sources);
+    }
+    fspath = row->files[index];
 
     if (fspath == NULL)
     {
@@ -1028,8 +1836,7 @@ GFile *dt_diff_tree_model_get_fs_file(DtDiffTreeModel *self, GtkTreeIter *iter,
 
         if (node != NULL)
         {
-            GFileInfo *info = NULL;
-            info = dt_tree_source_get_file_info(source, node);
+            GFileInfo *info = dt_tree_source_create_file_info(source, node);
             if (g_file_info_get_file_type(info) != G_FILE_TYPE_SYMBOLIC_LINK)
             {
                 fspath = G_FILE(g_file_info_get_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH));
@@ -1073,7 +1880,8 @@ GFile *dt_diff_tree_model_get_fs_file(DtDiffTreeModel *self, GtkTreeIter *iter,
                 }
             }
 
-            data->files[index] = fspath;
+            row->files[index] = fspath;
+            g_object_unref(info);
         }
     }
 
@@ -4,38 +4,76 @@
 #include <gtk/gtk.h>
 
 #include "tree-source.h"
+#include "diff-compare.h"
 
 G_BEGIN_DECLS
 
-typedef enum
-{
-    DT_DIFF_TYPE_UNKNOWN,
-    DT_DIFF_TYPE_IDENTICAL,
-    DT_DIFF_TYPE_DIFFERENT,
-} DtDiffType;
-
 enum
 {
+    /**
+     * The file name. The string belongs to the model, so use
+     * gtk_tree_model_get_value to read it without making a copy.
+     */
     DT_DIFF_TREE_MODEL_COL_NAME,
     DT_DIFF_TREE_MODEL_COL_FILE_TYPE,
+
+    /**
+     * A DtDiffType value. For a directory, this is DT_DIFF_TYPE_DIFFERENT if
+     * anything under it is different or missing, or DT_DIFF_TYPE_UNKNOWN if
+     * anything under it hasn't been checked yet.
+     */
     DT_DIFF_TREE_MODEL_COL_DIFFERENT,
 
     /**
-     * An GPtrArray with the DtTreeSourceNode pointers for each source
+     * A pointer to an array of DtTreeSourceNode pointers, with one element
+     * for each source. The array belongs to the model, and it's only valid
+     * until the row is removed.
      */
     DT_DIFF_TREE_MODEL_COL_NODE_ARRAY,
 
-    /// Stores data that's internal to the DtDiffTreeModel.
-    DT_DIFF_TREE_MODEL_COL_INTERNAL,
+    /**
+     * The number of files under a directory that are different, identical,
+     * or not checked yet. These are 0 for anything but a directory.
+     *
+     * These don't include directories, or anything that's missing from one
+     * of the sources.
+     */
+    DT_DIFF_TREE_MODEL_COL_NUM_DIFFERENT,
+    DT_DIFF_TREE_MODEL_COL_NUM_IDENTICAL,
+    DT_DIFF_TREE_MODEL_COL_NUM_UNKNOWN,
+
+    /**
+     * The number of files and directories under a directory that are missing
+     * from at least one source.
+     */
+    DT_DIFF_TREE_MODEL_COL_NUM_MISSING,
+
+    /**
+     * The total size of the regular files under a directory, as a guint64.
+     */
+    DT_DIFF_TREE_MODEL_COL_TOTAL_SIZE,
 
     DT_DIFF_TREE_MODEL_NUM_COLUMNS
 };
 
+/**
+ * DtDiffTreeModel
+ *
+ * A GtkTreeModel that merges the trees from each source. The root row is the
+ * only top-level row, and each row's children are always sorted, with
+ * directories first and then by name.
+ *
+ * Signals:
+ *
+ * "diff-invalidated" (DtDiffTreeModel *model, GtkTreeIter *iter)
+ *      Emitted when a file changes in one of the sources, and the contents
+ *      need to be compared again. Any check for that row that was already
+ *      running is aborted.
+ */
 #define DT_TYPE_DIFF_TREE_MODEL dt_diff_tree_model_get_type()
-G_DECLARE_FINAL_TYPE(DtDiffTreeModel, dt_diff_tree_model, DT, DIFF_TREE_MODEL, GtkTreeStore);
+G_DECLARE_FINAL_TYPE(DtDiffTreeModel, dt_diff_tree_model, DT, DIFF_TREE_MODEL, GObject);
 
-DtDiffTreeModel *dt_diff_tree_model_new(gint num_sources, DtTreeSource **sources,
-        int num_extra_columns, GType *extra_columns);
+DtDiffTreeModel *dt_diff_tree_model_new(gint num_sources, DtTreeSource **sources);
 
 gint dt_diff_tree_model_get_num_sources(DtDiffTreeModel *self);
 DtTreeSource *dt_diff_tree_model_get_source(DtDiffTreeModel *self, gint source_index);
@@ -46,6 +84,24 @@ DtTreeSource *dt_diff_tree_model_get_source(DtDiffTreeModel *self, gint source_i
 DtTreeSourceNode *dt_diff_tree_model_get_source_node(DtDiffTreeModel *self,
         gint source_index, GtkTreeIter *iter);
 
+/**
+ * Asks each source to read the directory for a row as soon as possible.
+ *
+ * This is for lazy scanning, so that the directories the user is looking at
+ * get read before the rest of the tree. See dt_tree_source_prioritize_node.
+ */
+void dt_diff_tree_model_prioritize_row(DtDiffTreeModel *self, GtkTreeIter *iter);
+
+/**
+ * Applies any nodes that the sources have added but that the model hasn't
+ * caught up with yet.
+ *
+ * During a scan, the model adds new nodes from an idle callback, a few
+ * milliseconds' worth at a time, so that the view stays responsive. This
+ * adds everything that's left right away.
+ */
+void dt_diff_tree_model_flush(DtDiffTreeModel *self);
+
 void dt_diff_tree_model_check_difference_async(DtDiffTreeModel *self,
         GtkTreeIter *iter, gint io_priority, GCancellable *cancellable,
         GAsyncReadyCallback callback, gpointer userdata);
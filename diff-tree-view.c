@@ -6,9 +6,10 @@
 static const GdkRGBA DIFF_COLOR = { 1.0, 0.5, 0.5, 1.0 };
 static const GdkRGBA MISSING_COLOR = { 0.5, 0.5, 1.0, 1.0 };
 
-static void set_cell_background(GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter)
+static void set_cell_background(GtkCellRenderer *cell, GtkTreeModel *model,
+        GtkTreeIter *iter, gint num_sources)
 {
-    GPtrArray *nodes = NULL;
+    DtTreeSourceNode **nodes = NULL;
     DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
     gboolean missing = FALSE;
     gint i;
@@ -17,20 +18,16 @@ static void set_cell_background(GtkCellRenderer *cell, GtkTreeModel *model, GtkT
             DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff,
             DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodes, -1);
 
-    if (nodes != NULL)
+    if (nodes != NULL && diff != DT_DIFF_TYPE_IDENTICAL)
     {
-        if (diff != DT_DIFF_TYPE_IDENTICAL)
+        for (i=0; i<num_sources; i++)
         {
-            for (i=0; i<nodes->len; i++)
+            if (nodes[i] == NULL)
             {
-                if (nodes->pdata[i] == NULL)
-                {
-                    missing = TRUE;
-                    break;
-                }
+                missing = TRUE;
+                break;
             }
         }
-        g_ptr_array_unref(nodes);
     }
 
     if (missing)
@@ -54,11 +51,14 @@ static void set_cell_background(GtkCellRenderer *cell, GtkTreeModel *model, GtkT
 static void col_data_name(GtkTreeViewColumn *col, GtkCellRenderer *cell,
         GtkTreeModel *model, GtkTreeIter *iter, gpointer userdata)
 {
-    char *text = NULL;
-    gtk_tree_model_get(model, iter,
-            DT_DIFF_TREE_MODEL_COL_NAME, &text, -1);
-    g_object_set(cell, "text", text, NULL);
-    set_cell_background(cell, model, iter);
+    GValue value = G_VALUE_INIT;
+
+    // gtk_tree_model_get would return a copy of the name, but the value from
+    // gtk_tree_model_get_value just points to the model's string.
+    gtk_tree_model_get_value(model, iter, DT_DIFF_TREE_MODEL_COL_NAME, &value);
+    g_object_set_property(G_OBJECT(cell), "text", &value);
+    g_value_unset(&value);
+    set_cell_background(cell, model, iter, GPOINTER_TO_INT(userdata));
 }
 
 static void col_data_icon(GtkTreeViewColumn *col, GtkCellRenderer *cell,
@@ -66,7 +66,6 @@ static void col_data_icon(GtkTreeViewColumn *col, GtkCellRenderer *cell,
 {
     // See here for the standard icon names:
     // https://developer.gnome.org/icon-naming-spec/
-    GtkTreeView *view = GTK_TREE_VIEW(userdata);
     GFileType type = G_FILE_TYPE_UNKNOWN;
     const char *icon = "emblem-unreadable";
 
@@ -78,23 +77,18 @@ static void col_data_icon(GtkTreeViewColumn *col, GtkCellRenderer *cell,
     }
     else if (type == G_FILE_TYPE_DIRECTORY)
     {
-        GtkTreePath *path = gtk_tree_model_get_path(model, iter);
-        icon = "folder";
-        if (path != NULL)
-        {
-            if (view != NULL && gtk_tree_view_row_expanded(view, path))
-            {
-                icon = "folder-open";
-            }
-            gtk_tree_path_free(path);
-        }
+        // The column sets the is-expanded property before it calls this, so
+        // we don't need to look up the row's path in the view.
+        gboolean expanded = FALSE;
+        g_object_get(cell, "is-expanded", &expanded, NULL);
+        icon = (expanded ? "folder-open" : "folder");
     }
     else if (type == G_FILE_TYPE_SYMBOLIC_LINK)
     {
         icon = "emblem-symbolic-link";
     }
     g_object_set(cell, "icon-name", icon, NULL);
-    set_cell_background(cell, model, iter);
+    set_cell_background(cell, model, iter, GPOINTER_TO_INT(userdata));
 }
 
 static void col_data_diff(GtkTreeViewColumn *col, GtkCellRenderer *cell,
@@ -102,8 +96,16 @@ static void col_data_diff(GtkTreeViewColumn *col, GtkCellRenderer *cell,
 {
     const char *text = "";
     DtDiffType diff = DT_DIFF_TYPE_UNKNOWN;
+    GFileType type = G_FILE_TYPE_UNKNOWN;
+    guint num_different = 0;
+    guint num_missing = 0;
+    gchar buf[32];
 
-    gtk_tree_model_get(model, iter, DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff, -1);
+    gtk_tree_model_get(model, iter,
+            DT_DIFF_TREE_MODEL_COL_DIFFERENT, &diff,
+            DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &type,
+            DT_DIFF_TREE_MODEL_COL_NUM_DIFFERENT, &num_different,
+            DT_DIFF_TREE_MODEL_COL_NUM_MISSING, &num_missing, -1);
     switch (diff)
     {
         case DT_DIFF_TYPE_UNKNOWN: text = ""; break;
@@ -111,8 +113,15 @@ static void col_data_diff(GtkTreeViewColumn *col, GtkCellRenderer *cell,
         case DT_DIFF_TYPE_DIFFERENT: text = "DIFF"; break;
         default: text = ""; break;
     }
+
+    if (type == G_FILE_TYPE_DIRECTORY && num_different + num_missing > 0)
+    {
+        // Show how many files are different under a directory.
+        g_snprintf(buf, sizeof(buf), "DIFF (%u)", num_different + num_missing);
+        text = buf;
+    }
     g_object_set(cell, "text", text, NULL);
-    set_cell_background(cell, model, iter);
+    set_cell_background(cell, model, iter, GPOINTER_TO_INT(userdata));
 }
 
 static gboolean on_tree_key_press(GtkWidget *widget, GdkEvent *event, gpointer user_data)
@@ -178,13 +187,15 @@ static gboolean on_tree_key_press(GtkWidget *widget, GdkEvent *event, gpointer u
 typedef struct
 {
     gint index;
+    gint num_sources;
     DtTreeSource *source;
 } FileInfoColParam;
 
-static FileInfoColParam *file_info_col_param_alloc(gint index, DtTreeSource *source)
+static FileInfoColParam *file_info_col_param_alloc(gint index, gint num_sources, DtTreeSource *source)
 {
     FileInfoColParam *param = g_malloc(sizeof(FileInfoColParam));
     param->index = index;
+    param->num_sources = num_sources;
     param->source = g_object_ref(source);
     return param;
 }
@@ -206,30 +217,26 @@ static void col_data_size(GtkTreeViewColumn *col, GtkCellRenderer *cell,
         GtkTreeModel *model, GtkTreeIter *iter, gpointer userdata)
 {
     const FileInfoColParam *param = userdata;
-    GFileInfo *info = NULL;
-    GPtrArray *nodes = NULL;
+    const DtFileMetadata *meta = NULL;
+    DtTreeSourceNode **nodes = NULL;
 
     gtk_tree_model_get(model, iter, DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodes, -1);
-    if (nodes != NULL)
+    if (nodes != NULL && nodes[param->index] != NULL)
     {
-        if (nodes->pdata[param->index] != NULL)
-        {
-            info = dt_tree_source_get_file_info(param->source, nodes->pdata[param->index]);
-        }
-        g_ptr_array_unref(nodes);
+        meta = dt_tree_source_get_metadata(param->source, nodes[param->index]);
     }
 
-    if (info != NULL && g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_STANDARD_SIZE))
+    if (meta != NULL && (meta->flags & DT_FILE_METADATA_HAS_SIZE))
     {
         gchar buf[32];
-        g_snprintf(buf, sizeof(buf), "%'lld", (unsigned long long) g_file_info_get_size(info));
+        g_snprintf(buf, sizeof(buf), "%'lld", (unsigned long long) meta->size);
         g_object_set(cell, "text", buf, NULL);
     }
     else
     {
         g_object_set(cell, "text", "", NULL);
     }
-    set_cell_background(cell, model, iter);
+    set_cell_background(cell, model, iter, param->num_sources);
 }
 
 static void col_data_time(GtkTreeViewColumn *col, GtkCellRenderer *cell,
@@ -237,27 +244,21 @@ static void col_data_time(GtkTreeViewColumn *col, GtkCellRenderer *cell,
 {
 
     const FileInfoColParam *param = userdata;
-    GFileInfo *info = NULL;
-    GPtrArray *nodes = NULL;
+    const DtFileMetadata *meta = NULL;
+    DtTreeSourceNode **nodes = NULL;
 
     gtk_tree_model_get(model, iter, DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodes, -1);
-    if (nodes != NULL)
+    if (nodes != NULL && nodes[param->index] != NULL)
     {
-        if (nodes->pdata[param->index] != NULL)
-        {
-            info = dt_tree_source_get_file_info(param->source, nodes->pdata[param->index]);
-        }
-        g_ptr_array_unref(nodes);
+        meta = dt_tree_source_get_metadata(param->source, nodes[param->index]);
     }
 
-    if (info != NULL && g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    if (meta != NULL && (meta->flags & DT_FILE_METADATA_HAS_MTIME))
     {
         gchar *buf;
-        GTimeVal tv = {};
         GDateTime *tm;
 
-        g_file_info_get_modification_time(info, &tv);
-        tm = g_date_time_new_from_unix_local(tv.tv_sec);
+        tm = g_date_time_new_from_unix_local(meta->mtime_sec);
 
         buf = g_date_time_format(tm, "%y-%d-%m %H:%M:%S");
         g_object_set(cell, "text", buf, NULL);
@@ -268,7 +269,7 @@ static void col_data_time(GtkTreeViewColumn *col, GtkCellRenderer *cell,
     {
         g_object_set(cell, "text", "", NULL);
     }
-    set_cell_background(cell, model, iter);
+    set_cell_background(cell, model, iter, param->num_sources);
 }
 
 GtkTreeView *create_diff_tree_view(gint num_sources, DtTreeSource **sources)
@@ -284,15 +285,15 @@ GtkTreeView *create_diff_tree_view(gint num_sources, DtTreeSource **sources)
 
     renderer = gtk_cell_renderer_pixbuf_new();
     gtk_tree_view_column_pack_start(col, renderer, FALSE);
-    gtk_tree_view_column_set_cell_data_func(col, renderer, col_data_icon, view, NULL);
+    gtk_tree_view_column_set_cell_data_func(col, renderer, col_data_icon, GINT_TO_POINTER(num_sources), NULL);
 
     renderer = gtk_cell_renderer_text_new();
     gtk_tree_view_column_pack_start(col, renderer, TRUE);
-    gtk_tree_view_column_set_cell_data_func(col, renderer, col_data_name, NULL, NULL);
+    gtk_tree_view_column_set_cell_data_func(col, renderer, col_data_name, GINT_TO_POINTER(num_sources), NULL);
 
     gtk_tree_view_insert_column_with_data_func(view, -1, "Diff",
             gtk_cell_renderer_text_new(),
-            col_data_diff, NULL, NULL);
+            col_data_diff, GINT_TO_POINTER(num_sources), NULL);
 
     for (i=0; i<num_sources; i++)
     {
@@ -300,12 +301,12 @@ GtkTreeView *create_diff_tree_view(gint num_sources, DtTreeSource **sources)
         g_snprintf(buf, sizeof(buf), "Size %d", i);
         gtk_tree_view_insert_column_with_data_func(view, -1, buf,
                 gtk_cell_renderer_text_new(), col_data_size,
-                file_info_col_param_alloc(i, sources[i]), file_info_col_param_free);
+                file_info_col_param_alloc(i, num_sources, sources[i]), file_info_col_param_free);
 
         g_snprintf(buf, sizeof(buf), "Time %d", i);
         gtk_tree_view_insert_column_with_data_func(view, -1, buf,
                 gtk_cell_renderer_text_new(), col_data_time,
-                file_info_col_param_alloc(i, sources[i]), file_info_col_param_free);
+                file_info_col_param_alloc(i, num_sources, sources[i]), file_info_col_param_free);
     }
 
     g_signal_connect(view, "key-press-event", G_CALLBACK(on_tree_key_press), NULL);
@@ -333,90 +334,25 @@ GtkTreeView *create_diff_tree_view_from_model(DtDiffTreeModel *model)
 
 gboolean dt_tree_filter_missing_visible(GtkTreeModel *chmodel, GtkTreeIter *iter, gpointer userdata)
 {
-    GPtrArray *nodes = NULL;
+    DtTreeSourceNode **nodes = NULL;
     GArray *hide_missing = userdata;
     gboolean result = TRUE;
 
     gtk_tree_model_get(chmodel, iter, DT_DIFF_TREE_MODEL_COL_NODE_ARRAY, &nodes, -1);
     if (nodes != NULL)
     {
-        gint i;
-        g_assert(nodes->len == hide_missing->len);
-        for (i=0; i<nodes->len; i++)
+        guint i;
+        for (i=0; i<hide_missing->len; i++)
         {
             if (g_array_index(hide_missing, gboolean, i))
             {
-                if (nodes->pdata[i] == NULL)
+                if (nodes[i] == NULL)
                 {
                     result = FALSE;
                     break;
                 }
             }
         }
-        g_ptr_array_unref(nodes);
     }
     return result;
 }
-
-static gint get_sort_group(GFileType type)
-{
-    switch (type)
-    {
-        case G_FILE_TYPE_DIRECTORY: return 0;
-        default: return 1;
-    }
-}
-
-gint diff_tree_model_row_compare(GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer userdata)
-{
-    GFileType type1 = G_FILE_TYPE_UNKNOWN;
-    GFileType type2 = G_FILE_TYPE_UNKNOWN;
-    gint diff = 0;
-
-    gtk_tree_model_get(model, a, DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &type1, -1);
-    gtk_tree_model_get(model, b, DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &type2, -1);
-    if (type1 != type2)
-    {
-        gint group1 = get_sort_group(type1);
-        gint group2 = get_sort_group(type2);
-        diff = group1 - group2;
-    }
-
-    if (diff == 0)
-    {
-        gchar *name1 = NULL;
-        gchar *name2 = NULL;
-        gtk_tree_model_get(model, a, DT_DIFF_TREE_MODEL_COL_NAME, &name1, -1);
-        gtk_tree_model_get(model, b, DT_DIFF_TREE_MODEL_COL_NAME, &name2, -1);
-        if (name1 == NULL && name2 == NULL)
-        {
-            diff = 0;
-        }
-        else if (name1 == NULL)
-        {
-            diff = -1;
-        }
-        else if (name2 == NULL)
-        {
-            diff = 1;
-        }
-        else
-        {
-            diff = strcasecmp(name1, name2);
-            if (diff == 0)
-            {
-                diff = strcmp(name1, name2);
-            }
-        }
-        g_free(name1);
-        g_free(name2);
-    }
-
-    if (diff == 0)
-    {
-        diff = type1 - type2;
-    }
-
-    return diff;
-}
-
@@ -17,11 +17,6 @@ G_BEGIN_DECLS
  */
 gboolean dt_tree_filter_missing_visible(GtkTreeModel *chmodel, GtkTreeIter *iter, gpointer userdata);
 
-/**
- * A sort function for comparing rows in a DtDiffTreeModel.
- */
-gint diff_tree_model_row_compare(GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer userdata);
-
 /**
  * Creates a GtkTreeView to display a DtDiffTreeModel.
  *
@@ -0,0 +1,398 @@
+#include "digest-cache.h"
+#include "slab-alloc.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define CACHE_MAGIC "DTDIGST"
+#define CACHE_BYTE_ORDER 0x01020304
+
+/**
+ * If the file has more entries than this when it's opened, then the oldest
+ * half are dropped. At 56 bytes each, this is a bit over 100 MB.
+ */
+#define MAX_RECORDS (2 * 1024 * 1024)
+
+/**
+ * The number of new entries to collect before appending them to the file.
+ */
+#define FLUSH_RECORDS 1024
+
+/**
+ * The number of new entries to allocate at once.
+ */
+#define RECORDS_PER_CHUNK 1024
+
+/**
+ * A file that was modified or changed less than this long ago, in
+ * nanoseconds, isn't added to the cache.
+ *
+ * A timestamp only changes once per kernel clock tick, so if a file was
+ * written again right after we read it, its ctime could still be the same,
+ * and the cache would have the old digest.
+ */
+#define RACY_WINDOW_NS G_GINT64_CONSTANT(2000000000)
+
+G_STATIC_ASSERT(sizeof(DtDigestCacheHeader) % sizeof(guint64) == 0);
+
+struct _DtDigestCache
+{
+    char *filename;
+
+    /// The cache file as it was when we opened it, or NULL if it was empty.
+    GMappedFile *mapped;
+
+    GMutex lock;
+
+    /**
+     * Maps each DtDigestCacheKey to its DtDigestCacheRecord. The records are
+     * either in the mapped file, or in new_records.
+     */
+    GHashTable *records;
+    DtSlab new_records;
+
+    /// The entries that haven't been written to the file yet.
+    GArray *pending;
+};
+
+static DtDigestCache *default_cache = NULL;
+
+static guint hash_key(gconstpointer ptr)
+{
+    const DtDigestCacheKey *key = ptr;
+    guint64 h = key->inode;
+
+    h = h * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15) ^ key->device;
+    h = h * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15) ^ (guint64) key->mtime_ns;
+    return (guint) (h ^ (h >> 32));
+}
+
+static gboolean equal_key(gconstpointer a, gconstpointer b)
+{
+    return (memcmp(a, b, sizeof(DtDigestCacheKey)) == 0);
+}
+
+static void init_header(DtDigestCacheHeader *header)
+{
+    memset(header, 0, sizeof(DtDigestCacheHeader));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->byte_order = CACHE_BYTE_ORDER;
+    header->version = DT_DIGEST_CACHE_VERSION;
+    header->header_size = sizeof(DtDigestCacheHeader);
+    header->record_size = sizeof(DtDigestCacheRecord);
+    g_strlcpy(header->algorithm, dt_file_digest_get_algorithm(), sizeof(header->algorithm));
+}
+
+/**
+ * Checks the header of a cache file, and returns its records.
+ *
+ * A record at the end that was only partly written is ignored.
+ *
+ * \return The records, or NULL if the file isn't a valid cache.
+ */
+static const DtDigestCacheRecord *get_records(GMappedFile *mapped, gsize *ret_num)
+{
+    const DtDigestCacheHeader *header = (const DtDigestCacheHeader *) g_mapped_file_get_contents(mapped);
+    gsize size = g_mapped_file_get_length(mapped);
+    DtDigestCacheHeader expected;
+
+    init_header(&expected);
+    if (header == NULL || size < sizeof(DtDigestCacheHeader)
+            || memcmp(header, &expected, sizeof(DtDigestCacheHeader)) != 0)
+    {
+        return NULL;
+    }
+
+    *ret_num = (size - sizeof(DtDigestCacheHeader)) / sizeof(DtDigestCacheRecord);
+    return (const DtDigestCacheRecord *) (header + 1);
+}
+
+/**
+ * Replaces the cache file with a new one.
+ */
+static gboolean write_cache_file(const char *filename, const DtDigestCacheRecord *records,
+        gsize num, GError **error)
+{
+    DtDigestCacheHeader header;
+    GByteArray *data;
+    gboolean ret;
+    char *dir;
+
+    init_header(&header);
+    data = g_byte_array_sized_new(sizeof(header) + num * sizeof(DtDigestCacheRecord));
+    g_byte_array_append(data, (const guint8 *) &header, sizeof(header));
+    g_byte_array_append(data, (const guint8 *) records, num * sizeof(DtDigestCacheRecord));
+
+    dir = g_path_get_dirname(filename);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    ret = g_file_set_contents(filename, (const gchar *) data->data, data->len, error);
+    g_byte_array_unref(data);
+    return ret;
+}
+
+DtDigestCache *dt_digest_cache_open(const char *filename, GError **error)
+{
+    DtDigestCache *cache = g_malloc0(sizeof(DtDigestCache));
+    const DtDigestCacheRecord *records = NULL;
+    gsize num = 0;
+    gsize i;
+
+    cache->filename = g_strdup(filename);
+    g_mutex_init(&cache->lock);
+    cache->records = g_hash_table_new(hash_key, equal_key);
+    dt_slab_init(&cache->new_records, sizeof(DtDigestCacheRecord), RECORDS_PER_CHUNK);
+    cache->pending = g_array_new(FALSE, FALSE, sizeof(DtDigestCacheRecord));
+
+    cache->mapped = g_mapped_file_new(filename, FALSE, NULL);
+    if (cache->mapped != NULL)
+    {
+        records = get_records(cache->mapped, &num);
+        if (records == NULL)
+        {
+            g_clear_pointer(&cache->mapped, g_mapped_file_unref);
+        }
+    }
+
+    if (records == NULL)
+    {
+        // Either there's no cache yet, or it's not one that we can use.
+        num = 0;
+        if (!write_cache_file(filename, NULL, 0, error))
+        {
+            dt_digest_cache_free(cache);
+            return NULL;
+        }
+    }
+    else if (num > MAX_RECORDS)
+    {
+        // Keep the newest half. The old mapping stays valid after the file is
+        // replaced, so we can keep using it.
+        records += num - MAX_RECORDS / 2;
+        num = MAX_RECORDS / 2;
+        if (!write_cache_file(filename, records, num, error))
+        {
+            dt_digest_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    // The newer entries come later in the file, so they replace any older
+    // ones for the same key.
+    for (i=0; i<num; i++)
+    {
+        g_hash_table_replace(cache->records, (gpointer) &records[i].key, (gpointer) &records[i]);
+    }
+    return cache;
+}
+
+/**
+ * Appends the pending entries to the file. The caller has to hold the lock.
+ */
+static void flush_locked(DtDigestCache *cache)
+{
+    const guint8 *data = (const guint8 *) cache->pending->data;
+    gsize remaining = cache->pending->len * sizeof(DtDigestCacheRecord);
+    int fd;
+
+    if (cache->pending->len == 0)
+    {
+        return;
+    }
+
+    fd = open(cache->filename, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+    {
+        GError *error = NULL;
+
+        // If the file was deleted, then start a new one.
+        if (errno != ENOENT || !write_cache_file(cache->filename,
+                    (const DtDigestCacheRecord *) cache->pending->data,
+                    cache->pending->len, &error))
+        {
+            g_warning("Can't write digest cache %s: %s", cache->filename,
+                    error != NULL ? error->message : g_strerror(errno));
+            g_clear_error(&error);
+        }
+        g_array_set_size(cache->pending, 0);
+        return;
+    }
+
+    while (remaining > 0)
+    {
+        ssize_t num = write(fd, data, remaining);
+        if (num < 0)
+        {
+            if (errno != EINTR)
+            {
+                g_warning("Can't write digest cache %s: %s", cache->filename, g_strerror(errno));
+                break;
+            }
+        }
+        else
+        {
+            data += num;
+            remaining -= num;
+        }
+    }
+    close(fd);
+    g_array_set_size(cache->pending, 0);
+}
+
+void dt_digest_cache_free(DtDigestCache *cache)
+{
+    if (cache != NULL)
+    {
+        dt_digest_cache_flush(cache);
+        g_hash_table_destroy(cache->records);
+        dt_slab_clear(&cache->new_records);
+        g_array_unref(cache->pending);
+        if (cache->mapped != NULL)
+        {
+            g_mapped_file_unref(cache->mapped);
+        }
+        g_mutex_clear(&cache->lock);
+        g_free(cache->filename);
+        g_free(cache);
+    }
+}
+
+char *dt_digest_cache_get_default_path(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "difftree", "digests.cache", NULL);
+}
+
+gboolean dt_digest_cache_init_default(GError **error)
+{
+    char *path;
+
+    g_return_val_if_fail(default_cache == NULL, FALSE);
+
+    path = dt_digest_cache_get_default_path();
+    default_cache = dt_digest_cache_open(path, error);
+    g_free(path);
+    return (default_cache != NULL);
+}
+
+DtDigestCache *dt_digest_cache_get_default(void)
+{
+    return default_cache;
+}
+
+void dt_digest_cache_key_from_stat(DtDigestCacheKey *key, const struct stat *st)
+{
+    memset(key, 0, sizeof(DtDigestCacheKey));
+    key->device = st->st_dev;
+    key->inode = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_ns = (gint64) st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st->st_mtim.tv_nsec;
+    key->ctime_ns = (gint64) st->st_ctim.tv_sec * G_GINT64_CONSTANT(1000000000) + st->st_ctim.tv_nsec;
+}
+
+gboolean dt_digest_cache_key_from_path(DtDigestCacheKey *key, const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        return FALSE;
+    }
+    dt_digest_cache_key_from_stat(key, &st);
+    return TRUE;
+}
+
+gboolean dt_digest_cache_lookup(DtDigestCache *cache, const DtDigestCacheKey *key,
+        guint8 *ret_digest)
+{
+    const DtDigestCacheRecord *rec;
+
+    g_mutex_lock(&cache->lock);
+    rec = g_hash_table_lookup(cache->records, key);
+    if (rec != NULL)
+    {
+        memcpy(ret_digest, rec->digest, DT_FILE_DIGEST_SIZE);
+    }
+    g_mutex_unlock(&cache->lock);
+    return (rec != NULL);
+}
+
+void dt_digest_cache_insert(DtDigestCache *cache, const DtDigestCacheKey *key,
+        const guint8 *digest)
+{
+    const DtDigestCacheRecord *old;
+    DtDigestCacheRecord *rec;
+
+    g_mutex_lock(&cache->lock);
+    old = g_hash_table_lookup(cache->records, key);
+    if (old == NULL || memcmp(old->digest, digest, DT_FILE_DIGEST_SIZE) != 0)
+    {
+        rec = dt_slab_alloc(&cache->new_records);
+        rec->key = *key;
+        memcpy(rec->digest, digest, DT_FILE_DIGEST_SIZE);
+        g_hash_table_replace(cache->records, &rec->key, rec);
+
+        g_array_append_val(cache->pending, *rec);
+        if (cache->pending->len >= FLUSH_RECORDS)
+        {
+            flush_locked(cache);
+        }
+    }
+    g_mutex_unlock(&cache->lock);
+}
+
+void dt_digest_cache_flush(DtDigestCache *cache)
+{
+    g_mutex_lock(&cache->lock);
+    flush_locked(cache);
+    g_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Returns TRUE if a file changed too recently to trust its timestamps.
+ */
+static gboolean is_racy(const DtDigestCacheKey *key)
+{
+    gint64 now = g_get_real_time() * 1000;
+
+    return (key->mtime_ns > now - RACY_WINDOW_NS || key->ctime_ns > now - RACY_WINDOW_NS);
+}
+
+void dt_digest_cache_insert_path(DtDigestCache *cache, const char *path,
+        const DtDigestCacheKey *before, const guint8 *digest)
+{
+    DtDigestCacheKey after;
+
+    // Only save the digest if the file didn't change while we were reading
+    // it, or get replaced by a different file.
+    if (dt_digest_cache_key_from_path(&after, path)
+            && equal_key(before, &after) && !is_racy(&after))
+    {
+        dt_digest_cache_insert(cache, &after, digest);
+    }
+}
+
+gboolean dt_digest_cache_compute_path(DtDigestCache *cache, const char *path,
+        GCancellable *cancellable, guint8 *ret_digest, GError **error)
+{
+    DtDigestCacheKey before;
+
+    if (cache == NULL || !dt_digest_cache_key_from_path(&before, path))
+    {
+        return dt_file_digest_compute_path(path, cancellable, ret_digest, error);
+    }
+
+    if (dt_digest_cache_lookup(cache, &before, ret_digest))
+    {
+        return TRUE;
+    }
+
+    if (!dt_file_digest_compute_path(path, cancellable, ret_digest, error))
+    {
+        return FALSE;
+    }
+    dt_digest_cache_insert_path(cache, path, &before, ret_digest);
+    return TRUE;
+}
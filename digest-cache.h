@@ -0,0 +1,165 @@
+#ifndef DIGEST_CACHE_H
+#define DIGEST_CACHE_H
+
+/**
+ * \file
+ *
+ * A cache of file digests that's saved between runs, so that comparing the
+ * same trees again doesn't have to read every file again.
+ *
+ * Each entry is keyed by the device, inode, size, modification time, and
+ * status change time of a local file, all from stat. Writing to a file
+ * updates its ctime, and unlike the mtime, that can't be set back, so an
+ * entry won't match a file whose contents have changed since.
+ *
+ * The cache is a single file, laid out so that it can be used directly from
+ * mmap:
+ *
+ * - A DtDigestCacheHeader.
+ * - An array of DtDigestCacheRecord, in the order that they were added.
+ *
+ * New entries are appended to the end of the file. If it gets too big, then
+ * the oldest half of the entries are dropped the next time it's opened.
+ *
+ * Like a scan snapshot, everything is stored in native byte order. A cache
+ * from a different byte order, version, or hash function is thrown out and
+ * started over.
+ *
+ * Lookups and inserts are thread-safe.
+ */
+
+#include <glib.h>
+#include <sys/stat.h>
+
+#include "file-digest.h"
+
+G_BEGIN_DECLS
+
+#define DT_DIGEST_CACHE_VERSION 1
+
+typedef struct
+{
+    /// Always "DTDIGST" followed by a NUL.
+    char magic[8];
+
+    /// Always 0x01020304, to detect a cache with a different byte order.
+    guint32 byte_order;
+    guint32 version;
+    guint32 header_size;
+    guint32 record_size;
+
+    /// The name from dt_file_digest_get_algorithm, padded with NULs.
+    char algorithm[16];
+} DtDigestCacheHeader;
+
+typedef struct
+{
+    guint64 device;
+    guint64 inode;
+    guint64 size;
+    gint64 mtime_ns;
+    gint64 ctime_ns;
+} DtDigestCacheKey;
+
+typedef struct
+{
+    DtDigestCacheKey key;
+    guint8 digest[DT_FILE_DIGEST_SIZE];
+} DtDigestCacheRecord;
+
+typedef struct _DtDigestCache DtDigestCache;
+
+/**
+ * Opens or creates a cache file.
+ *
+ * If the file isn't a valid cache, then it's replaced with an empty one.
+ */
+DtDigestCache *dt_digest_cache_open(const char *filename, GError **error);
+
+/**
+ * Writes out any new entries and frees the cache.
+ */
+void dt_digest_cache_free(DtDigestCache *cache);
+
+/**
+ * Returns the default path for the cache file, under the user's cache
+ * directory.
+ */
+char *dt_digest_cache_get_default_path(void);
+
+/**
+ * Opens the cache at the default path, and makes it the one that
+ * dt_digest_cache_get_default returns.
+ *
+ * The default cache stays open until the process exits, since worker threads
+ * could still be using it. Call dt_digest_cache_flush before exiting to save
+ * the new entries.
+ */
+gboolean dt_digest_cache_init_default(GError **error);
+
+/**
+ * Returns the default cache, or NULL if dt_digest_cache_init_default wasn't
+ * called.
+ */
+DtDigestCache *dt_digest_cache_get_default(void);
+
+/**
+ * Fills in a key from the result of stat or fstat.
+ */
+void dt_digest_cache_key_from_stat(DtDigestCacheKey *key, const struct stat *st);
+
+/**
+ * Fills in a key for a local file.
+ *
+ * \return FALSE if the file can't be stat'ed.
+ */
+gboolean dt_digest_cache_key_from_path(DtDigestCacheKey *key, const char *path);
+
+/**
+ * Looks up the digest for a file.
+ *
+ * \return TRUE if the cache has an entry for \p key.
+ */
+gboolean dt_digest_cache_lookup(DtDigestCache *cache, const DtDigestCacheKey *key,
+        guint8 *ret_digest);
+
+/**
+ * Adds or replaces the digest for a file.
+ *
+ * The new entry is written out with the next dt_digest_cache_flush, or once
+ * enough of them have piled up.
+ */
+void dt_digest_cache_insert(DtDigestCache *cache, const DtDigestCacheKey *key,
+        const guint8 *digest);
+
+/**
+ * Adds the digest for a local file that was just read, unless the file
+ * changed in the meantime.
+ *
+ * This checks the file again, and only adds the digest if it still matches
+ * \p before, and if it didn't change too recently to trust its timestamps.
+ *
+ * \param before The key for the file from before it was read.
+ */
+void dt_digest_cache_insert_path(DtDigestCache *cache, const char *path,
+        const DtDigestCacheKey *before, const guint8 *digest);
+
+/**
+ * Appends any new entries to the cache file.
+ */
+void dt_digest_cache_flush(DtDigestCache *cache);
+
+/**
+ * Returns the digest of a local file, from the cache if it has one.
+ * Otherwise, this reads the file and adds its digest to the cache.
+ *
+ * This is blocking, like dt_file_digest_compute_path.
+ *
+ * \param cache The cache, or NULL to just read the file.
+ */
+gboolean dt_digest_cache_compute_path(DtDigestCache *cache, const char *path,
+        GCancellable *cancellable, guint8 *ret_digest, GError **error);
+
+G_END_DECLS
+
+#endif // DIGEST_CACHE_H
@@ -0,0 +1,519 @@
+#include "exclude-rules.h"
+
+#include <string.h>
+
+typedef struct
+{
+    /**
+     * The pattern, without the leading '!' or '/', and without the trailing
+     * '/'.
+     */
+    char *glob;
+
+    gboolean negate;
+    gboolean dir_only;
+
+    /// True if the pattern is matched against the relative path.
+    gboolean anchored;
+} ExcludePattern;
+
+/**
+ * A regular expression that matches any of a set of patterns.
+ */
+typedef struct
+{
+    GRegex *regex;
+
+    /**
+     * The index of the pattern for each capture group, starting with group 1.
+     */
+    GArray *groups;
+} PatternRegex;
+
+struct _DtExcludeRules
+{
+    UtilRefCountedBase refcount;
+
+    /// The ExcludePattern structs, in the order they were added.
+    GPtrArray *patterns;
+    gboolean compiled;
+
+    /**
+     * Maps a file name to a GArray of the indexes of the patterns that match
+     * exactly that name, in increasing order.
+     */
+    GHashTable *literals;
+
+    /**
+     * Maps a suffix like ".o" to a GArray of the indexes of the patterns that
+     * match any name that ends with it, like "*.o".
+     */
+    GHashTable *suffixes;
+
+    /**
+     * The patterns that are matched against the file name. Index 0 is for
+     * files, and index 1 is for directories, which also includes the patterns
+     * with a trailing '/'.
+     */
+    PatternRegex name_regex[2];
+
+    /**
+     * The patterns that are matched against the relative path.
+     */
+    PatternRegex path_regex[2];
+};
+
+static void exclude_rules_free(DtExcludeRules *rules);
+
+UTIL_DEFINE_BOXED_REFCOUNT_TYPE(DtExcludeRules, dt_exclude_rules, exclude_rules_free)
+
+static void exclude_pattern_free(ExcludePattern *pat)
+{
+    if (pat != NULL)
+    {
+        g_free(pat->glob);
+        g_free(pat);
+    }
+}
+
+static void pattern_regex_clear(PatternRegex *pr)
+{
+    if (pr->regex != NULL)
+    {
+        g_regex_unref(pr->regex);
+        pr->regex = NULL;
+    }
+    if (pr->groups != NULL)
+    {
+        g_array_unref(pr->groups);
+        pr->groups = NULL;
+    }
+}
+
+DtExcludeRules *dt_exclude_rules_new(void)
+{
+    DtExcludeRules *rules = g_malloc0(sizeof(DtExcludeRules));
+    rules->patterns = g_ptr_array_new_with_free_func((GDestroyNotify) exclude_pattern_free);
+    rules->literals = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_array_unref);
+    rules->suffixes = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_array_unref);
+    return dt_exclude_rules_ref(rules);
+}
+
+static void exclude_rules_free(DtExcludeRules *rules)
+{
+    if (rules != NULL)
+    {
+        gint i;
+        for (i=0; i<2; i++)
+        {
+            pattern_regex_clear(&rules->name_regex[i]);
+            pattern_regex_clear(&rules->path_regex[i]);
+        }
+        g_hash_table_destroy(rules->literals);
+        g_hash_table_destroy(rules->suffixes);
+        g_ptr_array_unref(rules->patterns);
+        g_free(rules);
+    }
+}
+
+void dt_exclude_rules_add_pattern(DtExcludeRules *rules, const char *pattern)
+{
+    char *text = g_strdup(pattern);
+    char *start = text;
+    gsize len = strlen(text);
+    ExcludePattern *pat;
+
+    g_return_if_fail(!rules->compiled);
+
+    // Trailing spaces are ignored, unless they're escaped with a backslash.
+    while (len > 0 && (text[len - 1] == '\r' || text[len - 1] == '\n'
+                || (text[len - 1] == ' ' && !(len >= 2 && text[len - 2] == '\\'))))
+    {
+        text[--len] = '\0';
+    }
+    if (len == 0 || text[0] == '#')
+    {
+        g_free(text);
+        return;
+    }
+
+    pat = g_malloc0(sizeof(ExcludePattern));
+    if (*start == '!')
+    {
+        pat->negate = TRUE;
+        start++;
+    }
+    len = strlen(start);
+    if (len > 0 && start[len - 1] == '/')
+    {
+        pat->dir_only = TRUE;
+        start[--len] = '\0';
+    }
+    if (strchr(start, '/') != NULL)
+    {
+        pat->anchored = TRUE;
+        while (*start == '/')
+        {
+            start++;
+        }
+    }
+
+    if (*start == '\0')
+    {
+        exclude_pattern_free(pat);
+        g_free(text);
+        return;
+    }
+
+    pat->glob = g_strdup(start);
+    g_ptr_array_add(rules->patterns, pat);
+    g_free(text);
+}
+
+void dt_exclude_rules_add_from_data(DtExcludeRules *rules, const char *data, gsize length)
+{
+    const char *end = data + length;
+
+    while (data < end)
+    {
+        const char *eol = memchr(data, '\n', end - data);
+        char *line;
+
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+        line = g_strndup(data, eol - data);
+        dt_exclude_rules_add_pattern(rules, line);
+        g_free(line);
+        data = eol + 1;
+    }
+}
+
+gboolean dt_exclude_rules_is_empty(DtExcludeRules *rules)
+{
+    return (rules == NULL || rules->patterns->len == 0);
+}
+
+/**
+ * Returns TRUE if a pattern doesn't have any wildcards or escapes in it.
+ */
+static gboolean is_literal(const char *glob)
+{
+    return (strpbrk(glob, "*?[\\") == NULL);
+}
+
+static void append_escaped_char(GString *re, char ch)
+{
+    if (strchr("\\^$.|?*+()[]{}", ch) != NULL)
+    {
+        g_string_append_c(re, '\\');
+    }
+    g_string_append_c(re, ch);
+}
+
+/**
+ * Translates a glob pattern into a regular expression, without any anchors.
+ */
+static char *glob_to_regex(const char *glob)
+{
+    GString *re = g_string_new(NULL);
+    const char *p = glob;
+
+    while (*p != '\0')
+    {
+        if (p[0] == '*' && p[1] == '*' && (p == glob || p[-1] == '/')
+                && (p[2] == '/' || p[2] == '\0'))
+        {
+            // "**/" matches zero or more directories, and a trailing "**"
+            // matches everything inside a directory.
+            if (p[2] == '/')
+            {
+                g_string_append(re, "(?:.*/)?");
+                p += 3;
+            }
+            else
+            {
+                g_string_append(re, ".*");
+                p += 2;
+            }
+        }
+        else if (*p == '*')
+        {
+            g_string_append(re, "[^/]*");
+            while (*p == '*')
+            {
+                p++;
+            }
+        }
+        else if (*p == '?')
+        {
+            g_string_append(re, "[^/]");
+            p++;
+        }
+        else if (*p == '[')
+        {
+            const char *q = p + 1;
+            gboolean negate = FALSE;
+
+            if (*q == '!' || *q == '^')
+            {
+                negate = TRUE;
+                q++;
+            }
+            if (*q == ']')
+            {
+                q++;
+            }
+            while (*q != '\0' && *q != ']')
+            {
+                q++;
+            }
+
+            if (*q == '\0')
+            {
+                // No closing bracket, so it's just a literal '['.
+                append_escaped_char(re, '[');
+                p++;
+            }
+            else
+            {
+                const char *c = p + 1 + (negate ? 1 : 0);
+                g_string_append(re, negate ? "[^/" : "[");
+                for (; c < q; c++)
+                {
+                    if (*c == '\\' || *c == '[' || (*c == ']' && c != q))
+                    {
+                        g_string_append_c(re, '\\');
+                    }
+                    g_string_append_c(re, *c);
+                }
+                g_string_append_c(re, ']');
+                p = q + 1;
+            }
+        }
+        else if (*p == '\\' && p[1] != '\0')
+        {
+            append_escaped_char(re, p[1]);
+            p += 2;
+        }
+        else
+        {
+            append_escaped_char(re, *p);
+            p++;
+        }
+    }
+    return g_string_free(re, FALSE);
+}
+
+static void add_index(GHashTable *table, const char *key, gint index)
+{
+    GArray *indexes = g_hash_table_lookup(table, key);
+    if (indexes == NULL)
+    {
+        indexes = g_array_new(FALSE, FALSE, sizeof(gint));
+        g_hash_table_insert(table, g_strdup(key), indexes);
+    }
+    g_array_append_val(indexes, index);
+}
+
+static void append_alternative(GString *src, PatternRegex *pr, const char *re, gint index)
+{
+    if (pr->groups == NULL)
+    {
+        pr->groups = g_array_new(FALSE, FALSE, sizeof(gint));
+    }
+    if (src->len > 0)
+    {
+        g_string_append_c(src, '|');
+    }
+    g_string_append_c(src, '(');
+    g_string_append(src, re);
+    g_string_append_c(src, ')');
+    g_array_append_val(pr->groups, index);
+}
+
+static void compile_regex(PatternRegex *pr, GString *src)
+{
+    GError *error = NULL;
+    char *full;
+
+    if (src->len == 0)
+    {
+        return;
+    }
+
+    full = g_strdup_printf("^(?:%s)$", src->str);
+    pr->regex = g_regex_new(full, G_REGEX_RAW | G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, &error);
+    if (pr->regex == NULL)
+    {
+        g_critical("Can't compile exclude patterns: %s", error->message);
+        g_clear_error(&error);
+    }
+    g_free(full);
+}
+
+/**
+ * Sorts the patterns into the hash tables and the regular expressions.
+ */
+static void compile_rules(DtExcludeRules *rules)
+{
+    GString *name_src[2] = { g_string_new(NULL), g_string_new(NULL) };
+    GString *path_src[2] = { g_string_new(NULL), g_string_new(NULL) };
+    gint i, d;
+
+    for (i=0; i<rules->patterns->len; i++)
+    {
+        ExcludePattern *pat = rules->patterns->pdata[i];
+        if (!pat->anchored && is_literal(pat->glob))
+        {
+            add_index(rules->literals, pat->glob, i);
+        }
+        else if (!pat->anchored && pat->glob[0] == '*' && pat->glob[1] == '.'
+                && is_literal(pat->glob + 1))
+        {
+            add_index(rules->suffixes, pat->glob + 1, i);
+        }
+    }
+
+    // The regular expressions have the patterns in reverse order. The first
+    // alternative that matches is the one that gets captured, so that makes
+    // it the last pattern that matches, which is the one that wins.
+    for (i=rules->patterns->len - 1; i>=0; i--)
+    {
+        ExcludePattern *pat = rules->patterns->pdata[i];
+        GRegex *test;
+        char *re;
+
+        if (!pat->anchored && (is_literal(pat->glob)
+                    || (pat->glob[0] == '*' && pat->glob[1] == '.' && is_literal(pat->glob + 1))))
+        {
+            continue;
+        }
+
+        // Make sure that each pattern compiles by itself, so that one bad
+        // pattern doesn't break all of the others.
+        re = glob_to_regex(pat->glob);
+        test = g_regex_new(re, G_REGEX_RAW, 0, NULL);
+        if (test == NULL)
+        {
+            g_warning("Ignoring invalid exclude pattern: %s", pat->glob);
+            g_free(re);
+            continue;
+        }
+        g_regex_unref(test);
+
+        for (d=0; d<2; d++)
+        {
+            if (pat->dir_only && d == 0)
+            {
+                continue;
+            }
+            if (pat->anchored)
+            {
+                append_alternative(path_src[d], &rules->path_regex[d], re, i);
+            }
+            else
+            {
+                append_alternative(name_src[d], &rules->name_regex[d], re, i);
+            }
+        }
+        g_free(re);
+    }
+
+    for (d=0; d<2; d++)
+    {
+        compile_regex(&rules->name_regex[d], name_src[d]);
+        compile_regex(&rules->path_regex[d], path_src[d]);
+        g_string_free(name_src[d], TRUE);
+        g_string_free(path_src[d], TRUE);
+    }
+    rules->compiled = TRUE;
+}
+
+/**
+ * Returns the highest pattern index in a list that applies to a file, or -1.
+ */
+static gint match_indexes(DtExcludeRules *rules, GArray *indexes, gboolean is_dir)
+{
+    guint i;
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+    for (i=indexes->len; i>0; i--)
+    {
+        gint index = g_array_index(indexes, gint, i - 1);
+        ExcludePattern *pat = rules->patterns->pdata[index];
+        if (!pat->dir_only || is_dir)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns the index of the last pattern in a PatternRegex that matches, or -1.
+ */
+static gint match_regex(PatternRegex *pr, const char *subject)
+{
+    GMatchInfo *info = NULL;
+    gint index = -1;
+
+    if (pr->regex == NULL)
+    {
+        return -1;
+    }
+    if (g_regex_match(pr->regex, subject, 0, &info))
+    {
+        // Only one group can match, so the match count is one more than that
+        // group's number.
+        gint count = g_match_info_get_match_count(info);
+        if (count >= 2 && count - 2 < pr->groups->len)
+        {
+            index = g_array_index(pr->groups, gint, count - 2);
+        }
+    }
+    g_match_info_free(info);
+    return index;
+}
+
+DtExcludeMatch dt_exclude_rules_match(DtExcludeRules *rules, const char *relpath,
+        const char *name, gboolean is_dir)
+{
+    gint d = (is_dir ? 1 : 0);
+    gint best = -1;
+    const char *dot;
+    ExcludePattern *pat;
+
+    if (rules->patterns->len == 0)
+    {
+        return DT_EXCLUDE_MATCH_NONE;
+    }
+    if (!rules->compiled)
+    {
+        compile_rules(rules);
+    }
+
+    best = MAX(best, match_indexes(rules, g_hash_table_lookup(rules->literals, name), is_dir));
+    if (g_hash_table_size(rules->suffixes) > 0)
+    {
+        for (dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.'))
+        {
+            best = MAX(best, match_indexes(rules, g_hash_table_lookup(rules->suffixes, dot), is_dir));
+        }
+    }
+    best = MAX(best, match_regex(&rules->name_regex[d], name));
+    best = MAX(best, match_regex(&rules->path_regex[d], relpath));
+
+    if (best < 0)
+    {
+        return DT_EXCLUDE_MATCH_NONE;
+    }
+    pat = rules->patterns->pdata[best];
+    return (pat->negate ? DT_EXCLUDE_MATCH_INCLUDED : DT_EXCLUDE_MATCH_EXCLUDED);
+}
@@ -0,0 +1,84 @@
+#ifndef EXCLUDE_RULES_H
+#define EXCLUDE_RULES_H
+
+/**
+ * \file
+ *
+ * Matches file names against a set of .gitignore-style patterns.
+ *
+ * The patterns follow the same rules as a .gitignore file:
+ *
+ * - Blank lines and lines starting with '#' are ignored.
+ * - A leading '!' negates the pattern, so that a file that an earlier
+ *   pattern excluded is included again.
+ * - A trailing '/' only matches directories.
+ * - If the pattern has a '/' anywhere else, then it's matched against the
+ *   path relative to the directory the rules came from. Otherwise, it's
+ *   matched against the file name at any depth.
+ * - '*' and '?' match anything but a '/', "[...]" matches a character class,
+ *   and "**" matches any number of directories.
+ * - If more than one pattern matches, then the last one wins.
+ *
+ * The patterns are compiled the first time they're used. Plain names are
+ * looked up in a hash table, and so are patterns like "*.o" that only match a
+ * file extension, since those are by far the most common. Everything else is
+ * combined into a single regular expression, so matching a name doesn't loop
+ * over the patterns, no matter how many there are.
+ */
+
+#include <glib.h>
+#include "ref-count-struct.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    /// None of the patterns match.
+    DT_EXCLUDE_MATCH_NONE,
+
+    /// The last pattern that matched excludes the file.
+    DT_EXCLUDE_MATCH_EXCLUDED,
+
+    /// The last pattern that matched was a negated pattern.
+    DT_EXCLUDE_MATCH_INCLUDED,
+} DtExcludeMatch;
+
+typedef struct _DtExcludeRules DtExcludeRules;
+
+UTIL_DECLARE_BOXED_REFCOUNT_FUNCS(DtExcludeRules, dt_exclude_rules);
+
+#define DT_TYPE_EXCLUDE_RULES dt_exclude_rules_get_type()
+
+DtExcludeRules *dt_exclude_rules_new(void);
+
+/**
+ * Adds a single pattern.
+ *
+ * Patterns can't be added after the rules have been used for matching.
+ */
+void dt_exclude_rules_add_pattern(DtExcludeRules *rules, const char *pattern);
+
+/**
+ * Adds every pattern in the contents of a .gitignore file.
+ */
+void dt_exclude_rules_add_from_data(DtExcludeRules *rules, const char *data, gsize length);
+
+/**
+ * Returns TRUE if there aren't any patterns.
+ */
+gboolean dt_exclude_rules_is_empty(DtExcludeRules *rules);
+
+/**
+ * Checks a file against the patterns.
+ *
+ * \param relpath The path of the file, relative to the directory that the
+ *      rules apply to, without a leading '/'.
+ * \param name The file name. This should be the last component of \p relpath.
+ * \param is_dir TRUE if the file is a directory.
+ */
+DtExcludeMatch dt_exclude_rules_match(DtExcludeRules *rules, const char *relpath,
+        const char *name, gboolean is_dir);
+
+G_END_DECLS
+
+#endif // EXCLUDE_RULES_H
@@ -0,0 +1,173 @@
+#include "file-digest.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+/**
+ * How much to read at once. This is big enough that the syscall overhead
+ * doesn't matter next to the hashing.
+ */
+#define READ_BUFFER_SIZE (1024 * 1024)
+
+struct _DtFileDigest
+{
+#ifdef HAVE_XXHASH
+    XXH3_state_t *state;
+#else
+    GChecksum *checksum;
+#endif
+};
+
+const char *dt_file_digest_get_algorithm(void)
+{
+#ifdef HAVE_XXHASH
+    return "xxh128";
+#else
+    return "md5";
+#endif
+}
+
+DtFileDigest *dt_file_digest_new(void)
+{
+    DtFileDigest *digest = g_malloc(sizeof(DtFileDigest));
+
+#ifdef HAVE_XXHASH
+    digest->state = XXH3_createState();
+    XXH3_128bits_reset(digest->state);
+#else
+    digest->checksum = g_checksum_new(G_CHECKSUM_MD5);
+#endif
+    return digest;
+}
+
+void dt_file_digest_update(DtFileDigest *digest, const void *data, gsize len)
+{
+#ifdef HAVE_XXHASH
+    XXH3_128bits_update(digest->state, data, len);
+#else
+    g_checksum_update(digest->checksum, data, len);
+#endif
+}
+
+void dt_file_digest_finish(DtFileDigest *digest, guint8 *ret_digest)
+{
+#ifdef HAVE_XXHASH
+    XXH128_canonical_t canonical;
+
+    XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(digest->state));
+    memcpy(ret_digest, canonical.digest, DT_FILE_DIGEST_SIZE);
+#else
+    gsize len = DT_FILE_DIGEST_SIZE;
+
+    g_checksum_get_digest(digest->checksum, ret_digest, &len);
+    g_assert(len == DT_FILE_DIGEST_SIZE);
+#endif
+    dt_file_digest_free(digest);
+}
+
+void dt_file_digest_free(DtFileDigest *digest)
+{
+    if (digest != NULL)
+    {
+#ifdef HAVE_XXHASH
+        XXH3_freeState(digest->state);
+#else
+        g_checksum_free(digest->checksum);
+#endif
+        g_free(digest);
+    }
+}
+
+gboolean dt_file_digest_compute_path(const char *path, GCancellable *cancellable,
+        guint8 *ret_digest, GError **error)
+{
+    DtFileDigest *digest;
+    guchar *buffer;
+    gboolean ret = FALSE;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        int err = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                "Can't open %s: %s", path, g_strerror(err));
+        return FALSE;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    digest = dt_file_digest_new();
+    buffer = g_malloc(READ_BUFFER_SIZE);
+    while (TRUE)
+    {
+        ssize_t num;
+
+        if (g_cancellable_set_error_if_cancelled(cancellable, error))
+        {
+            break;
+        }
+
+        num = read(fd, buffer, READ_BUFFER_SIZE);
+        if (num > 0)
+        {
+            dt_file_digest_update(digest, buffer, num);
+        }
+        else if (num == 0)
+        {
+            dt_file_digest_finish(digest, ret_digest);
+            digest = NULL;
+            ret = TRUE;
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            int err = errno;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                    "Can't read %s: %s", path, g_strerror(err));
+            break;
+        }
+    }
+
+    g_free(buffer);
+    close(fd);
+    dt_file_digest_free(digest);
+    return ret;
+}
+
+gboolean dt_file_digest_compute_stream(GInputStream *stream, GCancellable *cancellable,
+        guint8 *ret_digest, GError **error)
+{
+    DtFileDigest *digest = dt_file_digest_new();
+    guchar *buffer = g_malloc(READ_BUFFER_SIZE);
+    gboolean ret = FALSE;
+
+    while (TRUE)
+    {
+        gsize num = 0;
+
+        if (!g_input_stream_read_all(stream, buffer, READ_BUFFER_SIZE, &num, cancellable, error))
+        {
+            break;
+        }
+        dt_file_digest_update(digest, buffer, num);
+        if (num < READ_BUFFER_SIZE)
+        {
+            dt_file_digest_finish(digest, ret_digest);
+            digest = NULL;
+            ret = TRUE;
+            break;
+        }
+    }
+
+    g_free(buffer);
+    dt_file_digest_free(digest);
+    return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef FILE_DIGEST_H
+#define FILE_DIGEST_H
+
+/**
+ * \file
+ *
+ * Computes a digest of a file's contents.
+ *
+ * The digest is a fast, non-cryptographic 128-bit hash, so that comparing
+ * many copies of a file only needs to read each copy once. If xxHash was
+ * available at build time, then this uses XXH3-128. Otherwise, it falls back
+ * to MD5 from GChecksum, which is slower but still the same size.
+ *
+ * The digests aren't meant to resist a deliberate collision, only to tell
+ * whether two files are the same.
+ *
+ * The functions that read a file are blocking, and are meant to be called
+ * from a worker thread.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * The size of a digest, in bytes.
+ */
+#define DT_FILE_DIGEST_SIZE 16
+
+typedef struct _DtFileDigest DtFileDigest;
+
+/**
+ * Returns the name of the hash function, like "xxh128" or "md5".
+ *
+ * Digests from different hash functions can't be compared, so anything that
+ * saves a digest should save this with it.
+ */
+const char *dt_file_digest_get_algorithm(void);
+
+/**
+ * Starts computing a digest incrementally.
+ */
+DtFileDigest *dt_file_digest_new(void);
+void dt_file_digest_update(DtFileDigest *digest, const void *data, gsize len);
+
+/**
+ * Returns the digest and frees \p digest.
+ *
+ * \param ret_digest Returns the digest. This must be DT_FILE_DIGEST_SIZE
+ *      bytes.
+ */
+void dt_file_digest_finish(DtFileDigest *digest, guint8 *ret_digest);
+
+/**
+ * Frees a digest without finishing it.
+ */
+void dt_file_digest_free(DtFileDigest *digest);
+
+/**
+ * Reads a local file and computes its digest.
+ */
+gboolean dt_file_digest_compute_path(const char *path, GCancellable *cancellable,
+        guint8 *ret_digest, GError **error);
+
+/**
+ * Reads a stream to the end and computes its digest.
+ */
+gboolean dt_file_digest_compute_stream(GInputStream *stream, GCancellable *cancellable,
+        guint8 *ret_digest, GError **error);
+
+G_END_DECLS
+
+#endif // FILE_DIGEST_H
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include "fs-compare.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_MMAP
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+/**
+ * How much of each file to map at once. Mapping a window at a time keeps
+ * the address space bounded on a 32-bit system, and unmapping each window
+ * lets the kernel drop the pages that we're done with.
+ */
+#define MAP_WINDOW_SIZE (64 * 1024 * 1024)
+
+typedef gsize (* FindDifferenceFunc) (const guchar *a, const guchar *b, gsize len);
+
+static gsize find_difference_generic(const guchar *a, const guchar *b, gsize len)
+{
+    gsize i = 0;
+
+    for (; i + sizeof(guint64) <= len; i += sizeof(guint64))
+    {
+        guint64 x, y;
+
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y)
+        {
+            break;
+        }
+    }
+    for (; i < len && a[i] == b[i]; i++)
+    {
+    }
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static gsize find_difference_avx2(const guchar *a, const guchar *b, gsize len)
+{
+    gsize i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        guint32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (mask != 0xFFFFFFFF)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + find_difference_generic(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static gsize find_difference_sse2(const guchar *a, const guchar *b, gsize len)
+{
+    gsize i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+        guint32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+        if (mask != 0xFFFF)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + find_difference_generic(a + i, b + i, len - i);
+}
+#endif // HAVE_X86_SIMD
+
+#ifdef HAVE_NEON
+static gsize find_difference_neon(const guchar *a, const guchar *b, gsize len)
+{
+    gsize i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+
+        if (vminvq_u8(eq) != 0xFF)
+        {
+            // Let the generic version find the exact byte.
+            break;
+        }
+    }
+    return i + find_difference_generic(a + i, b + i, len - i);
+}
+#endif // HAVE_NEON
+
+static FindDifferenceFunc get_find_difference_func(void)
+{
+    static gsize init = 0;
+    static FindDifferenceFunc func = NULL;
+
+    if (g_once_init_enter(&init))
+    {
+        func = find_difference_generic;
+#if defined(HAVE_X86_SIMD)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            func = find_difference_avx2;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            func = find_difference_sse2;
+        }
+#elif defined(HAVE_NEON)
+        func = find_difference_neon;
+#endif
+        g_once_init_leave(&init, 1);
+    }
+    return func;
+}
+
+gsize dt_fs_compare_find_difference(const void *a, const void *b, gsize len)
+{
+    return get_find_difference_func()(a, b, len);
+}
+
+#ifdef HAVE_MMAP
+
+/**
+ * The jump buffer for the comparison that's running on this thread, if any.
+ *
+ * If a file is truncated while it's mapped, then touching the pages past the
+ * new end raises SIGBUS. The handler jumps back out of the comparison
+ * instead of killing the process.
+ */
+static __thread sigjmp_buf *sigbus_jump = NULL;
+
+static void on_sigbus(int signum, siginfo_t *info, void *context)
+{
+    if (sigbus_jump != NULL)
+    {
+        siglongjmp(*sigbus_jump, 1);
+    }
+
+    // This wasn't from one of our mappings, so crash the way we normally
+    // would.
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+}
+
+static void install_sigbus_handler(void)
+{
+    static gsize init = 0;
+
+    if (g_once_init_enter(&init))
+    {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = on_sigbus;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGBUS, &sa, NULL);
+        g_once_init_leave(&init, 1);
+    }
+}
+
+/**
+ * Compares one window of every file against the first file.
+ *
+ * If \p digest isn't NULL and the window is the same in every file, then
+ * this also adds the window to the digest. The pages are already in the
+ * cache at that point, so that's much cheaper than reading them again later.
+ *
+ * \return TRUE on success, or FALSE if we got a SIGBUS.
+ */
+static gboolean compare_window(guchar **maps, gint num_maps, gsize len,
+        DtFileDigest *digest, gsize *ret_offset)
+{
+    FindDifferenceFunc func = get_find_difference_func();
+    sigjmp_buf jump;
+    gint i;
+
+    if (sigsetjmp(jump, 1) != 0)
+    {
+        sigbus_jump = NULL;
+        return FALSE;
+    }
+    sigbus_jump = &jump;
+
+    *ret_offset = len;
+    for (i=1; i<num_maps; i++)
+    {
+        gsize offset = func(maps[0], maps[i], *ret_offset);
+        if (offset < *ret_offset)
+        {
+            *ret_offset = offset;
+        }
+    }
+    if (digest != NULL && *ret_offset == len)
+    {
+        dt_file_digest_update(digest, maps[0], len);
+    }
+
+    sigbus_jump = NULL;
+    return TRUE;
+}
+
+#endif // HAVE_MMAP
+
+gboolean dt_fs_compare_is_supported(void)
+{
+#ifdef HAVE_MMAP
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean dt_fs_compare_mapped(const char * const *paths, gint num_paths,
+        DtFileDigest *digest, GCancellable *cancellable, gint64 *ret_diff_offset)
+{
+#ifdef HAVE_MMAP
+    int *fds = g_alloca(num_paths * sizeof(int));
+    guchar **maps = g_alloca(num_paths * sizeof(guchar *));
+    guint64 size = 0;
+    guint64 offset;
+    gsize len = 0;
+    gboolean ret = FALSE;
+    gint i;
+
+    install_sigbus_handler();
+
+    for (i=0; i<num_paths; i++)
+    {
+        fds[i] = -1;
+        maps[i] = NULL;
+    }
+
+    for (i=0; i<num_paths; i++)
+    {
+        struct stat st;
+
+        fds[i] = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fds[i] < 0 || fstat(fds[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            goto done;
+        }
+        if (i == 0)
+        {
+            size = st.st_size;
+        }
+        else if ((guint64) st.st_size != size)
+        {
+            // One of the files changed since we scanned it.
+            *ret_diff_offset = MIN(size, (guint64) st.st_size);
+            ret = TRUE;
+            goto done;
+        }
+    }
+
+    *ret_diff_offset = -1;
+    for (offset = 0; offset < size; offset += MAP_WINDOW_SIZE)
+    {
+        gsize diff;
+        gboolean success;
+
+        len = MIN(size - offset, MAP_WINDOW_SIZE);
+        diff = len;
+        if (g_cancellable_is_cancelled(cancellable))
+        {
+            goto done;
+        }
+
+        for (i=0; i<num_paths; i++)
+        {
+            void *ptr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fds[i], offset);
+            if (ptr == MAP_FAILED)
+            {
+                goto done;
+            }
+            maps[i] = ptr;
+
+            // Start reading ahead in every file at once, so that each device
+            // is busy while we compare.
+            madvise(ptr, len, MADV_SEQUENTIAL);
+            madvise(ptr, len, MADV_WILLNEED);
+        }
+
+        success = compare_window(maps, num_paths, len, digest, &diff);
+
+        for (i=0; i<num_paths; i++)
+        {
+            munmap(maps[i], len);
+            maps[i] = NULL;
+        }
+
+        if (!success)
+        {
+            goto done;
+        }
+        if (diff < len)
+        {
+            *ret_diff_offset = offset + diff;
+            break;
+        }
+    }
+    ret = TRUE;
+
+done:
+    for (i=0; i<num_paths; i++)
+    {
+        if (maps[i] != NULL)
+        {
+            munmap(maps[i], len);
+        }
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    return ret;
+#else
+    return FALSE;
+#endif
+}
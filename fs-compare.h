@@ -0,0 +1,60 @@
+#ifndef FS_COMPARE_H
+#define FS_COMPARE_H
+
+/**
+ * \file
+ *
+ * Compares local files by mapping them into memory.
+ *
+ * Reading through a GInputStream copies every block from the page cache into
+ * a buffer first. Mapping the files lets us compare the page cache directly,
+ * and an madvise hint lets the kernel read ahead in every file at once.
+ *
+ * The comparison itself uses the widest vector instructions that the CPU
+ * has (AVX2 or SSE2 on x86, NEON on ARM64), picked at runtime.
+ *
+ * The functions are blocking, and are meant to be called from a worker
+ * thread.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "file-digest.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Returns TRUE if mmap was available at build time.
+ */
+gboolean dt_fs_compare_is_supported(void);
+
+/**
+ * Compares two or more local files by mapping them.
+ *
+ * If a file shrinks while it's mapped, then the comparison stops instead of
+ * crashing on SIGBUS, and this returns FALSE.
+ *
+ * \param paths The files to compare.
+ * \param digest If this isn't NULL, then the contents of the first file are
+ *      added to it as they're compared, so that the caller gets a digest
+ *      without reading the files again. It only covers the whole file if the
+ *      files are identical.
+ * \param ret_diff_offset Returns the offset of the first byte that isn't the
+ *      same in every file, or -1 if the files are identical.
+ * \return TRUE if the comparison finished, or FALSE if a file couldn't be
+ *      mapped or \p cancellable was cancelled. The caller should fall back to
+ *      reading the files instead.
+ */
+gboolean dt_fs_compare_mapped(const char * const *paths, gint num_paths,
+        DtFileDigest *digest, GCancellable *cancellable, gint64 *ret_diff_offset);
+
+/**
+ * Returns the offset of the first byte that's different between two buffers,
+ * or \p len if they're the same.
+ */
+gsize dt_fs_compare_find_difference(const void *a, const void *b, gsize len);
+
+G_END_DECLS
+
+#endif // FS_COMPARE_H
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "fs-extents.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FIEMAP
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+/**
+ * The number of extents to ask for in each FIEMAP call.
+ */
+#define EXTENTS_PER_CALL 64
+
+/**
+ * Extent flags that mean that the physical offset can't be compared.
+ */
+#define UNSTABLE_EXTENT_FLAGS (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC \
+        | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_NOT_ALIGNED)
+
+static struct fiemap *fiemap_new(void)
+{
+    return g_malloc0(sizeof(struct fiemap) + EXTENTS_PER_CALL * sizeof(struct fiemap_extent));
+}
+
+/**
+ * Reads the extents for part of a file.
+ *
+ * This uses FIEMAP_FLAG_SYNC, so that any dirty data gets written out first.
+ * Otherwise, data that's only in the page cache could show up as a hole, or
+ * as a delayed allocation that doesn't have a physical offset yet.
+ */
+static gboolean get_extents(int fd, struct fiemap *fm, guint64 start, guint64 length)
+{
+    memset(fm, 0, sizeof(struct fiemap));
+    fm->fm_start = start;
+    fm->fm_length = length;
+    fm->fm_flags = FIEMAP_FLAG_SYNC;
+    fm->fm_extent_count = EXTENTS_PER_CALL;
+    return (ioctl(fd, FS_IOC_FIEMAP, fm) == 0);
+}
+
+static gboolean compare_extents(int fd0, int fd1, guint64 size)
+{
+    struct fiemap *fm0 = fiemap_new();
+    struct fiemap *fm1 = fiemap_new();
+    guint64 start = 0;
+    gboolean ret = FALSE;
+
+    while (start < size)
+    {
+        const struct fiemap_extent *last0, *last1;
+        guint32 i;
+
+        if (!get_extents(fd0, fm0, start, size - start)
+                || !get_extents(fd1, fm1, start, size - start))
+        {
+            break;
+        }
+        if (fm0->fm_mapped_extents != fm1->fm_mapped_extents)
+        {
+            break;
+        }
+        if (fm0->fm_mapped_extents == 0)
+        {
+            // The rest of both files is a hole.
+            ret = TRUE;
+            break;
+        }
+
+        for (i=0; i<fm0->fm_mapped_extents; i++)
+        {
+            const struct fiemap_extent *e0 = &fm0->fm_extents[i];
+            const struct fiemap_extent *e1 = &fm1->fm_extents[i];
+
+            // An unknown or delayed-allocation extent doesn't have a real
+            // physical offset yet, so we can't tell whether the files share
+            // it. Give up and let the caller read the files instead.
+            if ((e0->fe_flags & UNSTABLE_EXTENT_FLAGS) != 0
+                    || (e1->fe_flags & UNSTABLE_EXTENT_FLAGS) != 0)
+            {
+                break;
+            }
+
+            if (e0->fe_logical != e1->fe_logical
+                    || e0->fe_physical != e1->fe_physical
+                    || e0->fe_length != e1->fe_length
+                    || (e0->fe_flags & ~FIEMAP_EXTENT_LAST) != (e1->fe_flags & ~FIEMAP_EXTENT_LAST))
+            {
+                break;
+            }
+        }
+        if (i < fm0->fm_mapped_extents)
+        {
+            break;
+        }
+
+        last0 = &fm0->fm_extents[fm0->fm_mapped_extents - 1];
+        last1 = &fm1->fm_extents[fm1->fm_mapped_extents - 1];
+        if ((last0->fe_flags & FIEMAP_EXTENT_LAST) != (last1->fe_flags & FIEMAP_EXTENT_LAST))
+        {
+            break;
+        }
+        start = last0->fe_logical + last0->fe_length;
+        if ((last0->fe_flags & FIEMAP_EXTENT_LAST) || start >= size)
+        {
+            ret = TRUE;
+            break;
+        }
+    }
+
+    g_free(fm0);
+    g_free(fm1);
+    return ret;
+}
+#endif // HAVE_FIEMAP
+
+gboolean dt_fs_extents_is_supported(void)
+{
+#ifdef HAVE_FIEMAP
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean dt_fs_extents_same(const char *path0, const char *path1)
+{
+#ifdef HAVE_FIEMAP
+    struct stat st0, st1;
+    gboolean ret = FALSE;
+    int fd0 = -1;
+    int fd1 = -1;
+
+    fd0 = open(path0, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd0 < 0)
+    {
+        goto done;
+    }
+    fd1 = open(path1, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd1 < 0)
+    {
+        goto done;
+    }
+    if (fstat(fd0, &st0) != 0 || fstat(fd1, &st1) != 0)
+    {
+        goto done;
+    }
+
+    // Physical offsets only mean anything within the same device. Empty files
+    // are cheap enough to just read.
+    if (!S_ISREG(st0.st_mode) || !S_ISREG(st1.st_mode)
+            || st0.st_dev != st1.st_dev
+            || st0.st_size != st1.st_size
+            || st0.st_size == 0)
+    {
+        goto done;
+    }
+
+    ret = compare_extents(fd0, fd1, st0.st_size);
+
+done:
+    if (fd0 >= 0)
+    {
+        close(fd0);
+    }
+    if (fd1 >= 0)
+    {
+        close(fd1);
+    }
+    return ret;
+#else
+    return FALSE;
+#endif
+}
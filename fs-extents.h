@@ -0,0 +1,43 @@
+#ifndef FS_EXTENTS_H
+#define FS_EXTENTS_H
+
+/**
+ * \file
+ *
+ * Compares the physical extents of two files, to recognize reflink copies.
+ *
+ * On filesystems like btrfs and XFS, a file that was copied with a reflink
+ * shares its data blocks with the original until one of them is modified. If
+ * every extent of two files maps to the same physical blocks, then the files
+ * have to have the same contents, so there's no need to read them.
+ *
+ * This uses the FIEMAP ioctl, so it only works on Linux. The functions are
+ * blocking, and are meant to be called from a worker thread.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Returns TRUE if FIEMAP was available at build time.
+ */
+gboolean dt_fs_extents_is_supported(void);
+
+/**
+ * Checks whether two files have exactly the same physical extents.
+ *
+ * This is conservative: it only returns TRUE if both files are regular files
+ * on the same device with the same size, and every extent has the same
+ * logical offset, physical offset, and length. If the filesystem doesn't
+ * support FIEMAP, or if any extent doesn't have a stable physical location
+ * (for example, data that hasn't been written out yet), then it returns FALSE.
+ *
+ * Any dirty data in either file is written out before reading its extents,
+ * so this can block on disk writes.
+ */
+gboolean dt_fs_extents_same(const char *path0, const char *path1);
+
+G_END_DECLS
+
+#endif // FS_EXTENTS_H
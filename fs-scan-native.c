@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include "fs-scan-native.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#ifdef HAVE_GETDENTS64
+#include <sys/syscall.h>
+#endif
+
+/**
+ * The size of the buffer that we pass to getdents64.
+ */
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+DtFsEntryBatch *dt_fs_entry_batch_new(guint reserve)
+{
+    DtFsEntryBatch *batch = g_malloc(sizeof(DtFsEntryBatch));
+    batch->entries = g_array_sized_new(FALSE, FALSE, sizeof(DtFsEntry), reserve);
+    batch->names = g_string_sized_new(reserve * 16);
+    return batch;
+}
+
+void dt_fs_entry_batch_free(DtFsEntryBatch *batch)
+{
+    if (batch != NULL)
+    {
+        g_array_unref(batch->entries);
+        g_string_free(batch->names, TRUE);
+        g_free(batch);
+    }
+}
+
+guint32 dt_fs_entry_batch_add_string(DtFsEntryBatch *batch, const char *str, gssize len)
+{
+    guint32 offset = batch->names->len;
+    g_string_append_len(batch->names, str, len);
+    g_string_append_c(batch->names, '\x00');
+    return offset;
+}
+
+#ifdef HAVE_GETDENTS64
+
+/**
+ * The record format returned by getdents64. glibc doesn't define this.
+ */
+struct linux_dirent64
+{
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+gboolean dt_fs_scan_native_is_supported(void)
+{
+    return TRUE;
+}
+
+static GFileType file_type_from_mode(guint32 mode)
+{
+    if (S_ISREG(mode))
+    {
+        return G_FILE_TYPE_REGULAR;
+    }
+    else if (S_ISDIR(mode))
+    {
+        return G_FILE_TYPE_DIRECTORY;
+    }
+    else if (S_ISLNK(mode))
+    {
+        return G_FILE_TYPE_SYMBOLIC_LINK;
+    }
+    else
+    {
+        return G_FILE_TYPE_SPECIAL;
+    }
+}
+
+/**
+ * Looks up the metadata for a single entry.
+ *
+ * This uses statx if it's available, and only asks for the fields that we
+ * actually use.
+ */
+static int stat_entry(int dirfd, const char *name, gboolean follow_symlinks, DtFsEntry *entry)
+{
+    int flags = AT_NO_AUTOMOUNT;
+    if (!follow_symlinks)
+    {
+        flags |= AT_SYMLINK_NOFOLLOW;
+    }
+
+#ifdef HAVE_STATX
+    {
+        static gint statx_missing = FALSE;
+        if (!g_atomic_int_get(&statx_missing))
+        {
+            struct statx stx;
+            if (statx(dirfd, name, flags, DT_FS_SCAN_STATX_MASK, &stx) == 0)
+            {
+                entry->mode = stx.stx_mode;
+                entry->size = stx.stx_size;
+                entry->mtime_sec = stx.stx_mtime.tv_sec;
+                entry->mtime_nsec = stx.stx_mtime.tv_nsec;
+                entry->ctime_sec = stx.stx_ctime.tv_sec;
+                entry->ctime_nsec = stx.stx_ctime.tv_nsec;
+                entry->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+                entry->ino = stx.stx_ino;
+                return 0;
+            }
+            if (errno != ENOSYS)
+            {
+                return -1;
+            }
+
+            // The kernel doesn't support statx, so fall back to fstatat from
+            // now on.
+            g_atomic_int_set(&statx_missing, TRUE);
+        }
+    }
+#endif
+
+    {
+        struct stat st;
+        if (fstatat(dirfd, name, &st, flags) != 0)
+        {
+            return -1;
+        }
+        entry->mode = st.st_mode;
+        entry->size = st.st_size;
+        entry->mtime_sec = st.st_mtim.tv_sec;
+        entry->mtime_nsec = st.st_mtim.tv_nsec;
+        entry->ctime_sec = st.st_ctim.tv_sec;
+        entry->ctime_nsec = st.st_ctim.tv_nsec;
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        return 0;
+    }
+}
+
+void dt_fs_entry_batch_append(DtFsEntryBatch *batch, int dirfd, const char *name,
+        unsigned char d_type, DtFsEntry *entry)
+{
+    entry->type = file_type_from_mode(entry->mode);
+    entry->symlink_offset = DT_FS_ENTRY_NO_OFFSET;
+
+    if (d_type == DT_LNK || entry->type == G_FILE_TYPE_SYMBOLIC_LINK)
+    {
+        char target[4096];
+        ssize_t len = readlinkat(dirfd, name, target, sizeof(target));
+        if (len >= 0 && len < sizeof(target))
+        {
+            entry->symlink_offset = dt_fs_entry_batch_add_string(batch, target, len);
+        }
+    }
+
+    g_array_append_val(batch->entries, *entry);
+}
+
+gboolean dt_fs_scan_native_read_dirents(int fd, const char *path,
+        DtFsDirentFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error)
+{
+    char *buffer = g_malloc(DIRENT_BUFFER_SIZE);
+    gboolean success = TRUE;
+
+    while (TRUE)
+    {
+        long num;
+        long pos;
+
+        if (g_cancellable_set_error_if_cancelled(cancellable, error))
+        {
+            success = FALSE;
+            break;
+        }
+
+        num = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER_SIZE);
+        if (num < 0)
+        {
+            int err = errno;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                    "Can't read %s: %s", path, strerror(err));
+            success = FALSE;
+            break;
+        }
+        else if (num == 0)
+        {
+            break;
+        }
+
+        for (pos = 0; pos < num; )
+        {
+            struct linux_dirent64 *ent = (struct linux_dirent64 *) (buffer + pos);
+            pos += ent->d_reclen;
+
+            if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+            {
+                func(ent->d_name, ent->d_type, userdata);
+            }
+        }
+    }
+
+    g_free(buffer);
+    return success;
+}
+
+typedef struct
+{
+    int fd;
+    gboolean follow_symlinks;
+    guint batch_size;
+    DtFsEntryBatchFunc func;
+    gpointer userdata;
+    DtFsEntryBatch *batch;
+} ReadDirState;
+
+/**
+ * Adds an entry to the current batch.
+ *
+ * If the entry was deleted after we read the directory, then this drops it.
+ * If we can't stat it for any other reason, then this still adds it, with
+ * only the file type from \p d_type.
+ */
+static void read_dir_entry(const char *name, unsigned char d_type, gpointer userdata)
+{
+    ReadDirState *state = userdata;
+    DtFsEntry entry = {};
+
+    if (stat_entry(state->fd, name, state->follow_symlinks, &entry) != 0)
+    {
+        int err = errno;
+
+        // If we're following symlinks and the target doesn't exist, then
+        // report the symlink itself, the same way that GIO does.
+        if (state->follow_symlinks && err == ENOENT)
+        {
+            err = (stat_entry(state->fd, name, FALSE, &entry) == 0 ? 0 : errno);
+        }
+
+        if (err == ENOENT)
+        {
+            return;
+        }
+        else if (err != 0)
+        {
+            g_debug("Can't stat %s: %s", name, strerror(err));
+            memset(&entry, 0, sizeof(entry));
+            entry.mode = DTTOIF(d_type);
+        }
+    }
+
+    if (state->batch == NULL)
+    {
+        state->batch = dt_fs_entry_batch_new(state->batch_size);
+    }
+
+    entry.name_offset = dt_fs_entry_batch_add_string(state->batch, name, -1);
+    dt_fs_entry_batch_append(state->batch, state->fd, name, d_type, &entry);
+    if (state->batch->entries->len >= state->batch_size)
+    {
+        state->func(state->batch, state->userdata);
+        state->batch = NULL;
+    }
+}
+
+gboolean dt_fs_scan_native_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error)
+{
+    ReadDirState state;
+    gboolean ret;
+
+    state.fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (state.fd < 0)
+    {
+        int err = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                "Can't open %s: %s", path, strerror(err));
+        return FALSE;
+    }
+
+    state.follow_symlinks = follow_symlinks;
+    state.batch_size = batch_size;
+    state.func = func;
+    state.userdata = userdata;
+    state.batch = NULL;
+
+    ret = dt_fs_scan_native_read_dirents(state.fd, path, read_dir_entry, &state,
+                cancellable, error);
+    if (ret && state.batch != NULL)
+    {
+        func(state.batch, userdata);
+    }
+    else
+    {
+        dt_fs_entry_batch_free(state.batch);
+    }
+
+    close(state.fd);
+    return ret;
+}
+
+#else // HAVE_GETDENTS64
+
+gboolean dt_fs_scan_native_is_supported(void)
+{
+    return FALSE;
+}
+
+gboolean dt_fs_scan_native_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error)
+{
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "Native directory scanning is not supported on this platform");
+    return FALSE;
+}
+
+#endif // HAVE_GETDENTS64
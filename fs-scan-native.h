@@ -0,0 +1,158 @@
+#ifndef FS_SCAN_NATIVE_H
+#define FS_SCAN_NATIVE_H
+
+/**
+ * \file
+ *
+ * Reads directories using getdents64(2) and statx(2), without going through
+ * GFileEnumerator.
+ *
+ * These functions are all blocking, and are meant to be called from a worker
+ * thread. The results come back as DtFsEntryBatch structs, which just hold an
+ * array of fixed-size records and a single buffer with all of the names, so
+ * that they're cheap to pass back to the main thread. Each batch is handed
+ * off as soon as it's full, so that the caller can start adding entries to
+ * the tree while the rest of a large directory is still being read.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Used for DtFsEntry::symlink_offset if an entry doesn't have a symlink
+ * target.
+ */
+#define DT_FS_ENTRY_NO_OFFSET G_MAXUINT32
+
+/**
+ * A single directory entry.
+ */
+typedef struct
+{
+    /// The offset of the name in DtFsEntryBatch::names.
+    guint32 name_offset;
+
+    /// The offset of the symlink target in DtFsEntryBatch::names.
+    guint32 symlink_offset;
+
+    GFileType type;
+    guint32 mode;
+    guint64 size;
+    gint64 mtime_sec;
+    guint32 mtime_nsec;
+    guint32 ctime_nsec;
+    gint64 ctime_sec;
+
+    /// The device and inode number, to recognize hardlinks to the same file.
+    guint64 dev;
+    guint64 ino;
+} DtFsEntry;
+
+/**
+ * A batch of directory entries.
+ */
+typedef struct
+{
+    /// An array of DtFsEntry structs.
+    GArray *entries;
+
+    /// The names and symlink targets of every entry, each terminated with a NUL.
+    GString *names;
+} DtFsEntryBatch;
+
+DtFsEntryBatch *dt_fs_entry_batch_new(guint reserve);
+void dt_fs_entry_batch_free(DtFsEntryBatch *batch);
+
+/**
+ * The statx fields that the scanners ask for.
+ */
+#define DT_FS_SCAN_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO)
+
+/**
+ * Appends a NUL-terminated string to DtFsEntryBatch::names.
+ *
+ * \return The offset of the new string.
+ */
+guint32 dt_fs_entry_batch_add_string(DtFsEntryBatch *batch, const char *str, gssize len);
+
+/**
+ * Adds an entry to a batch.
+ *
+ * The caller fills in the name_offset, mode, size, mtime, dev, and ino fields of
+ * \p entry. This fills in the file type, and reads the symlink target if
+ * there is one.
+ *
+ * \param dirfd A file descriptor for the directory that contains the entry.
+ * \param name The name of the entry.
+ * \param d_type The d_type value from getdents64, or DT_UNKNOWN.
+ */
+void dt_fs_entry_batch_append(DtFsEntryBatch *batch, int dirfd, const char *name,
+        unsigned char d_type, DtFsEntry *entry);
+
+static inline const DtFsEntry *dt_fs_entry_batch_get_entry(const DtFsEntryBatch *batch, guint index)
+{
+    return &g_array_index(batch->entries, DtFsEntry, index);
+}
+
+static inline const char *dt_fs_entry_batch_get_string(const DtFsEntryBatch *batch, guint32 offset)
+{
+    if (offset == DT_FS_ENTRY_NO_OFFSET)
+    {
+        return NULL;
+    }
+    return batch->names->str + offset;
+}
+
+/**
+ * Returns TRUE if the native scanner was available at build time.
+ */
+gboolean dt_fs_scan_native_is_supported(void);
+
+/**
+ * A callback for dt_fs_scan_native_read_dirents.
+ */
+typedef void (* DtFsDirentFunc) (const char *name, unsigned char d_type, gpointer userdata);
+
+/**
+ * Calls \p func for every entry in a directory, other than "." and "..".
+ *
+ * \param fd A file descriptor for the directory.
+ * \param path The path to the directory, for error messages.
+ * \return FALSE if the operation was cancelled or if reading the directory
+ *      failed. Any entries that were already passed to \p func are still
+ *      valid.
+ */
+gboolean dt_fs_scan_native_read_dirents(int fd, const char *path,
+        DtFsDirentFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error);
+
+/**
+ * A callback for dt_fs_scan_native_read_dir, which gets each batch of
+ * entries. This is called on the same thread as dt_fs_scan_native_read_dir,
+ * and it takes ownership of \p batch.
+ */
+typedef void (* DtFsEntryBatchFunc) (DtFsEntryBatch *batch, gpointer userdata);
+
+/**
+ * Reads every entry in a directory.
+ *
+ * \param path The path to the directory.
+ * \param follow_symlinks If TRUE, then report the type and size of the
+ *      symlink target instead of the symlink itself.
+ * \param batch_size The maximum number of entries in each batch.
+ * \param func Called with each batch of entries. Every batch but the last
+ *      one has \p batch_size entries.
+ * \param cancellable A GCancellable, or NULL.
+ * \param error Returns an error if the directory can't be opened.
+ * \return FALSE on error. Any batches that were already passed to \p func
+ *      are still valid.
+ */
+gboolean dt_fs_scan_native_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error);
+
+G_END_DECLS
+
+#endif // FS_SCAN_NATIVE_H
@@ -0,0 +1,674 @@
+#define _GNU_SOURCE
+#include "fs-scan-uring.h"
+#include "fs-scan-native.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(HAVE_IO_URING) && defined(HAVE_GETDENTS64)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * The number of submission queue entries in each ring. This is also the
+ * maximum number of statx calls that we submit at once.
+ */
+#define URING_ENTRIES 256
+
+/**
+ * A single io_uring instance, with the submission and completion queues
+ * mapped into memory.
+ */
+typedef struct
+{
+    int fd;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int sq_entries;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /**
+     * Set if io_uring_enter failed. The submission queue might still have
+     * requests in it that the kernel never took, so the ring can't be used
+     * again.
+     */
+    gboolean failed;
+
+    /**
+     * Set if io_uring_enter failed, and we couldn't wait for the requests
+     * that the kernel already took. Those could still write to their
+     * buffers, so nothing that they point to can be freed.
+     */
+    gboolean busy;
+} DtUring;
+
+/**
+ * Set to TRUE if we failed to create a ring, so that we don't keep trying on
+ * every thread.
+ */
+static gint uring_unavailable = FALSE;
+
+static void uring_free(gpointer ptr);
+static GPrivate thread_ring = G_PRIVATE_INIT(uring_free);
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_free(gpointer ptr)
+{
+    DtUring *ring = ptr;
+    if (ring != NULL)
+    {
+        if (ring->sqes != NULL)
+        {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        {
+            munmap(ring->cq_ptr, ring->cq_size);
+        }
+        if (ring->sq_ptr != NULL)
+        {
+            munmap(ring->sq_ptr, ring->sq_size);
+        }
+        if (ring->fd >= 0)
+        {
+            close(ring->fd);
+        }
+        g_free(ring);
+    }
+}
+
+/**
+ * Checks whether the kernel supports the opcodes that we need.
+ */
+static gboolean uring_probe_opcodes(int fd)
+{
+    static const guint8 REQUIRED_OPS[] = { IORING_OP_OPENAT, IORING_OP_STATX };
+    struct io_uring_probe *probe;
+    gboolean supported = TRUE;
+    guint i;
+
+    probe = g_malloc0(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) != 0)
+    {
+        // IORING_REGISTER_PROBE was added after IORING_OP_STATX, so if the
+        // kernel doesn't support probing, then it doesn't support statx
+        // either.
+        g_free(probe);
+        return FALSE;
+    }
+
+    for (i=0; i<G_N_ELEMENTS(REQUIRED_OPS); i++)
+    {
+        guint8 op = REQUIRED_OPS[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            supported = FALSE;
+        }
+    }
+    g_free(probe);
+    return supported;
+}
+
+static DtUring *uring_new(void)
+{
+    struct io_uring_params params = {};
+    DtUring *ring = g_malloc0(sizeof(DtUring));
+
+    ring->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (ring->fd < 0)
+    {
+        g_debug("io_uring_setup failed: %s", strerror(errno));
+        g_free(ring);
+        return NULL;
+    }
+    if (!uring_probe_opcodes(ring->fd))
+    {
+        g_debug("io_uring doesn't support openat and statx");
+        uring_free(ring);
+        return NULL;
+    }
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_size = ring->cq_size = MAX(ring->sq_size, ring->cq_size);
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        ring->sq_ptr = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            ring->cq_ptr = NULL;
+            uring_free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_tail = (unsigned int *) ((char *) ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) ((char *) ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned int *) ((char *) ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned int *) ((char *) ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+    return ring;
+}
+
+/**
+ * Returns the ring for the current thread, creating it if necessary.
+ */
+static DtUring *get_thread_ring(void)
+{
+    DtUring *ring;
+
+    if (g_atomic_int_get(&uring_unavailable))
+    {
+        return NULL;
+    }
+
+    ring = g_private_get(&thread_ring);
+    if (ring == NULL)
+    {
+        ring = uring_new();
+        if (ring != NULL)
+        {
+            g_private_set(&thread_ring, ring);
+        }
+        else
+        {
+            g_atomic_int_set(&uring_unavailable, TRUE);
+        }
+    }
+    return ring;
+}
+
+/**
+ * Returns the next free submission queue entry.
+ *
+ * The caller must not queue more than DtUring::sq_entries requests before
+ * calling uring_submit_and_wait.
+ */
+static struct io_uring_sqe *uring_get_sqe(DtUring *ring, unsigned int queued)
+{
+    unsigned int tail = *ring->sq_tail + queued;
+    unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+/**
+ * Reads every completion that's in the completion queue.
+ *
+ * \return The number of completions.
+ */
+static unsigned int uring_reap(DtUring *ring, int *results)
+{
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned int count = 0;
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        results[cqe->user_data] = cqe->res;
+        head++;
+        count++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+/**
+ * Marks a ring as unusable after io_uring_enter fails, and stops using
+ * io_uring on every thread.
+ *
+ * This waits for the requests that the kernel already took, since they have
+ * pointers to the caller's buffers.
+ */
+static void uring_fail(DtUring *ring, unsigned int in_flight, int *results)
+{
+    ring->failed = TRUE;
+    g_atomic_int_set(&uring_unavailable, TRUE);
+
+    while (in_flight > 0)
+    {
+        int ret = sys_io_uring_enter(ring->fd, 0, in_flight, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR)
+        {
+            g_critical("Can't wait for io_uring requests: %s", strerror(errno));
+            ring->busy = TRUE;
+            return;
+        }
+        in_flight -= MIN(in_flight, uring_reap(ring, results));
+    }
+}
+
+/**
+ * Submits \p count requests from uring_get_sqe, and waits for all of them to
+ * finish.
+ *
+ * If io_uring_enter fails, then this waits for any requests that the kernel
+ * already took, and then marks the ring as failed. The ring can't be used
+ * after that.
+ *
+ * \param results Returns the result for each request, indexed by user_data.
+ * \return 0 on success, or an errno value if io_uring_enter fails.
+ */
+static int uring_submit_and_wait(DtUring *ring, unsigned int count, int *results)
+{
+    unsigned int submitted = 0;
+    unsigned int completed = 0;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+
+    while (completed < count)
+    {
+        int ret = sys_io_uring_enter(ring->fd, count - submitted,
+                count - completed, IORING_ENTER_GETEVENTS);
+        if (ret < 0)
+        {
+            int err = errno;
+            if (err == EINTR)
+            {
+                continue;
+            }
+
+            // If any requests were taken, then io_uring_enter returns the
+            // number it took instead of an error, so we know exactly how
+            // many are still running.
+            completed += uring_reap(ring, results);
+            uring_fail(ring, submitted - MIN(submitted, completed), results);
+            return err;
+        }
+        submitted += ret;
+        completed += uring_reap(ring, results);
+    }
+    return 0;
+}
+
+/**
+ * Drops the current thread's ring after it failed.
+ *
+ * If requests might still be running, then the ring is leaked instead of
+ * being closed.
+ */
+static void uring_discard_thread_ring(DtUring *ring)
+{
+    if (ring->busy)
+    {
+        g_private_set(&thread_ring, NULL);
+    }
+    else
+    {
+        g_private_replace(&thread_ring, NULL);
+    }
+}
+
+/**
+ * Opens a directory with IORING_OP_OPENAT.
+ *
+ * \return A file descriptor, or a negative errno value.
+ */
+static int uring_open_dir(DtUring *ring, const char *path)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring, 0);
+    int result = -EIO;
+    int err;
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (guint64) (uintptr_t) path;
+    sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    sqe->user_data = 0;
+
+    err = uring_submit_and_wait(ring, 1, &result);
+    if (err != 0)
+    {
+        if (result >= 0)
+        {
+            close(result);
+        }
+        return -err;
+    }
+    return result;
+}
+
+/**
+ * An entry that we've read from getdents64, but haven't called statx on yet.
+ */
+typedef struct
+{
+    guint32 name_offset;
+    unsigned char d_type;
+} PendingEntry;
+
+typedef struct
+{
+    DtUring *ring;
+    int fd;
+    gboolean follow_symlinks;
+    guint batch_size;
+    DtFsEntryBatchFunc func;
+    gpointer userdata;
+    DtFsEntryBatch *batch;
+
+    /**
+     * The entries in the current batch that we still need to stat. Their
+     * names are already in batch->names.
+     */
+    PendingEntry pending[URING_ENTRIES];
+    guint num_pending;
+
+    struct statx statx_bufs[URING_ENTRIES];
+    int results[URING_ENTRIES];
+
+    /// The errno value if io_uring_enter failed, or 0.
+    int error;
+} UringReadDirState;
+
+/**
+ * Submits a statx request for every pending entry, and adds the results to
+ * the current batch.
+ */
+static void flush_pending(UringReadDirState *state)
+{
+    int flags = AT_NO_AUTOMOUNT;
+    guint count = state->num_pending;
+    guint i;
+    int err;
+
+    if (count == 0)
+    {
+        return;
+    }
+    state->num_pending = 0;
+
+    if (!state->follow_symlinks)
+    {
+        flags |= AT_SYMLINK_NOFOLLOW;
+    }
+
+    // Nothing can be appended to batch->names until all of the requests
+    // finish, because the kernel has pointers into it.
+    for (i=0; i<count; i++)
+    {
+        struct io_uring_sqe *sqe = uring_get_sqe(state->ring, i);
+        const char *name = state->batch->names->str + state->pending[i].name_offset;
+
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = state->fd;
+        sqe->addr = (guint64) (uintptr_t) name;
+        sqe->len = DT_FS_SCAN_STATX_MASK;
+        sqe->off = (guint64) (uintptr_t) &state->statx_bufs[i];
+        sqe->statx_flags = flags;
+        sqe->user_data = i;
+        state->results[i] = -EIO;
+    }
+
+    err = uring_submit_and_wait(state->ring, count, state->results);
+    if (err != 0)
+    {
+        // The caller throws out this directory and reads it again without
+        // io_uring.
+        state->error = err;
+        return;
+    }
+
+    for (i=0; i<count; i++)
+    {
+        const char *name = state->batch->names->str + state->pending[i].name_offset;
+        DtFsEntry entry = {};
+
+        entry.name_offset = state->pending[i].name_offset;
+        if (state->results[i] == 0)
+        {
+            const struct statx *stx = &state->statx_bufs[i];
+            entry.mode = stx->stx_mode;
+            entry.size = stx->stx_size;
+            entry.mtime_sec = stx->stx_mtime.tv_sec;
+            entry.mtime_nsec = stx->stx_mtime.tv_nsec;
+            entry.ctime_sec = stx->stx_ctime.tv_sec;
+            entry.ctime_nsec = stx->stx_ctime.tv_nsec;
+            entry.dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+            entry.ino = stx->stx_ino;
+        }
+        else
+        {
+            struct stat st;
+            int result = -state->results[i];
+
+            // If we're following symlinks and the target doesn't exist, then
+            // report the symlink itself, the same way that GIO does. That
+            // should be rare enough that it's not worth another round trip
+            // through the ring.
+            if (state->follow_symlinks && result == ENOENT)
+            {
+                result = (fstatat(state->fd, name, &st, AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno);
+            }
+
+            if (result == ENOENT)
+            {
+                // The entry was deleted after we read the directory.
+                continue;
+            }
+            else if (result != 0)
+            {
+                // Keep the entry, the same way that read_dir_entry does.
+                g_debug("Can't stat %s: %s", name, strerror(result));
+                entry.mode = DTTOIF(state->pending[i].d_type);
+            }
+            else
+            {
+                entry.mode = st.st_mode;
+                entry.size = st.st_size;
+                entry.mtime_sec = st.st_mtim.tv_sec;
+                entry.mtime_nsec = st.st_mtim.tv_nsec;
+                entry.ctime_sec = st.st_ctim.tv_sec;
+                entry.ctime_nsec = st.st_ctim.tv_nsec;
+                entry.dev = st.st_dev;
+                entry.ino = st.st_ino;
+            }
+        }
+
+        dt_fs_entry_batch_append(state->batch, state->fd, name, state->pending[i].d_type, &entry);
+    }
+}
+
+static void uring_read_dir_entry(const char *name, unsigned char d_type, gpointer userdata)
+{
+    UringReadDirState *state = userdata;
+    PendingEntry *pending;
+
+    if (state->error != 0)
+    {
+        return;
+    }
+
+    if (state->batch == NULL)
+    {
+        state->batch = dt_fs_entry_batch_new(state->batch_size);
+    }
+
+    pending = &state->pending[state->num_pending++];
+    pending->name_offset = dt_fs_entry_batch_add_string(state->batch, name, -1);
+    pending->d_type = d_type;
+
+    if (state->num_pending >= MIN(state->ring->sq_entries, URING_ENTRIES)
+            || state->batch->entries->len + state->num_pending >= state->batch_size)
+    {
+        flush_pending(state);
+        if (state->error == 0 && state->batch->entries->len >= state->batch_size)
+        {
+            state->func(state->batch, state->userdata);
+            state->batch = NULL;
+        }
+    }
+}
+
+gboolean dt_fs_scan_uring_is_available(void)
+{
+    return (get_thread_ring() != NULL);
+}
+
+gboolean dt_fs_scan_uring_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error)
+{
+    UringReadDirState *state;
+    gboolean ret;
+    DtUring *ring;
+    int fd;
+
+    ring = get_thread_ring();
+    if (ring == NULL)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "io_uring is not available");
+        return FALSE;
+    }
+
+    fd = uring_open_dir(ring, path);
+    if (ring->failed)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "io_uring_enter failed: %s", strerror(-fd));
+        uring_discard_thread_ring(ring);
+        return FALSE;
+    }
+    if (fd < 0)
+    {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-fd),
+                "Can't open %s: %s", path, strerror(-fd));
+        return FALSE;
+    }
+
+    state = g_malloc(sizeof(UringReadDirState));
+    state->ring = ring;
+    state->fd = fd;
+    state->follow_symlinks = follow_symlinks;
+    state->batch_size = batch_size;
+    state->func = func;
+    state->userdata = userdata;
+    state->batch = NULL;
+    state->num_pending = 0;
+    state->error = 0;
+
+    ret = dt_fs_scan_native_read_dirents(fd, path, uring_read_dir_entry, state,
+                cancellable, error);
+    if (ret)
+    {
+        flush_pending(state);
+    }
+    close(fd);
+
+    if (state->error != 0)
+    {
+        // Report NOT_SUPPORTED, so that the caller reads the directory again
+        // with plain syscalls instead of using a partial listing.
+        g_clear_error(error);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "io_uring_enter failed: %s", strerror(state->error));
+        ret = FALSE;
+        if (ring->busy)
+        {
+            // The kernel might still write to the statx buffers and read the
+            // names, so leak them rather than risk a use-after-free.
+            uring_discard_thread_ring(ring);
+            return FALSE;
+        }
+        uring_discard_thread_ring(ring);
+    }
+
+    if (ret && state->batch != NULL)
+    {
+        func(state->batch, userdata);
+    }
+    else
+    {
+        dt_fs_entry_batch_free(state->batch);
+    }
+    g_free(state);
+    return ret;
+}
+
+#else // HAVE_IO_URING
+
+gboolean dt_fs_scan_uring_is_available(void)
+{
+    return FALSE;
+}
+
+gboolean dt_fs_scan_uring_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error)
+{
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "io_uring support was not enabled at build time");
+    return FALSE;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,55 @@
+#ifndef FS_SCAN_URING_H
+#define FS_SCAN_URING_H
+
+/**
+ * \file
+ *
+ * Reads directories using io_uring.
+ *
+ * This works like dt_fs_scan_native_read_dir, except that the directory is
+ * opened with IORING_OP_OPENAT, and the statx calls for each batch of entries
+ * are all submitted to the kernel at once with IORING_OP_STATX. The kernel
+ * doesn't have an io_uring opcode for getdents, so the directory entries
+ * themselves are still read with getdents64.
+ *
+ * Each thread gets its own ring, which is created the first time the thread
+ * reads a directory.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "fs-scan-native.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Returns TRUE if io_uring is usable on the current thread.
+ *
+ * This checks whether the kernel supports io_uring, and whether it supports
+ * the openat and statx opcodes. It can fail at runtime even if io_uring was
+ * available at build time, for example if io_uring is disabled with a sysctl
+ * or a seccomp filter.
+ */
+gboolean dt_fs_scan_uring_is_available(void);
+
+/**
+ * Reads every entry in a directory using io_uring.
+ *
+ * The parameters and return value are the same as
+ * dt_fs_scan_native_read_dir. If io_uring isn't available, then this fails
+ * with G_IO_ERROR_NOT_SUPPORTED, and the caller can fall back to
+ * dt_fs_scan_native_read_dir.
+ *
+ * If io_uring stops working partway through a directory, then this also
+ * fails with G_IO_ERROR_NOT_SUPPORTED, but some batches could already have
+ * been passed to \p func, so the caller has to expect those entries again
+ * when it falls back.
+ */
+gboolean dt_fs_scan_uring_read_dir(const char *path, gboolean follow_symlinks,
+        guint batch_size, DtFsEntryBatchFunc func, gpointer userdata,
+        GCancellable *cancellable, GError **error);
+
+G_END_DECLS
+
+#endif // FS_SCAN_URING_H
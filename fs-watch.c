@@ -0,0 +1,143 @@
+#include "fs-watch.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_INOTIFY
+
+#include <sys/inotify.h>
+#include <glib-unix.h>
+
+/**
+ * The events that we care about in a watched directory.
+ */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB \
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct _DtFsWatch
+{
+    int fd;
+    guint source_id;
+    DtFsWatchFunc func;
+    gpointer userdata;
+};
+
+static gboolean on_inotify_readable(gint fd, GIOCondition condition, gpointer userdata)
+{
+    DtFsWatch *watch = userdata;
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (TRUE)
+    {
+        ssize_t num = read(fd, buffer, sizeof(buffer));
+        ssize_t pos;
+
+        if (num <= 0)
+        {
+            if (num < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                g_critical("Failed to read inotify events: %s\n", strerror(errno));
+            }
+            break;
+        }
+
+        for (pos = 0; pos < num; )
+        {
+            const struct inotify_event *evt = (const struct inotify_event *) (buffer + pos);
+            pos += sizeof(struct inotify_event) + evt->len;
+
+            if (evt->mask & IN_Q_OVERFLOW)
+            {
+                watch->func(watch, -1, NULL, DT_FS_WATCH_EVENT_OVERFLOW, watch->userdata);
+            }
+            else if (evt->mask & IN_IGNORED)
+            {
+                watch->func(watch, evt->wd, NULL, DT_FS_WATCH_EVENT_GONE, watch->userdata);
+            }
+            else if (evt->len > 0)
+            {
+                watch->func(watch, evt->wd, evt->name, DT_FS_WATCH_EVENT_CHILD, watch->userdata);
+            }
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+DtFsWatch *dt_fs_watch_new(DtFsWatchFunc func, gpointer userdata, GError **error)
+{
+    DtFsWatch *watch;
+    int fd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        int err = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                "Can't create inotify instance: %s", strerror(err));
+        return NULL;
+    }
+
+    watch = g_malloc(sizeof(DtFsWatch));
+    watch->fd = fd;
+    watch->func = func;
+    watch->userdata = userdata;
+    watch->source_id = g_unix_fd_add(fd, G_IO_IN, on_inotify_readable, watch);
+    return watch;
+}
+
+void dt_fs_watch_free(DtFsWatch *watch)
+{
+    if (watch != NULL)
+    {
+        g_source_remove(watch->source_id);
+        close(watch->fd);
+        g_free(watch);
+    }
+}
+
+gint dt_fs_watch_add(DtFsWatch *watch, const char *path, GError **error)
+{
+    int wd = inotify_add_watch(watch->fd, path, WATCH_MASK);
+    if (wd < 0)
+    {
+        int err = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                "Can't watch %s: %s", path, strerror(err));
+        return -1;
+    }
+    return wd;
+}
+
+void dt_fs_watch_remove(DtFsWatch *watch, gint wd)
+{
+    inotify_rm_watch(watch->fd, wd);
+}
+
+#else // HAVE_INOTIFY
+
+DtFsWatch *dt_fs_watch_new(DtFsWatchFunc func, gpointer userdata, GError **error)
+{
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "File watching is not supported on this platform");
+    return NULL;
+}
+
+void dt_fs_watch_free(DtFsWatch *watch)
+{
+}
+
+gint dt_fs_watch_add(DtFsWatch *watch, const char *path, GError **error)
+{
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "File watching is not supported on this platform");
+    return -1;
+}
+
+void dt_fs_watch_remove(DtFsWatch *watch, gint wd)
+{
+}
+
+#endif // HAVE_INOTIFY
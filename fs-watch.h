@@ -0,0 +1,75 @@
+#ifndef FS_WATCH_H
+#define FS_WATCH_H
+
+/**
+ * \file
+ *
+ * A thin wrapper around inotify for watching directories.
+ *
+ * This only reports which directory entries changed, not what happened to
+ * them. The caller is expected to look at the file again to find out. That
+ * makes it easy to coalesce events, since a create, a few writes, and a
+ * rename all turn into "something happened to this name."
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    /// An entry in a watched directory was created, removed, or changed.
+    DT_FS_WATCH_EVENT_CHILD,
+
+    /**
+     * A watch was removed, because the directory was deleted or because
+     * dt_fs_watch_remove was called. The watch descriptor is no longer valid.
+     */
+    DT_FS_WATCH_EVENT_GONE,
+
+    /**
+     * The kernel dropped some events. The caller should assume that anything
+     * could have changed. The watch descriptor is -1.
+     */
+    DT_FS_WATCH_EVENT_OVERFLOW,
+} DtFsWatchEvent;
+
+typedef struct _DtFsWatch DtFsWatch;
+
+/**
+ * The callback for a DtFsWatch.
+ *
+ * \param wd The watch descriptor from dt_fs_watch_add.
+ * \param name The name of the entry that changed, for
+ *      DT_FS_WATCH_EVENT_CHILD. NULL for everything else.
+ */
+typedef void (* DtFsWatchFunc) (DtFsWatch *watch, gint wd, const char *name,
+        DtFsWatchEvent event, gpointer userdata);
+
+/**
+ * Creates a new DtFsWatch.
+ *
+ * The callback is called from the default main context.
+ *
+ * \return A new DtFsWatch, or NULL if inotify isn't available.
+ */
+DtFsWatch *dt_fs_watch_new(DtFsWatchFunc func, gpointer userdata, GError **error);
+
+void dt_fs_watch_free(DtFsWatch *watch);
+
+/**
+ * Starts watching a directory.
+ *
+ * \return A watch descriptor, or -1 on error.
+ */
+gint dt_fs_watch_add(DtFsWatch *watch, const char *path, GError **error);
+
+/**
+ * Stops watching a directory.
+ */
+void dt_fs_watch_remove(DtFsWatch *watch, gint wd);
+
+G_END_DECLS
+
+#endif // FS_WATCH_H
@@ -0,0 +1,296 @@
+/**
+ * \file
+ *
+ * A benchmark for the DtTreeSourceFS scan backends.
+ *
+ * This can create a synthetic directory tree, and then it scans that tree
+ * with each backend and reports how long each scan took. Note that only the
+ * first scan after creating the tree (or after dropping the page cache) is a
+ * cold scan. Use --backend to run a single backend at a time if you want to
+ * compare cold scans.
+ *
+ * With --snapshot, each scan loads and saves a snapshot file, so every run
+ * after the first one measures a warm restart.
+ *
+ * With --memory, it also reports how much heap memory the finished tree is
+ * using, and how much that is per node.
+ *
+ * Usage:
+ *   scan-benchmark --create --files 1000000 /tmp/scan-tree
+ *   scan-benchmark --backend io_uring /tmp/scan-tree
+ *   scan-benchmark --backend native --snapshot /tmp/scan.snap --repeat 3 /tmp/scan-tree
+ *   scan-benchmark --backend native --memory /tmp/scan-tree
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "tree-source-fs.h"
+
+/**
+ * The number of subdirectories in each directory of the synthetic tree.
+ */
+#define TREE_FANOUT 16
+
+typedef struct
+{
+    GMainLoop *loop;
+    gint64 num_nodes;
+    gboolean success;
+} BenchmarkData;
+
+typedef struct
+{
+    const char *name;
+    DtTreeSourceFSScanBackend backend;
+} BackendName;
+
+static const BackendName BACKENDS[] =
+{
+    { "gio", DT_TREE_SOURCE_FS_SCAN_GIO },
+    { "native", DT_TREE_SOURCE_FS_SCAN_NATIVE },
+    { "io_uring", DT_TREE_SOURCE_FS_SCAN_IO_URING },
+};
+
+/**
+ * Creates a directory with \p num_files files in it, spread out across
+ * subdirectories with at most \p files_per_dir files each.
+ *
+ * \return The number of files that were created.
+ */
+static gint64 create_tree(const char *path, gint64 num_files, gint files_per_dir, GError **error)
+{
+    gint64 created = 0;
+    gint64 remaining;
+    gint i;
+
+    if (g_mkdir_with_parents(path, 0755) != 0)
+    {
+        int err = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                "Can't create %s: %s", path, g_strerror(err));
+        return -1;
+    }
+
+    for (i=0; i<files_per_dir && created < num_files; i++)
+    {
+        gchar *name = g_strdup_printf("%s/file%05d.txt", path, i);
+        gboolean ok = g_file_set_contents(name, name, -1, error);
+        g_free(name);
+        if (!ok)
+        {
+            return -1;
+        }
+        created++;
+    }
+
+    // Split whatever's left evenly between the subdirectories.
+    remaining = num_files - created;
+    for (i=0; i<TREE_FANOUT && remaining > 0; i++)
+    {
+        gint64 count = (remaining + (TREE_FANOUT - i) - 1) / (TREE_FANOUT - i);
+        gchar *name = g_strdup_printf("%s/dir%02d", path, i);
+        gint64 ret = create_tree(name, count, files_per_dir, error);
+        g_free(name);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        created += ret;
+        remaining -= ret;
+    }
+    return created;
+}
+
+/**
+ * Returns the number of bytes of memory that are in use.
+ *
+ * This uses the malloc statistics if they're available, since those only
+ * count memory that's actually allocated. Otherwise, it falls back to the
+ * resident set size.
+ */
+static gint64 get_memory_usage(void)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    return (gint64) (mi.uordblks + mi.hblkhd);
+#else
+    gint64 rss = -1;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL)
+    {
+        long size, resident;
+        if (fscanf(fp, "%ld %ld", &size, &resident) == 2)
+        {
+            rss = (gint64) resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(fp);
+    }
+    return rss;
+#endif
+}
+
+static void on_nodes_added(DtTreeSource *source, DtTreeSourceNode *parent,
+        gint num, DtTreeSourceNode **nodes, gpointer userdata)
+{
+    BenchmarkData *data = userdata;
+    data->num_nodes += num;
+}
+
+static void on_scan_finished(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    BenchmarkData *data = userdata;
+    GError *error = NULL;
+
+    data->success = dt_tree_source_scan_finish(DT_TREE_SOURCE(sourceobj), res, &error);
+    if (!data->success)
+    {
+        fprintf(stderr, "Scan failed: %s\n", error->message);
+        g_clear_error(&error);
+    }
+    g_main_loop_quit(data->loop);
+}
+
+static gboolean run_scan(const char *path, const BackendName *backend, gint scan_jobs,
+        const char *snapshot_file, gboolean measure_memory)
+{
+    BenchmarkData data = {};
+    GFile *base = g_file_new_for_commandline_arg(path);
+    gint64 mem_before = get_memory_usage();
+    DtTreeSourceFS *source = dt_tree_source_fs_new(base, FALSE);
+    gint64 start;
+    gdouble elapsed;
+
+    g_object_set(source,
+            "max-scan-jobs", scan_jobs,
+            "scan-backend", backend->backend,
+            "snapshot-file", snapshot_file,
+            NULL);
+    g_signal_connect(source, "nodes-added", G_CALLBACK(on_nodes_added), &data);
+
+    data.loop = g_main_loop_new(NULL, FALSE);
+    start = g_get_monotonic_time();
+    dt_tree_source_scan_async(DT_TREE_SOURCE(source), G_PRIORITY_DEFAULT, NULL,
+            on_scan_finished, &data);
+    g_main_loop_run(data.loop);
+    elapsed = (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    if (data.success)
+    {
+        printf("%-10s %10" G_GINT64_FORMAT " nodes %8.3f s %12.0f nodes/s\n",
+                backend->name, data.num_nodes, elapsed,
+                elapsed > 0 ? data.num_nodes / elapsed : 0.0);
+        if (measure_memory)
+        {
+            gint64 mem_used = get_memory_usage() - mem_before;
+            printf("%-10s %10.1f MiB %8.1f bytes/node\n", "", mem_used / (1024.0 * 1024.0),
+                    data.num_nodes > 0 ? (gdouble) mem_used / data.num_nodes : 0.0);
+        }
+    }
+
+    g_main_loop_unref(data.loop);
+    g_object_unref(source);
+    g_object_unref(base);
+    return data.success;
+}
+
+int main(int argc, char **argv)
+{
+    gboolean option_create = FALSE;
+    gint64 option_files = 1000000;
+    gint option_files_per_dir = 1000;
+    gint option_scan_jobs = 8;
+    gint option_repeat = 1;
+    char *option_backend = NULL;
+    char *option_snapshot = NULL;
+    gboolean option_memory = FALSE;
+    char **paths = NULL;
+    const GOptionEntry options[] =
+    {
+        { "create", 0, 0, G_OPTION_ARG_NONE, &option_create,
+            "Create a synthetic tree before scanning it", NULL },
+        { "files", 0, 0, G_OPTION_ARG_INT64, &option_files,
+            "Number of files to create (default 1000000)", "N" },
+        { "files-per-dir", 0, 0, G_OPTION_ARG_INT, &option_files_per_dir,
+            "Number of files in each directory (default 1000)", "N" },
+        { "backend", 0, 0, G_OPTION_ARG_STRING, &option_backend,
+            "Only run one backend: gio, native, or io_uring", "BACKEND" },
+        { "scan-jobs", 0, 0, G_OPTION_ARG_INT, &option_scan_jobs,
+            "Number of directories to read at the same time", "N" },
+        { "repeat", 0, 0, G_OPTION_ARG_INT, &option_repeat,
+            "Number of times to run each backend", "N" },
+        { "snapshot", 0, 0, G_OPTION_ARG_FILENAME, &option_snapshot,
+            "Load and save a snapshot of the tree in this file", "PATH" },
+        { "memory", 0, 0, G_OPTION_ARG_NONE, &option_memory,
+            "Report how much memory the scanned tree uses", NULL },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths,
+            "Directory to scan", "PATH" },
+        { NULL }
+    };
+    GOptionContext *context;
+    GError *error = NULL;
+    gint ret = 1;
+    gint i, j;
+
+    context = g_option_context_new("PATH");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        fprintf(stderr, "%s\n", error->message);
+        g_clear_error(&error);
+        goto done;
+    }
+    if (paths == NULL || paths[0] == NULL || paths[1] != NULL)
+    {
+        fprintf(stderr, "Usage: %s [OPTIONS] PATH\n", argv[0]);
+        goto done;
+    }
+
+    if (option_create)
+    {
+        gint64 start = g_get_monotonic_time();
+        gint64 created = create_tree(paths[0], option_files, MAX(option_files_per_dir, 1), &error);
+        if (created < 0)
+        {
+            fprintf(stderr, "%s\n", error->message);
+            g_clear_error(&error);
+            goto done;
+        }
+        printf("Created %" G_GINT64_FORMAT " files in %.3f s\n", created,
+                (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC);
+    }
+
+    ret = 0;
+    for (i=0; i<G_N_ELEMENTS(BACKENDS); i++)
+    {
+        if (option_backend != NULL && strcmp(option_backend, BACKENDS[i].name) != 0)
+        {
+            continue;
+        }
+        for (j=0; j<option_repeat; j++)
+        {
+            if (!run_scan(paths[0], &BACKENDS[i], MAX(option_scan_jobs, 1),
+                        option_snapshot, option_memory))
+            {
+                ret = 1;
+            }
+        }
+    }
+
+done:
+    g_option_context_free(context);
+    g_strfreev(paths);
+    g_free(option_backend);
+    g_free(option_snapshot);
+    return ret;
+}
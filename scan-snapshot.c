@@ -0,0 +1,353 @@
+#include "scan-snapshot.h"
+
+#include <string.h>
+
+static const char SNAPSHOT_MAGIC[8] = "DTSNAP\0";
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+struct _DtScanSnapshot
+{
+    GMappedFile *mapped;
+    const DtScanSnapshotHeader *header;
+    const DtScanSnapshotNode *nodes;
+    const char *strings;
+    gsize strings_size;
+};
+
+/**
+ * Appends a string to the string table.
+ *
+ * \return The offset of the string, or DT_SCAN_SNAPSHOT_NONE if \p str is
+ *      NULL or if the string table is full.
+ */
+static guint32 add_string(GString *strings, const char *str)
+{
+    gsize offset = strings->len;
+    if (str == NULL || offset >= DT_SCAN_SNAPSHOT_NONE - strlen(str) - 1)
+    {
+        return DT_SCAN_SNAPSHOT_NONE;
+    }
+    g_string_append_len(strings, str, strlen(str) + 1);
+    return (guint32) offset;
+}
+
+static gboolean fill_node(DtScanSnapshotNode *rec, DtTreeSource *source, DtTreeSourceNode *node,
+        guint32 parent, GString *strings)
+{
+    const DtFileMetadata *meta = dt_tree_source_get_metadata(source, node);
+
+    memset(rec, 0, sizeof(DtScanSnapshotNode));
+    rec->parent = parent;
+    rec->name_offset = add_string(strings, dt_tree_source_get_name(source, node));
+    rec->symlink_offset = add_string(strings, dt_tree_source_get_symlink_target(source, node));
+    rec->mode = meta->mode;
+    rec->first_child = 0;
+    rec->num_children = 0;
+    rec->type = meta->type;
+    rec->size = meta->size;
+    rec->mtime_sec = meta->mtime_sec;
+    rec->mtime_usec = meta->mtime_usec;
+    if (meta->flags & DT_FILE_METADATA_HAS_CRC)
+    {
+        rec->crc = meta->crc;
+        rec->flags |= DT_SCAN_SNAPSHOT_NODE_HAS_CRC;
+    }
+    if (meta->flags & DT_FILE_METADATA_HAS_DIGEST)
+    {
+        memcpy(rec->digest, meta->digest, sizeof(rec->digest));
+        rec->flags |= DT_SCAN_SNAPSHOT_NODE_HAS_DIGEST;
+    }
+    return (rec->name_offset != DT_SCAN_SNAPSHOT_NONE);
+}
+
+GBytes *dt_scan_snapshot_build(DtTreeSource *source, const char *root_uri,
+        gboolean follow_symlinks, GError **error)
+{
+    GArray *records = g_array_new(FALSE, FALSE, sizeof(DtScanSnapshotNode));
+    GPtrArray *tree_nodes = g_ptr_array_new();
+    GString *strings = g_string_new(NULL);
+    DtTreeSourceNode *root = dt_tree_source_get_root(source);
+    DtScanSnapshotHeader header = {};
+    DtScanSnapshotNode rec;
+    gboolean ok = TRUE;
+    GByteArray *data;
+    guint i;
+
+    header.root_uri_offset = add_string(strings, root_uri);
+    ok = fill_node(&rec, source, root, DT_SCAN_SNAPSHOT_NONE, strings);
+    g_array_append_val(records, rec);
+    g_ptr_array_add(tree_nodes, root);
+
+    // Walk the tree breadth-first. Each node's children get appended to the
+    // end, so they're contiguous, and so every child comes after its parent.
+    for (i=0; ok && i<tree_nodes->len; i++)
+    {
+        DtTreeSourceNode * const *children;
+        guint num, j;
+
+        // The children are already sorted by name.
+        children = dt_tree_source_get_child_array(source, tree_nodes->pdata[i], &num);
+        g_array_index(records, DtScanSnapshotNode, i).first_child = records->len;
+        g_array_index(records, DtScanSnapshotNode, i).num_children = num;
+        for (j=0; ok && j<num; j++)
+        {
+            ok = fill_node(&rec, source, children[j], i, strings);
+            g_array_append_val(records, rec);
+            g_ptr_array_add(tree_nodes, children[j]);
+        }
+
+        if (records->len >= DT_SCAN_SNAPSHOT_NONE)
+        {
+            ok = FALSE;
+        }
+    }
+
+    g_ptr_array_unref(tree_nodes);
+    if (!ok || header.root_uri_offset == DT_SCAN_SNAPSHOT_NONE)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Tree is too large for a snapshot");
+        g_array_unref(records);
+        g_string_free(strings, TRUE);
+        return NULL;
+    }
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.version = DT_SCAN_SNAPSHOT_VERSION;
+    header.header_size = sizeof(DtScanSnapshotHeader);
+    header.node_size = sizeof(DtScanSnapshotNode);
+    header.num_nodes = records->len;
+    header.follow_symlinks = (follow_symlinks ? 1 : 0);
+    header.nodes_offset = sizeof(DtScanSnapshotHeader);
+    header.strings_offset = header.nodes_offset + (guint64) records->len * sizeof(DtScanSnapshotNode);
+    header.strings_size = strings->len;
+
+    data = g_byte_array_sized_new(header.strings_offset + header.strings_size);
+    g_byte_array_append(data, (const guint8 *) &header, sizeof(header));
+    g_byte_array_append(data, (const guint8 *) records->data, records->len * sizeof(DtScanSnapshotNode));
+    g_byte_array_append(data, (const guint8 *) strings->str, strings->len);
+
+    g_array_unref(records);
+    g_string_free(strings, TRUE);
+    return g_byte_array_free_to_bytes(data);
+}
+
+static gboolean check_string(DtScanSnapshot *snapshot, guint32 offset, gboolean allow_none)
+{
+    if (offset == DT_SCAN_SNAPSHOT_NONE)
+    {
+        return allow_none;
+    }
+    return (offset < snapshot->strings_size);
+}
+
+/**
+ * Checks that the header and every node in a snapshot are valid.
+ */
+static gboolean validate_snapshot(DtScanSnapshot *snapshot, gsize size)
+{
+    const DtScanSnapshotHeader *header = snapshot->header;
+    guint32 i;
+
+    if (size < sizeof(DtScanSnapshotHeader)
+            || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+            || header->byte_order != SNAPSHOT_BYTE_ORDER
+            || header->version != DT_SCAN_SNAPSHOT_VERSION
+            || header->header_size != sizeof(DtScanSnapshotHeader)
+            || header->node_size != sizeof(DtScanSnapshotNode))
+    {
+        return FALSE;
+    }
+
+    if (header->num_nodes == 0 || header->num_nodes == DT_SCAN_SNAPSHOT_NONE
+            || header->nodes_offset % sizeof(guint64) != 0
+            || header->nodes_offset > size
+            || (size - header->nodes_offset) / sizeof(DtScanSnapshotNode) < header->num_nodes
+            || header->strings_offset > size
+            || header->strings_size == 0
+            || size - header->strings_offset < header->strings_size)
+    {
+        return FALSE;
+    }
+
+    snapshot->nodes = (const DtScanSnapshotNode *) (((const guint8 *) header) + header->nodes_offset);
+    snapshot->strings = ((const char *) header) + header->strings_offset;
+    snapshot->strings_size = header->strings_size;
+    if (snapshot->strings[snapshot->strings_size - 1] != '\0'
+            || !check_string(snapshot, header->root_uri_offset, FALSE))
+    {
+        return FALSE;
+    }
+
+    for (i=0; i<header->num_nodes; i++)
+    {
+        const DtScanSnapshotNode *rec = &snapshot->nodes[i];
+        if (!check_string(snapshot, rec->name_offset, FALSE)
+                || !check_string(snapshot, rec->symlink_offset, TRUE))
+        {
+            return FALSE;
+        }
+
+        // The children have to come after the parent, which also means that
+        // there can't be any loops.
+        if (rec->num_children > 0 && (rec->first_child <= i
+                    || rec->first_child > header->num_nodes
+                    || header->num_nodes - rec->first_child < rec->num_children))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+DtScanSnapshot *dt_scan_snapshot_load(const char *filename, GError **error)
+{
+    DtScanSnapshot *snapshot;
+    GMappedFile *mapped;
+
+    mapped = g_mapped_file_new(filename, FALSE, error);
+    if (mapped == NULL)
+    {
+        return NULL;
+    }
+
+    snapshot = g_malloc0(sizeof(DtScanSnapshot));
+    snapshot->mapped = mapped;
+    snapshot->header = (const DtScanSnapshotHeader *) g_mapped_file_get_contents(mapped);
+    if (snapshot->header == NULL || !validate_snapshot(snapshot, g_mapped_file_get_length(mapped)))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s is not a valid snapshot file", filename);
+        dt_scan_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+void dt_scan_snapshot_free(DtScanSnapshot *snapshot)
+{
+    if (snapshot != NULL)
+    {
+        g_mapped_file_unref(snapshot->mapped);
+        g_free(snapshot);
+    }
+}
+
+const char *dt_scan_snapshot_get_root_uri(DtScanSnapshot *snapshot)
+{
+    return dt_scan_snapshot_get_string(snapshot, snapshot->header->root_uri_offset);
+}
+
+gboolean dt_scan_snapshot_get_follow_symlinks(DtScanSnapshot *snapshot)
+{
+    return (snapshot->header->follow_symlinks != 0);
+}
+
+guint32 dt_scan_snapshot_get_num_nodes(DtScanSnapshot *snapshot)
+{
+    return snapshot->header->num_nodes;
+}
+
+const DtScanSnapshotNode *dt_scan_snapshot_get_node(DtScanSnapshot *snapshot, guint32 index)
+{
+    g_return_val_if_fail(index < snapshot->header->num_nodes, NULL);
+    return &snapshot->nodes[index];
+}
+
+const char *dt_scan_snapshot_get_string(DtScanSnapshot *snapshot, guint32 offset)
+{
+    if (offset == DT_SCAN_SNAPSHOT_NONE)
+    {
+        return NULL;
+    }
+    return snapshot->strings + offset;
+}
+
+guint32 dt_scan_snapshot_find_child(DtScanSnapshot *snapshot, guint32 parent, const char *name)
+{
+    const DtScanSnapshotNode *rec = dt_scan_snapshot_get_node(snapshot, parent);
+    guint32 low = rec->first_child;
+    guint32 high = rec->first_child + rec->num_children;
+
+    while (low < high)
+    {
+        guint32 mid = low + (high - low) / 2;
+        int cmp = strcmp(name, snapshot->strings + snapshot->nodes[mid].name_offset);
+        if (cmp == 0)
+        {
+            return mid;
+        }
+        else if (cmp < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return DT_SCAN_SNAPSHOT_NONE;
+}
+
+GFileInfo *dt_scan_snapshot_create_file_info(DtScanSnapshot *snapshot, guint32 index)
+{
+    const DtScanSnapshotNode *rec = dt_scan_snapshot_get_node(snapshot, index);
+    const char *target = dt_scan_snapshot_get_string(snapshot, rec->symlink_offset);
+    GFileInfo *info = g_file_info_new();
+
+    g_file_info_set_name(info, dt_scan_snapshot_get_string(snapshot, rec->name_offset));
+    g_file_info_set_file_type(info, rec->type);
+    g_file_info_set_size(info, rec->size);
+    g_file_info_set_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED, rec->mtime_sec);
+    g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC, rec->mtime_usec);
+    g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_UNIX_MODE, rec->mode);
+    if (target != NULL)
+    {
+        g_file_info_set_symlink_target(info, target);
+    }
+    if (rec->flags & DT_SCAN_SNAPSHOT_NODE_HAS_CRC)
+    {
+        g_file_info_set_attribute_uint32(info, DT_FILE_ATTRIBUTE_CRC, rec->crc);
+    }
+    if (rec->flags & DT_SCAN_SNAPSHOT_NODE_HAS_DIGEST)
+    {
+        char str[DT_FILE_METADATA_DIGEST_SIZE * 2 + 1];
+        gint i;
+
+        for (i=0; i<DT_FILE_METADATA_DIGEST_SIZE; i++)
+        {
+            g_snprintf(str + i * 2, 3, "%02x", rec->digest[i]);
+        }
+        g_file_info_set_attribute_string(info, DT_FILE_ATTRIBUTE_DIGEST, str);
+    }
+    return info;
+}
+
+gboolean dt_scan_snapshot_node_is_current(const DtScanSnapshotNode *node, GFileInfo *info)
+{
+    return (g_file_info_get_file_type(info) == node->type
+            && g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED) == node->mtime_sec
+            && g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC) == node->mtime_usec);
+}
+
+char *dt_scan_snapshot_get_cache_path(const char *root_uri, gboolean follow_symlinks,
+        const char *variant)
+{
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    char *name;
+    char *path;
+
+    g_checksum_update(checksum, (const guchar *) root_uri, strlen(root_uri));
+    g_checksum_update(checksum, (const guchar *) (follow_symlinks ? "\n1" : "\n0"), 2);
+    if (variant != NULL && variant[0] != '\0')
+    {
+        g_checksum_update(checksum, (const guchar *) "\n", 1);
+        g_checksum_update(checksum, (const guchar *) variant, strlen(variant));
+    }
+    name = g_strdup_printf("%s.snap", g_checksum_get_string(checksum));
+    path = g_build_filename(g_get_user_cache_dir(), "difftree", "snapshots", name, NULL);
+
+    g_free(name);
+    g_checksum_free(checksum);
+    return path;
+}
@@ -0,0 +1,178 @@
+#ifndef SCAN_SNAPSHOT_H
+#define SCAN_SNAPSHOT_H
+
+/**
+ * \file
+ *
+ * Saves and loads a snapshot of a scanned tree.
+ *
+ * A snapshot records the name, type, size, modification time, mode, symlink
+ * target, and CRC and digest (if any) of every node in a DtTreeSource. The file is laid
+ * out so that it can be used directly from mmap, without parsing it:
+ *
+ * - A DtScanSnapshotHeader.
+ * - An array of DtScanSnapshotNode records. The nodes are stored in
+ *   breadth-first order, so the children of each node are contiguous, and
+ *   they're sorted by name so that they can be searched with a binary search.
+ *   The root node is always at index 0.
+ * - A string table with every name and symlink target, each one terminated
+ *   with a NUL.
+ *
+ * Everything is stored in native byte order, since a snapshot is only a cache
+ * for the same machine. A snapshot from a different byte order or a different
+ * version is simply rejected.
+ *
+ * Note that a snapshot can only tell whether a directory's entries changed,
+ * by looking at the directory's modification time. If a file is modified in
+ * place, then its directory's modification time doesn't change, so the
+ * snapshot will still have the old size and modification time for it.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "tree-source.h"
+
+G_BEGIN_DECLS
+
+#define DT_SCAN_SNAPSHOT_VERSION 2
+
+/**
+ * Used in place of an index or a string offset that doesn't exist.
+ */
+#define DT_SCAN_SNAPSHOT_NONE G_MAXUINT32
+
+/**
+ * Set in DtScanSnapshotNode::flags if the node has a CRC value.
+ */
+#define DT_SCAN_SNAPSHOT_NODE_HAS_CRC 0x0001
+
+/**
+ * Set in DtScanSnapshotNode::flags if the node has a digest.
+ */
+#define DT_SCAN_SNAPSHOT_NODE_HAS_DIGEST 0x0002
+
+typedef struct
+{
+    /// Always "DTSNAP" followed by two NUL characters.
+    char magic[8];
+
+    /// Always 0x01020304, to detect a snapshot with a different byte order.
+    guint32 byte_order;
+    guint32 version;
+    guint32 header_size;
+    guint32 node_size;
+    guint32 num_nodes;
+
+    /// The value of the follow-symlinks flag when the tree was scanned.
+    guint32 follow_symlinks;
+
+    guint64 nodes_offset;
+    guint64 strings_offset;
+    guint64 strings_size;
+
+    /// The URI of the base directory, as an offset into the string table.
+    guint32 root_uri_offset;
+    guint32 reserved;
+} DtScanSnapshotHeader;
+
+typedef struct
+{
+    guint32 parent;
+    guint32 name_offset;
+
+    /// The symlink target, or DT_SCAN_SNAPSHOT_NONE.
+    guint32 symlink_offset;
+    guint32 mode;
+
+    /// The index of the first child. The children are sorted by name.
+    guint32 first_child;
+    guint32 num_children;
+    guint32 crc;
+
+    /// A GFileType value.
+    guint16 type;
+    guint16 flags;
+
+    guint64 size;
+    guint64 mtime_sec;
+    guint32 mtime_usec;
+    guint32 reserved;
+
+    /// The content digest, if DT_SCAN_SNAPSHOT_NODE_HAS_DIGEST is set.
+    guint8 digest[DT_FILE_METADATA_DIGEST_SIZE];
+} DtScanSnapshotNode;
+
+typedef struct _DtScanSnapshot DtScanSnapshot;
+
+/**
+ * Creates a snapshot of every node in a tree.
+ *
+ * \param source The tree to save. This should be done scanning.
+ * \param root_uri The URI of the base directory that the tree came from.
+ * \param follow_symlinks The follow-symlinks flag that the tree was scanned
+ *      with.
+ * \return The contents of the snapshot file.
+ */
+GBytes *dt_scan_snapshot_build(DtTreeSource *source, const char *root_uri,
+        gboolean follow_symlinks, GError **error);
+
+/**
+ * Maps a snapshot file into memory.
+ *
+ * This checks that the file is well-formed, so that the accessor functions
+ * below don't have to.
+ */
+DtScanSnapshot *dt_scan_snapshot_load(const char *filename, GError **error);
+
+void dt_scan_snapshot_free(DtScanSnapshot *snapshot);
+
+const char *dt_scan_snapshot_get_root_uri(DtScanSnapshot *snapshot);
+gboolean dt_scan_snapshot_get_follow_symlinks(DtScanSnapshot *snapshot);
+guint32 dt_scan_snapshot_get_num_nodes(DtScanSnapshot *snapshot);
+
+const DtScanSnapshotNode *dt_scan_snapshot_get_node(DtScanSnapshot *snapshot, guint32 index);
+
+/**
+ * Returns a string from the string table, or NULL if \p offset is
+ * DT_SCAN_SNAPSHOT_NONE.
+ */
+const char *dt_scan_snapshot_get_string(DtScanSnapshot *snapshot, guint32 offset);
+
+/**
+ * Looks up a child of a node by name.
+ *
+ * \return The index of the child, or DT_SCAN_SNAPSHOT_NONE if there isn't one.
+ */
+guint32 dt_scan_snapshot_find_child(DtScanSnapshot *snapshot, guint32 parent, const char *name);
+
+/**
+ * Creates a GFileInfo from a snapshot node.
+ *
+ * This fills in the same attributes that DtTreeSourceFS would get from
+ * scanning, except for DT_FILE_ATTRIBUTE_FS_PATH.
+ */
+GFileInfo *dt_scan_snapshot_create_file_info(DtScanSnapshot *snapshot, guint32 index);
+
+/**
+ * Returns TRUE if a directory's modification time still matches a snapshot
+ * node.
+ */
+gboolean dt_scan_snapshot_node_is_current(const DtScanSnapshotNode *node, GFileInfo *info);
+
+/**
+ * Returns the default path to cache a snapshot for a directory.
+ *
+ * This is a file under the user's cache directory, with a name that's derived
+ * from the URI and the follow-symlinks flag.
+ *
+ * \param variant Anything else that changes which files end up in the tree,
+ *      like the exclude patterns, so that each combination gets its own
+ *      snapshot. This can be NULL.
+ */
+char *dt_scan_snapshot_get_cache_path(const char *root_uri, gboolean follow_symlinks,
+        const char *variant);
+
+G_END_DECLS
+
+#endif // SCAN_SNAPSHOT_H
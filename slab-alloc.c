@@ -0,0 +1,210 @@
+#include "slab-alloc.h"
+
+#include <string.h>
+
+/**
+ * The header at the start of each chunk. This is a union so that the objects
+ * after it are aligned for any basic type.
+ */
+typedef union
+{
+    gpointer next;
+    guint64 align_u64;
+    gdouble align_double;
+} ChunkHeader;
+
+/**
+ * The size of each chunk in DtSlabArrays, in bytes.
+ */
+#define ARRAY_CHUNK_SIZE (64 * 1024)
+
+void dt_slab_init(DtSlab *slab, gsize object_size, guint objects_per_chunk)
+{
+    object_size = MAX(object_size, sizeof(gpointer));
+    slab->object_size = (object_size + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1);
+    slab->objects_per_chunk = MAX(objects_per_chunk, 1);
+    slab->chunks = NULL;
+    slab->next = NULL;
+    slab->end = NULL;
+    slab->free_list = NULL;
+}
+
+void dt_slab_clear(DtSlab *slab)
+{
+    while (slab->chunks != NULL)
+    {
+        ChunkHeader *chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        g_free(chunk);
+    }
+    slab->next = NULL;
+    slab->end = NULL;
+    slab->free_list = NULL;
+}
+
+gpointer dt_slab_alloc(DtSlab *slab)
+{
+    gpointer obj;
+
+    if (slab->free_list != NULL)
+    {
+        obj = slab->free_list;
+        slab->free_list = *((gpointer *) obj);
+        return obj;
+    }
+
+    if (slab->next == slab->end)
+    {
+        gsize size = slab->object_size * slab->objects_per_chunk;
+        ChunkHeader *chunk = g_malloc(sizeof(ChunkHeader) + size);
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->next = (guint8 *) (chunk + 1);
+        slab->end = slab->next + size;
+    }
+
+    obj = slab->next;
+    slab->next += slab->object_size;
+    return obj;
+}
+
+void dt_slab_free(DtSlab *slab, gpointer obj)
+{
+    if (obj != NULL)
+    {
+        *((gpointer *) obj) = slab->free_list;
+        slab->free_list = obj;
+    }
+}
+
+void dt_slab_arrays_init(DtSlabArrays *arrays)
+{
+    gint i;
+
+    for (i=0; i<DT_SLAB_ARRAYS_NUM_CLASSES; i++)
+    {
+        gsize size = sizeof(gpointer) << (i + DT_SLAB_ARRAYS_MIN_SHIFT);
+        dt_slab_init(&arrays->classes[i], size, ARRAY_CHUNK_SIZE / size);
+    }
+}
+
+void dt_slab_arrays_clear(DtSlabArrays *arrays)
+{
+    gint i;
+
+    for (i=0; i<DT_SLAB_ARRAYS_NUM_CLASSES; i++)
+    {
+        dt_slab_clear(&arrays->classes[i]);
+    }
+}
+
+/**
+ * Returns the size class for a capacity, or -1 if it's too big for a slab.
+ */
+static gint get_size_class(guint32 capacity)
+{
+    gint shift;
+
+    for (shift = DT_SLAB_ARRAYS_MIN_SHIFT; shift <= DT_SLAB_ARRAYS_MAX_SHIFT; shift++)
+    {
+        if (capacity == (1U << shift))
+        {
+            return shift - DT_SLAB_ARRAYS_MIN_SHIFT;
+        }
+    }
+    return -1;
+}
+
+static gpointer *alloc_array(DtSlabArrays *arrays, guint32 capacity)
+{
+    gint cls = get_size_class(capacity);
+    if (cls >= 0)
+    {
+        return dt_slab_alloc(&arrays->classes[cls]);
+    }
+    return g_malloc(capacity * sizeof(gpointer));
+}
+
+void dt_slab_arrays_free(DtSlabArrays *arrays, gpointer *array, guint32 capacity)
+{
+    if (array != NULL)
+    {
+        gint cls = get_size_class(capacity);
+        if (cls >= 0)
+        {
+            dt_slab_free(&arrays->classes[cls], array);
+        }
+        else
+        {
+            g_free(array);
+        }
+    }
+}
+
+/**
+ * Moves an array to a new capacity.
+ */
+static gpointer *move_array(DtSlabArrays *arrays, gpointer *array,
+        guint32 *capacity, guint32 length, guint32 new_capacity)
+{
+    gpointer *new_array = alloc_array(arrays, new_capacity);
+    if (length > 0)
+    {
+        memcpy(new_array, array, length * sizeof(gpointer));
+    }
+    dt_slab_arrays_free(arrays, array, *capacity);
+    *capacity = new_capacity;
+    return new_array;
+}
+
+gpointer *dt_slab_arrays_reserve(DtSlabArrays *arrays, gpointer *array,
+        guint32 *capacity, guint32 length, guint32 needed)
+{
+    guint32 new_capacity;
+
+    if (array != NULL && needed <= *capacity)
+    {
+        return array;
+    }
+
+    new_capacity = 1U << DT_SLAB_ARRAYS_MIN_SHIFT;
+    while (new_capacity < needed)
+    {
+        new_capacity <<= 1;
+    }
+
+    if (array == NULL)
+    {
+        *capacity = new_capacity;
+        return alloc_array(arrays, new_capacity);
+    }
+    return move_array(arrays, array, capacity, length, new_capacity);
+}
+
+gpointer *dt_slab_arrays_trim(DtSlabArrays *arrays, gpointer *array,
+        guint32 *capacity, guint32 length)
+{
+    guint32 new_capacity;
+
+    if (array == NULL)
+    {
+        return NULL;
+    }
+    if (length == 0)
+    {
+        dt_slab_arrays_free(arrays, array, *capacity);
+        *capacity = 0;
+        return NULL;
+    }
+    if (length > *capacity / 4 || *capacity <= (1U << DT_SLAB_ARRAYS_MIN_SHIFT))
+    {
+        return array;
+    }
+
+    new_capacity = *capacity;
+    while (new_capacity / 2 >= length * 2 && new_capacity > (1U << DT_SLAB_ARRAYS_MIN_SHIFT))
+    {
+        new_capacity /= 2;
+    }
+    return move_array(arrays, array, capacity, length, new_capacity);
+}
@@ -0,0 +1,114 @@
+#ifndef SLAB_ALLOC_H
+#define SLAB_ALLOC_H
+
+/**
+ * \file
+ *
+ * Simple slab allocators for large numbers of small objects.
+ *
+ * A DtSlab hands out objects of a single size from large chunks, and keeps a
+ * free list of the objects that are given back. There's no per-object
+ * overhead, and freeing everything only takes one free for each chunk.
+ *
+ * DtSlabArrays builds on that to store growable arrays of pointers, using a
+ * separate DtSlab for each power-of-two capacity. Arrays that are bigger than
+ * the largest size class are allocated with g_malloc instead.
+ *
+ * None of these are thread-safe.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+    gsize object_size;
+    guint objects_per_chunk;
+
+    /// The chunks, linked through the first pointer in each one.
+    gpointer chunks;
+
+    /// The unused space at the end of the newest chunk.
+    guint8 *next;
+    guint8 *end;
+
+    /// Objects that were freed, linked through their first pointer.
+    gpointer free_list;
+} DtSlab;
+
+/**
+ * Initializes a DtSlab.
+ *
+ * \param object_size The size of each object. This is rounded up to a
+ *      multiple of the pointer size.
+ * \param objects_per_chunk The number of objects to allocate at once.
+ */
+void dt_slab_init(DtSlab *slab, gsize object_size, guint objects_per_chunk);
+
+/**
+ * Frees every object in a slab, and all of the memory that it's holding.
+ */
+void dt_slab_clear(DtSlab *slab);
+
+/**
+ * Allocates an object. The contents are not initialized.
+ */
+gpointer dt_slab_alloc(DtSlab *slab);
+
+/**
+ * Returns an object to the slab, so that the next dt_slab_alloc call can
+ * reuse it.
+ */
+void dt_slab_free(DtSlab *slab, gpointer obj);
+
+/**
+ * The smallest capacity in DtSlabArrays is 1 << DT_SLAB_ARRAYS_MIN_SHIFT,
+ * and the largest one that comes from a slab is 1 << DT_SLAB_ARRAYS_MAX_SHIFT.
+ */
+#define DT_SLAB_ARRAYS_MIN_SHIFT 1
+#define DT_SLAB_ARRAYS_MAX_SHIFT 8
+#define DT_SLAB_ARRAYS_NUM_CLASSES (DT_SLAB_ARRAYS_MAX_SHIFT - DT_SLAB_ARRAYS_MIN_SHIFT + 1)
+
+typedef struct
+{
+    DtSlab classes[DT_SLAB_ARRAYS_NUM_CLASSES];
+} DtSlabArrays;
+
+void dt_slab_arrays_init(DtSlabArrays *arrays);
+
+/**
+ * Frees every array that came from one of the slabs.
+ *
+ * The caller still has to call dt_slab_arrays_free for any arrays with a
+ * capacity bigger than 1 << DT_SLAB_ARRAYS_MAX_SHIFT.
+ */
+void dt_slab_arrays_clear(DtSlabArrays *arrays);
+
+/**
+ * Makes sure that an array has room for at least \p needed elements.
+ *
+ * \param array The existing array, or NULL.
+ * \param[in,out] capacity The capacity of \p array. This is updated if the
+ *      array is reallocated.
+ * \param length The number of elements in \p array to keep.
+ * \param needed The number of elements that the array needs to hold.
+ * \return The array, which might have moved.
+ */
+gpointer *dt_slab_arrays_reserve(DtSlabArrays *arrays, gpointer *array,
+        guint32 *capacity, guint32 length, guint32 needed);
+
+/**
+ * Shrinks an array if it's using less than a quarter of its capacity.
+ */
+gpointer *dt_slab_arrays_trim(DtSlabArrays *arrays, gpointer *array,
+        guint32 *capacity, guint32 length);
+
+/**
+ * Frees an array.
+ */
+void dt_slab_arrays_free(DtSlabArrays *arrays, gpointer *array, guint32 capacity);
+
+G_END_DECLS
+
+#endif // SLAB_ALLOC_H
@@ -235,6 +235,24 @@ gint dt_file_key_compare(gconstpointer a, gconstpointer b)
     return 0;
 }
 
+guint dt_file_key_hash(gconstpointer key)
+{
+    const DtFileKey *fkey = key;
+    guint hash = fkey->type;
+    gint i;
+
+    for (i=0; i<fkey->depth; i++)
+    {
+        hash = (hash * 31) + g_str_hash(fkey->names[i]);
+    }
+    return hash;
+}
+
+gboolean dt_file_key_equal(gconstpointer a, gconstpointer b)
+{
+    return (dt_file_key_compare(a, b) == 0);
+}
+
 static gboolean dt_file_key_find_child(GtkTreeModel *model, GtkTreeIter *iter,
         GtkTreeIter *parent, GFileType type, const char *name)
 {
@@ -251,14 +269,14 @@ static gboolean dt_file_key_find_child(GtkTreeModel *model, GtkTreeIter *iter,
                 DT_DIFF_TREE_MODEL_COL_FILE_TYPE, &rowType, -1);
         if (type == rowType)
         {
-            gchar *rowName = NULL;
-            gtk_tree_model_get(model, &next,
-                    DT_DIFF_TREE_MODEL_COL_NAME, &rowName, -1);
-            if (strcmp(rowName, name) == 0)
+            GValue rowName = G_VALUE_INIT;
+            gtk_tree_model_get_value(model, &next,
+                    DT_DIFF_TREE_MODEL_COL_NAME, &rowName);
+            if (g_strcmp0(g_value_get_string(&rowName), name) == 0)
             {
                 matches = TRUE;
             }
-            g_free(rowName);
+            g_value_unset(&rowName);
         }
         if (matches)
         {
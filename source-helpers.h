@@ -72,6 +72,12 @@ gboolean dt_file_key_get_iter(GtkTreeModel *model, GtkTreeIter *iter, DtFileKey
  */
 gint dt_file_key_compare(gconstpointer a, gconstpointer b);
 
+/**
+ * A GHashFunc and GEqualFunc for DtFileKey structs.
+ */
+guint dt_file_key_hash(gconstpointer key);
+gboolean dt_file_key_equal(gconstpointer a, gconstpointer b);
+
 G_END_DECLS
 
 #endif // SOURCE_HELPERS_H
@@ -1,8 +1,15 @@
 #include "tree-source-base.h"
+#include "slab-alloc.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
+
+/**
+ * The number of nodes to allocate at once.
+ */
+#define NODES_PER_CHUNK 4096
 
 typedef struct _TreeSourceBaseNode
 {
@@ -13,20 +20,47 @@ typedef struct _TreeSourceBaseNode
      */
     DtTreeSourceBase *owner;
 
-    GFileInfo *info;
+    DtFileMetadata metadata;
     struct _TreeSourceBaseNode *parent;
 
     /**
-     * A hashtable to map names to child nodes.
-     *
-     * \todo Should this be a GHashTable or a GTree?
+     * The file name. This points into DtTreeSourceBasePrivate::names.
      */
-    GHashTable *children;
+    const char *name;
+
+    /**
+     * The symlink target, or NULL. This also points into
+     * DtTreeSourceBasePrivate::names.
+     */
+    const char *symlink_target;
+
+    /**
+     * The child nodes, sorted by name with strcmp. This comes from
+     * DtTreeSourceBasePrivate::child_arrays.
+     */
+    struct _TreeSourceBaseNode **children;
+    guint32 num_children;
+    guint32 child_capacity;
 } TreeSourceBaseNode;
 
 typedef struct _DtTreeSourceBasePrivate
 {
     TreeSourceBaseNode *root;
+
+    /// Every TreeSourceBaseNode comes from this slab.
+    DtSlab nodes;
+
+    /// The children arrays for every node.
+    DtSlabArrays child_arrays;
+
+    /**
+     * The names and symlink targets of every node.
+     *
+     * Names aren't freed when a node is removed, only when the whole tree is
+     * destroyed. Removing nodes is rare enough that it's not worth keeping
+     * track of them.
+     */
+    GStringChunk *names;
 } DtTreeSourceBasePrivate;
 
 static void dt_tree_source_base_interface_init(DtTreeSourceInterface *iface);
@@ -34,8 +68,14 @@ static void dt_tree_source_base_interface_init(DtTreeSourceInterface *iface);
 static DtTreeSourceNode *dt_tree_source_base_get_root(DtTreeSource *self);
 static DtTreeSourceNode *dt_tree_source_base_get_parent(DtTreeSource *self, DtTreeSourceNode *node);
 static GList *dt_tree_source_base_get_children(DtTreeSource *self, DtTreeSourceNode *parent);
+static DtTreeSourceNode * const *dt_tree_source_base_get_child_array(DtTreeSource *self,
+        DtTreeSourceNode *parent, guint *ret_num);
 static DtTreeSourceNode *dt_tree_source_base_get_child_by_name(DtTreeSource *self, DtTreeSourceNode *parent, const char *name);
-static GFileInfo *dt_tree_source_base_get_file_info(DtTreeSource *self, DtTreeSourceNode *node);
+static const char *dt_tree_source_base_get_name(DtTreeSource *self, DtTreeSourceNode *node);
+static const DtFileMetadata *dt_tree_source_base_get_metadata(DtTreeSource *self, DtTreeSourceNode *node);
+static const char *dt_tree_source_base_get_symlink_target(DtTreeSource *self, DtTreeSourceNode *node);
+static GFileInfo *dt_tree_source_base_create_file_info(DtTreeSource *self, DtTreeSourceNode *node);
+static void dt_tree_source_base_set_digest(DtTreeSource *self, DtTreeSourceNode *node, const guint8 *digest);
 static void dt_tree_source_base_scan_async(DtTreeSource *self, int io_priority,
         GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata);
 static gboolean dt_tree_source_base_scan_finish(DtTreeSource *self, GAsyncResult *result, GError **error);
@@ -46,9 +86,12 @@ static gboolean dt_tree_source_base_scan_finish(DtTreeSource *self, GAsyncResult
 static TreeSourceBaseNode *check_node(DtTreeSourceBase *self, DtTreeSourceNode *snode);
 
 static TreeSourceBaseNode *node_create(DtTreeSourceBase *self, GFileInfo *info);
-static void node_free(TreeSourceBaseNode *node);
-static void node_add_child(TreeSourceBaseNode *parent, TreeSourceBaseNode *child);
-static void node_detach(TreeSourceBaseNode *node);
+static void node_set_info(DtTreeSourceBase *self, TreeSourceBaseNode *node, GFileInfo *info);
+static void node_free(DtTreeSourceBase *self, TreeSourceBaseNode *node);
+static void node_add_children(DtTreeSourceBase *self, TreeSourceBaseNode *parent,
+        guint num, TreeSourceBaseNode **children);
+static void node_detach(DtTreeSourceBase *self, TreeSourceBaseNode *node);
+static void release_subtree(DtTreeSourceBase *self, TreeSourceBaseNode *node);
 
 G_DEFINE_TYPE_WITH_CODE(DtTreeSourceBase, dt_tree_source_base, G_TYPE_OBJECT,
         G_ADD_PRIVATE(DtTreeSourceBase)
@@ -71,7 +114,14 @@ static void dt_tree_source_base_finalize(GObject *gobj)
     // Free anything that we didn't free in dispose().
     DtTreeSourceBase *self = DT_TREE_SOURCE_BASE(gobj);
     DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
-    node_free(priv->root);
+
+    // Everything that's left is in the slabs, so we only have to release the
+    // objects that each node refers to, and then free the slabs themselves.
+    release_subtree(self, priv->root);
+    priv->root = NULL;
+    g_string_chunk_free(priv->names);
+    dt_slab_arrays_clear(&priv->child_arrays);
+    dt_slab_clear(&priv->nodes);
     G_OBJECT_CLASS(dt_tree_source_base_parent_class)->finalize(gobj);
 }
 
@@ -80,8 +130,13 @@ static void dt_tree_source_base_interface_init(DtTreeSourceInterface *iface)
     iface->get_root = dt_tree_source_base_get_root;
     iface->get_parent = dt_tree_source_base_get_parent;
     iface->get_children = dt_tree_source_base_get_children;
+    iface->get_child_array = dt_tree_source_base_get_child_array;
     iface->get_child_by_name = dt_tree_source_base_get_child_by_name;
-    iface->get_file_info = dt_tree_source_base_get_file_info;
+    iface->get_name = dt_tree_source_base_get_name;
+    iface->get_metadata = dt_tree_source_base_get_metadata;
+    iface->get_symlink_target = dt_tree_source_base_get_symlink_target;
+    iface->create_file_info = dt_tree_source_base_create_file_info;
+    iface->set_digest = dt_tree_source_base_set_digest;
     iface->scan_async = dt_tree_source_base_scan_async;
     iface->scan_finish = dt_tree_source_base_scan_finish;
 
@@ -102,9 +157,14 @@ static void dt_tree_source_base_init(DtTreeSourceBase *self)
     DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
     GFileInfo *info = g_file_info_new();
 
+    dt_slab_init(&priv->nodes, sizeof(TreeSourceBaseNode), NODES_PER_CHUNK);
+    dt_slab_arrays_init(&priv->child_arrays);
+    priv->names = g_string_chunk_new(64 * 1024);
+
     g_file_info_set_name(info, "/");
     g_file_info_set_file_type(info, G_FILE_TYPE_DIRECTORY);
     priv->root = node_create(self, info);
+    g_object_unref(info);
 }
 
 static TreeSourceBaseNode *check_node(DtTreeSourceBase *self, DtTreeSourceNode *snode)
@@ -125,73 +185,233 @@ static TreeSourceBaseNode *check_node(DtTreeSourceBase *self, DtTreeSourceNode *
     return NULL;
 }
 
-static TreeSourceBaseNode *node_create(DtTreeSourceBase *self, GFileInfo *info)
+/**
+ * Allocates a new node without any metadata.
+ */
+static TreeSourceBaseNode *node_alloc(DtTreeSourceBase *self, const char *name)
 {
-    TreeSourceBaseNode *node = g_malloc(sizeof(TreeSourceBaseNode));
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    TreeSourceBaseNode *node = dt_slab_alloc(&priv->nodes);
     node->owner = self;
-    node->info = info;
     node->parent = NULL;
+    node->name = g_string_chunk_insert(priv->names, name);
+    node->symlink_target = NULL;
     node->children = NULL;
+    node->num_children = 0;
+    node->child_capacity = 0;
+    return node;
+}
+
+static TreeSourceBaseNode *node_create(DtTreeSourceBase *self, GFileInfo *info)
+{
+    TreeSourceBaseNode *node = node_alloc(self, g_file_info_get_name(info));
+    node_set_info(self, node, info);
 
     return node;
 }
 
-static void node_free(TreeSourceBaseNode *node)
+/**
+ * Copies the metadata and symlink target from a GFileInfo into a node.
+ */
+static void node_set_info(DtTreeSourceBase *self, TreeSourceBaseNode *node, GFileInfo *info)
 {
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    const char *target = g_file_info_get_symlink_target(info);
+
+    dt_file_metadata_from_file_info(&node->metadata, info);
+    if (target == NULL)
+    {
+        node->symlink_target = NULL;
+    }
+    else if (node->symlink_target == NULL || strcmp(node->symlink_target, target) != 0)
+    {
+        node->symlink_target = g_string_chunk_insert_const(priv->names, target);
+    }
+}
+
+/**
+ * Frees a node and everything under it.
+ *
+ * The node must already be detached from its parent.
+ */
+static void node_free(DtTreeSourceBase *self, TreeSourceBaseNode *node)
+{
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+
     if (node != NULL)
     {
-        if (node->children != NULL)
+        guint32 i;
+
+        for (i=0; i<node->num_children; i++)
         {
-            g_hash_table_destroy(node->children);
+            node_free(self, node->children[i]);
         }
+        dt_slab_arrays_free(&priv->child_arrays, (gpointer *) node->children, node->child_capacity);
+
+        node->owner = NULL;
+        dt_slab_free(&priv->nodes, node);
+    }
+}
+
+/**
+ * Releases everything that a node and its descendants refer to, without
+ * freeing the nodes themselves. This is only used when the whole tree is
+ * destroyed.
+ *
+ * Since the names and metadata are all in the arenas, the only thing left is
+ * any children array that's too big for a slab.
+ */
+static void release_subtree(DtTreeSourceBase *self, TreeSourceBaseNode *node)
+{
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    guint32 i;
+
+    for (i=0; i<node->num_children; i++)
+    {
+        release_subtree(self, node->children[i]);
+    }
+    if (node->child_capacity > (1U << DT_SLAB_ARRAYS_MAX_SHIFT))
+    {
+        // This one didn't come from a slab.
+        dt_slab_arrays_free(&priv->child_arrays, (gpointer *) node->children, node->child_capacity);
+    }
+}
+
+static gint compare_node_names(gconstpointer a, gconstpointer b, gpointer userdata)
+{
+    const TreeSourceBaseNode *n1 = *((const TreeSourceBaseNode * const *) a);
+    const TreeSourceBaseNode *n2 = *((const TreeSourceBaseNode * const *) b);
+    return strcmp(n1->name, n2->name);
+}
+
+/**
+ * Finds a child by name with a binary search.
+ *
+ * \param[out] ret_index Returns the index of the child if it's found, or the
+ *      index where it would be inserted if it isn't.
+ * \return TRUE if a child with that name exists.
+ */
+static gboolean find_child_index(TreeSourceBaseNode *parent, const char *name, guint32 *ret_index)
+{
+    guint32 low = 0;
+    guint32 high = parent->num_children;
 
-        if (node->info != NULL)
+    while (low < high)
+    {
+        guint32 mid = low + (high - low) / 2;
+        int cmp = strcmp(parent->children[mid]->name, name);
+        if (cmp == 0)
+        {
+            *ret_index = mid;
+            return TRUE;
+        }
+        else if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
         {
-            g_object_unref(node->info);
+            high = mid;
         }
-        g_free(node);
     }
+    *ret_index = low;
+    return FALSE;
 }
 
-static void node_add_child(TreeSourceBaseNode *parent, TreeSourceBaseNode *child)
+/**
+ * Adds a batch of new children to a node.
+ *
+ * The new nodes are sorted on their own, and then merged into the existing
+ * array from the back, so adding a whole directory at once only moves each
+ * existing child once.
+ */
+static void node_add_children(DtTreeSourceBase *self, TreeSourceBaseNode *parent,
+        guint num, TreeSourceBaseNode **children)
 {
-    const gchar *name = g_file_info_get_name(child->info);
-    g_return_if_fail(name != NULL);
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    TreeSourceBaseNode **sorted;
+    gint64 src, add, dst;
+    guint i;
 
-    if (parent->children == NULL)
+    if (num == 0)
     {
-        parent->children = g_hash_table_new_full(g_str_hash, g_str_equal,
-                g_free, (GDestroyNotify) node_free);
+        return;
     }
-    if (!g_hash_table_replace(parent->children, g_strdup(name), child))
+
+    sorted = g_memdup(children, num * sizeof(TreeSourceBaseNode *));
+    g_qsort_with_data(sorted, num, sizeof(TreeSourceBaseNode *), compare_node_names, NULL);
+
+    parent->children = (TreeSourceBaseNode **) dt_slab_arrays_reserve(&priv->child_arrays,
+            (gpointer *) parent->children, &parent->child_capacity,
+            parent->num_children, parent->num_children + num);
+
+    src = (gint64) parent->num_children - 1;
+    add = (gint64) num - 1;
+    dst = (gint64) parent->num_children + num - 1;
+    while (add >= 0)
     {
-        g_critical("Duplicate hash table key: \"%s\"\n", name);
+        int cmp = (src >= 0 ? strcmp(parent->children[src]->name, sorted[add]->name) : -1);
+        if (cmp == 0 || (add > 0 && strcmp(sorted[add - 1]->name, sorted[add]->name) == 0))
+        {
+            // Both nodes are kept, but get_child_by_name will only find one
+            // of them. This would mean that the DtTreeSource added the same
+            // name twice.
+            g_critical("Duplicate child name: \"%s\"\n", sorted[add]->name);
+        }
+
+        if (cmp > 0)
+        {
+            parent->children[dst--] = parent->children[src--];
+        }
+        else
+        {
+            parent->children[dst--] = sorted[add--];
+        }
     }
-    child->parent = parent;
+    parent->num_children += num;
+
+    for (i=0; i<num; i++)
+    {
+        sorted[i]->parent = parent;
+    }
+    g_free(sorted);
 }
 
-static void node_detach(TreeSourceBaseNode *node)
+static void node_detach(DtTreeSourceBase *self, TreeSourceBaseNode *node)
 {
-    if (node->parent != NULL)
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    TreeSourceBaseNode *parent = node->parent;
+
+    if (parent != NULL)
     {
-        gchar *key = NULL;
-        TreeSourceBaseNode *found = NULL;
+        guint32 index;
 
-        g_assert(node->parent->children != NULL);
+        if (!find_child_index(parent, node->name, &index))
+        {
+            g_error("Can't happen: Node not in parent's children array");
+        }
 
-        if (g_hash_table_lookup_extended(node->parent->children,
-                    g_file_info_get_name(node->info),
-                    (void **) &key, (void **) found))
+        // If there's a duplicate name, then the binary search might have
+        // found a different node with the same name.
+        while (index > 0 && strcmp(parent->children[index - 1]->name, node->name) == 0)
         {
-            g_assert(node == found);
-            g_hash_table_steal(node->parent->children, g_file_info_get_name(node->info));
-            g_free(key);
-            node->parent = NULL;
+            index--;
         }
-        else
+        while (parent->children[index] != node)
         {
-            g_error("Can't happen: Node not in parent's children hashtable");
+            index++;
+            if (index >= parent->num_children || strcmp(parent->children[index]->name, node->name) != 0)
+            {
+                g_error("Can't happen: Node not in parent's children array");
+            }
         }
+
+        memmove(parent->children + index, parent->children + index + 1,
+                (parent->num_children - index - 1) * sizeof(TreeSourceBaseNode *));
+        parent->num_children--;
+        parent->children = (TreeSourceBaseNode **) dt_slab_arrays_trim(&priv->child_arrays,
+                (gpointer *) parent->children, &parent->child_capacity, parent->num_children);
+        node->parent = NULL;
     }
 }
 
@@ -211,41 +431,97 @@ static DtTreeSourceNode *dt_tree_source_base_get_parent(DtTreeSource *self, DtTr
 static GList *dt_tree_source_base_get_children(DtTreeSource *self, DtTreeSourceNode *iparent)
 {
     TreeSourceBaseNode *parent = check_node(DT_TREE_SOURCE_BASE(self), iparent);
+    GList *children = NULL;
+    guint32 i;
 
     g_return_val_if_fail(parent != NULL, NULL);
 
-    if (parent->children != NULL)
-    {
-        return g_hash_table_get_values(parent->children);
-    }
-    else
+    for (i=parent->num_children; i>0; i--)
     {
-        return NULL;
+        children = g_list_prepend(children, parent->children[i - 1]);
     }
+    return children;
+}
+
+static DtTreeSourceNode * const *dt_tree_source_base_get_child_array(DtTreeSource *self,
+        DtTreeSourceNode *iparent, guint *ret_num)
+{
+    TreeSourceBaseNode *parent = check_node(DT_TREE_SOURCE_BASE(self), iparent);
+
+    g_return_val_if_fail(parent != NULL, NULL);
+    *ret_num = parent->num_children;
+    return (DtTreeSourceNode * const *) parent->children;
 }
 
 static DtTreeSourceNode *dt_tree_source_base_get_child_by_name(DtTreeSource *self, DtTreeSourceNode *iparent, const char *name)
 {
     TreeSourceBaseNode *parent = check_node(DT_TREE_SOURCE_BASE(self), iparent);
+    guint32 index;
 
     g_return_val_if_fail(parent != NULL, NULL);
     g_return_val_if_fail(name != NULL, NULL);
-    if (parent->children != NULL)
+
+    if (find_child_index(parent, name, &index))
     {
-        return g_hash_table_lookup(parent->children, name);
+        return (DtTreeSourceNode *) parent->children[index];
     }
-    else
+    return NULL;
+}
+
+static const char *dt_tree_source_base_get_name(DtTreeSource *self, DtTreeSourceNode *inode)
+{
+    TreeSourceBaseNode *node = check_node(DT_TREE_SOURCE_BASE(self), inode);
+
+    g_return_val_if_fail(node != NULL, NULL);
+    return node->name;
+}
+
+static const DtFileMetadata *dt_tree_source_base_get_metadata(DtTreeSource *self, DtTreeSourceNode *inode)
+{
+    TreeSourceBaseNode *node = check_node(DT_TREE_SOURCE_BASE(self), inode);
+
+    g_return_val_if_fail(node != NULL, NULL);
+    return &node->metadata;
+}
+
+static const char *dt_tree_source_base_get_symlink_target(DtTreeSource *self, DtTreeSourceNode *inode)
+{
+    TreeSourceBaseNode *node = check_node(DT_TREE_SOURCE_BASE(self), inode);
+
+    g_return_val_if_fail(node != NULL, NULL);
+    return node->symlink_target;
+}
+
+static GFileInfo *dt_tree_source_base_create_file_info(DtTreeSource *self, DtTreeSourceNode *inode)
+{
+    TreeSourceBaseNode *node = check_node(DT_TREE_SOURCE_BASE(self), inode);
+    DtTreeSourceBaseClass *klass = DT_TREE_SOURCE_BASE_GET_CLASS(self);
+    GFileInfo *info;
+
+    g_return_val_if_fail(node != NULL, NULL);
+
+    info = g_file_info_new();
+    g_file_info_set_name(info, node->name);
+    g_file_info_set_display_name(info, node->name);
+    dt_file_metadata_to_file_info(&node->metadata, info);
+    if (node->symlink_target != NULL)
     {
-        return NULL;
+        g_file_info_set_symlink_target(info, node->symlink_target);
     }
+    if (klass->add_file_attributes != NULL)
+    {
+        klass->add_file_attributes(DT_TREE_SOURCE_BASE(self), inode, info);
+    }
+    return info;
 }
 
-static GFileInfo *dt_tree_source_base_get_file_info(DtTreeSource *self, DtTreeSourceNode *inode)
+static void dt_tree_source_base_set_digest(DtTreeSource *self, DtTreeSourceNode *inode, const guint8 *digest)
 {
     TreeSourceBaseNode *node = check_node(DT_TREE_SOURCE_BASE(self), inode);
 
-    g_return_val_if_fail(node != NULL, NULL);
-    return node->info;
+    g_return_if_fail(node != NULL);
+    memcpy(node->metadata.digest, digest, DT_FILE_METADATA_DIGEST_SIZE);
+    node->metadata.flags |= DT_FILE_METADATA_HAS_DIGEST;
 }
 
 void dt_tree_source_base_add_children(DtTreeSourceBase *self, DtTreeSourceNode *iparent,
@@ -268,14 +544,53 @@ void dt_tree_source_base_add_children(DtTreeSourceBase *self, DtTreeSourceNode *
 
     for (i=0; i<num; i++)
     {
-        TreeSourceBaseNode *child;
         g_assert(info[i] != NULL);
         g_assert(G_IS_FILE_INFO(info[i]));
 
-        child = node_create(self, g_object_ref(info[i]));
-        node_add_child(parent, child);
-        new_nodes[i] = (DtTreeSourceNode *) child;
+        new_nodes[i] = (DtTreeSourceNode *) node_create(self, info[i]);
+    }
+    node_add_children(self, parent, num, (TreeSourceBaseNode **) new_nodes);
+
+    dt_tree_source_nodes_added(DT_TREE_SOURCE(self),
+            iparent, num, new_nodes);
+
+    if (ret_nodes == NULL)
+    {
+        g_free(new_nodes);
+    }
+}
+
+void dt_tree_source_base_add_children_metadata(DtTreeSourceBase *self, DtTreeSourceNode *iparent,
+        gint num, const char * const *names, const DtFileMetadata *metadata,
+        const char * const *symlink_targets, DtTreeSourceNode **ret_nodes)
+{
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    TreeSourceBaseNode *parent = check_node(self, iparent);
+    DtTreeSourceNode **new_nodes;
+    gint i;
+
+    g_return_if_fail(parent != NULL);
+
+    if (ret_nodes != NULL)
+    {
+        new_nodes = ret_nodes;
+    }
+    else
+    {
+        new_nodes = g_malloc(num * sizeof(DtTreeSourceNode *));
+    }
+
+    for (i=0; i<num; i++)
+    {
+        TreeSourceBaseNode *node = node_alloc(self, names[i]);
+        node->metadata = metadata[i];
+        if (symlink_targets != NULL && symlink_targets[i] != NULL)
+        {
+            node->symlink_target = g_string_chunk_insert_const(priv->names, symlink_targets[i]);
+        }
+        new_nodes[i] = (DtTreeSourceNode *) node;
     }
+    node_add_children(self, parent, num, (TreeSourceBaseNode **) new_nodes);
 
     dt_tree_source_nodes_added(DT_TREE_SOURCE(self),
             iparent, num, new_nodes);
@@ -286,6 +601,22 @@ void dt_tree_source_base_add_children(DtTreeSourceBase *self, DtTreeSourceNode *
     }
 }
 
+/**
+ * Removes all of the children of a node, deepest first.
+ */
+static void remove_descendants(DtTreeSourceBase *self, TreeSourceBaseNode *node)
+{
+    if (node->num_children > 0)
+    {
+        // Make a copy, since removing the children changes the array.
+        guint num = node->num_children;
+        DtTreeSourceNode **children = g_memdup(node->children, num * sizeof(DtTreeSourceNode *));
+
+        dt_tree_source_base_remove_children(self, (DtTreeSourceNode *) node, num, children);
+        g_free(children);
+    }
+}
+
 void dt_tree_source_base_remove_children(DtTreeSourceBase *self, DtTreeSourceNode *iparent,
         gint num, DtTreeSourceNode **nodes)
 {
@@ -299,6 +630,9 @@ void dt_tree_source_base_remove_children(DtTreeSourceBase *self, DtTreeSourceNod
         return;
     }
 
+    // Remove the children of each node first, so that anything listening for
+    // the nodes-removed signal never sees a node disappear out from under its
+    // own children.
     for (i=0; i<num; i++)
     {
         TreeSourceBaseNode *child = check_node(self, nodes[i]);
@@ -307,10 +641,22 @@ void dt_tree_source_base_remove_children(DtTreeSourceBase *self, DtTreeSourceNod
             g_error("Invalid child node\n");
             continue;
         }
-        node_detach(child);
+        remove_descendants(self, child);
+    }
+
+    for (i=0; i<num; i++)
+    {
+        node_detach(self, (TreeSourceBaseNode *) nodes[i]);
     }
 
     dt_tree_source_nodes_removed(DT_TREE_SOURCE(self), iparent, num, nodes);
+
+    // The signal handlers can still look at the nodes, so don't free them
+    // until after the signal.
+    for (i=0; i<num; i++)
+    {
+        node_free(self, (TreeSourceBaseNode *) nodes[i]);
+    }
 }
 
 void dt_tree_source_base_set_file_info(DtTreeSourceBase *self, DtTreeSourceNode *inode, GFileInfo *info)
@@ -320,21 +666,56 @@ void dt_tree_source_base_set_file_info(DtTreeSourceBase *self, DtTreeSourceNode
 
     g_return_if_fail(node != NULL);
     g_return_if_fail(info != NULL);
-    g_assert(strcmp(g_file_info_get_name(info), g_file_info_get_name(node->info)) == 0);
+    g_assert(strcmp(g_file_info_get_name(info), node->name) == 0);
 
-    oldInfo = g_object_ref(node->info);
-    g_set_object(&node->info, info);
+    oldInfo = dt_tree_source_create_file_info(DT_TREE_SOURCE(self), inode);
+    node_set_info(self, node, info);
 
     dt_tree_source_nodes_changed(DT_TREE_SOURCE(self), (DtTreeSourceNode *) node->parent,
             1, &inode, &oldInfo);
     g_object_unref(oldInfo);
 }
 
+/**
+ * Adds up the number of directories and entries under a node, for the final
+ * scan-progress update.
+ */
+static void count_nodes(TreeSourceBaseNode *node, DtTreeSourceScanStats *stats)
+{
+    guint32 i;
+
+    if (node->parent == NULL || node->metadata.type == G_FILE_TYPE_DIRECTORY)
+    {
+        stats->dirs_visited++;
+    }
+
+    for (i=0; i<node->num_children; i++)
+    {
+        TreeSourceBaseNode *ch = node->children[i];
+
+        stats->entries_found++;
+        stats->metadata_bytes += strlen(ch->name) + sizeof(struct stat);
+        if (ch->symlink_target != NULL)
+        {
+            stats->metadata_bytes += strlen(ch->symlink_target);
+        }
+        count_nodes(ch, stats);
+    }
+}
+
 void dt_tree_source_base_scan_async(DtTreeSource *self, int io_priority,
         GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata)
 {
-    // As a default implementation, just queue the completion callback.
+    // As a default implementation, the tree is already populated, so just
+    // report what's in it and queue the completion callback.
+    DtTreeSourceBasePrivate *priv = GET_PRIVATE(self);
+    DtTreeSourceScanStats stats = {};
     GTask *task = g_task_new(self, cancellable, callback, userdata);
+
+    count_nodes(priv->root, &stats);
+    stats.finished = TRUE;
+    dt_tree_source_scan_progress(self, &stats);
+
     g_task_return_boolean(task, TRUE);
     g_object_unref(task);
 }
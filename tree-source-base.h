@@ -6,8 +6,19 @@
  *
  * A basic DtTreeSource implementation.
  *
- * This implementation maintains a tree internally, and uses a hashtable to
- * quickly look up child nodes.
+ * This implementation maintains a tree internally. The nodes are allocated
+ * from a slab, each directory's children are kept in a compact array, and the
+ * names are all stored in one string arena, so a large tree doesn't turn into
+ * millions of separate allocations. Each children array is kept sorted by
+ * name, so dt_tree_source_get_child_array can hand it out directly, and
+ * looking up a child by name is a binary search.
+ *
+ * Each node stores its metadata in a DtFileMetadata struct, not a GFileInfo.
+ * The GFileInfo objects passed to dt_tree_source_base_add_children and
+ * dt_tree_source_base_set_file_info are only read, not kept, and
+ * dt_tree_source_create_file_info builds a new one each time. A subclass that
+ * already has a DtFileMetadata can use
+ * dt_tree_source_base_add_children_metadata to skip the GFileInfo entirely.
  */
 
 #include <glib.h>
@@ -23,14 +34,58 @@ G_DECLARE_DERIVABLE_TYPE(DtTreeSourceBase, dt_tree_source_base, DT, TREE_SOURCE_
 struct _DtTreeSourceBaseClass
 {
     GObjectClass parent_class;
+
+    /**
+     * Adds any attributes that are specific to a subclass to a GFileInfo for
+     * dt_tree_source_create_file_info. The standard attributes are already
+     * filled in.
+     *
+     * This is optional.
+     */
+    void (* add_file_attributes) (DtTreeSourceBase *self, DtTreeSourceNode *node, GFileInfo *info);
 };
 
+/**
+ * Adds nodes to the tree.
+ *
+ * This only copies the name, symlink target, and the attributes in
+ * DtFileMetadata from each GFileInfo. Any other attributes are dropped.
+ */
 void dt_tree_source_base_add_children(DtTreeSourceBase *self, DtTreeSourceNode *parent,
         gint num, GFileInfo **info, DtTreeSourceNode **ret_nodes);
 
+/**
+ * Adds nodes to the tree from plain metadata, without a GFileInfo for each
+ * one.
+ *
+ * This is the same as dt_tree_source_base_add_children, for a subclass that
+ * already has the metadata in a DtFileMetadata struct.
+ *
+ * \param names The name of each node.
+ * \param metadata The metadata for each node.
+ * \param symlink_targets The symlink target of each node, or NULL for a
+ *      node that isn't a symlink. The whole array can be NULL if there are no
+ *      symlinks.
+ */
+void dt_tree_source_base_add_children_metadata(DtTreeSourceBase *self, DtTreeSourceNode *parent,
+        gint num, const char * const *names, const DtFileMetadata *metadata,
+        const char * const *symlink_targets, DtTreeSourceNode **ret_nodes);
+
+/**
+ * Removes nodes from the tree.
+ *
+ * If any of the nodes have children, then those are removed first, with a
+ * separate nodes-removed signal for each directory. The nodes are freed after
+ * the nodes-removed signal.
+ */
 void dt_tree_source_base_remove_children(DtTreeSourceBase *self, DtTreeSourceNode *parent,
         gint num, DtTreeSourceNode **nodes);
 
+/**
+ * Replaces the metadata for a node, and sends a nodes-changed signal.
+ *
+ * The name in \p info must match the node's name.
+ */
 void dt_tree_source_base_set_file_info(DtTreeSourceBase *self, DtTreeSourceNode *node, GFileInfo *info);
 
 G_END_DECLS
@@ -1,8 +1,14 @@
 #include "tree-source-fs.h"
+#include "fs-scan-native.h"
+#include "fs-scan-uring.h"
+#include "fs-watch.h"
+#include "scan-snapshot.h"
+#include "exclude-rules.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <gio/gio.h>
 
@@ -11,17 +17,251 @@ struct _DtTreeSourceFS
     DtTreeSourceBase parent_instance;
     GFile *base;
     gboolean follow_symlinks;
+    gint max_scan_jobs;
+    DtTreeSourceFSScanBackend scan_backend;
+
+    /**
+     * The file to load a snapshot from before scanning, and to save one to
+     * afterward. If this is NULL, then we always do a full scan.
+     */
+    char *snapshot_file;
+
+    /**
+     * If TRUE, then read directories in the background, one at a time and at
+     * a low priority, and read any directory that someone asks for with
+     * dt_tree_source_prioritize_node right away.
+     */
+    gboolean lazy;
+
+    /**
+     * Patterns for files to leave out of the tree. An excluded directory is
+     * never read at all. This can be NULL.
+     */
+    DtExcludeRules *exclude_rules;
+
+    /**
+     * If TRUE, then also read the .gitignore file in each directory.
+     */
+    gboolean use_gitignore;
+
+    /**
+     * Maps a directory node to the DtExcludeRules from its .gitignore file.
+     * Directories without a .gitignore file aren't in here.
+     */
+    GHashTable *dir_rules;
+
+    /**
+     * The scan tasks that are running, including the ones that we start
+     * internally for new directories, so that dt_tree_source_prioritize_node
+     * and the watch can find the directories in their queues.
+     */
+    GList *scan_tasks;
+
+    /**
+     * True if we should watch for changes after scanning.
+     */
+    gboolean watch;
+    DtFsWatch *fs_watch;
+
+    /// Maps a watch descriptor to a directory node.
+    GHashTable *watch_dirs;
+
+    /// Maps a directory node to its watch descriptor.
+    GHashTable *watch_nodes;
+
+    /**
+     * Directories with changes that we haven't looked at yet. This maps a
+     * node to a DirtyDir struct.
+     */
+    GHashTable *dirty_dirs;
+    guint dirty_timeout;
+
+    /**
+     * Maps a directory node to the WatchUpdate that's checking it on a
+     * worker thread.
+     */
+    GHashTable *watch_updates;
+    gint64 first_dirty_time;
+    gint64 last_dirty_time;
 };
 
+/**
+ * Keeps track of the changes in a single watched directory.
+ */
+typedef struct
+{
+    /// The set of names that changed.
+    GHashTable *names;
+
+    /// If TRUE, then reread the whole directory.
+    gboolean all;
+} DirtyDir;
+
+/**
+ * A dirty directory that we're checking again on a worker thread.
+ */
+typedef struct
+{
+    /**
+     * The directory's node, or NULL if it was removed from the tree while
+     * the worker thread was running.
+     */
+    DtTreeSourceNode *node;
+    GFile *dir;
+    gboolean follow_symlinks;
+
+    /**
+     * If TRUE, then the worker thread also adds every name that's on disk
+     * to \c names.
+     */
+    gboolean all;
+
+    /// The set of names to check.
+    GHashTable *names;
+
+    /**
+     * The name and new GFileInfo of each entry, filled in by the worker
+     * thread. The GFileInfo is NULL if the entry doesn't exist anymore.
+     */
+    GPtrArray *result_names;
+    GPtrArray *result_infos;
+} WatchUpdate;
+
+/**
+ * Keeps track of a single directory that we're enumerating.
+ */
+typedef struct
+{
+    GTask *task;
+    DtTreeSourceNode *node;
+
+    /**
+     * The node for this directory in the snapshot, or DT_SCAN_SNAPSHOT_NONE
+     * if it's not in the snapshot.
+     */
+    guint32 snapshot_index;
+
+    /**
+     * The I/O priority for reading this directory.
+     */
+    gint io_priority;
+
+    /**
+     * True if someone asked for this directory with
+     * dt_tree_source_prioritize_node. An urgent job gets added to the tree as
+     * soon as it's ready, without waiting for the jobs that were started
+     * before it.
+     */
+    gboolean urgent;
+
+    /**
+     * Batches of entries that we've read. Each batch gets added to the tree
+     * as soon as this job is at the head of the running queue.
+     *
+     * For the native scanner, these are DtFsEntryBatch structs. Otherwise,
+     * they're GPtrArrays of GFileInfo objects.
+     */
+    GQueue batches;
+    gboolean native;
+
+    /**
+     * If TRUE, then the native scanner had to start over partway through
+     * the directory, so skip any entries that are already in the tree.
+     */
+    gboolean recheck_names;
+
+    /**
+     * The time that we started the current next_files request.
+     */
+    gint64 request_time;
+
+    /**
+     * True if we're done reading the directory.
+     */
+    gboolean finished;
+} ScanJob;
+
 typedef struct
 {
-    GQueue queue;
+    /**
+     * Directories that we still need to enumerate.
+     */
+    GQueue pending;
+
+    /**
+     * Directories that were passed to dt_tree_source_prioritize_node. These
+     * are started before anything in the pending queue.
+     */
+    GQueue urgent;
+
+    /**
+     * Map each directory in the pending and urgent queues to its GList link,
+     * so that dt_tree_source_prioritize_node can find and move it without
+     * walking the whole queue.
+     */
+    GHashTable *pending_links;
+    GHashTable *urgent_links;
+
+    /**
+     * The number of jobs in the running queue that are urgent.
+     */
+    guint num_urgent_running;
+
+    /**
+     * ScanJob structs for the directories that we're currently enumerating, in
+     * the order that they were started.
+     */
+    GQueue running;
+
+    /**
+     * The number of files to ask for in each next_files request. This is
+     * adjusted based on how long each request takes.
+     */
+    gint batch_size;
+
+    /**
+     * The first error that we ran into, if any.
+     */
+    GError *error;
+
+    /**
+     * The snapshot from the last scan, if we have one.
+     */
+    DtScanSnapshot *snapshot;
+
+    /**
+     * Maps each directory in the pending queue to its index in the snapshot,
+     * plus one. Directories that aren't in the snapshot aren't in here.
+     */
+    GHashTable *snapshot_dirs;
+
+    /**
+     * If TRUE, then save a new snapshot when the scan finishes.
+     */
+    gboolean save_snapshot;
+
+    /**
+     * If TRUE, then send scan-progress signals. This is only set for scans
+     * that were started with dt_tree_source_scan_async, not for the ones that
+     * we start internally for new directories.
+     */
+    gboolean report_progress;
+    DtTreeSourceScanStats stats;
+    gint64 start_time;
+    gint64 last_progress_time;
 } DtTreeSourceFSScanState;
 
 enum
 {
     PROP_BASE = 1,
     PROP_FOLLOW_SYMLINKS,
+    PROP_MAX_SCAN_JOBS,
+    PROP_SCAN_BACKEND,
+    PROP_WATCH,
+    PROP_SNAPSHOT_FILE,
+    PROP_LAZY,
+    PROP_EXCLUDE_RULES,
+    PROP_USE_GITIGNORE,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties[N_PROPERTIES] = {};
@@ -33,13 +273,65 @@ static const char *FILE_QUERY_ATTRIBS =
             "," G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET
             "," G_FILE_ATTRIBUTE_STANDARD_SIZE
             "," G_FILE_ATTRIBUTE_TIME_MODIFIED
-            "," G_FILE_ATTRIBUTE_UNIX_MODE;
+            "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+            "," G_FILE_ATTRIBUTE_TIME_CHANGED
+            "," G_FILE_ATTRIBUTE_TIME_CHANGED_USEC
+            "," G_FILE_ATTRIBUTE_UNIX_MODE
+            "," G_FILE_ATTRIBUTE_UNIX_DEVICE
+            "," G_FILE_ATTRIBUTE_UNIX_INODE;
+
+/*
+ * The limits for the number of files to read in a single next_files request.
+ *
+ * We start with a small batch, so that the first few rows show up quickly,
+ * and then double it as long as each request finishes within
+ * TARGET_BATCH_LATENCY. If a request takes much longer than that, then we cut
+ * it back down.
+ */
+#define MIN_QUERY_BATCH_SIZE 32
+#define MAX_QUERY_BATCH_SIZE 4096
+#define TARGET_BATCH_LATENCY (10 * G_TIME_SPAN_MILLISECOND)
+#define DEFAULT_MAX_SCAN_JOBS 8
+
+/**
+ * The minimum time between scan-progress signals.
+ */
+#define SCAN_PROGRESS_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+/**
+ * In lazy mode, the number of directories to read at once in the background.
+ * Directories from dt_tree_source_prioritize_node can still use up to
+ * max-scan-jobs.
+ */
+#define LAZY_BACKGROUND_JOBS 1
+
+/*
+ * Filesystem events are collected until nothing has happened for
+ * WATCH_QUIET_TIME, so that a burst of changes turns into one update. If the
+ * changes keep coming, then we update anyway after WATCH_MAX_DELAY.
+ */
+#define WATCH_QUIET_TIME (100 * G_TIME_SPAN_MILLISECOND)
+#define WATCH_MAX_DELAY (G_TIME_SPAN_SECOND)
 
-#define QUERY_BATCH_SIZE 1
+/**
+ * The number of entries in each batch from the native scanner.
+ *
+ * Each batch is sent back to the main thread as soon as it's full, so this
+ * is how many entries the first rows of a large directory wait behind, and
+ * how much we add to the tree in one go.
+ */
+#define NATIVE_BATCH_SIZE 1024
 
 static void dt_tree_source_fs_interface_init(DtTreeSourceInterface *iface);
+static void dt_tree_source_fs_prioritize_node(DtTreeSource *self, DtTreeSourceNode *node);
+static void dirty_dir_free(DirtyDir *dirty);
+static void watch_directory(DtTreeSourceFS *self, DtTreeSourceNode *node, GFile *file);
+static void schedule_dirty_flush(DtTreeSourceFS *self);
+static void save_snapshot(DtTreeSourceFS *self);
 static void dt_tree_source_fs_dispose(GObject *gobj);
 static void dt_tree_source_fs_finalize(GObject *gobj);
+static void dt_tree_source_fs_add_file_attributes(DtTreeSourceBase *self,
+        DtTreeSourceNode *node, GFileInfo *info);
 
 static void dt_tree_source_fs_open_file_async(DtTreeSource *self, DtTreeSourceNode *node,
         int io_priority, GCancellable *cancellable,
@@ -62,6 +354,7 @@ static void dt_tree_source_fs_interface_init(DtTreeSourceInterface *iface)
     iface->open_file_finish = dt_tree_source_fs_open_file_finish;
     iface->scan_async = dt_tree_source_fs_scan_async;
     iface->scan_finish = dt_tree_source_fs_scan_finish;
+    iface->prioritize_node = dt_tree_source_fs_prioritize_node;
 }
 
 static void dt_tree_source_fs_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
@@ -75,6 +368,32 @@ static void dt_tree_source_fs_set_property(GObject *object, guint property_id, c
         case PROP_FOLLOW_SYMLINKS:
             self->follow_symlinks = g_value_get_boolean(value);
             break;
+        case PROP_MAX_SCAN_JOBS:
+            self->max_scan_jobs = g_value_get_int(value);
+            break;
+        case PROP_SCAN_BACKEND:
+            self->scan_backend = g_value_get_int(value);
+            break;
+        case PROP_WATCH:
+            self->watch = g_value_get_boolean(value);
+            break;
+        case PROP_SNAPSHOT_FILE:
+            g_free(self->snapshot_file);
+            self->snapshot_file = g_value_dup_string(value);
+            break;
+        case PROP_LAZY:
+            self->lazy = g_value_get_boolean(value);
+            break;
+        case PROP_EXCLUDE_RULES:
+            if (self->exclude_rules != NULL)
+            {
+                dt_exclude_rules_unref(self->exclude_rules);
+            }
+            self->exclude_rules = g_value_dup_boxed(value);
+            break;
+        case PROP_USE_GITIGNORE:
+            self->use_gitignore = g_value_get_boolean(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -92,6 +411,27 @@ static void dt_tree_source_fs_get_property(GObject *object, guint property_id, G
         case PROP_FOLLOW_SYMLINKS:
             g_value_set_boolean(value, self->follow_symlinks);
             break;
+        case PROP_MAX_SCAN_JOBS:
+            g_value_set_int(value, self->max_scan_jobs);
+            break;
+        case PROP_SCAN_BACKEND:
+            g_value_set_int(value, self->scan_backend);
+            break;
+        case PROP_WATCH:
+            g_value_set_boolean(value, self->watch);
+            break;
+        case PROP_SNAPSHOT_FILE:
+            g_value_set_string(value, self->snapshot_file);
+            break;
+        case PROP_LAZY:
+            g_value_set_boolean(value, self->lazy);
+            break;
+        case PROP_EXCLUDE_RULES:
+            g_value_set_boxed(value, self->exclude_rules);
+            break;
+        case PROP_USE_GITIGNORE:
+            g_value_set_boolean(value, self->use_gitignore);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -101,9 +441,11 @@ static void dt_tree_source_fs_get_property(GObject *object, guint property_id, G
 static void dt_tree_source_fs_class_init(DtTreeSourceFSClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    DtTreeSourceBaseClass *base_class = DT_TREE_SOURCE_BASE_CLASS(klass);
 
     object_class->set_property = dt_tree_source_fs_set_property;
     object_class->get_property = dt_tree_source_fs_get_property;
+    base_class->add_file_attributes = dt_tree_source_fs_add_file_attributes;
     obj_properties[PROP_BASE] = g_param_spec_object(
             "base",
             "Base path",
@@ -116,6 +458,48 @@ static void dt_tree_source_fs_class_init(DtTreeSourceFSClass *klass)
             "True if we should follow symlinks, instead of showing the symlink itself",
             TRUE,
             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_MAX_SCAN_JOBS] = g_param_spec_int(
+            "max-scan-jobs",
+            "Maximum scan jobs",
+            "The maximum number of directories to enumerate at the same time",
+            1, G_MAXINT, DEFAULT_MAX_SCAN_JOBS,
+            G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_SCAN_BACKEND] = g_param_spec_int(
+            "scan-backend",
+            "Scan backend",
+            "How to read directories, as a DtTreeSourceFSScanBackend value",
+            DT_TREE_SOURCE_FS_SCAN_GIO, DT_TREE_SOURCE_FS_SCAN_IO_URING, DT_TREE_SOURCE_FS_SCAN_GIO,
+            G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_WATCH] = g_param_spec_boolean(
+            "watch",
+            "Watch for changes",
+            "True if we should keep watching the directories for changes after scanning them",
+            FALSE,
+            G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_SNAPSHOT_FILE] = g_param_spec_string(
+            "snapshot-file",
+            "Snapshot file",
+            "A file to cache the scanned tree in, so that the next scan only has to reread the directories that changed",
+            NULL,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_LAZY] = g_param_spec_boolean(
+            "lazy",
+            "Lazy scanning",
+            "True if we should scan in the background, and read the directories that are asked for first",
+            FALSE,
+            G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_EXCLUDE_RULES] = g_param_spec_boxed(
+            "exclude-rules",
+            "Exclude rules",
+            "Patterns for files and directories to leave out of the tree",
+            DT_TYPE_EXCLUDE_RULES,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    obj_properties[PROP_USE_GITIGNORE] = g_param_spec_boolean(
+            "use-gitignore",
+            "Use .gitignore files",
+            "True if we should also leave out the files that each directory's .gitignore file matches",
+            FALSE,
+            G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
     g_object_class_install_properties(object_class, N_PROPERTIES, obj_properties);
 
     object_class->dispose = dt_tree_source_fs_dispose;
@@ -133,15 +517,45 @@ DtTreeSourceFS *dt_tree_source_fs_new(GFile *base, gboolean follow_symlinks)
 static void dt_tree_source_fs_init(DtTreeSourceFS *self)
 {
     self->base = g_file_new_for_path("/");
+    self->max_scan_jobs = DEFAULT_MAX_SCAN_JOBS;
+    self->scan_backend = DT_TREE_SOURCE_FS_SCAN_GIO;
+    self->watch_dirs = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->watch_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->dirty_dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify) dirty_dir_free);
+    self->watch_updates = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->dir_rules = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify) dt_exclude_rules_unref);
 }
 static void dt_tree_source_fs_dispose(GObject *gobj)
 {
     DtTreeSourceFS *self = DT_TREE_SOURCE_FS(gobj);
     g_clear_object(&self->base);
+    if (self->dirty_timeout != 0)
+    {
+        g_source_remove(self->dirty_timeout);
+        self->dirty_timeout = 0;
+    }
+    if (self->fs_watch != NULL)
+    {
+        dt_fs_watch_free(self->fs_watch);
+        self->fs_watch = NULL;
+    }
     G_OBJECT_CLASS(dt_tree_source_fs_parent_class)->dispose(gobj);
 }
 static void dt_tree_source_fs_finalize(GObject *gobj)
 {
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(gobj);
+    g_hash_table_destroy(self->watch_dirs);
+    g_hash_table_destroy(self->watch_nodes);
+    g_hash_table_destroy(self->dirty_dirs);
+    g_hash_table_destroy(self->watch_updates);
+    g_hash_table_destroy(self->dir_rules);
+    if (self->exclude_rules != NULL)
+    {
+        dt_exclude_rules_unref(self->exclude_rules);
+    }
+    g_free(self->snapshot_file);
     G_OBJECT_CLASS(dt_tree_source_fs_parent_class)->finalize(gobj);
 }
 
@@ -159,308 +573,2188 @@ static void file_enum_close_ready(GObject *sourceobj, GAsyncResult *res, gpointe
     g_object_unref(sourceobj);
 }
 
-static void start_next_scan(GTask *task);
+static void start_next_scans(GTask *task);
 
-static void next_files_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+static ScanJob *scan_job_new(GTask *task, DtTreeSourceNode *node)
 {
-    GTask *task = G_TASK(userdata);
-    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
-    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
-    DtTreeSourceNode *parentNode = g_queue_peek_head(&state->queue);
-    GFileEnumerator *fenum = G_FILE_ENUMERATOR(sourceobj);
-    GList *files, *nextfile;
-    GError *error = NULL;
-
-    GFileInfo **infos = NULL;
-    DtTreeSourceNode **childNodes = NULL;
-    gint numChildren = 0;
-    gint i;
+    ScanJob *job = g_malloc(sizeof(ScanJob));
+    job->task = task;
+    job->node = node;
+    job->snapshot_index = DT_SCAN_SNAPSHOT_NONE;
+    job->io_priority = g_task_get_priority(task);
+    job->urgent = FALSE;
+    g_queue_init(&job->batches);
+    job->native = FALSE;
+    job->recheck_names = FALSE;
+    job->request_time = 0;
+    job->finished = FALSE;
+    return job;
+}
 
-    files = g_file_enumerator_next_files_finish(fenum, res, &error);
-    if (files == NULL)
+static void scan_job_free(ScanJob *job)
+{
+    if (job != NULL)
     {
-        if (error != NULL)
+        if (job->native)
         {
-            // TODO: Should this be fatal? Should I just add a placeholder
-            // entry in the tree to indicate that there was an error?
-            //g_task_return_error(task, error);
-            g_critical("Failed to enumerate files in %s: %s\n",
-                    g_file_peek_path(g_file_enumerator_get_container(fenum)),
-                    error->message);
-            g_clear_error(&error);
+            g_queue_foreach(&job->batches, (GFunc) dt_fs_entry_batch_free, NULL);
         }
-
-        // Close the file enumerator. This shouldn't be cancellable: We might
-        // be getting here because the rest of the operation was cancelled, and
-        // we don't want to leak anything.
-        g_file_enumerator_close_async(fenum, g_task_get_priority(task),
-                NULL, file_enum_close_ready, NULL);
-
-        g_queue_pop_head(&state->queue);
-        start_next_scan(task);
-        return;
-    }
-
-    // Scan the list to count the number of files and to create a GFile for
-    // each GFileInfo.
-    for (nextfile = files; nextfile != NULL; nextfile = nextfile->next)
-    {
-        GFileInfo *info = G_FILE_INFO(nextfile->data);
-        GFile *gf = g_file_enumerator_get_child(fenum, info);
-        g_file_info_set_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH, G_OBJECT(gf));
-        g_object_unref(gf);
-
-        numChildren++;
-    }
-
-    // Copy the GFileInfo objects to an array
-    infos = g_malloc(numChildren * sizeof(GFileInfo *));
-    childNodes = g_malloc(numChildren * sizeof(DtTreeSourceNode *));
-    numChildren = 0;
-    for (nextfile = files; nextfile != NULL; nextfile = nextfile->next)
-    {
-        infos[numChildren++] = nextfile->data;
-    }
-
-    // Add the files to the tree, and add any new directories to the queue.
-    dt_tree_source_base_add_children(DT_TREE_SOURCE_BASE(self), parentNode,
-            numChildren, infos, childNodes);
-    for (i=0; i<numChildren; i++)
-    {
-        if (g_file_info_get_file_type(infos[i]) == G_FILE_TYPE_DIRECTORY)
+        else
         {
-            g_queue_push_tail(&state->queue, childNodes[i]);
+            g_queue_foreach(&job->batches, (GFunc) g_ptr_array_unref, NULL);
         }
+        g_queue_clear(&job->batches);
+        g_free(job);
     }
-    g_list_free_full(files, g_object_unref);
-    g_free(infos);
-    g_free(childNodes);
-
-    // Start the next batch
-    g_file_enumerator_next_files_async(fenum, QUERY_BATCH_SIZE,
-                g_task_get_priority(task), g_task_get_cancellable(task),
-                next_files_ready, task);
 }
 
-static void file_enum_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+/**
+ * Records an error from one of the scan jobs.
+ *
+ * Only the first error is kept. Once there's an error, we don't start any new
+ * directories, and the scan finishes as soon as the running jobs are done.
+ */
+static void scan_set_error(DtTreeSourceFSScanState *state, GError *error)
 {
-    GTask *task = G_TASK(userdata);
-    //DtTreeSourceFSScanState *state = g_task_get_task_data(task);
-    //DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
-    //DtTreeSourceNode *node = g_queue_peek_head(&state->queue);
-    GError *error = NULL;
-    GFileEnumerator *fenum;
-
-    g_debug("Starting file enumeration: %s\n", g_file_peek_path(G_FILE(sourceobj)));
-    fenum = g_file_enumerate_children_finish(G_FILE(sourceobj), res, &error);
-    if (fenum == NULL)
+    if (state->error == NULL)
     {
-        g_task_return_error(task, error);
-        g_object_unref(task);
-        return;
+        state->error = error;
+    }
+    else
+    {
+        g_error_free(error);
     }
-
-    g_file_enumerator_next_files_async(fenum, QUERY_BATCH_SIZE,
-                g_task_get_priority(task), g_task_get_cancellable(task),
-                next_files_ready, task);
 }
 
-static void start_next_scan(GTask *task)
+/**
+ * Records an error from opening a directory.
+ *
+ * If the directory was removed after we found it, then we just skip it. That
+ * can happen any time, but it's especially likely when we're scanning a new
+ * directory that the watch reported.
+ */
+static void scan_set_open_error(DtTreeSourceFSScanState *state, GError *error)
 {
-    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
-    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
-    DtTreeSourceNode *node = g_queue_peek_head(&state->queue);
-
-    if (node != NULL)
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
     {
-        GFileInfo *info = dt_tree_source_get_file_info(DT_TREE_SOURCE(self), node);
-        g_assert(info != NULL);
-        g_assert(g_file_info_get_attribute_type(info, DT_FILE_ATTRIBUTE_FS_PATH) == G_FILE_ATTRIBUTE_TYPE_OBJECT);
-        GFile *file = G_FILE(g_file_info_get_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH));
-        GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
-        if (!self->follow_symlinks)
-        {
-            flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
-        }
-
-        g_assert(file != NULL);
-        g_file_enumerate_children_async(file, FILE_QUERY_ATTRIBS, flags,
-                g_task_get_priority(task), g_task_get_cancellable(task),
-                file_enum_ready, task);
+        g_debug("Directory disappeared while scanning: %s", error->message);
+        g_error_free(error);
     }
     else
     {
-        // The queue is empty, so we're done.
-        g_task_return_boolean(task, TRUE);
-        g_object_unref(task);
+        scan_set_error(state, error);
     }
 }
 
-static void scan_root_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+/**
+ * Sends a scan-progress signal.
+ *
+ * Unless \p finished is TRUE, this does nothing if the last update was less
+ * than SCAN_PROGRESS_INTERVAL ago.
+ */
+static void report_scan_progress(GTask *task, gboolean finished)
 {
-    GTask *task = G_TASK(userdata);
     DtTreeSourceFSScanState *state = g_task_get_task_data(task);
-    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
-    GError *error = NULL;
-    GFileInfo *info;
-    DtTreeSourceNode *node;
+    gint64 now = g_get_monotonic_time();
 
-    info = g_file_query_info_finish(G_FILE(sourceobj), res, &error);
-    if (info == NULL)
+    if (!state->report_progress)
     {
-        g_task_return_error(task, error);
-        g_object_unref(task);
         return;
     }
-    if (g_file_info_get_file_type(info) != G_FILE_TYPE_DIRECTORY)
+    if (!finished && now - state->last_progress_time < SCAN_PROGRESS_INTERVAL)
     {
-        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
-                "%s is not a directory", g_file_peek_path(G_FILE(sourceobj)));
-        g_object_unref(task);
         return;
     }
 
-    g_file_info_set_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH, sourceobj);
-    g_file_info_set_name(info, "/");
-    g_file_info_set_display_name(info, "/");
+    state->last_progress_time = now;
+    state->stats.queue_depth = state->pending.length + state->urgent.length + state->running.length;
+    state->stats.elapsed = now - state->start_time;
+    state->stats.entries_per_second = 0.0;
+    if (state->stats.elapsed > 0)
+    {
+        state->stats.entries_per_second = (gdouble) state->stats.entries_found
+            * G_USEC_PER_SEC / state->stats.elapsed;
+    }
+    state->stats.finished = finished;
+    dt_tree_source_scan_progress(DT_TREE_SOURCE(g_task_get_source_object(task)), &state->stats);
+}
 
-    node = dt_tree_source_get_root(DT_TREE_SOURCE(self));
-    dt_tree_source_base_set_file_info(DT_TREE_SOURCE_BASE(self), node, info);
+/**
+ * Keeps track of the exclude rules that apply to the entries in a single
+ * directory.
+ */
+typedef struct
+{
+    /**
+     * The path of the current entry, relative to the base directory.
+     */
+    GString *path;
+
+    /**
+     * The length of the directory's part of \p path, including the trailing
+     * '/'.
+     */
+    gsize dir_len;
+
+    /**
+     * The rules from the .gitignore files in the directory and its parents,
+     * starting with the deepest one.
+     */
+    GPtrArray *rules;
+
+    /**
+     * For each element of \p rules, the offset into \p path where the path
+     * relative to that .gitignore file's directory starts.
+     */
+    GArray *offsets;
+} ExcludeContext;
 
-    g_queue_push_tail(&state->queue, node);
-    start_next_scan(task);
+/**
+ * Returns TRUE if there are any exclude rules that we need to check.
+ */
+static gboolean has_exclude_rules(DtTreeSourceFS *self)
+{
+    return (!dt_exclude_rules_is_empty(self->exclude_rules)
+            || g_hash_table_size(self->dir_rules) > 0);
 }
 
-static void start_scan_root(GTask *task)
+/**
+ * Returns a GFile for a node.
+ *
+ * The nodes don't keep a GFile around, since most of them are never opened,
+ * so this builds one from the base directory and the names along the path.
+ *
+ * \return A new GFile. Transfer full.
+ */
+static GFile *get_node_file(DtTreeSourceFS *self, DtTreeSourceNode *node)
 {
-    //DtTreeSourceFSScanState *state = g_task_get_task_data(task);
-    DtTreeSourceFS *self = g_task_get_source_object(task);
-    GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
-    if (!self->follow_symlinks)
+    DtTreeSourceNode **path;
+    GString *relpath;
+    GFile *file;
+    gint depth;
+    gint i;
+
+    path = dt_tree_source_get_node_path(DT_TREE_SOURCE(self), node, &depth);
+    if (depth <= 1)
     {
-        flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+        g_free(path);
+        return g_object_ref(self->base);
     }
 
-    g_file_query_info_async(self->base, FILE_QUERY_ATTRIBS,
-            flags, g_task_get_priority(task), g_task_get_cancellable(task),
-            scan_root_ready, task);
+    // Skip the root node, since its name is just "/".
+    relpath = g_string_new(NULL);
+    for (i=1; i<depth; i++)
+    {
+        if (i > 1)
+        {
+            g_string_append_c(relpath, '/');
+        }
+        g_string_append(relpath, dt_tree_source_get_name(DT_TREE_SOURCE(self), path[i]));
+    }
+    file = g_file_resolve_relative_path(self->base, relpath->str);
+    g_string_free(relpath, TRUE);
+    g_free(path);
+    return file;
 }
 
-static void cleanup_scan_task_data(gpointer ptr)
+static void dt_tree_source_fs_add_file_attributes(DtTreeSourceBase *base,
+        DtTreeSourceNode *node, GFileInfo *info)
 {
-    if (ptr != NULL)
-    {
-        DtTreeSourceFSScanState *state = ptr;
-        g_queue_clear(&state->queue);
-        g_free(state);
-    }
+    GFile *file = get_node_file(DT_TREE_SOURCE_FS(base), node);
+    g_file_info_set_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH, G_OBJECT(file));
+    g_object_unref(file);
 }
 
-void dt_tree_source_fs_scan_async(DtTreeSource *self, int io_priority,
-        GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata)
+static void exclude_context_init(DtTreeSourceFS *self, ExcludeContext *ctx, DtTreeSourceNode *dir)
 {
-    GTask *task = g_task_new(self, cancellable, callback, userdata);
-    DtTreeSourceFSScanState *state = g_malloc(sizeof(DtTreeSourceFSScanState));
-    g_queue_init(&state->queue);
+    DtTreeSourceNode **path;
+    gint depth;
+    gint i;
 
-    g_task_set_priority(task, io_priority);
-    g_task_set_task_data(task, state, cleanup_scan_task_data);
+    ctx->path = g_string_new(NULL);
+    ctx->rules = g_ptr_array_new();
+    ctx->offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
 
-    start_scan_root(task);
+    path = dt_tree_source_get_node_path(DT_TREE_SOURCE(self), dir, &depth);
+    for (i=0; i<depth; i++)
+    {
+        DtExcludeRules *rules;
+
+        // Skip the root node, since its name is just "/".
+        if (i > 0)
+        {
+            g_string_append(ctx->path, dt_tree_source_get_name(DT_TREE_SOURCE(self), path[i]));
+            g_string_append_c(ctx->path, '/');
+        }
+
+        rules = g_hash_table_lookup(self->dir_rules, path[i]);
+        if (rules != NULL)
+        {
+            gsize offset = ctx->path->len;
+            g_ptr_array_insert(ctx->rules, 0, rules);
+            g_array_prepend_val(ctx->offsets, offset);
+        }
+    }
+    ctx->dir_len = ctx->path->len;
+    g_free(path);
 }
 
-gboolean dt_tree_source_fs_scan_finish(DtTreeSource *self, GAsyncResult *result, GError **error)
+static void exclude_context_clear(ExcludeContext *ctx)
 {
-    GTask *task = G_TASK(result);
-    gboolean ret = g_task_propagate_boolean(task, error);
-    return ret;
+    g_string_free(ctx->path, TRUE);
+    g_ptr_array_unref(ctx->rules);
+    g_array_unref(ctx->offsets);
 }
 
-static GFile *lookup_file_for_open(DtTreeSource *self, DtTreeSourceNode *node, GError **error)
+/**
+ * Checks whether an entry in the directory should be left out of the tree.
+ *
+ * The exclude-rules property comes first, and then each .gitignore file
+ * starting with the deepest one, so that a deeper .gitignore can override a
+ * pattern from its parent directory, the same as in git. The first set of
+ * rules with a matching pattern decides.
+ */
+static gboolean exclude_context_check(DtTreeSourceFS *self, ExcludeContext *ctx,
+        const char *name, gboolean is_dir)
 {
-    GFileInfo *info = dt_tree_source_get_file_info(self, node);
-    GFile *gf;
+    DtExcludeMatch match = DT_EXCLUDE_MATCH_NONE;
+    guint i;
 
-    if (info == NULL)
+    g_string_truncate(ctx->path, ctx->dir_len);
+    g_string_append(ctx->path, name);
+
+    if (self->exclude_rules != NULL)
     {
-        g_critical("%s: No file info for row\n", G_STRLOC);
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "No file info for row.");
-        return NULL;
+        match = dt_exclude_rules_match(self->exclude_rules, ctx->path->str, name, is_dir);
     }
-    if (g_file_info_get_file_type(info) != G_FILE_TYPE_REGULAR)
+    for (i=0; i<ctx->rules->len && match == DT_EXCLUDE_MATCH_NONE; i++)
     {
-        g_critical("%s: No file info for row\n", G_STRLOC);
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
-                "%s is not a regular file.", g_file_info_get_name(info));
-        return NULL;
+        match = dt_exclude_rules_match(ctx->rules->pdata[i],
+                ctx->path->str + g_array_index(ctx->offsets, gsize, i), name, is_dir);
     }
-    gf = G_FILE(g_file_info_get_attribute_object(info, DT_FILE_ATTRIBUTE_FS_PATH));
-    g_assert(gf != NULL);
-
-    return gf;
+    return (match == DT_EXCLUDE_MATCH_EXCLUDED);
 }
 
-static void dt_tree_source_fs_open_file_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+/**
+ * Checks a single file in a directory against the exclude rules.
+ */
+static gboolean is_excluded(DtTreeSourceFS *self, DtTreeSourceNode *dir, GFileInfo *info)
 {
-    GTask *task = G_TASK(userdata);
-    GFileInputStream *stream;
-    GError *error = NULL;
+    ExcludeContext ctx;
+    gboolean ret;
 
-    stream = g_file_read_finish(G_FILE(sourceobj), res, &error);
-    if (stream != NULL)
+    if (!has_exclude_rules(self))
     {
-        g_task_return_pointer(task, stream, g_object_unref);
+        return FALSE;
     }
-    else
+    exclude_context_init(self, &ctx, dir);
+    ret = exclude_context_check(self, &ctx, g_file_info_get_name(info),
+            g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY);
+    exclude_context_clear(&ctx);
+    return ret;
+}
+
+/**
+ * Copies the files that aren't excluded from a list.
+ *
+ * \param[out] kept Returns the files that are left. This must have room for
+ *      \p count elements.
+ * \return The number of files in \p kept.
+ */
+static guint filter_excluded(DtTreeSourceFS *self, DtTreeSourceNode *dir,
+        GFileInfo **infos, guint count, GFileInfo **kept)
+{
+    ExcludeContext ctx;
+    guint num_kept = 0;
+    guint i;
+
+    exclude_context_init(self, &ctx, dir);
+    for (i=0; i<count; i++)
     {
-        g_task_return_error(task, error);
+        if (!exclude_context_check(self, &ctx, g_file_info_get_name(infos[i]),
+                    g_file_info_get_file_type(infos[i]) == G_FILE_TYPE_DIRECTORY))
+        {
+            kept[num_kept++] = infos[i];
+        }
     }
-
-    // Unreference the task now. The g_task_return_* call above will add a
-    // reference until the task's callbck function finishes.
-    g_object_unref(task);
+    exclude_context_clear(&ctx);
+    return num_kept;
 }
 
-static void dt_tree_source_fs_open_file_async(DtTreeSource *self, DtTreeSourceNode *node,
-        int io_priority, GCancellable *cancellable,
-        GAsyncReadyCallback callback, gpointer userdata)
+/**
+ * Adds a directory to the pending queue.
+ *
+ * \param head If TRUE, then add it to the front of the queue instead of the
+ *      end.
+ */
+static void push_pending(DtTreeSourceFSScanState *state, DtTreeSourceNode *node, gboolean head)
 {
-    GError *error = NULL;
-    GFile *gf = lookup_file_for_open(self, node, &error);
-    if (gf != NULL)
+    if (head)
     {
-        // Wrap this in a GTask so that the source object to (callback) can
-        // point to the DtTreeSourceFS instead of the GFile.
-        GTask *task = g_task_new(self, cancellable, callback, userdata);
-        g_file_read_async(gf, io_priority, cancellable, dt_tree_source_fs_open_file_ready, task);
+        g_queue_push_head(&state->pending, node);
+        g_hash_table_insert(state->pending_links, node, state->pending.head);
     }
     else
     {
-        g_task_report_error(self, callback, userdata, NULL, error);
+        g_queue_push_tail(&state->pending, node);
+        g_hash_table_insert(state->pending_links, node, state->pending.tail);
     }
 }
 
-static GInputStream *dt_tree_source_fs_open_file_finish(DtTreeSource *self, GAsyncResult *res, GError **error)
+/**
+ * Removes and returns the directory at the front of the pending or urgent
+ * queue.
+ */
+static DtTreeSourceNode *pop_queued(GQueue *queue, GHashTable *links)
 {
-    GTask *task = G_TASK(res);
-    GFileInputStream *stream = g_task_propagate_pointer(task, error);
-    if (stream != NULL)
-    {
-        return G_INPUT_STREAM(stream);
-    }
-    else
+    DtTreeSourceNode *node = g_queue_pop_head(queue);
+    g_hash_table_remove(links, node);
+    return node;
+}
+
+/**
+ * Collects a new subdirectory for push_new_dirs.
+ *
+ * If the parent directory is in the snapshot, then this also looks up the
+ * new directory in the snapshot, so that we can check whether it changed
+ * instead of reading it again.
+ */
+static void add_new_dir(DtTreeSourceFSScanState *state, ScanJob *job,
+        DtTreeSourceNode *node, const char *name, GQueue *new_dirs)
+{
+    g_queue_push_tail(new_dirs, node);
+
+    if (job->snapshot_index != DT_SCAN_SNAPSHOT_NONE)
     {
-        return NULL;
+        guint32 index = dt_scan_snapshot_find_child(state->snapshot,
+                job->snapshot_index, name);
+        if (index != DT_SCAN_SNAPSHOT_NONE)
+        {
+            g_hash_table_insert(state->snapshot_dirs, node,
+                    GUINT_TO_POINTER(index + 1));
+        }
     }
 }
 
-static GInputStream *dt_tree_source_fs_open_file(DtTreeSource *self, DtTreeSourceNode *node,
-        GCancellable *cancellable, GError **error)
+/**
+ * Adds the new subdirectories from a batch to the pending queue.
+ *
+ * The subdirectories of an urgent job go to the front of the pending queue,
+ * since they're probably what the user is going to look at next.
+ */
+static void push_new_dirs(DtTreeSourceFSScanState *state, ScanJob *job, GQueue *new_dirs)
 {
-    GFile *gf = lookup_file_for_open(self, node, error);
-    if (gf != NULL)
+    while (!g_queue_is_empty(new_dirs))
     {
-        return G_INPUT_STREAM(g_file_read(gf, cancellable, error));
+        if (job->urgent)
+        {
+            push_pending(state, g_queue_pop_tail(new_dirs), TRUE);
+        }
+        else
+        {
+            push_pending(state, g_queue_pop_head(new_dirs), FALSE);
+        }
+    }
+}
+
+/**
+ * Adds a batch of files to the tree, and adds any new directories to the
+ * pending queue.
+ *
+ * Any files that match the exclude rules are dropped here, so an excluded
+ * directory never makes it into the pending queue.
+ */
+static void commit_batch(GTask *task, ScanJob *job, GPtrArray *batch)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    GFileInfo **infos = (GFileInfo **) batch->pdata;
+    GFileInfo **kept = NULL;
+    guint count = batch->len;
+    DtTreeSourceNode **childNodes;
+    GQueue new_dirs = G_QUEUE_INIT;
+    gint i;
+
+    if (has_exclude_rules(self))
+    {
+        kept = g_malloc(batch->len * sizeof(GFileInfo *));
+        count = filter_excluded(self, job->node, infos, batch->len, kept);
+        infos = kept;
+        if (count == 0)
+        {
+            g_free(kept);
+            return;
+        }
+    }
+
+    childNodes = g_malloc(count * sizeof(DtTreeSourceNode *));
+    dt_tree_source_base_add_children(DT_TREE_SOURCE_BASE(self), job->node,
+            count, infos, childNodes);
+    state->stats.entries_found += count;
+    for (i=0; i<count; i++)
+    {
+        const char *target = g_file_info_get_symlink_target(infos[i]);
+
+        state->stats.metadata_bytes += strlen(g_file_info_get_name(infos[i])) + sizeof(struct stat);
+        if (target != NULL)
+        {
+            state->stats.metadata_bytes += strlen(target);
+        }
+
+        if (g_file_info_get_file_type(infos[i]) == G_FILE_TYPE_DIRECTORY)
+        {
+            add_new_dir(state, job, childNodes[i], g_file_info_get_name(infos[i]), &new_dirs);
+        }
+    }
+    g_free(childNodes);
+    g_free(kept);
+
+    push_new_dirs(state, job, &new_dirs);
+}
+
+/**
+ * Fills in a DtFileMetadata from the native scanner.
+ *
+ * This sets the same fields as dt_file_metadata_from_file_info would for a
+ * GFileInfo from GIO.
+ */
+static void metadata_from_fs_entry(DtFileMetadata *meta, const DtFsEntry *entry)
+{
+    memset(meta, 0, sizeof(DtFileMetadata));
+    meta->type = entry->type;
+    meta->size = entry->size;
+    meta->mtime_sec = entry->mtime_sec;
+    meta->mtime_usec = entry->mtime_nsec / 1000;
+    meta->ctime_sec = entry->ctime_sec;
+    meta->ctime_usec = entry->ctime_nsec / 1000;
+    meta->mode = entry->mode;
+    meta->device = (guint32) entry->dev;
+    meta->inode = entry->ino;
+    meta->flags = DT_FILE_METADATA_HAS_SIZE | DT_FILE_METADATA_HAS_MTIME
+        | DT_FILE_METADATA_HAS_CTIME | DT_FILE_METADATA_HAS_MODE | DT_FILE_METADATA_HAS_INODE;
+}
+
+/**
+ * Adds a batch from the native scanner to the tree, and adds any new
+ * directories to the pending queue.
+ *
+ * This is the same as commit_batch, but it fills in the nodes directly from
+ * the DtFsEntry records, without creating a GFileInfo for each one.
+ */
+static void commit_native_batch(GTask *task, ScanJob *job, DtFsEntryBatch *batch)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    guint len = batch->entries->len;
+    const char **names = g_malloc(len * sizeof(const char *));
+    const char **targets = g_malloc(len * sizeof(const char *));
+    DtFileMetadata *metas = g_malloc(len * sizeof(DtFileMetadata));
+    DtTreeSourceNode **childNodes;
+    gboolean exclude = has_exclude_rules(self);
+    GQueue new_dirs = G_QUEUE_INIT;
+    ExcludeContext ctx;
+    guint count = 0;
+    guint i;
+
+    if (exclude)
+    {
+        exclude_context_init(self, &ctx, job->node);
+    }
+    for (i=0; i<len; i++)
+    {
+        const DtFsEntry *entry = dt_fs_entry_batch_get_entry(batch, i);
+        const char *name = dt_fs_entry_batch_get_string(batch, entry->name_offset);
+
+        if (exclude && exclude_context_check(self, &ctx, name, entry->type == G_FILE_TYPE_DIRECTORY))
+        {
+            continue;
+        }
+        if (job->recheck_names && dt_tree_source_get_child_by_name(DT_TREE_SOURCE(self), job->node, name) != NULL)
+        {
+            continue;
+        }
+
+        names[count] = name;
+        targets[count] = dt_fs_entry_batch_get_string(batch, entry->symlink_offset);
+        metadata_from_fs_entry(&metas[count], entry);
+        count++;
+    }
+    if (exclude)
+    {
+        exclude_context_clear(&ctx);
+    }
+
+    if (count > 0)
+    {
+        childNodes = g_malloc(count * sizeof(DtTreeSourceNode *));
+        dt_tree_source_base_add_children_metadata(DT_TREE_SOURCE_BASE(self), job->node,
+                count, names, metas, targets, childNodes);
+        state->stats.entries_found += count;
+        for (i=0; i<count; i++)
+        {
+            state->stats.metadata_bytes += strlen(names[i]) + sizeof(struct stat);
+            if (targets[i] != NULL)
+            {
+                state->stats.metadata_bytes += strlen(targets[i]);
+            }
+
+            if (metas[i].type == G_FILE_TYPE_DIRECTORY)
+            {
+                add_new_dir(state, job, childNodes[i], names[i], &new_dirs);
+            }
+        }
+        g_free(childNodes);
+    }
+    g_free(names);
+    g_free(targets);
+    g_free(metas);
+
+    push_new_dirs(state, job, &new_dirs);
+}
+
+/**
+ * Adds all of the batches that a job has read so far to the tree.
+ */
+static void commit_job_batches(GTask *task, ScanJob *job)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+
+    while (!g_queue_is_empty(&job->batches))
+    {
+        if (job->native)
+        {
+            DtFsEntryBatch *batch = g_queue_pop_head(&job->batches);
+            if (state->error == NULL)
+            {
+                commit_native_batch(task, job, batch);
+            }
+            dt_fs_entry_batch_free(batch);
+        }
+        else
+        {
+            GPtrArray *batch = g_queue_pop_head(&job->batches);
+            if (state->error == NULL)
+            {
+                commit_batch(task, job, batch);
+            }
+            g_ptr_array_unref(batch);
+        }
+    }
+}
+
+/**
+ * Cleans up a job after it's been removed from the running queue.
+ */
+static void finish_job(GTask *task, ScanJob *job)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+
+    if (job->urgent)
+    {
+        g_assert(state->num_urgent_running > 0);
+        state->num_urgent_running--;
+    }
+    scan_job_free(job);
+    state->stats.dirs_visited++;
+}
+
+/**
+ * Adds any batches that are ready to the tree.
+ *
+ * The jobs are committed in the same order that they were started, so the
+ * order of the nodes-added signals is the same no matter how many directories
+ * we enumerate at once, and no matter which one finishes first. The job at
+ * the head of the queue gets each batch added as soon as it arrives.
+ *
+ * The exception is urgent jobs, which get added as soon as they're ready,
+ * since someone is waiting on them.
+ */
+static void commit_finished_jobs(GTask *task)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    GList *link, *next;
+
+    for (link = state->running.head; link != NULL && state->num_urgent_running > 0; link = next)
+    {
+        ScanJob *job = link->data;
+        next = link->next;
+        if (job->urgent)
+        {
+            commit_job_batches(task, job);
+            if (job->finished)
+            {
+                g_queue_delete_link(&state->running, link);
+                finish_job(task, job);
+            }
+        }
+    }
+
+    while (!g_queue_is_empty(&state->running))
+    {
+        ScanJob *job = g_queue_peek_head(&state->running);
+
+        commit_job_batches(task, job);
+        if (!job->finished)
+        {
+            break;
+        }
+        g_queue_pop_head(&state->running);
+        finish_job(task, job);
+    }
+
+    report_scan_progress(task, FALSE);
+}
+
+/**
+ * Adjusts the batch size based on how long the last request took.
+ */
+static void update_batch_size(DtTreeSourceFSScanState *state, ScanJob *job, gint numread)
+{
+    gint64 latency = g_get_monotonic_time() - job->request_time;
+
+    if (latency < TARGET_BATCH_LATENCY && numread >= state->batch_size)
+    {
+        state->batch_size = MIN(state->batch_size * 2, MAX_QUERY_BATCH_SIZE);
+    }
+    else if (latency > TARGET_BATCH_LATENCY * 4)
+    {
+        state->batch_size = MAX(state->batch_size / 2, MIN_QUERY_BATCH_SIZE);
+    }
+}
+
+static void request_next_files(GTask *task, ScanJob *job, GFileEnumerator *fenum);
+
+static void next_files_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    ScanJob *job = userdata;
+    GTask *task = job->task;
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    GFileEnumerator *fenum = G_FILE_ENUMERATOR(sourceobj);
+    GList *files, *nextfile;
+    GPtrArray *batch;
+    GError *error = NULL;
+
+    files = g_file_enumerator_next_files_finish(fenum, res, &error);
+    if (files == NULL)
+    {
+        if (error != NULL)
+        {
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            {
+                scan_set_error(state, error);
+            }
+            else
+            {
+                // TODO: Should this be fatal? Should I just add a placeholder
+                // entry in the tree to indicate that there was an error?
+                g_critical("Failed to enumerate files in %s: %s\n",
+                        g_file_peek_path(g_file_enumerator_get_container(fenum)),
+                        error->message);
+                g_clear_error(&error);
+            }
+        }
+
+        // Close the file enumerator. This shouldn't be cancellable: We might
+        // be getting here because the rest of the operation was cancelled, and
+        // we don't want to leak anything.
+        g_file_enumerator_close_async(fenum, job->io_priority,
+                NULL, file_enum_close_ready, NULL);
+
+        job->finished = TRUE;
+        commit_finished_jobs(task);
+        start_next_scans(task);
+        return;
+    }
+
+    // Collect the GFileInfo objects into a batch.
+    batch = g_ptr_array_new_with_free_func(g_object_unref);
+    for (nextfile = files; nextfile != NULL; nextfile = nextfile->next)
+    {
+        g_ptr_array_add(batch, nextfile->data);
+    }
+    g_list_free(files);
+    update_batch_size(state, job, batch->len);
+
+    g_queue_push_tail(&job->batches, batch);
+    commit_finished_jobs(task);
+
+    // Start the next batch, and start on any new directories that we found.
+    request_next_files(task, job, fenum);
+    start_next_scans(task);
+}
+
+static void request_next_files(GTask *task, ScanJob *job, GFileEnumerator *fenum)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+
+    job->request_time = g_get_monotonic_time();
+    g_file_enumerator_next_files_async(fenum, state->batch_size,
+                job->io_priority, g_task_get_cancellable(task),
+                next_files_ready, job);
+}
+
+static void file_enum_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    ScanJob *job = userdata;
+    GTask *task = job->task;
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    GError *error = NULL;
+    GFileEnumerator *fenum;
+
+    g_debug("Starting file enumeration: %s\n", g_file_peek_path(G_FILE(sourceobj)));
+    fenum = g_file_enumerate_children_finish(G_FILE(sourceobj), res, &error);
+    if (fenum == NULL)
+    {
+        scan_set_open_error(state, error);
+        job->finished = TRUE;
+        commit_finished_jobs(task);
+        start_next_scans(task);
+        return;
+    }
+
+    request_next_files(task, job, fenum);
+}
+
+/**
+ * The parameters for reading a directory on a worker thread, and the batches
+ * that it's sending back.
+ */
+typedef struct
+{
+    char *path;
+    gboolean follow_symlinks;
+    DtTreeSourceFSScanBackend backend;
+
+    /**
+     * The job that we're reading for. This is only used on the main thread,
+     * and it's set to NULL once the read is finished.
+     */
+    ScanJob *job;
+
+    /**
+     * The number of batches that the worker thread has sent so far. This is
+     * only used on the worker thread.
+     */
+    guint num_sent;
+
+    /// Protects the fields below.
+    GMutex lock;
+
+    /**
+     * DtFsEntryBatch structs that the worker thread has finished, but that
+     * haven't been added to the job yet.
+     */
+    GQueue ready;
+
+    /// TRUE if there's an idle callback scheduled to take the ready batches.
+    gboolean idle_pending;
+
+    /// Set if the worker thread had to start over after sending some batches.
+    gboolean recheck_names;
+} NativeReadDirData;
+
+static void native_read_dir_data_free(gpointer ptr)
+{
+    NativeReadDirData *data = ptr;
+    g_queue_foreach(&data->ready, (GFunc) dt_fs_entry_batch_free, NULL);
+    g_queue_clear(&data->ready);
+    g_mutex_clear(&data->lock);
+    g_free(data->path);
+    g_free(data);
+}
+
+/**
+ * Moves the batches that the worker thread has finished so far into the job.
+ * This is called on the main thread.
+ */
+static void native_read_dir_take_batches(NativeReadDirData *data)
+{
+    ScanJob *job = data->job;
+
+    g_mutex_lock(&data->lock);
+    while (!g_queue_is_empty(&data->ready))
+    {
+        g_queue_push_tail(&job->batches, g_queue_pop_head(&data->ready));
+    }
+    if (data->recheck_names)
+    {
+        job->recheck_names = TRUE;
+    }
+    data->idle_pending = FALSE;
+    g_mutex_unlock(&data->lock);
+}
+
+static gboolean native_read_dir_batch_idle(gpointer userdata)
+{
+    GTask *subtask = G_TASK(userdata);
+    NativeReadDirData *data = g_task_get_task_data(subtask);
+
+    // If the read already finished, then native_read_dir_ready took
+    // everything.
+    if (data->job != NULL)
+    {
+        GTask *task = data->job->task;
+
+        native_read_dir_take_batches(data);
+        commit_finished_jobs(task);
+        start_next_scans(task);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Sends a batch from the worker thread back to the main thread, so that it
+ * can go into the tree while we read the rest of the directory.
+ */
+static void native_read_dir_send_batch(DtFsEntryBatch *batch, gpointer userdata)
+{
+    GTask *subtask = G_TASK(userdata);
+    NativeReadDirData *data = g_task_get_task_data(subtask);
+    gboolean schedule;
+
+    data->num_sent++;
+    if (batch->entries->len == 0)
+    {
+        dt_fs_entry_batch_free(batch);
+        return;
+    }
+
+    g_mutex_lock(&data->lock);
+    g_queue_push_tail(&data->ready, batch);
+    schedule = !data->idle_pending;
+    data->idle_pending = TRUE;
+    g_mutex_unlock(&data->lock);
+
+    if (schedule)
+    {
+        GSource *source = g_idle_source_new();
+        g_source_set_priority(source, g_task_get_priority(subtask));
+        g_source_set_callback(source, native_read_dir_batch_idle,
+                g_object_ref(subtask), g_object_unref);
+        g_source_attach(source, g_task_get_context(subtask));
+        g_source_unref(source);
+    }
+}
+
+static void native_read_dir_thread(GTask *subtask, gpointer sourceobj,
+        gpointer taskdata, GCancellable *cancellable)
+{
+    NativeReadDirData *data = taskdata;
+    GError *error = NULL;
+    gboolean ok = FALSE;
+
+    if (data->backend == DT_TREE_SOURCE_FS_SCAN_IO_URING)
+    {
+        ok = dt_fs_scan_uring_read_dir(data->path, data->follow_symlinks,
+                NATIVE_BATCH_SIZE, native_read_dir_send_batch, subtask,
+                cancellable, &error);
+        if (!ok && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        {
+            // No io_uring on this kernel, so fall back to plain syscalls.
+            g_clear_error(&error);
+            if (data->num_sent > 0)
+            {
+                // We've already sent part of the directory, so the main
+                // thread has to skip those entries when we read it again.
+                g_mutex_lock(&data->lock);
+                data->recheck_names = TRUE;
+                g_mutex_unlock(&data->lock);
+            }
+        }
+    }
+    if (!ok && error == NULL)
+    {
+        ok = dt_fs_scan_native_read_dir(data->path, data->follow_symlinks,
+                NATIVE_BATCH_SIZE, native_read_dir_send_batch, subtask,
+                cancellable, &error);
+    }
+
+    if (ok)
+    {
+        g_task_return_boolean(subtask, TRUE);
+    }
+    else
+    {
+        g_task_return_error(subtask, error);
+    }
+}
+
+static void native_read_dir_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    ScanJob *job = userdata;
+    GTask *task = job->task;
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    NativeReadDirData *data = g_task_get_task_data(G_TASK(res));
+    GError *error = NULL;
+
+    // Take any batches that the idle callback hasn't gotten to yet.
+    native_read_dir_take_batches(data);
+    data->job = NULL;
+
+    if (!g_task_propagate_boolean(G_TASK(res), &error))
+    {
+        scan_set_open_error(state, error);
+    }
+
+    job->finished = TRUE;
+    commit_finished_jobs(task);
+    start_next_scans(task);
+}
+
+/**
+ * Reads a directory using getdents64 and statx on a worker thread, either
+ * with plain syscalls or through io_uring.
+ *
+ * The worker thread only fills in a few fixed-size records per entry, and
+ * sends each batch back to the main thread as soon as it's full. The records
+ * are copied straight into the tree, without creating a GFileInfo for each
+ * entry.
+ */
+static void start_native_scan_job(GTask *task, ScanJob *job, GFile *file)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    NativeReadDirData *data = g_malloc(sizeof(NativeReadDirData));
+    GTask *subtask;
+
+    data->path = g_file_get_path(file);
+    data->follow_symlinks = self->follow_symlinks;
+    data->backend = self->scan_backend;
+    data->job = job;
+    data->num_sent = 0;
+    g_mutex_init(&data->lock);
+    g_queue_init(&data->ready);
+    data->idle_pending = FALSE;
+    data->recheck_names = FALSE;
+
+    job->native = TRUE;
+
+    subtask = g_task_new(self, g_task_get_cancellable(task), native_read_dir_ready, job);
+    g_task_set_priority(subtask, job->io_priority);
+    g_task_set_task_data(subtask, data, native_read_dir_data_free);
+    g_task_run_in_thread(subtask, native_read_dir_thread);
+    g_object_unref(subtask);
+}
+
+/**
+ * Returns TRUE if we should use the native scanner for a directory.
+ */
+static gboolean use_native_scan(DtTreeSourceFS *self, GFile *file)
+{
+    return (self->scan_backend != DT_TREE_SOURCE_FS_SCAN_GIO
+            && dt_fs_scan_native_is_supported()
+            && g_file_is_native(file));
+}
+
+/**
+ * Starts reading the contents of a directory.
+ */
+static void start_read_dir(GTask *task, ScanJob *job, GFile *file)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
+
+    if (use_native_scan(self, file))
+    {
+        start_native_scan_job(task, job, file);
+        return;
+    }
+
+    if (!self->follow_symlinks)
+    {
+        flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+    }
+
+    g_file_enumerate_children_async(file, FILE_QUERY_ATTRIBS, flags,
+            job->io_priority, g_task_get_cancellable(task),
+            file_enum_ready, job);
+}
+
+/**
+ * Adds the children of a directory from the snapshot, in the same sized
+ * batches that the native scanner uses.
+ */
+static void restore_from_snapshot(GTask *task, ScanJob *job)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    const DtScanSnapshotNode *rec = dt_scan_snapshot_get_node(state->snapshot, job->snapshot_index);
+    GPtrArray *batch = NULL;
+    guint32 i;
+
+    for (i=0; i<rec->num_children; i++)
+    {
+        GFileInfo *info = dt_scan_snapshot_create_file_info(state->snapshot, rec->first_child + i);
+
+        if (batch == NULL)
+        {
+            batch = g_ptr_array_new_full(MIN(rec->num_children - i, NATIVE_BATCH_SIZE), g_object_unref);
+        }
+        g_ptr_array_add(batch, info);
+        if (batch->len >= NATIVE_BATCH_SIZE)
+        {
+            g_queue_push_tail(&job->batches, batch);
+            batch = NULL;
+        }
+    }
+    if (batch != NULL)
+    {
+        g_queue_push_tail(&job->batches, batch);
+    }
+}
+
+static void snapshot_check_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    ScanJob *job = userdata;
+    GTask *task = job->task;
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    GFile *file = G_FILE(sourceobj);
+    GError *error = NULL;
+    GFileInfo *info;
+
+    info = g_file_query_info_finish(file, res, &error);
+    if (info == NULL)
+    {
+        scan_set_open_error(state, error);
+    }
+    else if (dt_scan_snapshot_node_is_current(dt_scan_snapshot_get_node(state->snapshot,
+                    job->snapshot_index), info))
+    {
+        restore_from_snapshot(task, job);
+    }
+    else
+    {
+        // The directory changed, so read it again. We'll still check each
+        // subdirectory against the snapshot.
+        g_object_unref(info);
+        start_read_dir(task, job, file);
+        return;
+    }
+    g_clear_object(&info);
+
+    job->finished = TRUE;
+    commit_finished_jobs(task);
+    start_next_scans(task);
+}
+
+/**
+ * Checks whether a directory changed since the snapshot was taken.
+ *
+ * If a directory has the same modification time as it did in the snapshot,
+ * then nothing was added, removed, or renamed in it, so we can use the
+ * snapshot's list of children instead of reading the directory.
+ */
+static void start_snapshot_check(GTask *task, ScanJob *job, GFile *file)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
+
+    if (!self->follow_symlinks)
+    {
+        flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+    }
+
+    g_file_query_info_async(file,
+            G_FILE_ATTRIBUTE_STANDARD_TYPE
+            "," G_FILE_ATTRIBUTE_TIME_MODIFIED
+            "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+            flags, job->io_priority, g_task_get_cancellable(task),
+            snapshot_check_ready, job);
+}
+
+/**
+ * Reads a directory, or checks it against the snapshot if it's in there.
+ */
+static void continue_scan_job(GTask *task, ScanJob *job, GFile *file)
+{
+    if (job->snapshot_index != DT_SCAN_SNAPSHOT_NONE)
+    {
+        start_snapshot_check(task, job, file);
+    }
+    else
+    {
+        start_read_dir(task, job, file);
+    }
+}
+
+static void gitignore_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    ScanJob *job = userdata;
+    GTask *task = job->task;
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    GFile *dir = g_file_get_parent(G_FILE(sourceobj));
+    GError *error = NULL;
+    char *contents = NULL;
+    gsize length = 0;
+
+    if (g_file_load_contents_finish(G_FILE(sourceobj), res, &contents, &length, NULL, &error))
+    {
+        DtExcludeRules *rules = dt_exclude_rules_new();
+        dt_exclude_rules_add_from_data(rules, contents, length);
+        if (!dt_exclude_rules_is_empty(rules))
+        {
+            g_hash_table_replace(self->dir_rules, job->node, dt_exclude_rules_ref(rules));
+        }
+        else
+        {
+            g_hash_table_remove(self->dir_rules, job->node);
+        }
+        dt_exclude_rules_unref(rules);
+        g_free(contents);
+    }
+    else
+    {
+        // A missing .gitignore file just means there aren't any rules. If
+        // the directory itself can't be read, then we'll find out when we
+        // try to read it.
+        g_hash_table_remove(self->dir_rules, job->node);
+        g_clear_error(&error);
+    }
+
+    continue_scan_job(task, job, dir);
+    g_object_unref(dir);
+}
+
+/**
+ * Loads the .gitignore file in a directory, before we read the directory.
+ *
+ * The rules have to be loaded first, since they apply to the directory's own
+ * entries.
+ */
+static void start_load_gitignore(GTask *task, ScanJob *job, GFile *file)
+{
+    GFile *gitignore = g_file_get_child(file, ".gitignore");
+    g_file_load_contents_async(gitignore, g_task_get_cancellable(task),
+            gitignore_ready, job);
+    g_object_unref(gitignore);
+}
+
+static void start_scan_job(GTask *task, DtTreeSourceNode *node, gboolean urgent)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    ScanJob *job;
+    GFile *file;
+    gpointer index;
+
+    file = get_node_file(self, node);
+
+    job = scan_job_new(task, node);
+    g_queue_push_tail(&state->running, job);
+    if (urgent)
+    {
+        job->urgent = TRUE;
+        state->num_urgent_running++;
+    }
+    else if (self->lazy)
+    {
+        job->io_priority = MAX(job->io_priority, G_PRIORITY_LOW);
+    }
+
+    // Start watching before we read the directory, so that we don't miss
+    // anything that changes in between.
+    if (self->watch)
+    {
+        watch_directory(self, node, file);
+    }
+
+    if (state->snapshot_dirs != NULL
+            && g_hash_table_lookup_extended(state->snapshot_dirs, node, NULL, &index))
+    {
+        g_hash_table_remove(state->snapshot_dirs, node);
+        job->snapshot_index = GPOINTER_TO_UINT(index) - 1;
+    }
+
+    if (self->use_gitignore)
+    {
+        start_load_gitignore(task, job, file);
+    }
+    else
+    {
+        continue_scan_job(task, job, file);
+    }
+    g_object_unref(file);
+}
+
+/**
+ * Finishes a scan task, either with an error or successfully.
+ */
+static void scan_task_return(GTask *task, GError *error)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+
+    self->scan_tasks = g_list_remove(self->scan_tasks, task);
+    report_scan_progress(task, TRUE);
+    if (error == NULL && state->save_snapshot)
+    {
+        save_snapshot(self);
+    }
+    if (error != NULL)
+    {
+        g_task_return_error(task, error);
+    }
+    else
+    {
+        g_task_return_boolean(task, TRUE);
+    }
+    g_object_unref(task);
+}
+
+/**
+ * Starts enumerating directories from the pending queue, until we hit the
+ * limit on how many we can run at once.
+ *
+ * If there's nothing left to do, then this finishes the task.
+ */
+static void start_next_scans(GTask *task)
+{
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    guint background_jobs = (self->lazy ? MIN(LAZY_BACKGROUND_JOBS, self->max_scan_jobs) : self->max_scan_jobs);
+
+    while (state->error == NULL
+            && !g_queue_is_empty(&state->urgent)
+            && state->running.length < self->max_scan_jobs)
+    {
+        start_scan_job(task, pop_queued(&state->urgent, state->urgent_links), TRUE);
+    }
+
+    while (state->error == NULL
+            && !g_queue_is_empty(&state->pending)
+            && state->running.length - state->num_urgent_running < background_jobs
+            && state->running.length < self->max_scan_jobs)
+    {
+        start_scan_job(task, pop_queued(&state->pending, state->pending_links), FALSE);
+    }
+
+    if (g_queue_is_empty(&state->running)
+            && (state->error != NULL
+                || (g_queue_is_empty(&state->pending) && g_queue_is_empty(&state->urgent))))
+    {
+        // Everything is finished.
+        GError *error = state->error;
+        state->error = NULL;
+        scan_task_return(task, error);
+    }
+}
+
+static void scan_root_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GTask *task = G_TASK(userdata);
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(g_task_get_source_object(task));
+    GError *error = NULL;
+    GFileInfo *info;
+    DtTreeSourceNode *node;
+
+    info = g_file_query_info_finish(G_FILE(sourceobj), res, &error);
+    if (info == NULL)
+    {
+        scan_task_return(task, error);
+        return;
+    }
+    if (g_file_info_get_file_type(info) != G_FILE_TYPE_DIRECTORY)
+    {
+        scan_task_return(task, g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                "%s is not a directory", g_file_peek_path(G_FILE(sourceobj))));
+        return;
+    }
+
+    g_file_info_set_name(info, "/");
+    g_file_info_set_display_name(info, "/");
+
+    node = dt_tree_source_get_root(DT_TREE_SOURCE(self));
+    dt_tree_source_base_set_file_info(DT_TREE_SOURCE_BASE(self), node, info);
+
+    if (state->snapshot != NULL)
+    {
+        g_hash_table_insert(state->snapshot_dirs, node, GUINT_TO_POINTER(1));
+    }
+    push_pending(state, node, FALSE);
+    start_next_scans(task);
+}
+
+static void start_scan_root(GTask *task)
+{
+    //DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+    DtTreeSourceFS *self = g_task_get_source_object(task);
+    GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
+    if (!self->follow_symlinks)
+    {
+        flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+    }
+
+    g_file_query_info_async(self->base, FILE_QUERY_ATTRIBS,
+            flags, g_task_get_priority(task), g_task_get_cancellable(task),
+            scan_root_ready, task);
+}
+
+static void cleanup_scan_task_data(gpointer ptr)
+{
+    if (ptr != NULL)
+    {
+        DtTreeSourceFSScanState *state = ptr;
+        g_queue_clear(&state->pending);
+        g_queue_clear(&state->urgent);
+        g_hash_table_destroy(state->pending_links);
+        g_hash_table_destroy(state->urgent_links);
+        g_assert(g_queue_is_empty(&state->running));
+        if (state->error != NULL)
+        {
+            g_error_free(state->error);
+        }
+        if (state->snapshot_dirs != NULL)
+        {
+            g_hash_table_destroy(state->snapshot_dirs);
+        }
+        dt_scan_snapshot_free(state->snapshot);
+        g_free(state);
+    }
+}
+
+/**
+ * Creates a GTask to scan some part of the tree.
+ */
+static GTask *scan_task_new(DtTreeSourceFS *self, int io_priority,
+        GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata)
+{
+    GTask *task = g_task_new(self, cancellable, callback, userdata);
+    DtTreeSourceFSScanState *state = g_malloc(sizeof(DtTreeSourceFSScanState));
+    g_queue_init(&state->pending);
+    g_queue_init(&state->urgent);
+    state->pending_links = g_hash_table_new(g_direct_hash, g_direct_equal);
+    state->urgent_links = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_queue_init(&state->running);
+    state->num_urgent_running = 0;
+    state->batch_size = MIN_QUERY_BATCH_SIZE;
+    state->error = NULL;
+    state->snapshot = NULL;
+    state->snapshot_dirs = NULL;
+    state->save_snapshot = FALSE;
+    state->report_progress = FALSE;
+    memset(&state->stats, 0, sizeof(state->stats));
+    state->start_time = g_get_monotonic_time();
+    state->last_progress_time = state->start_time;
+
+    g_task_set_priority(task, io_priority);
+    g_task_set_task_data(task, state, cleanup_scan_task_data);
+    self->scan_tasks = g_list_prepend(self->scan_tasks, task);
+    return task;
+}
+
+/**
+ * Loads the snapshot from the last scan, if there is one and if it's for the
+ * same directory.
+ */
+static DtScanSnapshot *load_snapshot(DtTreeSourceFS *self)
+{
+    DtScanSnapshot *snapshot;
+    GError *error = NULL;
+    char *uri;
+
+    snapshot = dt_scan_snapshot_load(self->snapshot_file, &error);
+    if (snapshot == NULL)
+    {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+            g_warning("Can't load snapshot: %s", error->message);
+        }
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    uri = g_file_get_uri(self->base);
+    if (strcmp(uri, dt_scan_snapshot_get_root_uri(snapshot)) != 0
+            || dt_scan_snapshot_get_follow_symlinks(snapshot) != self->follow_symlinks)
+    {
+        g_debug("Ignoring snapshot %s for a different directory", self->snapshot_file);
+        dt_scan_snapshot_free(snapshot);
+        snapshot = NULL;
+    }
+    g_free(uri);
+    return snapshot;
+}
+
+static void snapshot_save_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GError *error = NULL;
+    if (!g_file_replace_contents_finish(G_FILE(sourceobj), res, NULL, &error))
+    {
+        g_warning("Can't save snapshot: %s", error->message);
+        g_clear_error(&error);
+    }
+}
+
+/**
+ * Writes a snapshot of the current tree to the snapshot file.
+ *
+ * The file is written to a temporary file and then renamed, so if the old
+ * snapshot is still mapped, it stays valid.
+ */
+static void save_snapshot(DtTreeSourceFS *self)
+{
+    GError *error = NULL;
+    GBytes *bytes;
+    GFile *file;
+    char *dir;
+    char *uri;
+
+    uri = g_file_get_uri(self->base);
+    bytes = dt_scan_snapshot_build(DT_TREE_SOURCE(self), uri, self->follow_symlinks, &error);
+    g_free(uri);
+    if (bytes == NULL)
+    {
+        g_warning("Can't save snapshot: %s", error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    dir = g_path_get_dirname(self->snapshot_file);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    file = g_file_new_for_path(self->snapshot_file);
+    g_file_replace_contents_bytes_async(file, bytes, NULL, FALSE,
+            G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
+            NULL, snapshot_save_ready, NULL);
+    g_object_unref(file);
+    g_bytes_unref(bytes);
+}
+
+void dt_tree_source_fs_scan_async(DtTreeSource *self, int io_priority,
+        GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata)
+{
+    DtTreeSourceFS *fs = DT_TREE_SOURCE_FS(self);
+    GTask *task = scan_task_new(fs, io_priority, cancellable, callback, userdata);
+    DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+
+    state->report_progress = TRUE;
+    if (fs->snapshot_file != NULL)
+    {
+        state->snapshot = load_snapshot(fs);
+        if (state->snapshot != NULL)
+        {
+            state->snapshot_dirs = g_hash_table_new(g_direct_hash, g_direct_equal);
+        }
+        state->save_snapshot = TRUE;
+    }
+    start_scan_root(task);
+}
+
+gboolean dt_tree_source_fs_scan_finish(DtTreeSource *self, GAsyncResult *result, GError **error)
+{
+    GTask *task = G_TASK(result);
+    gboolean ret = g_task_propagate_boolean(task, error);
+    return ret;
+}
+
+static void dt_tree_source_fs_prioritize_node(DtTreeSource *source, DtTreeSourceNode *node)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(source);
+    GList *t, *link;
+
+    for (t = self->scan_tasks; t != NULL; t = t->next)
+    {
+        GTask *task = t->data;
+        DtTreeSourceFSScanState *state = g_task_get_task_data(task);
+
+        if (g_hash_table_contains(state->urgent_links, node))
+        {
+            return;
+        }
+
+        link = g_hash_table_lookup(state->pending_links, node);
+        if (link != NULL)
+        {
+            g_hash_table_remove(state->pending_links, node);
+            g_queue_unlink(&state->pending, link);
+            g_queue_push_tail_link(&state->urgent, link);
+            g_hash_table_insert(state->urgent_links, node, link);
+            start_next_scans(task);
+            return;
+        }
+
+        for (link = state->running.head; link != NULL; link = link->next)
+        {
+            ScanJob *job = link->data;
+            if (job->node == node)
+            {
+                // We're already reading it, but make sure that it doesn't
+                // have to wait behind any other directories.
+                if (!job->urgent)
+                {
+                    job->urgent = TRUE;
+                    state->num_urgent_running++;
+                    commit_finished_jobs(task);
+                    start_next_scans(task);
+                }
+                return;
+            }
+        }
+    }
+}
+
+static void dirty_dir_free(DirtyDir *dirty)
+{
+    if (dirty != NULL)
+    {
+        g_hash_table_destroy(dirty->names);
+        g_free(dirty);
+    }
+}
+
+static void on_watch_event(DtFsWatch *watch, gint wd, const char *name,
+        DtFsWatchEvent event, gpointer userdata);
+
+/**
+ * Starts watching a directory for changes.
+ */
+static void watch_directory(DtTreeSourceFS *self, DtTreeSourceNode *node, GFile *file)
+{
+    GError *error = NULL;
+    char *path;
+    gint wd;
+
+    if (g_hash_table_contains(self->watch_nodes, node))
+    {
+        return;
+    }
+
+    path = g_file_get_path(file);
+    if (path == NULL)
+    {
+        // We can only watch local files.
+        return;
+    }
+
+    if (self->fs_watch == NULL)
+    {
+        self->fs_watch = dt_fs_watch_new(on_watch_event, self, &error);
+        if (self->fs_watch == NULL)
+        {
+            g_warning("Can't watch for changes: %s", error->message);
+            g_clear_error(&error);
+            self->watch = FALSE;
+            g_free(path);
+            return;
+        }
+    }
+
+    wd = dt_fs_watch_add(self->fs_watch, path, &error);
+    g_free(path);
+    if (wd < 0)
+    {
+        g_warning("%s", error->message);
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+        {
+            // We hit the limit on inotify watches, so don't bother trying
+            // with any more directories.
+            g_warning("Too many directories to watch, so changes may be missed");
+            self->watch = FALSE;
+        }
+        g_clear_error(&error);
+        return;
+    }
+
+    // If two directories are really the same directory (through a symlink or
+    // a bind mount), then inotify gives us the same watch descriptor for both.
+    // We only keep track of the first one.
+    if (!g_hash_table_contains(self->watch_dirs, GINT_TO_POINTER(wd)))
+    {
+        g_hash_table_insert(self->watch_dirs, GINT_TO_POINTER(wd), node);
+        g_hash_table_insert(self->watch_nodes, node, GINT_TO_POINTER(wd));
+    }
+}
+
+/**
+ * Removes a directory from the queues of any scans that haven't gotten to it
+ * yet. This has to be called before the node is removed from the tree.
+ */
+static void unqueue_dir(DtTreeSourceFS *self, DtTreeSourceNode *node)
+{
+    GList *t, *link;
+
+    for (t = self->scan_tasks; t != NULL; t = t->next)
+    {
+        DtTreeSourceFSScanState *state = g_task_get_task_data(t->data);
+
+        link = g_hash_table_lookup(state->pending_links, node);
+        if (link != NULL)
+        {
+            g_hash_table_remove(state->pending_links, node);
+            g_queue_delete_link(&state->pending, link);
+        }
+        link = g_hash_table_lookup(state->urgent_links, node);
+        if (link != NULL)
+        {
+            g_hash_table_remove(state->urgent_links, node);
+            g_queue_delete_link(&state->urgent, link);
+        }
+        if (state->snapshot_dirs != NULL)
+        {
+            g_hash_table_remove(state->snapshot_dirs, node);
+        }
+    }
+}
+
+/**
+ * Stops watching a directory and everything under it, and forgets any
+ * .gitignore rules for them. This has to be called before the nodes are
+ * removed from the tree.
+ */
+static void unwatch_subtree(DtTreeSourceFS *self, DtTreeSourceNode *node)
+{
+    WatchUpdate *update;
+    gpointer wd;
+    DtTreeSourceNode * const *children;
+    guint num, i;
+
+    if (g_hash_table_lookup_extended(self->watch_nodes, node, NULL, &wd))
+    {
+        g_hash_table_remove(self->watch_nodes, node);
+        g_hash_table_remove(self->watch_dirs, wd);
+        g_hash_table_remove(self->dirty_dirs, node);
+        dt_fs_watch_remove(self->fs_watch, GPOINTER_TO_INT(wd));
+    }
+    g_hash_table_remove(self->dir_rules, node);
+
+    update = g_hash_table_lookup(self->watch_updates, node);
+    if (update != NULL)
+    {
+        update->node = NULL;
+        g_hash_table_remove(self->watch_updates, node);
+    }
+    unqueue_dir(self, node);
+
+    children = dt_tree_source_get_child_array(DT_TREE_SOURCE(self), node, &num);
+    for (i=0; i<num; i++)
+    {
+        unwatch_subtree(self, children[i]);
+    }
+}
+
+/**
+ * Records that something in a directory changed.
+ *
+ * \param name The name of the entry that changed, or NULL to reread the whole
+ *      directory.
+ */
+static void mark_dirty(DtTreeSourceFS *self, DtTreeSourceNode *node, const char *name)
+{
+    DirtyDir *dirty = g_hash_table_lookup(self->dirty_dirs, node);
+    if (dirty == NULL)
+    {
+        dirty = g_malloc(sizeof(DirtyDir));
+        dirty->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        dirty->all = FALSE;
+        g_hash_table_insert(self->dirty_dirs, node, dirty);
+    }
+
+    if (name != NULL)
+    {
+        g_hash_table_add(dirty->names, g_strdup(name));
+    }
+    else
+    {
+        dirty->all = TRUE;
+    }
+}
+
+/**
+ * Returns TRUE if anything that we show or compare is different between a
+ * node and a new GFileInfo.
+ *
+ * This also checks the device and change time, the same as the digest cache
+ * does, so that a file that was replaced with one with the same size and
+ * modification time doesn't keep the old file's CRC or digest. A node from a
+ * snapshot doesn't have a change time, so that's only checked if both sides
+ * have one.
+ */
+static gboolean file_info_changed(DtTreeSourceFS *self, DtTreeSourceNode *node, GFileInfo *newinfo)
+{
+    const DtFileMetadata *old = dt_tree_source_get_metadata(DT_TREE_SOURCE(self), node);
+    DtFileMetadata new;
+
+    dt_file_metadata_from_file_info(&new, newinfo);
+    return (old->size != new.size
+            || old->mtime_sec != new.mtime_sec
+            || old->mtime_usec != new.mtime_usec
+            || ((old->flags & new.flags & DT_FILE_METADATA_HAS_CTIME)
+                && (old->ctime_sec != new.ctime_sec || old->ctime_usec != new.ctime_usec))
+            || old->mode != new.mode
+            || old->device != new.device
+            || old->inode != new.inode
+            || g_strcmp0(dt_tree_source_get_symlink_target(DT_TREE_SOURCE(self), node),
+                g_file_info_get_symlink_target(newinfo)) != 0);
+}
+
+/**
+ * Adds, removes, or updates the node for a single directory entry to match
+ * what's on disk.
+ *
+ * \param info The new GFileInfo for the entry, or NULL if it doesn't exist
+ *      anymore.
+ * \param new_dirs Any new directories are added to this queue, so that the
+ *      caller can scan them.
+ */
+static void watch_update_child(DtTreeSourceFS *self, DtTreeSourceNode *parent,
+        const char *name, GFileInfo *info, GQueue *new_dirs)
+{
+    DtTreeSourceNode *node = dt_tree_source_get_child_by_name(DT_TREE_SOURCE(self), parent, name);
+
+    if (info != NULL && is_excluded(self, parent, info))
+    {
+        // Treat an excluded file the same as one that doesn't exist.
+        info = NULL;
+    }
+
+    if (node != NULL)
+    {
+        const DtFileMetadata *oldmeta = dt_tree_source_get_metadata(DT_TREE_SOURCE(self), node);
+        if (info != NULL && g_file_info_get_file_type(info) == oldmeta->type)
+        {
+            if (file_info_changed(self, node, info))
+            {
+                dt_tree_source_base_set_file_info(DT_TREE_SOURCE_BASE(self), node, info);
+            }
+            return;
+        }
+
+        // The file was removed, or it was replaced with a different type of
+        // file. Either way, the old node has to go.
+        unwatch_subtree(self, node);
+        dt_tree_source_base_remove_children(DT_TREE_SOURCE_BASE(self), parent, 1, &node);
+    }
+
+    if (info != NULL)
+    {
+        DtTreeSourceNode *child = NULL;
+        dt_tree_source_base_add_children(DT_TREE_SOURCE_BASE(self), parent, 1, &info, &child);
+        if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+        {
+            g_queue_push_tail(new_dirs, child);
+        }
+    }
+}
+
+static void watch_scan_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GError *error = NULL;
+    if (!g_task_propagate_boolean(G_TASK(res), &error))
+    {
+        g_warning("Failed to read new directories: %s", error->message);
+        g_clear_error(&error);
+    }
+}
+
+/**
+ * Reads the contents of any new directories, using the same code as the
+ * initial scan. That will also start watching them.
+ */
+static void scan_new_dirs(DtTreeSourceFS *self, GQueue *new_dirs)
+{
+    GTask *task;
+    DtTreeSourceFSScanState *state;
+
+    if (g_queue_is_empty(new_dirs))
+    {
+        return;
+    }
+
+    task = scan_task_new(self, G_PRIORITY_DEFAULT, NULL, watch_scan_ready, NULL);
+    state = g_task_get_task_data(task);
+    while (!g_queue_is_empty(new_dirs))
+    {
+        push_pending(state, g_queue_pop_head(new_dirs), FALSE);
+    }
+    start_next_scans(task);
+}
+
+/**
+ * Returns TRUE if a scan is still reading a directory or anything under it.
+ *
+ * Updating a directory like that could add a node that the scan is about to
+ * add too, or remove a node that the scan is still adding children to, so it
+ * has to wait until the scan is done with it.
+ */
+static gboolean is_dir_busy(DtTreeSourceFS *self, DtTreeSourceNode *dir)
+{
+    GList *t, *link;
+
+    for (t = self->scan_tasks; t != NULL; t = t->next)
+    {
+        DtTreeSourceFSScanState *state = g_task_get_task_data(t->data);
+
+        if (g_hash_table_contains(state->pending_links, dir)
+                || g_hash_table_contains(state->urgent_links, dir))
+        {
+            return TRUE;
+        }
+
+        for (link = state->running.head; link != NULL; link = link->next)
+        {
+            ScanJob *job = link->data;
+            DtTreeSourceNode *node;
+
+            for (node = job->node; node != NULL; node = dt_tree_source_get_parent(DT_TREE_SOURCE(self), node))
+            {
+                if (node == dir)
+                {
+                    return TRUE;
+                }
+            }
+        }
+    }
+    return FALSE;
+}
+
+static void watch_update_free(gpointer ptr)
+{
+    WatchUpdate *update = ptr;
+    guint i;
+
+    for (i=0; i<update->result_infos->len; i++)
+    {
+        if (update->result_infos->pdata[i] != NULL)
+        {
+            g_object_unref(update->result_infos->pdata[i]);
+        }
+    }
+    g_ptr_array_unref(update->result_infos);
+    g_ptr_array_unref(update->result_names);
+    g_hash_table_destroy(update->names);
+    g_object_unref(update->dir);
+    g_free(update);
+}
+
+/**
+ * Queries every entry in a dirty directory on a worker thread.
+ */
+static void watch_update_thread(GTask *task, gpointer sourceobj,
+        gpointer taskdata, GCancellable *cancellable)
+{
+    WatchUpdate *update = taskdata;
+    GFileQueryInfoFlags flags = G_FILE_QUERY_INFO_NONE;
+    GHashTableIter iter;
+    gpointer name;
+
+    if (update->all)
+    {
+        // We don't know what changed, so check everything that's on disk,
+        // along with everything that was in the tree.
+        GFileEnumerator *fenum = g_file_enumerate_children(update->dir,
+                G_FILE_ATTRIBUTE_STANDARD_NAME, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                cancellable, NULL);
+        if (fenum != NULL)
+        {
+            GFileInfo *info;
+            while ((info = g_file_enumerator_next_file(fenum, cancellable, NULL)) != NULL)
+            {
+                g_hash_table_add(update->names, g_strdup(g_file_info_get_name(info)));
+                g_object_unref(info);
+            }
+            g_object_unref(fenum);
+        }
+    }
+
+    if (!update->follow_symlinks)
+    {
+        flags |= G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+    }
+
+    g_hash_table_iter_init(&iter, update->names);
+    while (g_hash_table_iter_next(&iter, &name, NULL))
+    {
+        GFile *file = g_file_get_child(update->dir, name);
+        g_ptr_array_add(update->result_names, name);
+        g_ptr_array_add(update->result_infos,
+                g_file_query_info(file, FILE_QUERY_ATTRIBS, flags, cancellable, NULL));
+        g_object_unref(file);
+    }
+    g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * Applies the results from watch_update_thread to the tree.
+ */
+static void watch_update_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(sourceobj);
+    WatchUpdate *update = g_task_get_task_data(G_TASK(res));
+    GQueue new_dirs = G_QUEUE_INIT;
+    GHashTableIter iter;
+    gpointer name;
+    guint i;
+
+    if (update->node == NULL)
+    {
+        // The directory was removed while we were reading it.
+        return;
+    }
+    g_hash_table_remove(self->watch_updates, update->node);
+
+    if (is_dir_busy(self, update->node))
+    {
+        // A scan started on something in this directory in the meantime, so
+        // put the changes back and try again once it's done.
+        if (update->all)
+        {
+            mark_dirty(self, update->node, NULL);
+        }
+        g_hash_table_iter_init(&iter, update->names);
+        while (g_hash_table_iter_next(&iter, &name, NULL))
+        {
+            mark_dirty(self, update->node, name);
+        }
+        schedule_dirty_flush(self);
+        return;
+    }
+
+    for (i=0; i<update->result_names->len; i++)
+    {
+        watch_update_child(self, update->node, update->result_names->pdata[i],
+                update->result_infos->pdata[i], &new_dirs);
+    }
+    scan_new_dirs(self, &new_dirs);
+}
+
+/**
+ * Starts checking a dirty directory again on a worker thread.
+ *
+ * This takes ownership of \p dirty.
+ */
+static void start_watch_update(DtTreeSourceFS *self, DtTreeSourceNode *node, DirtyDir *dirty)
+{
+    WatchUpdate *update = g_malloc(sizeof(WatchUpdate));
+    GTask *task;
+
+    update->node = node;
+    update->dir = get_node_file(self, node);
+    update->follow_symlinks = self->follow_symlinks;
+    update->all = dirty->all;
+    update->names = dirty->names;
+    update->result_names = g_ptr_array_new();
+    update->result_infos = g_ptr_array_new();
+    g_free(dirty);
+
+    if (update->all)
+    {
+        DtTreeSourceNode * const *children;
+        guint num, i;
+
+        children = dt_tree_source_get_child_array(DT_TREE_SOURCE(self), node, &num);
+        for (i=0; i<num; i++)
+        {
+            g_hash_table_add(update->names, g_strdup(dt_tree_source_get_name(DT_TREE_SOURCE(self), children[i])));
+        }
+    }
+
+    g_hash_table_insert(self->watch_updates, node, update);
+
+    task = g_task_new(self, NULL, watch_update_ready, NULL);
+    g_task_set_task_data(task, update, watch_update_free);
+    g_task_run_in_thread(task, watch_update_thread);
+    g_object_unref(task);
+}
+
+/**
+ * Starts checking every directory that we've collected changes for.
+ *
+ * A directory that a scan is still reading, or that we're already checking,
+ * stays dirty until the next time around.
+ *
+ * \return TRUE if there are still any dirty directories.
+ */
+static gboolean flush_dirty_dirs(DtTreeSourceFS *self)
+{
+    GHashTableIter iter;
+    gpointer node, dirty;
+
+    g_hash_table_iter_init(&iter, self->dirty_dirs);
+    while (g_hash_table_iter_next(&iter, &node, &dirty))
+    {
+        if (!g_hash_table_contains(self->watch_nodes, node))
+        {
+            // Skip any directories that were removed since the event came in.
+            g_hash_table_iter_remove(&iter);
+        }
+        else if (!g_hash_table_contains(self->watch_updates, node)
+                && !is_dir_busy(self, node))
+        {
+            g_hash_table_iter_steal(&iter);
+            start_watch_update(self, node, dirty);
+        }
+    }
+    return (g_hash_table_size(self->dirty_dirs) > 0);
+}
+
+static gboolean on_dirty_timeout(gpointer userdata)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(userdata);
+    gint64 now = g_get_monotonic_time();
+
+    if (now - self->last_dirty_time < WATCH_QUIET_TIME
+            && now - self->first_dirty_time < WATCH_MAX_DELAY)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    if (flush_dirty_dirs(self))
+    {
+        // Some directories are still being scanned, so check them again on
+        // the next tick.
+        return G_SOURCE_CONTINUE;
+    }
+    self->dirty_timeout = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Starts the timer to apply the dirty directories, if it isn't running
+ * already.
+ */
+static void schedule_dirty_flush(DtTreeSourceFS *self)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (self->dirty_timeout == 0)
+    {
+        self->first_dirty_time = now;
+        self->dirty_timeout = g_timeout_add(WATCH_QUIET_TIME / G_TIME_SPAN_MILLISECOND,
+                on_dirty_timeout, self);
+    }
+    self->last_dirty_time = now;
+}
+
+static void on_watch_event(DtFsWatch *watch, gint wd, const char *name,
+        DtFsWatchEvent event, gpointer userdata)
+{
+    DtTreeSourceFS *self = DT_TREE_SOURCE_FS(userdata);
+    DtTreeSourceNode *node;
+
+    if (event == DT_FS_WATCH_EVENT_GONE)
+    {
+        node = g_hash_table_lookup(self->watch_dirs, GINT_TO_POINTER(wd));
+        if (node != NULL)
+        {
+            g_hash_table_remove(self->watch_dirs, GINT_TO_POINTER(wd));
+            g_hash_table_remove(self->watch_nodes, node);
+        }
+        return;
+    }
+    else if (event == DT_FS_WATCH_EVENT_OVERFLOW)
+    {
+        GHashTableIter iter;
+        gpointer key;
+
+        g_warning("Too many filesystem changes, rereading every directory");
+        g_hash_table_iter_init(&iter, self->watch_nodes);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+        {
+            mark_dirty(self, key, NULL);
+        }
+    }
+    else
+    {
+        node = g_hash_table_lookup(self->watch_dirs, GINT_TO_POINTER(wd));
+        if (node == NULL)
+        {
+            return;
+        }
+        mark_dirty(self, node, name);
+    }
+
+    schedule_dirty_flush(self);
+}
+
+/**
+ * Returns the GFile to open for a node.
+ *
+ * \return A new GFile. Transfer full.
+ */
+static GFile *lookup_file_for_open(DtTreeSource *self, DtTreeSourceNode *node, GError **error)
+{
+    const DtFileMetadata *meta = dt_tree_source_get_metadata(self, node);
+
+    if (meta == NULL)
+    {
+        g_critical("%s: No file info for row\n", G_STRLOC);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "No file info for row.");
+        return NULL;
+    }
+    if (meta->type != G_FILE_TYPE_REGULAR)
+    {
+        g_critical("%s: No file info for row\n", G_STRLOC);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                "%s is not a regular file.", dt_tree_source_get_name(self, node));
+        return NULL;
+    }
+    return get_node_file(DT_TREE_SOURCE_FS(self), node);
+}
+
+static void dt_tree_source_fs_open_file_ready(GObject *sourceobj, GAsyncResult *res, gpointer userdata)
+{
+    GTask *task = G_TASK(userdata);
+    GFileInputStream *stream;
+    GError *error = NULL;
+
+    stream = g_file_read_finish(G_FILE(sourceobj), res, &error);
+    if (stream != NULL)
+    {
+        g_task_return_pointer(task, stream, g_object_unref);
+    }
+    else
+    {
+        g_task_return_error(task, error);
+    }
+
+    // Unreference the task now. The g_task_return_* call above will add a
+    // reference until the task's callbck function finishes.
+    g_object_unref(task);
+}
+
+static void dt_tree_source_fs_open_file_async(DtTreeSource *self, DtTreeSourceNode *node,
+        int io_priority, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer userdata)
+{
+    GError *error = NULL;
+    GFile *gf = lookup_file_for_open(self, node, &error);
+    if (gf != NULL)
+    {
+        // Wrap this in a GTask so that the source object to (callback) can
+        // point to the DtTreeSourceFS instead of the GFile.
+        GTask *task = g_task_new(self, cancellable, callback, userdata);
+        g_file_read_async(gf, io_priority, cancellable, dt_tree_source_fs_open_file_ready, task);
+        g_object_unref(gf);
+    }
+    else
+    {
+        g_task_report_error(self, callback, userdata, NULL, error);
+    }
+}
+
+static GInputStream *dt_tree_source_fs_open_file_finish(DtTreeSource *self, GAsyncResult *res, GError **error)
+{
+    GTask *task = G_TASK(res);
+    GFileInputStream *stream = g_task_propagate_pointer(task, error);
+    if (stream != NULL)
+    {
+        return G_INPUT_STREAM(stream);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+static GInputStream *dt_tree_source_fs_open_file(DtTreeSource *self, DtTreeSourceNode *node,
+        GCancellable *cancellable, GError **error)
+{
+    GFile *gf = lookup_file_for_open(self, node, error);
+    GInputStream *stream = NULL;
+    if (gf != NULL)
+    {
+        stream = G_INPUT_STREAM(g_file_read(gf, cancellable, error));
+        g_object_unref(gf);
     }
-    return NULL;
+    return stream;
 }
@@ -1,13 +1,6 @@
 #ifndef TREE_SOURCE_FS_H
 #define TREE_SOURCE_FS_H
 
-/*
- * TODO:
- * - Should there be a signal in the DtTreeSource interface for some sort of
- * progress callback, or at least to indicate when it's finished? It might not
- * be especially meaningful for some archive formats.
- */
-
 #include <gtk/gtk.h>
 
 #include "tree-source-base.h"
@@ -17,6 +10,53 @@ G_BEGIN_DECLS
 #define DT_TYPE_TREE_SOURCE_FS dt_tree_source_fs_get_type()
 G_DECLARE_FINAL_TYPE(DtTreeSourceFS, dt_tree_source_fs, DT, TREE_SOURCE_FS, DtTreeSourceBase);
 
+/**
+ * Selects how DtTreeSourceFS reads directories. This is the value of the
+ * "scan-backend" property.
+ */
+typedef enum
+{
+    /// Use GFileEnumerator. This works with any GFile.
+    DT_TREE_SOURCE_FS_SCAN_GIO,
+
+    /**
+     * Use getdents64 and statx on worker threads. This only works for local
+     * files, and it falls back to GIO if the base directory doesn't have a
+     * path, or if the platform doesn't support it.
+     */
+    DT_TREE_SOURCE_FS_SCAN_NATIVE,
+
+    /**
+     * Like DT_TREE_SOURCE_FS_SCAN_NATIVE, but submit the statx calls in
+     * batches through io_uring. If io_uring isn't available at runtime, then
+     * this falls back to DT_TREE_SOURCE_FS_SCAN_NATIVE.
+     */
+    DT_TREE_SOURCE_FS_SCAN_IO_URING,
+} DtTreeSourceFSScanBackend;
+
+/**
+ * Creates a DtTreeSource for a directory.
+ *
+ * The "max-scan-jobs" property controls how many directories
+ * dt_tree_source_scan_async will enumerate at once. The results are always
+ * added to the tree in the same order, regardless of that limit. The
+ * "scan-backend" property selects how each directory is read.
+ *
+ * If the "snapshot-file" property is set, then the scan starts from the
+ * snapshot that the last scan saved there, and only rereads the directories
+ * whose modification time changed. See scan-snapshot.h for the details.
+ *
+ * If the "lazy" property is set, then the scan reads one directory at a time
+ * at a low priority, and any directory that's passed to
+ * dt_tree_source_prioritize_node is read right away instead.
+ *
+ * The "exclude-rules" property is a DtExcludeRules with patterns for files to
+ * leave out of the tree, matched against the path relative to the base
+ * directory. If "use-gitignore" is set, then the .gitignore file in each
+ * directory is applied as well. An excluded directory is never read. Note
+ * that a snapshot only holds the files that weren't excluded, so a snapshot
+ * file shouldn't be shared between different sets of rules.
+ */
 DtTreeSourceFS *dt_tree_source_fs_new(GFile *base, gboolean follow_symlinks);
 
 G_END_DECLS
@@ -13,7 +13,6 @@
 #include "zip-input-stream.h"
 
 #define ATTRIB_FILE_ARCHIVE_INDEX "dt::zipfile:archive_index"
-#define ATTRIB_FILE_ARCHIVE_PATH "dt::zipfile:archive_path"
 
 struct _DtTreeSourceZip
 {
@@ -23,6 +22,13 @@ struct _DtTreeSourceZip
     gint prefix_len;
 
     DtZipFile *zipsource;
+
+    /**
+     * Maps each DtTreeSourceNode to the index of its archive member, plus
+     * one. Directories that don't have their own entry in the zip file aren't
+     * in here.
+     */
+    GHashTable *member_index;
 };
 
 static void dt_tree_source_zip_interface_init(DtTreeSourceInterface *iface);
@@ -35,6 +41,8 @@ static void dt_tree_source_zip_open_file_async(DtTreeSource *self, DtTreeSourceN
 static GInputStream *dt_tree_source_zip_open_file_finish(DtTreeSource *self, GAsyncResult *res, GError **error);
 static GInputStream *dt_tree_source_zip_open_file(DtTreeSource *self, DtTreeSourceNode *node,
         GCancellable *cancellable, GError **error);
+static void dt_tree_source_zip_add_file_attributes(DtTreeSourceBase *self,
+        DtTreeSourceNode *node, GFileInfo *info);
 
 G_DEFINE_TYPE_WITH_CODE(DtTreeSourceZip, dt_tree_source_zip, DT_TYPE_TREE_SOURCE_BASE,
         G_IMPLEMENT_INTERFACE(DT_TYPE_TREE_SOURCE, dt_tree_source_zip_interface_init));
@@ -49,9 +57,36 @@ static void dt_tree_source_zip_interface_init(DtTreeSourceInterface *iface)
 static void dt_tree_source_zip_class_init(DtTreeSourceZipClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    DtTreeSourceBaseClass *base_class = DT_TREE_SOURCE_BASE_CLASS(klass);
 
     object_class->dispose = dt_tree_source_zip_dispose;
     object_class->finalize = dt_tree_source_zip_finalize;
+    base_class->add_file_attributes = dt_tree_source_zip_add_file_attributes;
+}
+
+/**
+ * Looks up the archive member for a node.
+ *
+ * \return The member index, or -1 if the node doesn't have one.
+ */
+static zip_int64_t get_member_index(DtTreeSourceZip *self, DtTreeSourceNode *node)
+{
+    gpointer value = g_hash_table_lookup(self->member_index, node);
+    if (value != NULL)
+    {
+        return ((zip_int64_t) GPOINTER_TO_SIZE(value)) - 1;
+    }
+    return -1;
+}
+
+static void dt_tree_source_zip_add_file_attributes(DtTreeSourceBase *base,
+        DtTreeSourceNode *node, GFileInfo *info)
+{
+    zip_int64_t index = get_member_index(DT_TREE_SOURCE_ZIP(base), node);
+    if (index >= 0)
+    {
+        g_file_info_set_attribute_int64(info, ATTRIB_FILE_ARCHIVE_INDEX, index);
+    }
 }
 
 static gint remove_empty_strings(char **strings)
@@ -74,7 +109,8 @@ static gint remove_empty_strings(char **strings)
     return dst;
 }
 
-static DtTreeSourceNode *add_member(DtTreeSourceZip *self, const char *path, GFileInfo *info)
+static DtTreeSourceNode *add_member(DtTreeSourceZip *self, const char *path,
+        zip_int64_t index, GFileInfo *info)
 {
     char **pathElems = g_strsplit(path, "/", 0);
     gint pathLen = remove_empty_strings(pathElems);
@@ -115,8 +151,8 @@ static DtTreeSourceNode *add_member(DtTreeSourceZip *self, const char *path, GFi
         }
         else
         {
-            GFileInfo *parentInfo = dt_tree_source_get_file_info(DT_TREE_SOURCE(self), nextParent);
-            if (g_file_info_get_file_type(parentInfo) != G_FILE_TYPE_DIRECTORY)
+            const DtFileMetadata *parentMeta = dt_tree_source_get_metadata(DT_TREE_SOURCE(self), nextParent);
+            if (parentMeta->type != G_FILE_TYPE_DIRECTORY)
             {
                 g_warning("Zip file contains children under non-directory for %s\n", path);
                 g_strfreev(pathElems);
@@ -141,8 +177,8 @@ static DtTreeSourceNode *add_member(DtTreeSourceZip *self, const char *path, GFi
         // There's already a row for this file. This could happen if we added a
         // file before its parent directory, or if the zip file contains
         // duplicate paths.
-        GFileInfo *prevInfo = dt_tree_source_get_file_info(DT_TREE_SOURCE(self), node);
-        if (g_file_info_get_file_type(prevInfo) != g_file_info_get_file_type(info))
+        const DtFileMetadata *prevMeta = dt_tree_source_get_metadata(DT_TREE_SOURCE(self), node);
+        if (prevMeta->type != g_file_info_get_file_type(info))
         {
             g_warning("Zip file contains mismatched file type for %s\n", path);
             g_strfreev(pathElems);
@@ -150,6 +186,7 @@ static DtTreeSourceNode *add_member(DtTreeSourceZip *self, const char *path, GFi
         }
         dt_tree_source_base_set_file_info(DT_TREE_SOURCE_BASE(self), node, info);
     }
+    g_hash_table_insert(self->member_index, node, GSIZE_TO_POINTER((gsize) (index + 1)));
     g_strfreev(pathElems);
     return node;
 }
@@ -176,8 +213,6 @@ static gboolean scan_zip_file(DtTreeSourceZip *self, zip_t *zipfile)
             }
 
             info = g_file_info_new();
-            g_file_info_set_attribute_int64(info, ATTRIB_FILE_ARCHIVE_INDEX, i);
-            g_file_info_set_attribute_string(info, ATTRIB_FILE_ARCHIVE_PATH, zst.name);
 
             // Directories in a zip file are distinguished by a trailing '/'
             // character in the filename.
@@ -209,7 +244,7 @@ static gboolean scan_zip_file(DtTreeSourceZip *self, zip_t *zipfile)
                 g_file_info_set_modification_time(info, &tv);
             }
 
-            add_member(self, zst.name, info);
+            add_member(self, zst.name, i, info);
             foundAnyMatch = TRUE;
             g_object_unref(info);
         }
@@ -308,6 +343,7 @@ static void dt_tree_source_zip_init(DtTreeSourceZip *self)
     self->prefix = NULL;
     self->prefix_len = 0;
     self->zipsource = NULL;
+    self->member_index = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 static void dt_tree_source_zip_dispose(GObject *gobj)
 {
@@ -328,6 +364,7 @@ static void dt_tree_source_zip_finalize(GObject *gobj)
         g_strfreev(self->prefix);
         self->prefix = NULL;
     }
+    g_clear_pointer(&self->member_index, g_hash_table_destroy);
 
     G_OBJECT_CLASS(dt_tree_source_zip_parent_class)->finalize(gobj);
 }
@@ -340,21 +377,19 @@ static void zip_stream_close_callback(DtZipInputStream *stream, zip_t *zip, gpoi
     dt_zip_file_unref(zipsource);
 }
 
-static GInputStream *open_file_common(DtTreeSourceZip *self, GFileInfo *info, GError **error)
+static GInputStream *open_file_common(DtTreeSourceZip *self, zip_int64_t index, GError **error)
 {
     DtZipInputStream *stream;
     zip_t *zipfile;
     zip_file_t *member;
-    zip_int64_t index;
     zip_error_t ze;
 
-    if (!g_file_info_has_attribute(info, ATTRIB_FILE_ARCHIVE_INDEX))
+    if (index < 0)
     {
         g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
                 "File has no corresponding archive member\n");
         return NULL;
     }
-    index = g_file_info_get_attribute_int64(info, ATTRIB_FILE_ARCHIVE_INDEX);
 
     zip_error_init(&ze);
     zipfile = dt_zip_file_get_zipfile(self->zipsource, &ze);
@@ -382,10 +417,10 @@ static GInputStream *open_file_common(DtTreeSourceZip *self, GFileInfo *info, GE
 static void open_file_thread_proc(GTask *task, gpointer source_object,
         gpointer task_data, GCancellable *cancellable)
 {
-    GFileInfo *info = G_FILE_INFO(task_data);
+    zip_int64_t *index = task_data;
     DtTreeSourceZip *self = DT_TREE_SOURCE_ZIP(source_object);
     GError *error = NULL;
-    GInputStream *stream = open_file_common(self, info, &error);
+    GInputStream *stream = open_file_common(self, *index, &error);
     if (stream != NULL)
     {
         g_task_return_pointer(task, stream, g_object_unref);
@@ -401,10 +436,11 @@ static void dt_tree_source_zip_open_file_async(DtTreeSource *source, DtTreeSourc
         GAsyncReadyCallback callback, gpointer userdata)
 {
     GTask *task = NULL;
-    GFileInfo *info = NULL;
+    const DtFileMetadata *meta = NULL;
+    zip_int64_t *index;
 
-    info = dt_tree_source_get_file_info(source, node);
-    if (info == NULL || g_file_info_get_file_type(info) != G_FILE_TYPE_REGULAR)
+    meta = dt_tree_source_get_metadata(source, node);
+    if (meta == NULL || meta->type != G_FILE_TYPE_REGULAR)
     {
         g_task_report_new_error(source, callback, userdata, NULL,
                 G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
@@ -415,10 +451,10 @@ static void dt_tree_source_zip_open_file_async(DtTreeSource *source, DtTreeSourc
     task = g_task_new(source, cancellable, callback, userdata);
     g_task_set_priority(task, io_priority);
 
-    // I'm not sure if GFileInfo is thread-safe, so just copy it instead
-    // TODO: I think all I actually need is the member index, so I could just
-    // pass that through.
-    g_task_set_task_data(task, g_file_info_dup(info), g_object_unref);
+    // All the worker thread needs is the member index.
+    index = g_new(zip_int64_t, 1);
+    *index = get_member_index(DT_TREE_SOURCE_ZIP(source), node);
+    g_task_set_task_data(task, index, g_free);
     g_task_run_in_thread(task, open_file_thread_proc);
 
     // Unreference the GTask. I think it'll keep a reference while the worker
@@ -445,15 +481,16 @@ static GInputStream *dt_tree_source_zip_open_file_finish(DtTreeSource *source, G
 static GInputStream *dt_tree_source_zip_open_file(DtTreeSource *source, DtTreeSourceNode *node,
         GCancellable *cancellable, GError **error)
 {
-    GFileInfo *info = dt_tree_source_get_file_info(source, node);
+    const DtFileMetadata *meta = dt_tree_source_get_metadata(source, node);
 
-    if (info == NULL || g_file_info_get_file_type(info) != G_FILE_TYPE_REGULAR)
+    if (meta == NULL || meta->type != G_FILE_TYPE_REGULAR)
     {
         g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                 "File has no corresponding archive member\n");
         return NULL;
     }
 
-    return open_file_common(DT_TREE_SOURCE_ZIP(source), info, error);
+    return open_file_common(DT_TREE_SOURCE_ZIP(source),
+            get_member_index(DT_TREE_SOURCE_ZIP(source), node), error);
 }
 
@@ -1,6 +1,7 @@
 #include "tree-source.h"
 
 #include <assert.h>
+#include <string.h>
 
 G_DEFINE_INTERFACE(DtTreeSource, dt_tree_source, G_TYPE_OBJECT);
 
@@ -9,6 +10,7 @@ enum
     SIGNAL_NODES_ADDED,
     SIGNAL_NODES_REMOVED,
     SIGNAL_NODES_CHANGED,
+    SIGNAL_SCAN_PROGRESS,
     LAST_SIGNAL
 };
 
@@ -39,6 +41,14 @@ static void dt_tree_source_default_init(DtTreeSourceInterface *iface)
             NULL, NULL, NULL,
             G_TYPE_NONE,
             4, G_TYPE_POINTER, G_TYPE_INT, G_TYPE_POINTER, G_TYPE_POINTER);
+
+    tree_source_signals[SIGNAL_SCAN_PROGRESS] = g_signal_new("scan-progress",
+            DT_TYPE_TREE_SOURCE,
+            G_SIGNAL_RUN_LAST,
+            G_STRUCT_OFFSET(DtTreeSourceInterface, scan_progress),
+            NULL, NULL, NULL,
+            G_TYPE_NONE,
+            1, G_TYPE_POINTER);
 }
 
 DtTreeSourceNode *dt_tree_source_get_root(DtTreeSource *self)
@@ -69,9 +79,39 @@ GList *dt_tree_source_get_children(DtTreeSource *self, DtTreeSourceNode *parent)
 
     g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
     iface = DT_TREE_SOURCE_GET_IFACE(self);
-    g_return_val_if_fail(iface->get_children != NULL, NULL);
 
-    return iface->get_children(self, parent);
+    if (iface->get_children != NULL)
+    {
+        return iface->get_children(self, parent);
+    }
+    else
+    {
+        // Build the list from the child array.
+        DtTreeSourceNode * const *children;
+        GList *list = NULL;
+        guint num;
+
+        children = dt_tree_source_get_child_array(self, parent, &num);
+        while (num > 0)
+        {
+            num--;
+            list = g_list_prepend(list, children[num]);
+        }
+        return list;
+    }
+}
+
+DtTreeSourceNode * const *dt_tree_source_get_child_array(DtTreeSource *self,
+        DtTreeSourceNode *parent, guint *ret_num)
+{
+    DtTreeSourceInterface *iface;
+
+    *ret_num = 0;
+    g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+    g_return_val_if_fail(iface->get_child_array != NULL, NULL);
+
+    return iface->get_child_array(self, parent, ret_num);
 }
 
 DtTreeSourceNode *dt_tree_source_get_child_by_name(DtTreeSource *self, DtTreeSourceNode *parent, const char *name)
@@ -87,41 +127,190 @@ DtTreeSourceNode *dt_tree_source_get_child_by_name(DtTreeSource *self, DtTreeSou
     }
     else
     {
-        // If the class doesn't implement this, then do a linear search through
-        // the child nodes
-        GList *children, *ch;
-        DtTreeSourceNode *node = NULL;
-
-        g_return_val_if_fail(iface->get_children != NULL, NULL);
-
-        children = iface->get_children(self, parent);
-        for (ch = children; ch != NULL; ch = ch->next)
+        // If the class doesn't implement this, then do a binary search
+        // through the sorted child array.
+        DtTreeSourceNode * const *children;
+        guint low = 0;
+        guint high;
+
+        children = dt_tree_source_get_child_array(self, parent, &high);
+        while (low < high)
         {
-            GFileInfo *info = dt_tree_source_get_file_info(self, (DtTreeSourceNode *) ch->data);
-            if (info != NULL)
+            guint mid = low + (high - low) / 2;
+            int cmp = strcmp(dt_tree_source_get_name(self, children[mid]), name);
+            if (cmp == 0)
             {
-                const char *chName = g_file_info_get_name(info);
-                if (chName != NULL && strcmp(chName, name) == 0)
-                {
-                    node = ch->data;
-                    break;
-                }
+                return children[mid];
+            }
+            else if (cmp < 0)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
             }
         }
-        g_list_free(children);
-        return node;
+        return NULL;
     }
 }
 
-GFileInfo *dt_tree_source_get_file_info(DtTreeSource *self, DtTreeSourceNode *node)
+const char *dt_tree_source_get_name(DtTreeSource *self, DtTreeSourceNode *node)
+{
+    DtTreeSourceInterface *iface;
+
+    g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+    g_return_val_if_fail(iface->get_name != NULL, NULL);
+
+    return iface->get_name(self, node);
+}
+
+const DtFileMetadata *dt_tree_source_get_metadata(DtTreeSource *self, DtTreeSourceNode *node)
+{
+    DtTreeSourceInterface *iface;
+
+    g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+    g_return_val_if_fail(iface->get_metadata != NULL, NULL);
+
+    return iface->get_metadata(self, node);
+}
+
+const char *dt_tree_source_get_symlink_target(DtTreeSource *self, DtTreeSourceNode *node)
 {
     DtTreeSourceInterface *iface;
 
     g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
     iface = DT_TREE_SOURCE_GET_IFACE(self);
-    g_return_val_if_fail(iface->get_file_info != NULL, NULL);
+    g_return_val_if_fail(iface->get_symlink_target != NULL, NULL);
 
-    return iface->get_file_info(self, node);
+    return iface->get_symlink_target(self, node);
+}
+
+GFileInfo *dt_tree_source_create_file_info(DtTreeSource *self, DtTreeSourceNode *node)
+{
+    DtTreeSourceInterface *iface;
+
+    g_return_val_if_fail(DT_IS_TREE_SOURCE(self), NULL);
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+    g_return_val_if_fail(iface->create_file_info != NULL, NULL);
+
+    return iface->create_file_info(self, node);
+}
+
+/**
+ * Parses a hex string from DT_FILE_ATTRIBUTE_DIGEST.
+ */
+static gboolean parse_digest(const char *str, guint8 *digest)
+{
+    gint i;
+
+    if (strlen(str) != DT_FILE_METADATA_DIGEST_SIZE * 2)
+    {
+        return FALSE;
+    }
+    for (i=0; i<DT_FILE_METADATA_DIGEST_SIZE; i++)
+    {
+        gint high = g_ascii_xdigit_value(str[i * 2]);
+        gint low = g_ascii_xdigit_value(str[i * 2 + 1]);
+
+        if (high < 0 || low < 0)
+        {
+            return FALSE;
+        }
+        digest[i] = (high << 4) | low;
+    }
+    return TRUE;
+}
+
+void dt_file_metadata_from_file_info(DtFileMetadata *metadata, GFileInfo *info)
+{
+    memset(metadata, 0, sizeof(DtFileMetadata));
+    metadata->type = g_file_info_get_file_type(info);
+
+    if (g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_STANDARD_SIZE))
+    {
+        metadata->size = g_file_info_get_size(info);
+        metadata->flags |= DT_FILE_METADATA_HAS_SIZE;
+    }
+    if (g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    {
+        metadata->mtime_sec = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        metadata->mtime_usec = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+        metadata->flags |= DT_FILE_METADATA_HAS_MTIME;
+    }
+    if (g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_TIME_CHANGED))
+    {
+        metadata->ctime_sec = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_CHANGED);
+        metadata->ctime_usec = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
+        metadata->flags |= DT_FILE_METADATA_HAS_CTIME;
+    }
+    if (g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_UNIX_MODE))
+    {
+        metadata->mode = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_UNIX_MODE);
+        metadata->flags |= DT_FILE_METADATA_HAS_MODE;
+    }
+    if (g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_UNIX_DEVICE)
+            && g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_UNIX_INODE))
+    {
+        metadata->device = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+        metadata->inode = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_UNIX_INODE);
+        metadata->flags |= DT_FILE_METADATA_HAS_INODE;
+    }
+    if (g_file_info_get_attribute_type(info, DT_FILE_ATTRIBUTE_CRC) == G_FILE_ATTRIBUTE_TYPE_UINT32)
+    {
+        metadata->crc = g_file_info_get_attribute_uint32(info, DT_FILE_ATTRIBUTE_CRC);
+        metadata->flags |= DT_FILE_METADATA_HAS_CRC;
+    }
+    if (g_file_info_get_attribute_type(info, DT_FILE_ATTRIBUTE_DIGEST) == G_FILE_ATTRIBUTE_TYPE_STRING
+            && parse_digest(g_file_info_get_attribute_string(info, DT_FILE_ATTRIBUTE_DIGEST), metadata->digest))
+    {
+        metadata->flags |= DT_FILE_METADATA_HAS_DIGEST;
+    }
+}
+
+void dt_file_metadata_to_file_info(const DtFileMetadata *metadata, GFileInfo *info)
+{
+    g_file_info_set_file_type(info, metadata->type);
+    if (metadata->flags & DT_FILE_METADATA_HAS_SIZE)
+    {
+        g_file_info_set_size(info, metadata->size);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_MTIME)
+    {
+        g_file_info_set_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED, metadata->mtime_sec);
+        g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC, metadata->mtime_usec);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_CTIME)
+    {
+        g_file_info_set_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_CHANGED, metadata->ctime_sec);
+        g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC, metadata->ctime_usec);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_MODE)
+    {
+        g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_UNIX_MODE, metadata->mode);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_INODE)
+    {
+        g_file_info_set_attribute_uint32(info, G_FILE_ATTRIBUTE_UNIX_DEVICE, metadata->device);
+        g_file_info_set_attribute_uint64(info, G_FILE_ATTRIBUTE_UNIX_INODE, metadata->inode);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_CRC)
+    {
+        g_file_info_set_attribute_uint32(info, DT_FILE_ATTRIBUTE_CRC, metadata->crc);
+    }
+    if (metadata->flags & DT_FILE_METADATA_HAS_DIGEST)
+    {
+        char str[DT_FILE_METADATA_DIGEST_SIZE * 2 + 1];
+        gint i;
+
+        for (i=0; i<DT_FILE_METADATA_DIGEST_SIZE; i++)
+        {
+            g_snprintf(str + i * 2, 3, "%02x", metadata->digest[i]);
+        }
+        g_file_info_set_attribute_string(info, DT_FILE_ATTRIBUTE_DIGEST, str);
+    }
 }
 
 DtTreeSourceNode **dt_tree_source_get_node_path(DtTreeSource *self, DtTreeSourceNode *node, gint *ret_depth)
@@ -261,6 +450,32 @@ GInputStream *dt_tree_source_open_file(DtTreeSource *self, DtTreeSourceNode *nod
     }
 }
 
+void dt_tree_source_prioritize_node(DtTreeSource *self, DtTreeSourceNode *node)
+{
+    DtTreeSourceInterface *iface;
+
+    g_return_if_fail(DT_IS_TREE_SOURCE(self));
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+
+    if (iface->prioritize_node != NULL)
+    {
+        iface->prioritize_node(self, node);
+    }
+}
+
+void dt_tree_source_set_digest(DtTreeSource *self, DtTreeSourceNode *node, const guint8 *digest)
+{
+    DtTreeSourceInterface *iface;
+
+    g_return_if_fail(DT_IS_TREE_SOURCE(self));
+    iface = DT_TREE_SOURCE_GET_IFACE(self);
+
+    if (iface->set_digest != NULL)
+    {
+        iface->set_digest(self, node, digest);
+    }
+}
+
 void dt_tree_source_nodes_added(DtTreeSource *source, DtTreeSourceNode *parent,
         gint num, DtTreeSourceNode **nodes)
 {
@@ -278,3 +493,8 @@ void dt_tree_source_nodes_changed(DtTreeSource *source, DtTreeSourceNode *parent
 {
     g_signal_emit(source, tree_source_signals[SIGNAL_NODES_CHANGED], 0, parent, num, nodes, old_info);
 }
+
+void dt_tree_source_scan_progress(DtTreeSource *source, const DtTreeSourceScanStats *stats)
+{
+    g_signal_emit(source, tree_source_signals[SIGNAL_SCAN_PROGRESS], 0, stats);
+}
@@ -29,6 +29,98 @@ typedef struct _DtTreeSourceNode DtTreeSourceNode;
  */
 #define DT_FILE_ATTRIBUTE_FS_PATH "dt::fs_path"
 
+/**
+ * A GFileInfo attribute with a digest of a file's contents, from
+ * file-digest.h, as a hex string.
+ */
+#define DT_FILE_ATTRIBUTE_DIGEST "dt::digest"
+
+/**
+ * The size of DtFileMetadata::digest. This is the same as
+ * DT_FILE_DIGEST_SIZE.
+ */
+#define DT_FILE_METADATA_DIGEST_SIZE 16
+
+/**
+ * Flags for DtFileMetadata::flags, to say which of the optional fields have a
+ * value.
+ */
+typedef enum
+{
+    DT_FILE_METADATA_HAS_SIZE = 0x0001,
+    DT_FILE_METADATA_HAS_MTIME = 0x0002,
+    DT_FILE_METADATA_HAS_MODE = 0x0004,
+
+    /// Set if both DtFileMetadata::device and DtFileMetadata::inode are valid.
+    DT_FILE_METADATA_HAS_INODE = 0x0008,
+    DT_FILE_METADATA_HAS_CRC = 0x0010,
+    DT_FILE_METADATA_HAS_DIGEST = 0x0020,
+    DT_FILE_METADATA_HAS_CTIME = 0x0040,
+} DtFileMetadataFlags;
+
+/**
+ * The metadata for a single node.
+ *
+ * This holds the same values as the GFileInfo that
+ * dt_tree_source_create_file_info returns, but it's a plain struct, so that
+ * the comparison code and the view can read it without looking up each
+ * attribute by name.
+ */
+typedef struct
+{
+    guint64 size;
+    guint64 mtime_sec;
+    guint64 ctime_sec;
+    guint64 inode;
+    guint32 mtime_usec;
+    guint32 ctime_usec;
+    guint32 mode;
+    guint32 device;
+    guint32 crc;
+
+    /**
+     * A digest of the file's contents. This is filled in once a comparison
+     * has read the file, so that later checks don't have to read it again.
+     */
+    guint8 digest[DT_FILE_METADATA_DIGEST_SIZE];
+
+    /// A GFileType value.
+    guint16 type;
+
+    /// A combination of DtFileMetadataFlags.
+    guint16 flags;
+} DtFileMetadata;
+
+/**
+ * Statistics about a scan, for the scan-progress signal.
+ */
+typedef struct
+{
+    /// The number of directories that have been read completely.
+    guint64 dirs_visited;
+
+    /// The number of entries that have been added to the tree.
+    guint64 entries_found;
+
+    /**
+     * Approximately how much metadata has been read: the names and symlink
+     * targets of each entry, plus one stat record per entry.
+     */
+    guint64 metadata_bytes;
+
+    /// The number of directories that are waiting to be read or being read.
+    guint queue_depth;
+
+    /// The time since the scan started, in microseconds.
+    gint64 elapsed;
+
+    /// The average number of entries per second since the scan started.
+    gdouble entries_per_second;
+
+    /// True if this is the last update for the scan.
+    gboolean finished;
+} DtTreeSourceScanStats;
+
 #define DT_TYPE_TREE_SOURCE dt_tree_source_get_type()
 G_DECLARE_INTERFACE(DtTreeSource, dt_tree_source, DT, TREE_SOURCE, GObject)
 
@@ -39,8 +131,13 @@ struct _DtTreeSourceInterface
     DtTreeSourceNode * (* get_root) (DtTreeSource *self);
     DtTreeSourceNode * (* get_parent) (DtTreeSource *self, DtTreeSourceNode *node);
     GList * (* get_children) (DtTreeSource *self, DtTreeSourceNode *parent);
+    DtTreeSourceNode * const * (* get_child_array) (DtTreeSource *self,
+            DtTreeSourceNode *parent, guint *ret_num);
     DtTreeSourceNode * (* get_child_by_name) (DtTreeSource *self, DtTreeSourceNode *parent, const char *name);
-    GFileInfo * (* get_file_info) (DtTreeSource *self, DtTreeSourceNode *node);
+    const char * (* get_name) (DtTreeSource *self, DtTreeSourceNode *node);
+    const DtFileMetadata * (* get_metadata) (DtTreeSource *self, DtTreeSourceNode *node);
+    const char * (* get_symlink_target) (DtTreeSource *self, DtTreeSourceNode *node);
+    GFileInfo * (* create_file_info) (DtTreeSource *self, DtTreeSourceNode *node);
 
     void (* scan_async) (DtTreeSource *self, int io_priority,
             GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata);
@@ -60,6 +157,22 @@ struct _DtTreeSourceInterface
     GInputStream * (* open_file) (DtTreeSource *self, DtTreeSourceNode *node,
             GCancellable *cancellable, GError **error);
 
+    /**
+     * Asks the source to read a directory as soon as possible.
+     *
+     * This is optional. Sources that read everything up front don't need to
+     * implement it.
+     */
+    void (* prioritize_node) (DtTreeSource *self, DtTreeSourceNode *node);
+
+    /**
+     * Stores a digest of a file's contents in its metadata.
+     *
+     * This is optional. If a source doesn't implement it, then the digest
+     * is simply computed again the next time.
+     */
+    void (* set_digest) (DtTreeSource *self, DtTreeSourceNode *node, const guint8 *digest);
+
     /* Signals */
 
     /**
@@ -72,7 +185,8 @@ struct _DtTreeSourceInterface
      * Called when nodes are removed from the tree.
      *
      * The DtSourceNode pointers are still valid during this call for looking
-     * up a GFileInfo, but they may or may not appear in the list of children.
+     * up a name or metadata, but they may or may not appear in the list of
+     * children.
      *
      * TODO: Should this take a GFileInfo array instead of a DtTreeSourceNode
      * array?
@@ -86,6 +200,15 @@ struct _DtTreeSourceInterface
      */
     void (* nodes_changed) (DtTreeSource *source, DtTreeSourceNode *parent,
             gint num_changed, DtTreeSourceNode **nodes, GFileInfo **old_info);
+
+    /**
+     * Called periodically while dt_tree_source_scan_async is running, and
+     * once more when it's done, with DtTreeSourceScanStats::finished set.
+     *
+     * A source that doesn't have anything to scan still sends the final
+     * update, so every scan has at least one.
+     */
+    void (* scan_progress) (DtTreeSource *source, const DtTreeSourceScanStats *stats);
 };
 
 DtTreeSourceNode *dt_tree_source_get_root(DtTreeSource *self);
@@ -105,17 +228,73 @@ DtTreeSourceNode *dt_tree_source_get_parent(DtTreeSource *self, DtTreeSourceNode
  */
 GList *dt_tree_source_get_children(DtTreeSource *self, DtTreeSourceNode *parent);
 
+/**
+ * Returns the children of a node as an array, sorted by name.
+ *
+ * The names are sorted by strcmp, so that the children of the same directory
+ * in two sources can be merged in a single pass.
+ *
+ * The array belongs to the source, so this doesn't allocate anything. It's
+ * only valid until the next time a child is added to or removed from
+ * \p parent, so don't hold onto it across a nodes-added or nodes-removed
+ * signal.
+ *
+ * \param ret_num Returns the number of children.
+ * \return The array of children. This may be NULL if there aren't any.
+ */
+DtTreeSourceNode * const *dt_tree_source_get_child_array(DtTreeSource *self,
+        DtTreeSourceNode *parent, guint *ret_num);
+
 /**
  * Returns the DtTreeSourceNode that matches the given name.
  */
 DtTreeSourceNode *dt_tree_source_get_child_by_name(DtTreeSource *self, DtTreeSourceNode *parent, const char *name);
 
 /**
- * Returns the GFileInfo object for a given node.
+ * Returns the name of a node.
+ *
+ * The string remains valid as long as the node is in the tree.
+ */
+const char *dt_tree_source_get_name(DtTreeSource *self, DtTreeSourceNode *node);
+
+/**
+ * Returns the metadata for a node.
+ *
+ * The struct remains valid until the node is removed or its metadata changes,
+ * so callers shouldn't hold onto it across a nodes-changed signal.
+ */
+const DtFileMetadata *dt_tree_source_get_metadata(DtTreeSource *self, DtTreeSourceNode *node);
+
+/**
+ * Returns the symlink target of a node, or NULL if it isn't a symlink.
+ */
+const char *dt_tree_source_get_symlink_target(DtTreeSource *self, DtTreeSourceNode *node);
+
+/**
+ * Creates a GFileInfo object for a given node.
+ *
+ * The sources don't keep a GFileInfo for each node, so this builds a new one
+ * each time. Anything that only needs the name, type, size, and so on should
+ * use dt_tree_source_get_name and dt_tree_source_get_metadata instead.
+ *
+ * Besides the standard attributes, this includes any extra attributes that
+ * the source provides, like DT_FILE_ATTRIBUTE_FS_PATH.
+ *
+ * \return A new GFileInfo object. Transfer full.
+ */
+GFileInfo *dt_tree_source_create_file_info(DtTreeSource *self, DtTreeSourceNode *node);
+
+/**
+ * Fills in a DtFileMetadata struct from a GFileInfo.
+ */
+void dt_file_metadata_from_file_info(DtFileMetadata *metadata, GFileInfo *info);
+
+/**
+ * Sets the attributes in a GFileInfo from a DtFileMetadata struct.
  *
- * \return A GFileInfo object. Transfer none.
+ * This doesn't set the name or the symlink target.
  */
-GFileInfo *dt_tree_source_get_file_info(DtTreeSource *self, DtTreeSourceNode *node);
+void dt_file_metadata_to_file_info(const DtFileMetadata *metadata, GFileInfo *info);
 
 /**
  * Returns the full path to a node as an array of DtTreeSourceNode pointers.
@@ -155,6 +334,28 @@ GInputStream *dt_tree_source_open_file_finish(DtTreeSource *self, GAsyncResult *
 GInputStream *dt_tree_source_open_file(DtTreeSource *self, DtTreeSourceNode *node,
         GCancellable *cancellable, GError **error);
 
+/**
+ * Tells the source that someone is waiting on the contents of a directory.
+ *
+ * If a scan is running and it hasn't gotten to \p node yet, then the source
+ * should read that directory next, ahead of everything else. This does
+ * nothing if the directory has already been read, or if the source doesn't
+ * support it.
+ */
+void dt_tree_source_prioritize_node(DtTreeSource *self, DtTreeSourceNode *node);
+
+/**
+ * Remembers the digest of a file's contents, so that the next comparison can
+ * use it instead of reading the file again.
+ *
+ * This sets DtFileMetadata::digest and DT_FILE_METADATA_HAS_DIGEST. It
+ * doesn't send a nodes-changed signal, since the file itself didn't change.
+ * If the file does change later, then the new metadata won't have a digest.
+ *
+ * \param digest The digest, which is DT_FILE_METADATA_DIGEST_SIZE bytes.
+ */
+void dt_tree_source_set_digest(DtTreeSource *self, DtTreeSourceNode *node, const guint8 *digest);
+
 void dt_tree_source_nodes_added(DtTreeSource *source, DtTreeSourceNode *parent,
         gint num, DtTreeSourceNode **nodes);
 
@@ -164,6 +365,8 @@ void dt_tree_source_nodes_removed(DtTreeSource *source, DtTreeSourceNode *parent
 void dt_tree_source_nodes_changed(DtTreeSource *source, DtTreeSourceNode *parent,
         gint num, DtTreeSourceNode **nodes, GFileInfo **old_info);
 
+void dt_tree_source_scan_progress(DtTreeSource *source, const DtTreeSourceScanStats *stats);
+
 G_END_DECLS
 
 #endif // TREE_SOURCE_H